@@ -0,0 +1,782 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "DirectChannelMultiplexer.h"
+
+#include <cutils/ashmem.h>
+#include <log/log.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::SensorFlagBits;
+using ::android::hardware::sensors::V1_0::SensorFlagShift;
+using ::android::hardware::sensors::V1_0::SharedMemFormat;
+using ::android::hardware::sensors::V1_0::SharedMemType;
+
+/**
+ * An event in direct channel memory, laid out like sensors_event_t. The counter is written last
+ * and tells readers the event is complete.
+ */
+struct DirectReportEvent {
+    int32_t size;
+    int32_t token;
+    int32_t type;
+    uint32_t counter;
+    int64_t timestamp;
+    float data[16];
+    uint32_t reserved[4];
+};
+
+static_assert(sizeof(DirectReportEvent) == 104, "Direct report events must be 104 bytes");
+
+/**
+ * Direct channel memory mapped by the HalProxy, written as a ring of events like subhals do, or
+ * read as such for private channels.
+ */
+class DirectReportRing {
+  public:
+    //! Map the memory of fd, or return nullptr.
+    static std::shared_ptr<DirectReportRing> map(int fd, size_t size) {
+        size_t numEvents = size / sizeof(DirectReportEvent);
+        if (fd < 0 || numEvents == 0) {
+            return nullptr;
+        }
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (data == MAP_FAILED) {
+            ALOGE("Failed to map direct channel memory: %s", strerror(errno));
+            return nullptr;
+        }
+        return std::shared_ptr<DirectReportRing>(
+                new DirectReportRing(static_cast<DirectReportEvent*>(data), size, numEvents));
+    }
+
+    ~DirectReportRing() { munmap(mEvents, mSize); }
+
+    //! Write an event, with the next counter of the ring.
+    void write(const DirectReportEvent& event) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        DirectReportEvent* slot = &mEvents[mIndex];
+        uint32_t counter = mCounter;
+        memcpy(slot, &event, offsetof(DirectReportEvent, counter));
+        memcpy(&slot->timestamp, &event.timestamp,
+               sizeof(DirectReportEvent) - offsetof(DirectReportEvent, timestamp));
+        __atomic_store_n(&slot->counter, counter, __ATOMIC_RELEASE);
+        mIndex = (mIndex + 1) % mNumEvents;
+        mCounter = counter + 1 == 0 ? 1 : counter + 1;
+    }
+
+    //! Get the next event a subhal wrote, if any, leaving it to consume().
+    bool peek(DirectReportEvent* event) const {
+        const DirectReportEvent* slot = &mEvents[mIndex];
+        uint32_t counter = __atomic_load_n(&slot->counter, __ATOMIC_ACQUIRE);
+        if (counter == 0 || static_cast<int32_t>(counter - mCounter) < 0) {
+            return false;
+        }
+        memcpy(event, slot, sizeof(*event));
+        event->counter = counter;
+        return true;
+    }
+
+    //! Move past an event returned by peek().
+    void consume(const DirectReportEvent& event) {
+        // A counter ahead of the expected one means the subhal lapped the ring, so follow it.
+        mIndex = (mIndex + 1) % mNumEvents;
+        mCounter = event.counter + 1 == 0 ? 1 : event.counter + 1;
+    }
+
+    //! Continue writing after the last event written by a subhal.
+    void resumeAfterLastWrite() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        uint32_t lastCounter = 0;
+        size_t lastIndex = mNumEvents - 1;
+        for (size_t i = 0; i < mNumEvents; i++) {
+            uint32_t counter = __atomic_load_n(&mEvents[i].counter, __ATOMIC_ACQUIRE);
+            if (counter != 0 &&
+                (lastCounter == 0 || static_cast<int32_t>(counter - lastCounter) > 0)) {
+                lastCounter = counter;
+                lastIndex = i;
+            }
+        }
+        mIndex = (lastIndex + 1) % mNumEvents;
+        mCounter = lastCounter + 1 == 0 ? 1 : lastCounter + 1;
+    }
+
+  private:
+    DirectReportRing(DirectReportEvent* events, size_t size, size_t numEvents)
+        : mEvents(events), mSize(size), mNumEvents(numEvents) {}
+
+    DirectReportEvent* const mEvents;
+    const size_t mSize;
+    const size_t mNumEvents;
+
+    //! The mutex protecting the write position, as events are copied from several threads.
+    std::mutex mMutex;
+    size_t mIndex = 0;
+    uint32_t mCounter = 1;
+};
+
+static int64_t getRatePeriodNs(RateLevel rate) {
+    switch (rate) {
+        case RateLevel::NORMAL:
+            return 20000000;  // 50 Hz
+        case RateLevel::FAST:
+            return 5000000;  // 200 Hz
+        case RateLevel::VERY_FAST:
+            return 1250000;  // 800 Hz
+        default:
+            return 0;
+    }
+}
+
+static uint32_t getMemTypeFlag(SharedMemType type) {
+    switch (type) {
+        case SharedMemType::ASHMEM:
+            return static_cast<uint32_t>(SensorFlagBits::DIRECT_CHANNEL_ASHMEM);
+        case SharedMemType::GRALLOC:
+            return static_cast<uint32_t>(SensorFlagBits::DIRECT_CHANNEL_GRALLOC);
+        default:
+            return 0;
+    }
+}
+
+static RateLevel getMaxRate(uint32_t flags) {
+    return static_cast<RateLevel>(
+            (flags & static_cast<uint32_t>(SensorFlagBits::MASK_DIRECT_REPORT)) >>
+            static_cast<uint32_t>(SensorFlagShift::DIRECT_REPORT));
+}
+
+static void freeHandle(native_handle_t* handle) {
+    if (handle != nullptr) {
+        native_handle_close(handle);
+        native_handle_delete(handle);
+    }
+}
+
+DirectChannelMultiplexer::~DirectChannelMultiplexer() {
+    reset({}, nullptr, 0);
+}
+
+void DirectChannelMultiplexer::reset(std::vector<std::shared_ptr<ISubHalWrapperBase>> subHals,
+                                     SubHalRunner runner, int64_t minPollPeriodNs) {
+    stopCopyThread();
+    releaseAllChannels();
+    mCopiedSensorConfigs.clear();
+    mSensors.clear();
+    mSubHals = std::move(subHals);
+    mRunner = std::move(runner);
+    mMinPollPeriodNs = minPollPeriodNs;
+}
+
+void DirectChannelMultiplexer::addSensor(const SensorInfo& sensor, bool copied) {
+    Sensor entry;
+    entry.subHalIndex = static_cast<uint32_t>(sensor.sensorHandle) >> 24;
+    entry.localHandle = sensor.sensorHandle & 0x00FFFFFF;
+    entry.flags = sensor.flags;
+    entry.copied = copied;
+    mSensors[sensor.sensorHandle] = entry;
+    if (copied) {
+        mCopiedSensorConfigs[sensor.sensorHandle] = CopiedSensorConfig();
+    }
+}
+
+void DirectChannelMultiplexer::releaseAllChannels() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto& [channelHandle, channel] : mChannels) {
+            releaseChannelLocked(channel);
+        }
+        mChannels.clear();
+        updateCopySourcesLocked();
+    }
+    std::lock_guard<std::mutex> lock(mCopyConfigMutex);
+    for (auto& [sensorHandle, config] : mCopiedSensorConfigs) {
+        config = CopiedSensorConfig();
+    }
+    std::lock_guard<std::mutex> routesLock(mCopyRoutesMutex);
+    mCopyRoutes.clear();
+}
+
+bool DirectChannelMultiplexer::setCopiedFlags(SensorInfo* sensor) {
+    uint32_t directFlags = static_cast<uint32_t>(SensorFlagBits::MASK_DIRECT_CHANNEL) |
+                           static_cast<uint32_t>(SensorFlagBits::MASK_DIRECT_REPORT);
+    bool continuous =
+            (sensor->flags & static_cast<uint32_t>(SensorFlagBits::MASK_REPORTING_MODE)) ==
+            static_cast<uint32_t>(SensorFlagBits::CONTINUOUS_MODE);
+    bool wakeUp = (sensor->flags & static_cast<uint32_t>(SensorFlagBits::WAKE_UP)) != 0;
+    if ((sensor->flags & directFlags) != 0 || wakeUp || !continuous || sensor->minDelay <= 0) {
+        return false;
+    }
+    RateLevel rate = RateLevel::VERY_FAST;
+    while (rate != RateLevel::STOP && getRatePeriodNs(rate) < sensor->minDelay * 1000LL) {
+        rate = static_cast<RateLevel>(static_cast<int32_t>(rate) - 1);
+    }
+    if (rate == RateLevel::STOP) {
+        return false;
+    }
+    sensor->flags |= static_cast<uint32_t>(SensorFlagBits::DIRECT_CHANNEL_ASHMEM) |
+                     (static_cast<uint32_t>(rate)
+                      << static_cast<uint32_t>(SensorFlagShift::DIRECT_REPORT));
+    return true;
+}
+
+void DirectChannelMultiplexer::registerChannel(const SharedMemInfo& mem,
+                                               ISensors::registerDirectChannel_cb callback) {
+    uint32_t typeFlag = getMemTypeFlag(mem.type);
+    bool supported = false;
+    for (const auto& [sensorHandle, sensor] : mSensors) {
+        supported |= (sensor.flags & typeFlag) != 0;
+    }
+    if (!supported) {
+        callback(Result::INVALID_OPERATION, -1 /* channelHandle */);
+        return;
+    }
+    if (mem.format != SharedMemFormat::SENSORS_EVENT ||
+        mem.memoryHandle.getNativeHandle() == nullptr || mem.size < sizeof(DirectReportEvent)) {
+        callback(Result::BAD_VALUE, -1 /* channelHandle */);
+        return;
+    }
+
+    Channel channel;
+    channel.handle = native_handle_clone(mem.memoryHandle.getNativeHandle());
+    if (channel.handle == nullptr) {
+        callback(Result::NO_MEMORY, -1 /* channelHandle */);
+        return;
+    }
+    channel.mem = mem;
+    channel.mem.memoryHandle = channel.handle;
+    if (mem.type == SharedMemType::ASHMEM && channel.handle->numFds > 0) {
+        channel.ring = DirectReportRing::map(channel.handle->data[0], mem.size);
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    int32_t channelHandle = mNextChannelHandle++;
+    mChannels[channelHandle] = std::move(channel);
+    callback(Result::OK, channelHandle);
+}
+
+Result DirectChannelMultiplexer::unregisterChannel(int32_t channelHandle) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto channel = mChannels.find(channelHandle);
+    if (channel == mChannels.end()) {
+        return Result::BAD_VALUE;
+    }
+    releaseChannelLocked(channel->second);
+    mChannels.erase(channel);
+    updateCopySourcesLocked();
+    return Result::OK;
+}
+
+void DirectChannelMultiplexer::configReport(int32_t sensorHandle, int32_t channelHandle,
+                                            RateLevel rate,
+                                            ISensors::configDirectReport_cb callback) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    {
+        std::lock_guard<std::mutex> sourcesLock(mCopySourcesMutex);
+        mConfiguringReport = true;
+    }
+    configReportLocked(sensorHandle, channelHandle, rate, callback);
+    updateCopySourcesLocked();
+}
+
+void DirectChannelMultiplexer::configReportLocked(int32_t sensorHandle, int32_t channelHandle,
+                                                  RateLevel rate,
+                                                  ISensors::configDirectReport_cb callback) {
+    auto channelIt = mChannels.find(channelHandle);
+    if (channelIt == mChannels.end()) {
+        callback(Result::BAD_VALUE, -1 /* reportToken */);
+        return;
+    }
+    Channel& channel = channelIt->second;
+
+    // -1 denotes all sensors should be disabled
+    if (sensorHandle == -1) {
+        while (!channel.reports.empty()) {
+            stopReportLocked(channel, channel.reports.begin()->first);
+        }
+        callback(Result::OK, -1 /* reportToken */);
+        return;
+    }
+
+    auto sensorIt = mSensors.find(sensorHandle);
+    if (sensorIt == mSensors.end()) {
+        callback(Result::BAD_VALUE, -1 /* reportToken */);
+        return;
+    }
+    const Sensor& sensor = sensorIt->second;
+    if ((sensor.flags & getMemTypeFlag(channel.mem.type)) == 0 || rate > getMaxRate(sensor.flags)) {
+        callback(Result::BAD_VALUE, -1 /* reportToken */);
+        return;
+    }
+
+    if (rate == RateLevel::STOP) {
+        stopReportLocked(channel, sensorHandle);
+        callback(Result::OK, -1 /* reportToken */);
+        return;
+    }
+
+    Report report;
+    Result result = startReportLocked(channel, sensorHandle, sensor, rate, &report);
+    if (result != Result::OK) {
+        callback(result, -1 /* reportToken */);
+        return;
+    }
+    channel.reports[sensorHandle] = report;
+    callback(Result::OK, report.token);
+}
+
+Result DirectChannelMultiplexer::startReportLocked(Channel& channel, int32_t sensorHandle,
+                                                   const Sensor& sensor, RateLevel rate,
+                                                   Report* report) {
+    auto existing = channel.reports.find(sensorHandle);
+    bool exists = existing != channel.reports.end();
+    if (exists) {
+        *report = existing->second;
+    }
+    report->rate = rate;
+
+    if (sensor.copied) {
+        if (channel.ring == nullptr) {
+            return Result::INVALID_OPERATION;
+        }
+        if (!channel.proxyOwned) {
+            Result result = makeProxyOwnedLocked(channel);
+            if (result != Result::OK) {
+                return result;
+            }
+        }
+        int64_t oldPeriodNs = 0;
+        if (!exists) {
+            report->token = channel.nextToken++;
+        } else {
+            oldPeriodNs = getRatePeriodNs(existing->second.rate);
+        }
+        {
+            std::lock_guard<std::mutex> lock(mCopyRoutesMutex);
+            std::vector<CopyRoute>& routes = mCopyRoutes[sensorHandle].routes;
+            auto route = std::find_if(routes.begin(), routes.end(),
+                                      [&](const CopyRoute& r) { return r.ring == channel.ring; });
+            if (route == routes.end()) {
+                route = routes.insert(routes.end(), CopyRoute());
+                route->ring = channel.ring;
+                route->token = report->token;
+                mNumCopyRoutes++;
+            }
+            route->periodNs = getRatePeriodNs(rate);
+        }
+        setCopiedReportPeriod(sensorHandle, oldPeriodNs, getRatePeriodNs(rate));
+        return Result::OK;
+    }
+
+    bool native = !channel.proxyOwned && (channel.nativeSubHalIndex < 0 ||
+                                          static_cast<size_t>(channel.nativeSubHalIndex) ==
+                                                  sensor.subHalIndex);
+    if (native) {
+        if (channel.nativeSubHalIndex < 0) {
+            Result result = Result::INVALID_OPERATION;
+            mRunner(sensor.subHalIndex, "registerDirectChannel", [&] {
+                mSubHals[sensor.subHalIndex]->registerDirectChannel(
+                        channel.mem, [&](Result r, int32_t handle) {
+                            result = r;
+                            channel.nativeChannelHandle = handle;
+                        });
+            });
+            if (result != Result::OK) {
+                return result;
+            }
+            channel.nativeSubHalIndex = sensor.subHalIndex;
+        }
+        int32_t token;
+        Result result = configSubHalReport(sensor.subHalIndex, sensor.localHandle,
+                                           channel.nativeChannelHandle, rate, &token);
+        if (result != Result::OK) {
+            return result;
+        }
+        report->token = token;
+        report->subHalToken = token;
+        channel.nextToken = std::max(channel.nextToken, token + 1);
+        return Result::OK;
+    }
+
+    if (channel.ring == nullptr) {
+        ALOGE("Cannot report sensors of several subhals to a gralloc direct channel");
+        return Result::INVALID_OPERATION;
+    }
+    if (!channel.proxyOwned) {
+        Result result = makeProxyOwnedLocked(channel);
+        if (result != Result::OK) {
+            return result;
+        }
+    }
+    PrivateChannel* privateChannel = getPrivateChannelLocked(channel, sensor.subHalIndex);
+    if (privateChannel == nullptr) {
+        return Result::NO_MEMORY;
+    }
+    int32_t subHalToken;
+    Result result = configSubHalReport(sensor.subHalIndex, sensor.localHandle,
+                                       privateChannel->channelHandle, rate, &subHalToken);
+    if (result != Result::OK) {
+        return result;
+    }
+    if (exists) {
+        privateChannel->tokens.erase(report->subHalToken);
+    } else {
+        report->token = channel.nextToken++;
+    }
+    report->subHalToken = subHalToken;
+    privateChannel->tokens[subHalToken] = report->token;
+    return Result::OK;
+}
+
+void DirectChannelMultiplexer::stopReportLocked(Channel& channel, int32_t sensorHandle) {
+    auto report = channel.reports.find(sensorHandle);
+    auto sensor = mSensors.find(sensorHandle);
+    if (report == channel.reports.end() || sensor == mSensors.end()) {
+        return;
+    }
+    const Sensor& s = sensor->second;
+    int32_t token;
+    if (s.copied) {
+        {
+            std::lock_guard<std::mutex> lock(mCopyRoutesMutex);
+            std::vector<CopyRoute>& routes = mCopyRoutes[sensorHandle].routes;
+            size_t numRoutes = routes.size();
+            routes.erase(std::remove_if(routes.begin(), routes.end(),
+                                        [&](const CopyRoute& r) { return r.ring == channel.ring; }),
+                         routes.end());
+            mNumCopyRoutes -= numRoutes - routes.size();
+        }
+        setCopiedReportPeriod(sensorHandle, getRatePeriodNs(report->second.rate), 0);
+    } else if (!channel.proxyOwned) {
+        configSubHalReport(s.subHalIndex, s.localHandle, channel.nativeChannelHandle,
+                           RateLevel::STOP, &token);
+    } else {
+        auto privateChannel = channel.privateChannels.find(s.subHalIndex);
+        if (privateChannel != channel.privateChannels.end()) {
+            configSubHalReport(s.subHalIndex, s.localHandle, privateChannel->second.channelHandle,
+                               RateLevel::STOP, &token);
+            privateChannel->second.tokens.erase(report->second.subHalToken);
+        }
+    }
+    channel.reports.erase(report);
+}
+
+Result DirectChannelMultiplexer::makeProxyOwnedLocked(Channel& channel) {
+    if (channel.nativeSubHalIndex >= 0) {
+        size_t subHalIndex = channel.nativeSubHalIndex;
+        PrivateChannel* privateChannel = getPrivateChannelLocked(channel, subHalIndex);
+        if (privateChannel == nullptr) {
+            return Result::NO_MEMORY;
+        }
+        // Keep the tokens handed to the framework, only the subhal tokens change.
+        for (auto& [sensorHandle, report] : channel.reports) {
+            const Sensor& sensor = mSensors[sensorHandle];
+            int32_t token;
+            configSubHalReport(subHalIndex, sensor.localHandle, channel.nativeChannelHandle,
+                               RateLevel::STOP, &token);
+            if (configSubHalReport(subHalIndex, sensor.localHandle,
+                                   privateChannel->channelHandle, report.rate,
+                                   &report.subHalToken) == Result::OK) {
+                privateChannel->tokens[report.subHalToken] = report.token;
+            }
+        }
+        mRunner(subHalIndex, "unregisterDirectChannel", [&] {
+            mSubHals[subHalIndex]->unregisterDirectChannel(channel.nativeChannelHandle);
+        });
+        channel.nativeSubHalIndex = -1;
+        channel.nativeChannelHandle = -1;
+        channel.ring->resumeAfterLastWrite();
+    }
+    channel.proxyOwned = true;
+    return Result::OK;
+}
+
+DirectChannelMultiplexer::PrivateChannel* DirectChannelMultiplexer::getPrivateChannelLocked(
+        Channel& channel, size_t subHalIndex) {
+    auto existing = channel.privateChannels.find(subHalIndex);
+    if (existing != channel.privateChannels.end()) {
+        return &existing->second;
+    }
+
+    int fd = ashmem_create_region("sensors_direct_channel", channel.mem.size);
+    if (fd < 0) {
+        ALOGE("Failed to create a private direct channel: %s", strerror(errno));
+        return nullptr;
+    }
+    PrivateChannel privateChannel;
+    privateChannel.handle = native_handle_create(1 /* numFds */, 0 /* numInts */);
+    privateChannel.handle->data[0] = fd;
+    privateChannel.ring = DirectReportRing::map(fd, channel.mem.size);
+    if (privateChannel.ring == nullptr) {
+        freeHandle(privateChannel.handle);
+        return nullptr;
+    }
+
+    SharedMemInfo mem;
+    mem.type = SharedMemType::ASHMEM;
+    mem.format = SharedMemFormat::SENSORS_EVENT;
+    mem.size = channel.mem.size;
+    mem.memoryHandle = privateChannel.handle;
+    Result result = Result::INVALID_OPERATION;
+    mRunner(subHalIndex, "registerDirectChannel", [&] {
+        mSubHals[subHalIndex]->registerDirectChannel(mem, [&](Result r, int32_t handle) {
+            result = r;
+            privateChannel.channelHandle = handle;
+        });
+    });
+    if (result != Result::OK) {
+        ALOGE("Failed to register a private direct channel with subhal %zu", subHalIndex);
+        freeHandle(privateChannel.handle);
+        return nullptr;
+    }
+
+    return &(channel.privateChannels[subHalIndex] = std::move(privateChannel));
+}
+
+void DirectChannelMultiplexer::releaseChannelLocked(Channel& channel) {
+    while (!channel.reports.empty()) {
+        stopReportLocked(channel, channel.reports.begin()->first);
+    }
+    if (channel.nativeSubHalIndex >= 0) {
+        mRunner(channel.nativeSubHalIndex, "unregisterDirectChannel", [&] {
+            mSubHals[channel.nativeSubHalIndex]->unregisterDirectChannel(
+                    channel.nativeChannelHandle);
+        });
+    }
+    for (auto& [subHalIndex, privateChannel] : channel.privateChannels) {
+        mRunner(subHalIndex, "unregisterDirectChannel", [&] {
+            mSubHals[subHalIndex]->unregisterDirectChannel(privateChannel.channelHandle);
+        });
+        freeHandle(privateChannel.handle);
+    }
+    channel.privateChannels.clear();
+    channel.ring.reset();
+    freeHandle(channel.handle);
+    channel.handle = nullptr;
+}
+
+Result DirectChannelMultiplexer::configSubHalReport(size_t subHalIndex, int32_t localHandle,
+                                                    int32_t channelHandle, RateLevel rate,
+                                                    int32_t* token) {
+    Result result = Result::INVALID_OPERATION;
+    mRunner(subHalIndex, "configDirectReport", [&] {
+        mSubHals[subHalIndex]->configDirectReport(localHandle, channelHandle, rate,
+                                                  [&](Result r, int32_t reportToken) {
+                                                      result = r;
+                                                      *token = reportToken;
+                                                  });
+    });
+    return result;
+}
+
+bool DirectChannelMultiplexer::copyEvent(const Event& event) {
+    // Flush complete events are for the framework only.
+    if (event.sensorType == SensorType::META_DATA) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mCopyRoutesMutex);
+    auto copied = mCopyRoutes.find(event.sensorHandle);
+    if (copied == mCopyRoutes.end()) {
+        return true;
+    }
+    for (CopyRoute& route : copied->second.routes) {
+        // The sensor may run faster for the framework, so decimate to the report rate.
+        if (event.timestamp - route.lastTimestamp < route.periodNs - route.periodNs / 8) {
+            continue;
+        }
+        route.lastTimestamp = event.timestamp;
+        DirectReportEvent directEvent = {};
+        directEvent.size = sizeof(DirectReportEvent);
+        directEvent.token = route.token;
+        directEvent.type = static_cast<int32_t>(event.sensorType);
+        directEvent.timestamp = event.timestamp;
+        memcpy(directEvent.data, event.u.data.data(), sizeof(directEvent.data));
+        route.ring->write(directEvent);
+    }
+    return copied->second.enabled;
+}
+
+void DirectChannelMultiplexer::updateCopySourcesLocked() {
+    std::vector<CopySource> sources;
+    int64_t fastestPeriodNs = 0;
+    for (const auto& [channelHandle, channel] : mChannels) {
+        for (const auto& [subHalIndex, privateChannel] : channel.privateChannels) {
+            sources.push_back({privateChannel.ring, channel.ring, privateChannel.tokens});
+        }
+        if (!channel.proxyOwned) {
+            continue;
+        }
+        for (const auto& [sensorHandle, report] : channel.reports) {
+            // The events of copied sensors are written by the event path rather than polled.
+            if (mSensors[sensorHandle].copied) {
+                continue;
+            }
+            int64_t periodNs = getRatePeriodNs(report.rate);
+            if (fastestPeriodNs == 0 || periodNs < fastestPeriodNs) {
+                fastestPeriodNs = periodNs;
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mCopySourcesMutex);
+        mCopySources = std::move(sources);
+        mCopyPollPeriodNs = fastestPeriodNs > 0 ? std::max(fastestPeriodNs, mMinPollPeriodNs) : 0;
+        mConfiguringReport = false;
+        if (!mCopySources.empty() && !mCopyThread.joinable()) {
+            mStopCopyThread = false;
+            mCopyThread = std::thread([this] { runCopyThread(); });
+        }
+    }
+    mCopyThreadCV.notify_all();
+}
+
+void DirectChannelMultiplexer::runCopyThread() {
+    std::unique_lock<std::mutex> lock(mCopySourcesMutex);
+    while (!mStopCopyThread) {
+        // Copy once more on every update, which drops the events of stopped reports.
+        copyPrivateEventsLocked();
+        if (mCopyPollPeriodNs == 0) {
+            mCopyThreadCV.wait(lock);
+        } else {
+            mCopyThreadCV.wait_for(lock, std::chrono::nanoseconds(mCopyPollPeriodNs));
+        }
+    }
+}
+
+void DirectChannelMultiplexer::copyPrivateEventsLocked() {
+    for (CopySource& source : mCopySources) {
+        DirectReportEvent event;
+        while (source.ring->peek(&event)) {
+            auto token = source.tokens.find(event.token);
+            if (token == source.tokens.end() && mConfiguringReport) {
+                // The event may be of the report being started, so wait for its token.
+                break;
+            }
+            source.ring->consume(event);
+            if (token != source.tokens.end()) {
+                event.token = token->second;
+                source.target->write(event);
+            }
+        }
+    }
+}
+
+void DirectChannelMultiplexer::stopCopyThread() {
+    {
+        std::lock_guard<std::mutex> lock(mCopySourcesMutex);
+        mStopCopyThread = true;
+    }
+    mCopyThreadCV.notify_all();
+    if (mCopyThread.joinable()) {
+        mCopyThread.join();
+    }
+}
+
+bool DirectChannelMultiplexer::isCopied(int32_t sensorHandle) const {
+    auto sensor = mSensors.find(sensorHandle);
+    return sensor != mSensors.end() && sensor->second.copied;
+}
+
+void DirectChannelMultiplexer::setCopiedReportPeriod(int32_t sensorHandle, int64_t oldPeriodNs,
+                                                     int64_t newPeriodNs) {
+    std::lock_guard<std::mutex> lock(mCopyConfigMutex);
+    CopiedSensorConfig& config = mCopiedSensorConfigs[sensorHandle];
+    auto oldPeriod = config.reportPeriodsNs.find(oldPeriodNs);
+    if (oldPeriod != config.reportPeriodsNs.end()) {
+        config.reportPeriodsNs.erase(oldPeriod);
+    }
+    if (newPeriodNs > 0) {
+        config.reportPeriodsNs.insert(newPeriodNs);
+    }
+    applyCopiedConfigLocked(sensorHandle, true /* batch */);
+}
+
+Result DirectChannelMultiplexer::activateCopied(int32_t sensorHandle, bool enabled) {
+    std::lock_guard<std::mutex> lock(mCopyConfigMutex);
+    mCopiedSensorConfigs[sensorHandle].enabled = enabled;
+    {
+        std::lock_guard<std::mutex> routesLock(mCopyRoutesMutex);
+        mCopyRoutes[sensorHandle].enabled = enabled;
+    }
+    return applyCopiedConfigLocked(sensorHandle, false /* batch */);
+}
+
+Result DirectChannelMultiplexer::batchCopied(int32_t sensorHandle, int64_t samplingPeriodNs,
+                                             int64_t maxReportLatencyNs) {
+    std::lock_guard<std::mutex> lock(mCopyConfigMutex);
+    CopiedSensorConfig& config = mCopiedSensorConfigs[sensorHandle];
+    config.samplingPeriodNs = samplingPeriodNs;
+    config.maxReportLatencyNs = maxReportLatencyNs;
+    return applyCopiedConfigLocked(sensorHandle, true /* batch */);
+}
+
+Result DirectChannelMultiplexer::applyCopiedConfigLocked(int32_t sensorHandle, bool batch) {
+    const Sensor& sensor = mSensors[sensorHandle];
+    CopiedSensorConfig& config = mCopiedSensorConfigs[sensorHandle];
+    bool reported = !config.reportPeriodsNs.empty();
+    int64_t samplingPeriodNs = config.enabled ? config.samplingPeriodNs : INT64_MAX;
+    int64_t maxReportLatencyNs = config.maxReportLatencyNs;
+    if (reported) {
+        samplingPeriodNs = std::min(samplingPeriodNs, *config.reportPeriodsNs.begin());
+        maxReportLatencyNs = 0;
+    }
+    bool activate = config.enabled || reported;
+
+    Result result = Result::OK;
+    std::shared_ptr<ISubHalWrapperBase> subHal = mSubHals[sensor.subHalIndex];
+    if (batch || (activate && !config.activated)) {
+        mRunner(sensor.subHalIndex, "batch", [&] {
+            result = subHal->batch(sensor.localHandle, activate ? samplingPeriodNs
+                                                                : config.samplingPeriodNs,
+                                   maxReportLatencyNs);
+        });
+    }
+    if (result == Result::OK && activate != config.activated) {
+        mRunner(sensor.subHalIndex, "activate",
+                [&] { result = subHal->activate(sensor.localHandle, activate); });
+        if (result == Result::OK) {
+            config.activated = activate;
+        }
+    }
+    return result;
+}
+
+void DirectChannelMultiplexer::dump(std::ostream& stream) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    stream << "  Direct channels (" << mChannels.size() << "):" << std::endl;
+    for (const auto& [channelHandle, channel] : mChannels) {
+        stream << "    Channel " << channelHandle << ": "
+               << (channel.mem.type == SharedMemType::ASHMEM ? "ashmem" : "gralloc") << ", "
+               << channel.mem.size << " bytes, ";
+        if (channel.proxyOwned) {
+            stream << "proxy owned with " << channel.privateChannels.size()
+                   << " private channels";
+        } else if (channel.nativeSubHalIndex >= 0) {
+            stream << "written by subhal " << channel.nativeSubHalIndex;
+        } else {
+            stream << "unused";
+        }
+        stream << ", " << channel.reports.size() << " reports" << std::endl;
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
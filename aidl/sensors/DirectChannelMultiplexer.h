@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "SubHalWrapper.h"
+
+#include <cutils/native_handle.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+class DirectReportRing;
+
+/**
+ * Multiplexes the direct channels of the framework across every subhal reporting directly, and
+ * copies the events of continuous sensors of other subhals into them where enabled.
+ *
+ * The framework only sees channel handles of the multiplexer. A channel is registered with a
+ * subhal once a sensor of that subhal is configured on it, and the subhal then writes the shared
+ * memory itself. As the shared memory must have a single writer, configuring a sensor of a second
+ * subhal, or a copied sensor, on an ashmem channel makes the channel proxy owned: every subhal
+ * then writes a private ashmem channel of its own, which a copy thread polls at the rate of the
+ * fastest report in them and copies into the shared memory along with the copied events. A
+ * channel stays proxy owned until it is unregistered. Gralloc channels cannot be mapped, so they
+ * only ever serve a single subhal.
+ */
+class DirectChannelMultiplexer {
+  public:
+    //! Runs a control call of a subhal, waiting for it to return.
+    using SubHalRunner = std::function<void(size_t subHalIndex, const char* callName,
+                                            const std::function<void()>& call)>;
+
+    ~DirectChannelMultiplexer();
+
+    /**
+     * Forget every channel and sensor. Must not race with any other method.
+     *
+     * @param subHals The subhals, indexed like sensor handles.
+     * @param runner How to run control calls of the subhals.
+     * @param minPollPeriodNs The shortest period the copy thread polls the private channels of
+     *    subhals at, which otherwise follows the fastest report in them.
+     */
+    void reset(std::vector<std::shared_ptr<ISubHalWrapperBase>> subHals, SubHalRunner runner,
+               int64_t minPollPeriodNs);
+
+    /**
+     * Add a static sensor. Must not race with any other method.
+     *
+     * @param sensor The sensor, with the subhal index in the first byte of its handle.
+     * @param copied Whether the HalProxy copies its events into direct channels rather than the
+     *    subhal reporting them.
+     */
+    void addSensor(const SensorInfo& sensor, bool copied);
+
+    //! Unregister every channel, as when the framework restarted.
+    void releaseAllChannels();
+
+    /**
+     * Give the direct channel flags to a sensor whose events the HalProxy can copy into direct
+     * channels, which are non-wakeup continuous sensors not reporting directly themselves.
+     *
+     * @return false if the events of the sensor cannot be copied.
+     */
+    static bool setCopiedFlags(SensorInfo* sensor);
+
+    void registerChannel(const SharedMemInfo& mem, ISensors::registerDirectChannel_cb callback);
+
+    Result unregisterChannel(int32_t channelHandle);
+
+    void configReport(int32_t sensorHandle, int32_t channelHandle, RateLevel rate,
+                      ISensors::configDirectReport_cb callback);
+
+    //! Whether copyEvent() has anything to do. Cheap enough to check for every posted event.
+    bool isCopying() const { return mNumCopyRoutes.load(std::memory_order_relaxed) > 0; }
+
+    /**
+     * Copy an event into the channels with reports of its sensor.
+     *
+     * @param event The event as delivered to the framework, with the subhal index in the first
+     *    byte of its sensor handle.
+     *
+     * @return false if the framework did not enable the sensor, which then only runs for direct
+     *    reports.
+     */
+    bool copyEvent(const Event& event);
+
+    //! Whether the HalProxy copies the events of the sensor into direct channels.
+    bool isCopied(int32_t sensorHandle) const;
+
+    /**
+     * Activate or deactivate a copied sensor as the framework asks, keeping it running for the
+     * direct reports of its events.
+     */
+    Result activateCopied(int32_t sensorHandle, bool enabled);
+
+    //! Batch a copied sensor as the framework asks, at most at the period of its direct reports.
+    Result batchCopied(int32_t sensorHandle, int64_t samplingPeriodNs, int64_t maxReportLatencyNs);
+
+    void dump(std::ostream& stream);
+
+  private:
+    struct Sensor {
+        size_t subHalIndex = 0;
+        int32_t localHandle = 0;
+        uint32_t flags = 0;
+        bool copied = false;
+    };
+
+    //! What the framework and the direct reports ask of a copied sensor.
+    struct CopiedSensorConfig {
+        bool enabled = false;
+        int64_t samplingPeriodNs = 0;
+        int64_t maxReportLatencyNs = 0;
+        //! The periods of the direct reports of the sensor.
+        std::multiset<int64_t> reportPeriodsNs;
+        //! Whether the sensor is activated at the subhal.
+        bool activated = false;
+    };
+
+    //! A direct report of a copied sensor, as the event path sees it.
+    struct CopyRoute {
+        std::shared_ptr<DirectReportRing> ring;
+        int32_t token = 0;
+        int64_t periodNs = 0;
+        int64_t lastTimestamp = 0;
+    };
+
+    //! The direct reports of a copied sensor, and whether the framework enabled the sensor.
+    struct CopiedSensorRoutes {
+        std::vector<CopyRoute> routes;
+        bool enabled = false;
+    };
+
+    //! The private channel of a subhal in a proxy owned channel.
+    struct PrivateChannel {
+        std::shared_ptr<DirectReportRing> ring;
+        native_handle_t* handle = nullptr;
+        int32_t channelHandle = -1;
+        //! The report tokens of the subhal mapped to the tokens handed to the framework.
+        std::map<int32_t, int32_t> tokens;
+    };
+
+    struct Report {
+        RateLevel rate = RateLevel::STOP;
+        //! The token handed to the framework.
+        int32_t token = 0;
+        //! The token of the subhal, the same as token unless the channel is proxy owned.
+        int32_t subHalToken = 0;
+    };
+
+    struct Channel {
+        //! The memory of the framework, with a handle owned by the channel.
+        SharedMemInfo mem;
+        native_handle_t* handle = nullptr;
+        //! The mapped memory of the framework, null if it cannot be mapped.
+        std::shared_ptr<DirectReportRing> ring;
+        bool proxyOwned = false;
+        //! The subhal writing the memory of the framework, -1 if none.
+        int32_t nativeSubHalIndex = -1;
+        int32_t nativeChannelHandle = -1;
+        std::map<size_t, PrivateChannel> privateChannels;
+        std::map<int32_t, Report> reports;
+        //! The next token to hand to the framework, never reusing the token of a stopped report.
+        int32_t nextToken = 1;
+    };
+
+    //! A private channel as the copy thread sees it, so that it never needs mMutex.
+    struct CopySource {
+        std::shared_ptr<DirectReportRing> ring;
+        //! The memory of the framework.
+        std::shared_ptr<DirectReportRing> target;
+        std::map<int32_t, int32_t> tokens;
+    };
+
+    //! Start a report of a sensor of a subhal. Requires mMutex.
+    Result startReportLocked(Channel& channel, int32_t sensorHandle, const Sensor& sensor,
+                             RateLevel rate, Report* report);
+
+    //! Stop a report. Requires mMutex.
+    void stopReportLocked(Channel& channel, int32_t sensorHandle);
+
+    //! Move the subhal writing the memory of the framework to a private channel. Requires mMutex.
+    Result makeProxyOwnedLocked(Channel& channel);
+
+    //! Get the private channel of a subhal, registering it if needed. Requires mMutex.
+    PrivateChannel* getPrivateChannelLocked(Channel& channel, size_t subHalIndex);
+
+    //! Unregister every channel of the subhals and free the memory. Requires mMutex.
+    void releaseChannelLocked(Channel& channel);
+
+    //! Configure a report of a channel. Requires mMutex.
+    void configReportLocked(int32_t sensorHandle, int32_t channelHandle, RateLevel rate,
+                            ISensors::configDirectReport_cb callback);
+
+    //! Hand the private channels and their reports to the copy thread. Requires mMutex.
+    void updateCopySourcesLocked();
+
+    //! Configure a report at a subhal. Requires mMutex.
+    Result configSubHalReport(size_t subHalIndex, int32_t localHandle, int32_t channelHandle,
+                              RateLevel rate, int32_t* token);
+
+    //! Add or remove a direct report period of a copied sensor and apply the result.
+    void setCopiedReportPeriod(int32_t sensorHandle, int64_t oldPeriodNs, int64_t newPeriodNs);
+
+    //! Apply the merged config of a copied sensor at its subhal. Requires mCopyConfigMutex.
+    Result applyCopiedConfigLocked(int32_t sensorHandle, bool batch);
+
+    //! Copy the events of private channels into the memory of the framework until reset.
+    void runCopyThread();
+
+    //! Copy the events newly written to private channels. Requires mCopySourcesMutex.
+    void copyPrivateEventsLocked();
+
+    void stopCopyThread();
+
+    std::vector<std::shared_ptr<ISubHalWrapperBase>> mSubHals;
+
+    SubHalRunner mRunner;
+
+    int64_t mMinPollPeriodNs = 0;
+
+    //! The static sensors, never changed after reset() and addSensor().
+    std::map<int32_t, Sensor> mSensors;
+
+    //! The mutex protecting the channels, held across subhal calls.
+    std::mutex mMutex;
+
+    std::map<int32_t, Channel> mChannels;
+
+    int32_t mNextChannelHandle = 1;
+
+    /**
+     * The mutex protecting the state of the copy thread, taken by the copy thread and never held
+     * across subhal calls.
+     */
+    std::mutex mCopySourcesMutex;
+
+    std::vector<CopySource> mCopySources;
+
+    //! How often the copy thread polls, 0 while no private channel has a report running.
+    int64_t mCopyPollPeriodNs = 0;
+
+    //! Whether a report is being configured, whose events may come before its token is known.
+    bool mConfiguringReport = false;
+
+    std::condition_variable mCopyThreadCV;
+
+    std::thread mCopyThread;
+
+    bool mStopCopyThread = false;
+
+    /**
+     * The mutex protecting mCopyRoutes, taken by the event path and never held across subhal
+     * calls.
+     */
+    std::mutex mCopyRoutesMutex;
+
+    //! The copied sensors with direct reports or enabled by the framework, by sensor handle.
+    std::map<int32_t, CopiedSensorRoutes> mCopyRoutes;
+
+    std::atomic<size_t> mNumCopyRoutes = 0;
+
+    //! The mutex protecting mCopiedSensorConfigs, held across subhal calls.
+    std::mutex mCopyConfigMutex;
+
+    std::map<int32_t, CopiedSensorConfig> mCopiedSensorConfigs;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,435 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "DirectChannelMultiplexer.h"
+
+#include <gtest/gtest.h>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+namespace {
+
+using ::android::hardware::sensors::V1_0::SensorFlagBits;
+using ::android::hardware::sensors::V1_0::SensorFlagShift;
+using ::android::hardware::sensors::V1_0::SharedMemFormat;
+using ::android::hardware::sensors::V1_0::SharedMemType;
+
+constexpr int64_t kPollPeriodNs = 1000000;
+constexpr int64_t kNormalPeriodNs = 20000000;
+constexpr size_t kNumEvents = 16;
+
+// An event in direct channel memory, laid out like sensors_event_t.
+struct DirectEvent {
+    int32_t size;
+    int32_t token;
+    int32_t type;
+    uint32_t counter;
+    int64_t timestamp;
+    float data[16];
+    uint32_t reserved[4];
+};
+
+static_assert(sizeof(DirectEvent) == 104, "Direct report events must be 104 bytes");
+
+constexpr size_t kChannelSize = kNumEvents * sizeof(DirectEvent);
+
+DirectEvent* mapEvents(int fd) {
+    void* data = mmap(nullptr, kChannelSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    return data == MAP_FAILED ? nullptr : static_cast<DirectEvent*>(data);
+}
+
+// The events written to a channel, in the order of their counters.
+std::vector<DirectEvent> readEvents(const DirectEvent* events) {
+    std::vector<DirectEvent> written;
+    for (size_t i = 0; i < kNumEvents; i++) {
+        if (__atomic_load_n(&events[i].counter, __ATOMIC_ACQUIRE) != 0) {
+            written.push_back(events[i]);
+        }
+    }
+    std::sort(written.begin(), written.end(), [](const DirectEvent& a, const DirectEvent& b) {
+        return a.counter < b.counter;
+    });
+    return written;
+}
+
+// Wait for the copy thread to write count events into a channel.
+std::vector<DirectEvent> waitForEvents(const DirectEvent* events, size_t count) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    std::vector<DirectEvent> written = readEvents(events);
+    while (written.size() < count && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(kPollPeriodNs));
+        written = readEvents(events);
+    }
+    return written;
+}
+
+// A subhal writing direct channels like a real one, and recording how its sensors are run.
+class FakeSubHal : public ISubHalWrapperBase {
+  public:
+    explicit FakeSubHal(int32_t firstToken) : mNextToken(firstToken) {}
+
+    ~FakeSubHal() {
+        for (auto& [channelHandle, channel] : mChannels) {
+            munmap(channel.events, kChannelSize);
+        }
+    }
+
+    bool supportsNewEvents() override { return true; }
+
+    Return<Result> initialize(V2_0::implementation::ISubHalCallback* /* callback */,
+                              V2_0::implementation::IScopedWakelockRefCounter* /* refCounter */,
+                              int32_t /* subHalIndex */) override {
+        return Result::OK;
+    }
+
+    Return<void> getSensorsList(ISensors::getSensorsList_2_1_cb /* _hidl_cb */) override {
+        return Void();
+    }
+
+    Return<Result> setOperationMode(OperationMode /* mode */) override { return Result::OK; }
+
+    Return<Result> activate(int32_t sensorHandle, bool enabled) override {
+        mActive[sensorHandle] = enabled;
+        return Result::OK;
+    }
+
+    Return<Result> batch(int32_t sensorHandle, int64_t samplingPeriodNs,
+                         int64_t /* maxReportLatencyNs */) override {
+        mSamplingPeriodsNs[sensorHandle] = samplingPeriodNs;
+        return Result::OK;
+    }
+
+    Return<Result> flush(int32_t /* sensorHandle */) override { return Result::OK; }
+
+    Return<Result> injectSensorData(const Event& /* event */) override {
+        return Result::INVALID_OPERATION;
+    }
+
+    Return<void> registerDirectChannel(const SharedMemInfo& mem,
+                                       ISensors::registerDirectChannel_cb _hidl_cb) override {
+        Channel channel;
+        channel.events = mem.size == kChannelSize
+                                 ? mapEvents(mem.memoryHandle.getNativeHandle()->data[0])
+                                 : nullptr;
+        if (channel.events == nullptr) {
+            _hidl_cb(Result::BAD_VALUE, -1 /* channelHandle */);
+            return Void();
+        }
+        int32_t channelHandle = mNextChannelHandle++;
+        mChannels[channelHandle] = channel;
+        _hidl_cb(Result::OK, channelHandle);
+        return Void();
+    }
+
+    Return<Result> unregisterDirectChannel(int32_t channelHandle) override {
+        auto channel = mChannels.find(channelHandle);
+        if (channel == mChannels.end()) {
+            return Result::BAD_VALUE;
+        }
+        munmap(channel->second.events, kChannelSize);
+        mChannels.erase(channel);
+        return Result::OK;
+    }
+
+    Return<void> configDirectReport(int32_t sensorHandle, int32_t channelHandle, RateLevel rate,
+                                    ISensors::configDirectReport_cb _hidl_cb) override {
+        auto channel = mChannels.find(channelHandle);
+        if (channel == mChannels.end()) {
+            _hidl_cb(Result::BAD_VALUE, -1 /* reportToken */);
+            return Void();
+        }
+        if (rate == RateLevel::STOP) {
+            channel->second.tokens.erase(sensorHandle);
+            _hidl_cb(Result::OK, -1 /* reportToken */);
+            return Void();
+        }
+        // Tokens differ from those of every other subhal, like ones of unrelated HALs would.
+        int32_t token = mNextToken++;
+        channel->second.tokens[sensorHandle] = token;
+        _hidl_cb(Result::OK, token);
+        return Void();
+    }
+
+    Return<void> debug(const hidl_handle& /* fd */,
+                       const hidl_vec<hidl_string>& /* args */) override {
+        return Void();
+    }
+
+    const std::string getName() override { return "FakeSubHal"; }
+
+    //! Write an event of the report of a sensor into the only registered channel.
+    void writeEvent(int32_t sensorHandle, int64_t timestamp) {
+        ASSERT_EQ(1u, mChannels.size());
+        Channel& channel = mChannels.begin()->second;
+        DirectEvent* slot = &channel.events[channel.index];
+        slot->size = sizeof(DirectEvent);
+        slot->token = channel.tokens.at(sensorHandle);
+        slot->type = 1;
+        slot->timestamp = timestamp;
+        __atomic_store_n(&slot->counter, channel.counter, __ATOMIC_RELEASE);
+        channel.index = (channel.index + 1) % kNumEvents;
+        channel.counter++;
+    }
+
+    size_t getNumChannels() const { return mChannels.size(); }
+
+    //! The handle of the only registered channel.
+    int32_t getChannelHandle() const {
+        return mChannels.size() == 1 ? mChannels.begin()->first : -1;
+    }
+
+    //! The token of the report of a sensor in the only registered channel.
+    int32_t getToken(int32_t sensorHandle) const {
+        if (mChannels.size() != 1) {
+            return -1;
+        }
+        const std::map<int32_t, int32_t>& tokens = mChannels.begin()->second.tokens;
+        auto token = tokens.find(sensorHandle);
+        return token == tokens.end() ? -1 : token->second;
+    }
+
+    bool isActive(int32_t sensorHandle) const {
+        auto active = mActive.find(sensorHandle);
+        return active != mActive.end() && active->second;
+    }
+
+    int64_t getSamplingPeriodNs(int32_t sensorHandle) const {
+        auto period = mSamplingPeriodsNs.find(sensorHandle);
+        return period == mSamplingPeriodsNs.end() ? 0 : period->second;
+    }
+
+  private:
+    struct Channel {
+        DirectEvent* events = nullptr;
+        size_t index = 0;
+        uint32_t counter = 1;
+        std::map<int32_t, int32_t> tokens;
+    };
+
+    std::map<int32_t, Channel> mChannels;
+    int32_t mNextChannelHandle = 1;
+    int32_t mNextToken;
+    std::map<int32_t, bool> mActive;
+    std::map<int32_t, int64_t> mSamplingPeriodsNs;
+};
+
+SensorInfo makeSensor(size_t subHalIndex, int32_t localHandle, uint32_t flags) {
+    SensorInfo sensor = {};
+    sensor.sensorHandle = static_cast<int32_t>(subHalIndex << 24) | localHandle;
+    sensor.type = SensorType::ACCELEROMETER;
+    sensor.minDelay = 1000;
+    sensor.flags = flags;
+    return sensor;
+}
+
+Event makeEvent(int32_t sensorHandle, int64_t timestamp) {
+    Event event = {};
+    event.sensorHandle = sensorHandle;
+    event.sensorType = SensorType::ACCELEROMETER;
+    event.timestamp = timestamp;
+    event.u.data[0] = 1.5f;
+    return event;
+}
+
+class DirectChannelMultiplexerTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        mFd = memfd_create("direct_channel", MFD_CLOEXEC);
+        ASSERT_GE(mFd, 0);
+        ASSERT_EQ(0, ftruncate(mFd, kChannelSize));
+        mEvents = mapEvents(mFd);
+        ASSERT_NE(nullptr, mEvents);
+        mHandle = native_handle_create(1 /* numFds */, 0 /* numInts */);
+        mHandle->data[0] = mFd;
+
+        mSubHals = {std::make_shared<FakeSubHal>(100), std::make_shared<FakeSubHal>(200)};
+        mMultiplexer.reset({mSubHals[0], mSubHals[1]},
+                           [](size_t /* subHalIndex */, const char* /* callName */,
+                              const std::function<void()>& call) { call(); },
+                           kPollPeriodNs);
+    }
+
+    void TearDown() override {
+        mMultiplexer.reset({}, nullptr, 0);
+        munmap(mEvents, kChannelSize);
+        native_handle_close(mHandle);
+        native_handle_delete(mHandle);
+    }
+
+    int32_t registerChannel() {
+        SharedMemInfo mem;
+        mem.type = SharedMemType::ASHMEM;
+        mem.format = SharedMemFormat::SENSORS_EVENT;
+        mem.size = kChannelSize;
+        mem.memoryHandle = mHandle;
+        int32_t channelHandle = -1;
+        mMultiplexer.registerChannel(mem, [&](Result result, int32_t handle) {
+            EXPECT_EQ(Result::OK, result);
+            channelHandle = handle;
+        });
+        return channelHandle;
+    }
+
+    int32_t configReport(int32_t sensorHandle, int32_t channelHandle, RateLevel rate) {
+        int32_t token = -1;
+        mMultiplexer.configReport(sensorHandle, channelHandle, rate,
+                                  [&](Result result, int32_t reportToken) {
+                                      EXPECT_EQ(Result::OK, result);
+                                      token = reportToken;
+                                  });
+        return token;
+    }
+
+    static constexpr uint32_t kDirectFlags =
+            static_cast<uint32_t>(SensorFlagBits::DIRECT_CHANNEL_ASHMEM) |
+            (static_cast<uint32_t>(RateLevel::FAST)
+             << static_cast<uint32_t>(SensorFlagShift::DIRECT_REPORT));
+
+    int mFd = -1;
+    DirectEvent* mEvents = nullptr;
+    native_handle_t* mHandle = nullptr;
+    std::vector<std::shared_ptr<FakeSubHal>> mSubHals;
+    DirectChannelMultiplexer mMultiplexer;
+};
+
+TEST_F(DirectChannelMultiplexerTest, SingleSubHalWritesTheChannelItself) {
+    SensorInfo sensor = makeSensor(0, 1, kDirectFlags);
+    mMultiplexer.addSensor(sensor, false /* copied */);
+    int32_t channelHandle = registerChannel();
+
+    int32_t token = configReport(sensor.sensorHandle, channelHandle, RateLevel::NORMAL);
+    ASSERT_EQ(1u, mSubHals[0]->getNumChannels());
+    EXPECT_EQ(0u, mSubHals[1]->getNumChannels());
+    EXPECT_EQ(mSubHals[0]->getToken(1), token);
+
+    mSubHals[0]->writeEvent(1, 1000);
+    std::vector<DirectEvent> events = readEvents(mEvents);
+    ASSERT_EQ(1u, events.size());
+    EXPECT_EQ(token, events[0].token);
+    EXPECT_EQ(1000, events[0].timestamp);
+
+    EXPECT_EQ(Result::OK, mMultiplexer.unregisterChannel(channelHandle));
+    EXPECT_EQ(0u, mSubHals[0]->getNumChannels());
+}
+
+TEST_F(DirectChannelMultiplexerTest, SecondSubHalMakesTheChannelProxyOwned) {
+    SensorInfo first = makeSensor(0, 1, kDirectFlags);
+    SensorInfo second = makeSensor(1, 1, kDirectFlags);
+    mMultiplexer.addSensor(first, false /* copied */);
+    mMultiplexer.addSensor(second, false /* copied */);
+    int32_t channelHandle = registerChannel();
+
+    int32_t firstToken = configReport(first.sensorHandle, channelHandle, RateLevel::NORMAL);
+    int32_t nativeChannelHandle = mSubHals[0]->getChannelHandle();
+    mSubHals[0]->writeEvent(1, 1000);
+
+    int32_t secondToken = configReport(second.sensorHandle, channelHandle, RateLevel::NORMAL);
+    EXPECT_NE(firstToken, secondToken);
+
+    // The first subhal moved to a private channel, with a token of its own.
+    ASSERT_EQ(1u, mSubHals[0]->getNumChannels());
+    EXPECT_NE(nativeChannelHandle, mSubHals[0]->getChannelHandle());
+    EXPECT_NE(firstToken, mSubHals[0]->getToken(1));
+    ASSERT_EQ(1u, mSubHals[1]->getNumChannels());
+
+    mSubHals[0]->writeEvent(1, 2000);
+    mSubHals[1]->writeEvent(1, 3000);
+    std::vector<DirectEvent> events = waitForEvents(mEvents, 3);
+    ASSERT_EQ(3u, events.size());
+
+    // Copies resume after the event the first subhal wrote natively, rather than overwrite it.
+    EXPECT_EQ(1000, events[0].timestamp);
+    EXPECT_EQ(firstToken, events[0].token);
+    EXPECT_EQ(1000, mEvents[0].timestamp);
+    for (size_t i = 1; i < events.size(); i++) {
+        EXPECT_EQ(events[i].timestamp == 2000 ? firstToken : secondToken, events[i].token);
+        EXPECT_EQ(events[i - 1].counter + 1, events[i].counter);
+    }
+
+    EXPECT_EQ(Result::OK, mMultiplexer.unregisterChannel(channelHandle));
+    EXPECT_EQ(0u, mSubHals[0]->getNumChannels());
+    EXPECT_EQ(0u, mSubHals[1]->getNumChannels());
+}
+
+TEST_F(DirectChannelMultiplexerTest, RestartedReportsGetNewTokens) {
+    SensorInfo first = makeSensor(0, 1, kDirectFlags);
+    SensorInfo second = makeSensor(1, 1, kDirectFlags);
+    mMultiplexer.addSensor(first, false /* copied */);
+    mMultiplexer.addSensor(second, false /* copied */);
+    int32_t channelHandle = registerChannel();
+
+    int32_t firstToken = configReport(first.sensorHandle, channelHandle, RateLevel::NORMAL);
+    int32_t secondToken = configReport(second.sensorHandle, channelHandle, RateLevel::NORMAL);
+    configReport(second.sensorHandle, channelHandle, RateLevel::STOP);
+    int32_t restartedToken = configReport(second.sensorHandle, channelHandle, RateLevel::FAST);
+    EXPECT_NE(firstToken, restartedToken);
+    EXPECT_NE(secondToken, restartedToken);
+
+    // Events written as soon as the report restarted still reach the framework.
+    mSubHals[1]->writeEvent(1, 1000);
+    std::vector<DirectEvent> events = waitForEvents(mEvents, 1);
+    ASSERT_EQ(1u, events.size());
+    EXPECT_EQ(restartedToken, events[0].token);
+}
+
+TEST_F(DirectChannelMultiplexerTest, CopiesEventsAtTheReportRate) {
+    SensorInfo sensor = makeSensor(0, 2, 0 /* flags */);
+    ASSERT_TRUE(DirectChannelMultiplexer::setCopiedFlags(&sensor));
+    mMultiplexer.addSensor(sensor, true /* copied */);
+    int32_t channelHandle = registerChannel();
+
+    int32_t token = configReport(sensor.sensorHandle, channelHandle, RateLevel::NORMAL);
+    EXPECT_EQ(0u, mSubHals[0]->getNumChannels());
+    EXPECT_TRUE(mSubHals[0]->isActive(2));
+    EXPECT_EQ(kNormalPeriodNs, mSubHals[0]->getSamplingPeriodNs(2));
+    ASSERT_TRUE(mMultiplexer.isCopying());
+
+    // The sensor only runs for the report, so its events must not reach the framework.
+    int64_t start = 1000000000;
+    for (int64_t timestamp = start; timestamp < start + 5 * kNormalPeriodNs;
+         timestamp += kNormalPeriodNs / 4) {
+        EXPECT_FALSE(mMultiplexer.copyEvent(makeEvent(sensor.sensorHandle, timestamp)));
+    }
+
+    std::vector<DirectEvent> events = readEvents(mEvents);
+    ASSERT_EQ(5u, events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        EXPECT_EQ(token, events[i].token);
+        EXPECT_EQ(start + static_cast<int64_t>(i) * kNormalPeriodNs, events[i].timestamp);
+        EXPECT_EQ(1.5f, events[i].data[0]);
+    }
+
+    EXPECT_EQ(Result::OK, mMultiplexer.activateCopied(sensor.sensorHandle, true));
+    EXPECT_TRUE(mMultiplexer.copyEvent(makeEvent(sensor.sensorHandle, start * 2)));
+    Event flushComplete = makeEvent(sensor.sensorHandle, 0);
+    flushComplete.sensorType = SensorType::META_DATA;
+    EXPECT_TRUE(mMultiplexer.copyEvent(flushComplete));
+    EXPECT_EQ(6u, readEvents(mEvents).size());
+
+    // Stopping the report keeps the sensor running for the framework only.
+    configReport(sensor.sensorHandle, channelHandle, RateLevel::STOP);
+    EXPECT_FALSE(mMultiplexer.isCopying());
+    EXPECT_TRUE(mSubHals[0]->isActive(2));
+    EXPECT_EQ(Result::OK, mMultiplexer.activateCopied(sensor.sensorHandle, false));
+    EXPECT_FALSE(mSubHals[0]->isActive(2));
+}
+
+}  // namespace
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "ConvertUtils.h"
+#include "EventMessageQueueWrapper.h"
+#include "convertV2_1.h"
+
+#include <aidl/android/hardware/sensors/Event.h>
+#include <android/hardware/sensors/1.0/types.h>
+#include <android/hardware/sensors/2.1/types.h>
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Event FMQ wrapper that can also hand out FMQ memory, so events can be stored straight into the
+ * queue instead of going through intermediate buffers. Only the single FMQ writer may use it.
+ */
+class DirectEventMessageQueueWrapperBase : public EventMessageQueueWrapperBase {
+  public:
+    /**
+     * Reserve FMQ memory for count events. Events stored into the reservation are not visible to
+     * the reader until commitWrite() is called.
+     *
+     * @return false if the FMQ does not have room for count events.
+     */
+    virtual bool beginWrite(size_t count) = 0;
+
+    //! Store event into the index'th slot of the current reservation.
+    virtual void setSlot(size_t index, const V2_1::Event& event) = 0;
+
+    //! Publish the first count slots of the current reservation to the reader.
+    virtual bool commitWrite(size_t count) = 0;
+};
+
+inline void convertEvent(const V2_1::Event& src, V2_1::Event* dst) {
+    *dst = src;
+}
+
+inline void convertEvent(const V2_1::Event& src, V1_0::Event* dst) {
+    *dst = convertToOldEvent(src);
+}
+
+inline void convertEvent(const V2_1::Event& src, ::aidl::android::hardware::sensors::Event* dst) {
+    ::aidl::android::hardware::sensors::implementation::convertToAidlEvent(src, dst);
+}
+
+inline void convertEvent(const V1_0::Event& src, V2_1::Event* dst) {
+    *dst = convertToNewEvent(src);
+}
+
+inline void convertEvent(const ::aidl::android::hardware::sensors::Event& src, V2_1::Event* dst) {
+    ::aidl::android::hardware::sensors::implementation::convertToHidlEvent(src, dst);
+}
+
+/**
+ * DirectEventMessageQueueWrapperBase for any HIDL or AIDL synchronized FMQ, converting events
+ * to the queue's event type as they are stored.
+ */
+template <typename QueueEvent, typename Queue>
+class DirectEventMessageQueueWrapper : public DirectEventMessageQueueWrapperBase {
+  public:
+    explicit DirectEventMessageQueueWrapper(std::unique_ptr<Queue>& queue)
+        : mQueue(std::move(queue)) {
+        if constexpr (kNeedsConversion) {
+            mWriteBlockingBuffer.resize(mQueue->getQuantumCount());
+        }
+    }
+
+    std::atomic<uint32_t>* getEventFlagWord() override { return mQueue->getEventFlagWord(); }
+
+    size_t availableToRead() override { return mQueue->availableToRead(); }
+
+    size_t availableToWrite() override { return mQueue->availableToWrite(); }
+
+    size_t getQuantumCount() override { return mQueue->getQuantumCount(); }
+
+    bool read(V2_1::Event* events, size_t numToRead) override {
+        if constexpr (!kNeedsConversion) {
+            return mQueue->read(events, numToRead);
+        } else {
+            std::vector<QueueEvent> queueEvents(numToRead);
+            bool success = mQueue->read(queueEvents.data(), numToRead);
+            for (size_t i = 0; success && i < numToRead; i++) {
+                convertEvent(queueEvents[i], &events[i]);
+            }
+            return success;
+        }
+    }
+
+    bool write(const V2_1::Event* events, size_t numToWrite) override {
+        if (!beginWrite(numToWrite)) {
+            return false;
+        }
+        for (size_t i = 0; i < numToWrite; i++) {
+            setSlot(i, events[i]);
+        }
+        return commitWrite(numToWrite);
+    }
+
+    bool write(const std::vector<V2_1::Event>& events) override {
+        return write(events.data(), events.size());
+    }
+
+    bool writeBlocking(const V2_1::Event* events, size_t count, uint32_t readNotification,
+                       uint32_t writeNotification, int64_t timeOutNanos,
+                       android::hardware::EventFlag* evFlag) override {
+        if constexpr (!kNeedsConversion) {
+            return mQueue->writeBlocking(events, count, readNotification, writeNotification,
+                                         timeOutNanos, evFlag);
+        } else {
+            // Only the pending writes thread blocks, so this buffer is never shared with the
+            // direct write path.
+            if (count > mWriteBlockingBuffer.size()) {
+                mWriteBlockingBuffer.resize(count);
+            }
+            for (size_t i = 0; i < count; i++) {
+                convertEvent(events[i], &mWriteBlockingBuffer[i]);
+            }
+            return mQueue->writeBlocking(mWriteBlockingBuffer.data(), count, readNotification,
+                                         writeNotification, timeOutNanos, evFlag);
+        }
+    }
+
+    bool beginWrite(size_t count) override { return mQueue->beginWrite(count, &mTransaction); }
+
+    void setSlot(size_t index, const V2_1::Event& event) override {
+        convertEvent(event, mTransaction.getSlot(index));
+    }
+
+    bool commitWrite(size_t count) override { return mQueue->commitWrite(count); }
+
+  private:
+    static constexpr bool kNeedsConversion = !std::is_same_v<QueueEvent, V2_1::Event>;
+
+    std::unique_ptr<Queue> mQueue;
+    typename Queue::MemTransaction mTransaction;
+    std::vector<QueueEvent> mWriteBlockingBuffer;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "WakeLockMessageQueueWrapper.h"
+
+#include <memory>
+#include <type_traits>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Wake lock FMQ wrapper that can also read without blocking, so every acknowledgement the
+ * framework has written can be drained at once.
+ */
+class DrainableWakeLockMessageQueueWrapperBase : public WakeLockMessageQueueWrapperBase {
+  public:
+    virtual size_t availableToRead() = 0;
+
+    //! Read numToRead acknowledgements without blocking.
+    virtual bool read(uint32_t* wakeLocks, size_t numToRead) = 0;
+};
+
+/**
+ * DrainableWakeLockMessageQueueWrapperBase for the HIDL uint32_t or the AIDL int32_t wake lock
+ * FMQ. Both carry the same counts, so they are read in place.
+ */
+template <typename QueueWakeLock, typename Queue>
+class DrainableWakeLockMessageQueueWrapper : public DrainableWakeLockMessageQueueWrapperBase {
+  public:
+    static_assert(sizeof(QueueWakeLock) == sizeof(uint32_t));
+
+    explicit DrainableWakeLockMessageQueueWrapper(std::unique_ptr<Queue>& queue)
+        : mQueue(std::move(queue)) {}
+
+    std::atomic<uint32_t>* getEventFlagWord() override { return mQueue->getEventFlagWord(); }
+
+    bool readBlocking(uint32_t* wakeLocks, size_t numToRead, uint32_t readNotification,
+                      uint32_t writeNotification, int64_t timeOutNanos,
+                      android::hardware::EventFlag* evFlag = nullptr) override {
+        return mQueue->readBlocking(reinterpret_cast<QueueWakeLock*>(wakeLocks), numToRead,
+                                    readNotification, writeNotification, timeOutNanos, evFlag);
+    }
+
+    bool write(const uint32_t* wakeLock) override {
+        return mQueue->write(reinterpret_cast<const QueueWakeLock*>(wakeLock));
+    }
+
+    size_t availableToRead() override { return mQueue->availableToRead(); }
+
+    bool read(uint32_t* wakeLocks, size_t numToRead) override {
+        return mQueue->read(reinterpret_cast<QueueWakeLock*>(wakeLocks), numToRead);
+    }
+
+  private:
+    std::unique_ptr<Queue> mQueue;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "FlightRecorder.h"
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+void FlightRecorder::record(const Event& event, int64_t receivedNs, int64_t writtenNs) {
+    Ring* ring = findRing(event.sensorHandle, true /* claim */);
+    if (ring == nullptr) {
+        return;
+    }
+    uint64_t index = ring->head.fetch_add(1, std::memory_order_relaxed);
+    Entry& entry = ring->entries[index % kEventsPerSensor];
+    entry.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.sensorType.store(static_cast<int32_t>(event.sensorType), std::memory_order_relaxed);
+    entry.timestamp.store(event.timestamp, std::memory_order_relaxed);
+    entry.receivedNs.store(receivedNs, std::memory_order_relaxed);
+    entry.writtenNs.store(writtenNs, std::memory_order_relaxed);
+    entry.sequence.store(2 * (index + 1), std::memory_order_release);
+
+    // Flush complete events carry no timestamp.
+    if (event.sensorType != V2_1::SensorType::META_DATA) {
+        ring->receiveLatency.record(receivedNs - event.timestamp);
+    }
+    if (writtenNs != 0) {
+        ring->writeLatency.record(writtenNs - receivedNs);
+    }
+}
+
+void FlightRecorder::markWritten(const Event& event, int64_t receivedNs, int64_t writtenNs) {
+    Ring* ring = findRing(event.sensorHandle, false /* claim */);
+    if (ring == nullptr) {
+        return;
+    }
+    if (receivedNs != 0) {
+        ring->writeLatency.record(writtenNs - receivedNs);
+    }
+    // Events of a sensor are written in the order they were received, so the match is nearly
+    // always the entry at the cursor. Entries of dropped events are skipped over.
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    uint64_t cursor = ring->writtenCursor.load(std::memory_order_relaxed);
+    cursor = std::max(cursor, head > kEventsPerSensor ? head - kEventsPerSensor : 0);
+    for (uint64_t index = cursor; index < head; index++) {
+        Entry& entry = ring->entries[index % kEventsPerSensor];
+        if (entry.writtenNs.load(std::memory_order_relaxed) == 0 &&
+            entry.timestamp.load(std::memory_order_relaxed) == event.timestamp &&
+            entry.sensorType.load(std::memory_order_relaxed) ==
+                    static_cast<int32_t>(event.sensorType)) {
+            entry.writtenNs.store(writtenNs, std::memory_order_relaxed);
+            ring->writtenCursor.store(index + 1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void FlightRecorder::dump(std::ostream& stream, const std::set<int32_t>& sensorHandles) const {
+    stream << "Flight recorder (event timestamp, then received and written relative to it, in us):"
+           << std::endl;
+    for (const Ring& ring : mRings) {
+        int32_t sensorHandle = ring.sensorHandle.load(std::memory_order_acquire);
+        if (sensorHandle == kNoSensor ||
+            (!sensorHandles.empty() && sensorHandles.count(sensorHandle) == 0)) {
+            continue;
+        }
+        stream << "  0x" << std::hex << sensorHandle << std::dec << ":" << std::endl;
+        uint64_t head = ring.head.load(std::memory_order_acquire);
+        for (uint64_t index = head > kEventsPerSensor ? head - kEventsPerSensor : 0;
+             index < head; index++) {
+            const Entry& entry = ring.entries[index % kEventsPerSensor];
+            uint64_t sequence = entry.sequence.load(std::memory_order_acquire);
+            int32_t sensorType = entry.sensorType.load(std::memory_order_relaxed);
+            int64_t timestamp = entry.timestamp.load(std::memory_order_relaxed);
+            int64_t receivedNs = entry.receivedNs.load(std::memory_order_relaxed);
+            int64_t writtenNs = entry.writtenNs.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence != 2 * (index + 1) ||
+                entry.sequence.load(std::memory_order_relaxed) != sequence) {
+                // Overwritten or still being written.
+                continue;
+            }
+            stream << "    type " << sensorType << " at " << timestamp << " received +"
+                   << (receivedNs - timestamp) / 1000 << " written ";
+            if (writtenNs == 0) {
+                stream << "-";
+            } else {
+                stream << "+" << (writtenNs - timestamp) / 1000;
+            }
+            stream << std::endl;
+        }
+    }
+}
+
+void FlightRecorder::dumpLatency(std::ostream& stream) const {
+    stream << "Latency per sensor (event timestamp to received, received to written):"
+           << std::endl;
+    for (const Ring& ring : mRings) {
+        int32_t sensorHandle = ring.sensorHandle.load(std::memory_order_acquire);
+        if (sensorHandle == kNoSensor) {
+            continue;
+        }
+        stream << "  0x" << std::hex << sensorHandle << std::dec << ": ";
+        ring.receiveLatency.dump(stream);
+        stream << "; ";
+        ring.writeLatency.dump(stream);
+        stream << std::endl;
+    }
+}
+
+void FlightRecorder::resetLatency() {
+    for (Ring& ring : mRings) {
+        ring.receiveLatency.reset();
+        ring.writeLatency.reset();
+    }
+}
+
+FlightRecorder::Ring* FlightRecorder::findRing(int32_t sensorHandle, bool claim) {
+    // Mix the subhal index in the top byte with the local handle, then probe linearly.
+    uint32_t hash = static_cast<uint32_t>(sensorHandle) * 2654435761u;
+    size_t start = (hash >> 16) % kMaxSensors;
+    for (size_t i = 0; i < kMaxSensors; i++) {
+        Ring& ring = mRings[(start + i) % kMaxSensors];
+        int32_t ringHandle = ring.sensorHandle.load(std::memory_order_acquire);
+        if (ringHandle == sensorHandle) {
+            return &ring;
+        }
+        if (ringHandle == kNoSensor) {
+            if (!claim) {
+                return nullptr;
+            }
+            if (ring.sensorHandle.compare_exchange_strong(ringHandle, sensorHandle,
+                                                          std::memory_order_acq_rel) ||
+                ringHandle == sensorHandle) {
+                return &ring;
+            }
+        }
+    }
+    return nullptr;
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
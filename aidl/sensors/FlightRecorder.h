@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "LatencyHistogram.h"
+
+#include <android/hardware/sensors/2.1/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <set>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Always-on record of the last kEventsPerSensor events of every sensor, with the time the
+ * HalProxy received each event and the time it was written to the event FMQ.
+ *
+ * Every sensor also gets histograms of the delay from its event timestamps to the HalProxy
+ * receiving the events, and from receiving them to writing them to the event FMQ.
+ *
+ * All memory is allocated up front and recording never takes a lock, so it is cheap enough for
+ * the event path. Entries are seqlock protected, so a dump never shows a half written entry.
+ * Only the first kMaxSensors sensors seen are recorded.
+ */
+class FlightRecorder {
+  public:
+    using Event = ::android::hardware::sensors::V2_1::Event;
+
+    static constexpr size_t kMaxSensors = 128;
+    static constexpr size_t kEventsPerSensor = 32;
+
+    /**
+     * Record an event the HalProxy received.
+     *
+     * @param event The event, with the sensor handle as reported to the framework.
+     * @param receivedNs When the event was received, on the event timestamp clock.
+     * @param writtenNs When the event was written to the event FMQ, or 0 if it is still pending.
+     */
+    void record(const Event& event, int64_t receivedNs, int64_t writtenNs);
+
+    /**
+     * Mark the oldest recorded but unwritten entry matching event as written. Must only be called
+     * by the event FMQ writer.
+     *
+     * @param event The event written.
+     * @param receivedNs When the event was received, or 0 to leave it out of the histograms.
+     * @param writtenNs When the event was written.
+     */
+    void markWritten(const Event& event, int64_t receivedNs, int64_t writtenNs);
+
+    /**
+     * Write the recorded events, oldest first per sensor.
+     *
+     * @param stream The stream to write to.
+     * @param sensorHandles The sensors to write, or empty to write every sensor.
+     */
+    void dump(std::ostream& stream, const std::set<int32_t>& sensorHandles) const;
+
+    //! Write the latency histograms of every sensor.
+    void dumpLatency(std::ostream& stream) const;
+
+    //! Forget every latency recorded so far.
+    void resetLatency();
+
+  private:
+    static constexpr int32_t kNoSensor = -1;
+
+    struct Entry {
+        //! Odd while the entry is written, 2 * (index + 1) once entry index is complete.
+        std::atomic<uint64_t> sequence = 0;
+        std::atomic<int32_t> sensorType = 0;
+        std::atomic<int64_t> timestamp = 0;
+        std::atomic<int64_t> receivedNs = 0;
+        std::atomic<int64_t> writtenNs = 0;
+    };
+
+    struct Ring {
+        std::atomic<int32_t> sensorHandle = kNoSensor;
+
+        //! The index of the next entry to record.
+        std::atomic<uint64_t> head = 0;
+
+        //! The index of the oldest entry that may still be unwritten, only used by the FMQ writer.
+        std::atomic<uint64_t> writtenCursor = 0;
+
+        Entry entries[kEventsPerSensor];
+
+        //! From the event timestamp to the HalProxy receiving the event.
+        LatencyHistogram receiveLatency;
+
+        //! From the HalProxy receiving the event to writing it to the event FMQ.
+        LatencyHistogram writeLatency;
+    };
+
+    /**
+     * Find the ring of a sensor.
+     *
+     * @param sensorHandle The sensor handle.
+     * @param claim Whether to claim a free ring if the sensor has none.
+     *
+     * @return The ring, or nullptr if the sensor has none and none could be claimed.
+     */
+    Ring* findRing(int32_t sensorHandle, bool claim);
+
+    Ring mRings[kMaxSensors];
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -19,14 +19,22 @@
 #include <android/hardware/sensors/2.0/types.h>
 
 #include <android-base/file.h>
+#include <cutils/properties.h>
 #include "hardware_legacy/power.h"
+#include <utils/SystemClock.h>
 
+#include <dirent.h>
 #include <dlfcn.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cinttypes>
 #include <cmath>
+#include <cstring>
 #include <fstream>
 #include <functional>
+#include <future>
+#include <set>
 #include <thread>
 
 namespace android {
@@ -81,33 +89,74 @@ int64_t msFromNs(int64_t nanos) {
     return nanos / nanosecondsInAMillsecond;
 }
 
-bool patchXiaomiPickupSensor(V2_1::SensorInfo& sensor) {
-    if (sensor.typeAsString != "xiaomi.sensor.pickup" &&
-        sensor.typeAsString != "xiaomi pick up sensor") {
-        return true;
+/**
+ * Run task for every index in [0, count) on up to kMaxSubHalThreads threads, including the calling
+ * thread, and wait for all of them to finish.
+ *
+ * @param count The number of indices.
+ * @param task The task to run for each index.
+ */
+static void runInParallel(size_t count, const std::function<void(size_t)>& task) {
+    constexpr size_t kMaxSubHalThreads = 4;
+    std::atomic<size_t> nextIndex = 0;
+    auto worker = [&] {
+        for (size_t i = nextIndex++; i < count; i = nextIndex++) {
+            task(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < std::min(count, kMaxSubHalThreads); i++) {
+        threads.emplace_back(worker);
     }
-
-    /*
-     * Implement only the wake-up version of this sensor.
-     */
-    if (!(sensor.flags & V1_0::SensorFlagBits::WAKE_UP)) {
-        return false;
+    worker();
+    for (std::thread& thread : threads) {
+        thread.join();
     }
-
-    sensor.type = V2_1::SensorType::PICK_UP_GESTURE;
-    sensor.typeAsString = SENSOR_STRING_TYPE_PICK_UP_GESTURE;
-    sensor.maxRange = 1;
-
-    return true;
 }
 
 HalProxy::HalProxy() {
     static const std::string kMultiHalConfigFiles[] = {"/vendor/etc/sensors/hals.conf",
                                                        "/odm/etc/sensors/hals.conf"};
+    int64_t startTime = getTimeNow();
+    std::vector<std::string> subHalLibraryFiles;
     for (const std::string& configFile : kMultiHalConfigFiles) {
-        initializeSubHalListFromConfigFile(configFile.c_str());
+        readSubHalConfigFile(configFile.c_str(), &subHalLibraryFiles);
+    }
+    initializeSubHalList(subHalLibraryFiles);
+    static const char* kThreadPolicyConfigFiles[] = {"/vendor/etc/sensors/threads.conf",
+                                                     "/odm/etc/sensors/threads.conf"};
+    for (const char* configFile : kThreadPolicyConfigFiles) {
+        mThreadPolicies.readConfigFile(configFile);
     }
+    int64_t coalesceWindowUs =
+            property_get_int64("ro.vendor.sensors.xiaomi.multihal.coalesce_window_us", 0);
+    mEventCoalesceWindowNs = std::max<int64_t>(coalesceWindowUs, 0) * 1000;
+    char dropPolicy[PROPERTY_VALUE_MAX];
+    property_get("ro.vendor.sensors.xiaomi.multihal.drop_policy", dropPolicy, "decimate");
+    if (strcmp(dropPolicy, "newest") == 0) {
+        mDropPolicy = DropPolicy::DROP_NEWEST;
+    } else if (strcmp(dropPolicy, "decimate") != 0) {
+        ALOGW("Unknown drop policy '%s', decimating", dropPolicy);
+    }
+    int64_t wakelockReleaseDelayMs = property_get_int64(
+            "ro.vendor.sensors.xiaomi.multihal.wakelock_release_delay_ms",
+            kDefaultWakelockReleaseDelayMs);
+    mWakelockReleaseDelayNs = std::max<int64_t>(wakelockReleaseDelayMs, 0) * 1000000;
+    int64_t subHalCallBudgetMs = property_get_int64(
+            "ro.vendor.sensors.xiaomi.multihal.subhal_call_budget_ms", kDefaultSubHalCallBudgetMs);
+    mSubHalCallBudgetNs = std::max<int64_t>(subHalCallBudgetMs, 1) * 1000000;
+    int64_t subHalCallTimeoutMs =
+            property_get_int64("ro.vendor.sensors.xiaomi.multihal.subhal_call_timeout_ms",
+                               kDefaultSubHalCallTimeoutMs);
+    mSubHalCallTimeoutNs = std::max(subHalCallTimeoutMs * 1000000, mSubHalCallBudgetNs);
+    mDirectChannelCopy =
+            property_get_bool("ro.vendor.sensors.xiaomi.multihal.direct_channel_copy", false);
+    int64_t directChannelMinPollUs =
+            property_get_int64("ro.vendor.sensors.xiaomi.multihal.direct_channel_min_poll_us",
+                               kDefaultDirectChannelMinPollUs);
+    mDirectChannelMinPollNs = std::max<int64_t>(directChannelMinPollUs, 100) * 1000;
     init();
+    mStartupTimeNs = getTimeNow() - startTime;
 }
 
 HalProxy::HalProxy(std::vector<ISensorsSubHalV2_0*>& subHalList) {
@@ -133,9 +182,13 @@ HalProxy::HalProxy(std::vector<ISensorsSubHalV2_0*>& subHalList,
 
 HalProxy::~HalProxy() {
     stopThreads();
+    if (mSensorListCacheThread.joinable()) {
+        mSensorListCacheThread.join();
+    }
 }
 
 Return<void> HalProxy::getSensorsList_2_1(ISensorsV2_1::getSensorsList_2_1_cb _hidl_cb) {
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
     std::vector<V2_1::SensorInfo> sensors;
     for (const auto& iter : mSensors) {
         sensors.push_back(iter.second);
@@ -145,6 +198,7 @@ Return<void> HalProxy::getSensorsList_2_1(ISensorsV2_1::getSensorsList_2_1_cb _h
 }
 
 Return<void> HalProxy::getSensorsList(ISensorsV2_0::getSensorsList_cb _hidl_cb) {
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
     std::vector<V1_0::SensorInfo> sensors;
     for (const auto& iter : mSensors) {
       if (iter.second.type != SensorType::HINGE_ANGLE) {
@@ -156,22 +210,27 @@ Return<void> HalProxy::getSensorsList(ISensorsV2_0::getSensorsList_cb _hidl_cb)
 }
 
 Return<Result> HalProxy::setOperationMode(OperationMode mode) {
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
+    std::lock_guard<std::mutex> lock(mOperationModeMutex);
+    std::vector<Result> results(mSubHalList.size(), Result::OK);
+    runOnEverySubHal("setOperationMode",
+                     [&](size_t i) { results[i] = mSubHalList[i]->setOperationMode(mode); });
+
     Result result = Result::OK;
-    size_t subHalIndex;
-    for (subHalIndex = 0; subHalIndex < mSubHalList.size(); subHalIndex++) {
-        result = mSubHalList[subHalIndex]->setOperationMode(mode);
-        if (result != Result::OK) {
-            ALOGE("setOperationMode failed for SubHal: %s",
-                  mSubHalList[subHalIndex]->getName().c_str());
-            break;
+    for (size_t i = 0; i < mSubHalList.size(); i++) {
+        if (results[i] != Result::OK) {
+            ALOGE("setOperationMode failed for SubHal: %s", mSubHalList[i]->getName().c_str());
+            result = results[i];
         }
     }
 
     if (result != Result::OK) {
         // Reset the subhal operation modes that have been flipped
-        for (size_t i = 0; i < subHalIndex; i++) {
-            mSubHalList[i]->setOperationMode(mCurrentOperationMode);
-        }
+        runOnEverySubHal("setOperationMode", [&](size_t i) {
+            if (results[i] == Result::OK) {
+                mSubHalList[i]->setOperationMode(mCurrentOperationMode.load());
+            }
+        });
     } else {
         mCurrentOperationMode = mode;
     }
@@ -179,11 +238,26 @@ Return<Result> HalProxy::setOperationMode(OperationMode mode) {
 }
 
 Return<Result> HalProxy::activate(int32_t sensorHandle, bool enabled) {
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
     if (!isSubHalIndexValid(sensorHandle)) {
         return Result::BAD_VALUE;
     }
-    return getSubHalForSensorHandle(sensorHandle)
-            ->activate(clearSubHalIndex(sensorHandle), enabled);
+    Result result;
+    if (mDirectChannels.isCopied(sensorHandle)) {
+        result = mDirectChannels.activateCopied(sensorHandle, enabled);
+    } else {
+        result = runSensorCall("activate", sensorHandle, [sensorHandle, enabled](auto subHal) {
+            return subHal->activate(clearSubHalIndex(sensorHandle), enabled);
+        });
+    }
+    if (!enabled && mThreadsRun.load()) {
+        // Deliver whatever the software FIFO still holds for the sensor.
+        std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
+        std::vector<Event> events;
+        mSoftwareBatcher.release(sensorHandle, &events);
+        writeEventsLocked(events, 0 /* numWakeupEvents */, 0 /* receivedNs */);
+    }
+    return result;
 }
 
 Return<Result> HalProxy::initialize_2_1(
@@ -196,14 +270,15 @@ Return<Result> HalProxy::initialize_2_1(
     // Create the Event FMQ from the eventQueueDescriptor. Reset the read/write positions.
     auto eventQueue =
             std::make_unique<EventMessageQueueV2_1>(eventQueueDescriptor, true /* resetPointers */);
-    std::unique_ptr<EventMessageQueueWrapperBase> queue =
-            std::make_unique<EventMessageQueueWrapperV2_1>(eventQueue);
+    std::unique_ptr<DirectEventMessageQueueWrapperBase> queue = std::make_unique<
+            DirectEventMessageQueueWrapper<V2_1::Event, EventMessageQueueV2_1>>(eventQueue);
 
     // Create the Wake Lock FMQ from the wakeLockDescriptor. Reset the read/write positions.
     auto hidlWakeLockQueue =
             std::make_unique<WakeLockMessageQueue>(wakeLockDescriptor, true /* resetPointers */);
-    std::unique_ptr<WakeLockMessageQueueWrapperBase> wakeLockQueue =
-            std::make_unique<WakeLockMessageQueueWrapperHidl>(hidlWakeLockQueue);
+    std::unique_ptr<DrainableWakeLockMessageQueueWrapperBase> wakeLockQueue = std::make_unique<
+            DrainableWakeLockMessageQueueWrapper<uint32_t, WakeLockMessageQueue>>(
+            hidlWakeLockQueue);
 
     return initializeCommon(queue, wakeLockQueue, dynamicCallback);
 }
@@ -218,70 +293,104 @@ Return<Result> HalProxy::initialize(
     // Create the Event FMQ from the eventQueueDescriptor. Reset the read/write positions.
     auto eventQueue =
             std::make_unique<EventMessageQueueV2_0>(eventQueueDescriptor, true /* resetPointers */);
-    std::unique_ptr<EventMessageQueueWrapperBase> queue =
-            std::make_unique<EventMessageQueueWrapperV1_0>(eventQueue);
+    std::unique_ptr<DirectEventMessageQueueWrapperBase> queue = std::make_unique<
+            DirectEventMessageQueueWrapper<V1_0::Event, EventMessageQueueV2_0>>(eventQueue);
 
     // Create the Wake Lock FMQ from the wakeLockDescriptor. Reset the read/write positions.
     auto hidlWakeLockQueue =
             std::make_unique<WakeLockMessageQueue>(wakeLockDescriptor, true /* resetPointers */);
-    std::unique_ptr<WakeLockMessageQueueWrapperBase> wakeLockQueue =
-            std::make_unique<WakeLockMessageQueueWrapperHidl>(hidlWakeLockQueue);
+    std::unique_ptr<DrainableWakeLockMessageQueueWrapperBase> wakeLockQueue = std::make_unique<
+            DrainableWakeLockMessageQueueWrapper<uint32_t, WakeLockMessageQueue>>(
+            hidlWakeLockQueue);
 
     return initializeCommon(queue, wakeLockQueue, dynamicCallback);
 }
 
 Return<Result> HalProxy::initializeCommon(
-        std::unique_ptr<EventMessageQueueWrapperBase>& eventQueue,
-        std::unique_ptr<WakeLockMessageQueueWrapperBase>& wakeLockQueue,
+        std::unique_ptr<DirectEventMessageQueueWrapperBase>& eventQueue,
+        std::unique_ptr<DrainableWakeLockMessageQueueWrapperBase>& wakeLockQueue,
         const sp<ISensorsCallbackWrapperBase>& sensorsCallback) {
     Result result = Result::OK;
 
+    waitForSensorList();
+    // Producers waiting for room in the pending events rings give up once the threads stop, so
+    // the calls they block finish and the lock below can be taken.
+    mThreadsRun.store(false);
+    { std::lock_guard<std::mutex> lock(mPendingWritesMutex); }
+    mPendingPriorityRoomCV.notify_all();
+    std::unique_lock<std::shared_mutex> callLock(mCallsMutex);
+
     stopThreads();
     resetSharedWakelock();
 
     // So that the pending write events queue can be cleared safely and when we start threads
     // again we do not get new events until after initialize resets the subhals.
+    mDirectChannels.releaseAllChannels();
     disableAllSensors();
 
-    // Clears the queue if any events were pending write before.
-    mPendingWriteEventsQueue = std::queue<std::pair<std::vector<V2_1::Event>, size_t>>();
-    mSizePendingWriteEventsQueue = 0;
-
-    // Clears previously connected dynamic sensors
-    mDynamicSensors.clear();
-
-    mDynamicSensorsCallback = sensorsCallback;
+    {
+        // Subhals may still post events, which must never see the queues being replaced.
+        std::lock_guard<std::mutex> eventQueueLock(mEventQueueWriteMutex);
+        std::lock_guard<std::recursive_mutex> wakelockLock(mWakelockMutex);
+
+        // Clears the ring and the software FIFOs if any events were pending write before.
+        mPendingPriorityWriteEvents.clear();
+        mPendingWriteEvents.clear();
+        mSoftwareBatcher.clear();
+        mWakelockAccounting.clearPendingWakeupEvents();
+
+        // Clears previously connected dynamic sensors
+        {
+            std::lock_guard<std::mutex> dynamicSensorsLock(mDynamicSensorsMutex);
+            for (const auto& sensorEntry : mDynamicSensors) {
+                mSensorInfoTable.erase(sensorEntry.first);
+                mEventFilters.erase(sensorEntry.first);
+            }
+            mDynamicSensors.clear();
+            mDynamicSensorsCallback = sensorsCallback;
+        }
 
-    // Create the Event FMQ from the eventQueueDescriptor. Reset the read/write positions.
-    mEventQueue = std::move(eventQueue);
+        // Create the Event FMQ from the eventQueueDescriptor. Reset the read/write positions.
+        mEventQueue = std::move(eventQueue);
 
-    // Create the Wake Lock FMQ that is used by the framework to communicate whenever WAKE_UP
-    // events have been successfully read and handled by the framework.
-    mWakeLockQueue = std::move(wakeLockQueue);
+        // Create the Wake Lock FMQ that is used by the framework to communicate whenever WAKE_UP
+        // events have been successfully read and handled by the framework.
+        mWakeLockQueue = std::move(wakeLockQueue);
 
-    if (mEventQueueFlag != nullptr) {
-        EventFlag::deleteEventFlag(&mEventQueueFlag);
-    }
-    if (mWakelockQueueFlag != nullptr) {
-        EventFlag::deleteEventFlag(&mWakelockQueueFlag);
-    }
-    if (EventFlag::createEventFlag(mEventQueue->getEventFlagWord(), &mEventQueueFlag) != OK) {
-        result = Result::BAD_VALUE;
-    }
-    if (EventFlag::createEventFlag(mWakeLockQueue->getEventFlagWord(), &mWakelockQueueFlag) != OK) {
-        result = Result::BAD_VALUE;
-    }
-    if (!mDynamicSensorsCallback || !mEventQueue || !mWakeLockQueue || mEventQueueFlag == nullptr) {
-        result = Result::BAD_VALUE;
+        if (mEventQueueFlag != nullptr) {
+            EventFlag::deleteEventFlag(&mEventQueueFlag);
+        }
+        if (mWakelockQueueFlag != nullptr) {
+            EventFlag::deleteEventFlag(&mWakelockQueueFlag);
+        }
+        if (EventFlag::createEventFlag(mEventQueue->getEventFlagWord(), &mEventQueueFlag) != OK) {
+            result = Result::BAD_VALUE;
+        }
+        if (EventFlag::createEventFlag(mWakeLockQueue->getEventFlagWord(),
+                                       &mWakelockQueueFlag) != OK) {
+            result = Result::BAD_VALUE;
+        }
+        if (!mDynamicSensorsCallback || !mEventQueue || !mWakeLockQueue ||
+            mEventQueueFlag == nullptr) {
+            result = Result::BAD_VALUE;
+        }
     }
 
     mThreadsRun.store(true);
 
     mPendingWritesThread = std::thread(startPendingWritesThread, this);
+    mSoftwareBatchThread = std::thread(startSoftwareBatchThread, this);
     mWakelockThread = std::thread(startWakelockThread, this);
-
+    applyThreadPolicies();
+
+    std::vector<Result> results(mSubHalList.size());
+    runOnEverySubHal("initialize", [&](size_t i) {
+        int64_t startTime = getTimeNow();
+        results[i] = mSubHalList[i]->initialize(this, mSubHalWakelockRefCounters[i].get(), i);
+        mSubHalTimings[i].initializeNs = getTimeNow() - startTime;
+    });
     for (size_t i = 0; i < mSubHalList.size(); i++) {
-        Result currRes = mSubHalList[i]->initialize(this, this, i);
+        Result currRes = results[i];
         if (currRes != Result::OK) {
             result = currRes;
             ALOGE("Subhal '%s' failed to initialize with reason %" PRId32 ".",
@@ -289,25 +398,48 @@ Return<Result> HalProxy::initializeCommon(
         }
     }
 
-    mCurrentOperationMode = OperationMode::NORMAL;
+    {
+        std::lock_guard<std::mutex> lock(mOperationModeMutex);
+        mCurrentOperationMode = OperationMode::NORMAL;
+    }
 
     return result;
 }
 
 Return<Result> HalProxy::batch(int32_t sensorHandle, int64_t samplingPeriodNs,
                                int64_t maxReportLatencyNs) {
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
     if (!isSubHalIndexValid(sensorHandle)) {
         return Result::BAD_VALUE;
     }
-    return getSubHalForSensorHandle(sensorHandle)
-            ->batch(clearSubHalIndex(sensorHandle), samplingPeriodNs, maxReportLatencyNs);
+    Result result;
+    if (mDirectChannels.isCopied(sensorHandle)) {
+        result = mDirectChannels.batchCopied(sensorHandle, samplingPeriodNs, maxReportLatencyNs);
+    } else {
+        result = runSensorCall("batch", sensorHandle, [=](auto subHal) {
+            return subHal->batch(clearSubHalIndex(sensorHandle), samplingPeriodNs,
+                                 maxReportLatencyNs);
+        });
+    }
+    if (result == Result::OK) {
+        std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
+        std::vector<Event> events;
+        mSoftwareBatcher.batch(sensorHandle, maxReportLatencyNs, &events);
+        if (mThreadsRun.load()) {
+            writeEventsLocked(events, 0 /* numWakeupEvents */, 0 /* receivedNs */);
+        }
+    }
+    return result;
 }
 
 Return<Result> HalProxy::flush(int32_t sensorHandle) {
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
     if (!isSubHalIndexValid(sensorHandle)) {
         return Result::BAD_VALUE;
     }
-    return getSubHalForSensorHandle(sensorHandle)->flush(clearSubHalIndex(sensorHandle));
+    return runSensorCall("flush", sensorHandle, [sensorHandle](auto subHal) {
+        return subHal->flush(clearSubHalIndex(sensorHandle));
+    });
 }
 
 Return<Result> HalProxy::injectSensorData_2_1(const V2_1::Event& event) {
@@ -315,6 +447,7 @@ Return<Result> HalProxy::injectSensorData_2_1(const V2_1::Event& event) {
 }
 
 Return<Result> HalProxy::injectSensorData(const V1_0::Event& event) {
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
     Result result = Result::OK;
     if (mCurrentOperationMode == OperationMode::NORMAL &&
         event.sensorType != V1_0::SensorType::ADDITIONAL_INFO) {
@@ -336,41 +469,64 @@ Return<Result> HalProxy::injectSensorData(const V1_0::Event& event) {
 
 Return<void> HalProxy::registerDirectChannel(const SharedMemInfo& mem,
                                              ISensorsV2_0::registerDirectChannel_cb _hidl_cb) {
-    if (mDirectChannelSubHal == nullptr) {
-        _hidl_cb(Result::INVALID_OPERATION, -1 /* channelHandle */);
-    } else {
-        mDirectChannelSubHal->registerDirectChannel(mem, _hidl_cb);
-    }
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
+    mDirectChannels.registerChannel(mem, _hidl_cb);
     return Return<void>();
 }
 
 Return<Result> HalProxy::unregisterDirectChannel(int32_t channelHandle) {
-    Result result;
-    if (mDirectChannelSubHal == nullptr) {
-        result = Result::INVALID_OPERATION;
-    } else {
-        result = mDirectChannelSubHal->unregisterDirectChannel(channelHandle);
-    }
-    return result;
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
+    return mDirectChannels.unregisterChannel(channelHandle);
 }
 
 Return<void> HalProxy::configDirectReport(int32_t sensorHandle, int32_t channelHandle,
                                           RateLevel rate,
                                           ISensorsV2_0::configDirectReport_cb _hidl_cb) {
-    if (mDirectChannelSubHal == nullptr) {
-        _hidl_cb(Result::INVALID_OPERATION, -1 /* reportToken */);
-    } else if (sensorHandle == -1 && rate != RateLevel::STOP) {
+    std::shared_lock<std::shared_mutex> callLock = enterCall();
+    if (sensorHandle == -1 && rate != RateLevel::STOP) {
         _hidl_cb(Result::BAD_VALUE, -1 /* reportToken */);
     } else {
-        // -1 denotes all sensors should be disabled
-        if (sensorHandle != -1) {
-            sensorHandle = clearSubHalIndex(sensorHandle);
-        }
-        mDirectChannelSubHal->configDirectReport(sensorHandle, channelHandle, rate, _hidl_cb);
+        mDirectChannels.configReport(sensorHandle, channelHandle, rate, _hidl_cb);
     }
     return Return<void>();
 }
 
+void HalProxy::applyThreadPolicies() {
+    std::lock_guard<std::mutex> lock(mThreadPolicyReportsMutex);
+    mThreadPolicyReports.clear();
+    if (mThreadPolicies.empty()) {
+        return;
+    }
+    auto apply = [this](const std::string& thread, const char* fallback, pthread_t handle) {
+        std::string report;
+        mThreadPolicies.apply(thread, fallback, handle, &report);
+        if (!report.empty()) {
+            mThreadPolicyReports.emplace_back(thread, std::move(report));
+        }
+    };
+    apply("pending_writes", nullptr, mPendingWritesThread.native_handle());
+    apply("software_batch", nullptr, mSoftwareBatchThread.native_handle());
+    apply("wakelock", nullptr, mWakelockThread.native_handle());
+    for (size_t i = 0; i < mSubHalExecutors.size(); i++) {
+        apply("subhal_executor:" + mSubHalList[i]->getName(), "subhal_executor",
+              mSubHalExecutors[i]->getNativeHandle());
+    }
+}
+
+HalProxy::EventPathStats HalProxy::getEventPathStats() {
+    EventPathStats stats;
+    {
+        std::lock_guard<std::mutex> lock(mDroppedEventsMutex);
+        for (const auto& [sensorHandle, count] : mDroppedEventCounts) {
+            stats.numDroppedEvents += count;
+        }
+    }
+    std::lock_guard<std::recursive_mutex> lock(mWakelockMutex);
+    stats.numWakelockAcquisitions = mNumWakelockAcquisitions;
+    stats.numWakelockReleases = mNumWakelockReleases;
+    return stats;
+}
+
 Return<void> HalProxy::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& args) {
     if (fd.getNativeHandle() == nullptr || fd->numFds < 1) {
         ALOGE("%s: missing fd for writing", __FUNCTION__);
@@ -378,8 +534,59 @@ Return<void> HalProxy::debug(const hidl_handle& fd, const hidl_vec<hidl_string>&
     }
 
     int writeFd = fd->data[0];
+    waitForSensorList();
+    // Exclusively, as it starts and stops the event trace and reads state calls change.
+    std::unique_lock<std::shared_mutex> callLock(mCallsMutex);
 
     std::ostringstream stream;
+    auto getSubHalName = [this](size_t i) { return mSubHalList[i]->getName(); };
+    if (std::find(args.begin(), args.end(), "--wakelock-stats") != args.end()) {
+        mWakelockAccounting.dumpCsv(stream, getSubHalName);
+        android::base::WriteStringToFd(stream.str(), writeFd);
+        return Return<void>();
+    }
+    if (std::find(args.begin(), args.end(), "--reset-latency") != args.end()) {
+        mFlightRecorder.resetLatency();
+        stream << "Latency histograms reset" << std::endl;
+        android::base::WriteStringToFd(stream.str(), writeFd);
+        return Return<void>();
+    }
+    if (args.size() > 0 && args[0] == "--trace-start") {
+        // Usage: --trace-start <path> [size in MB]
+        size_t sizeMb = args.size() > 2 ? strtoul(args[2].c_str(), nullptr, 0) : 0;
+        if (args.size() < 2 || args[1].size() == 0) {
+            stream << "Usage: --trace-start <path> [size in MB]" << std::endl;
+        } else if (startEventTrace(args[1], sizeMb > 0 ? sizeMb : kDefaultEventTraceSizeMb)) {
+            stream << "Tracing events to " << args[1] << std::endl;
+        } else {
+            stream << "Failed to start tracing events to " << args[1] << std::endl;
+        }
+        android::base::WriteStringToFd(stream.str(), writeFd);
+        return Return<void>();
+    }
+    if (std::find(args.begin(), args.end(), "--trace-stop") != args.end()) {
+        if (mEventTraceWriter.isActive()) {
+            mEventTraceWriter.stop();
+            stream << "Traced " << mEventTraceWriter.getNumRecords() << " events to "
+                   << mEventTraceWriter.getPath() << ", dropped "
+                   << mEventTraceWriter.getNumDropped() << std::endl;
+        } else {
+            stream << "No event trace is being captured" << std::endl;
+        }
+        android::base::WriteStringToFd(stream.str(), writeFd);
+        return Return<void>();
+    }
+    if (args.size() > 0 && args[0] == "--flight-recorder") {
+        // Any further arguments are the handles of the sensors to dump.
+        std::set<int32_t> sensorHandles;
+        for (size_t i = 1; i < args.size(); i++) {
+            sensorHandles.insert(static_cast<int32_t>(strtoul(args[i].c_str(), nullptr, 0)));
+        }
+        mFlightRecorder.dump(stream, sensorHandles);
+        android::base::WriteStringToFd(stream.str(), writeFd);
+        return Return<void>();
+    }
+
     stream << "===HalProxy===" << std::endl;
     stream << "Internal values:" << std::endl;
     stream << "  Threads are running: " << (mThreadsRun.load() ? "true" : "false") << std::endl;
@@ -388,21 +595,85 @@ Return<void> HalProxy::debug(const hidl_handle& fd, const hidl_vec<hidl_string>&
            << " ms ago" << std::endl;
     stream << "  Wakelock timeout reset time: " << msFromNs(now - mWakelockTimeoutResetTime)
            << " ms ago" << std::endl;
-    // TODO(b/142969448): Add logging for history of wakelock acquisition per subhal.
     stream << "  Wakelock ref count: " << mWakelockRefCount << std::endl;
-    stream << "  # of events on pending write writes queue: " << mSizePendingWriteEventsQueue
+    {
+        std::lock_guard<std::recursive_mutex> lock(mWakelockMutex);
+        stream << "  Wakelock release delay: " << msFromNs(mWakelockReleaseDelayNs) << " ms"
+               << std::endl;
+        stream << "  # of kernel wakelock acquisitions: " << mNumWakelockAcquisitions
+               << ", releases: " << mNumWakelockReleases
+               << ", releases avoided by the delay: " << mNumWakelockReleasesAvoided << std::endl;
+        stream << "  # of wake lock queue reads: " << mNumWakeLockQueueReads
+               << ", acknowledgements read: " << mNumWakeLockAcksRead << std::endl;
+    }
+    mWakelockAccounting.dump(stream, getSubHalName);
+    stream << "  # of events on pending write writes queue: " << mPendingWriteEvents.size()
            << std::endl;
     stream << " Most events seen on pending write events queue: "
            << mMostEventsObservedPendingWriteEventsQueue << std::endl;
-    if (!mPendingWriteEventsQueue.empty()) {
-        stream << "  Size of events list on front of pending writes queue: "
-               << mPendingWriteEventsQueue.front().first.size() << std::endl;
+    stream << "  Capacity of pending write events queue: " << mPendingWriteEvents.capacity()
+           << std::endl;
+    stream << "  # of events on pending priority write events queue: "
+           << mPendingPriorityWriteEvents.size() << std::endl;
+    stream << "  Capacity of pending priority write events queue: "
+           << mPendingPriorityWriteEvents.capacity() << std::endl;
+    stream << "  # of sensors batched in software: " << mSoftwareBatcher.getNumBatchedSensors()
+           << std::endl;
+    stream << "  Event coalescing window: " << mEventCoalesceWindowNs / 1000 << " us" << std::endl;
+    stream << "  Drop policy: "
+           << (mDropPolicy == DropPolicy::DECIMATE ? "decimate" : "newest") << std::endl;
+    {
+        std::lock_guard<std::mutex> lock(mDroppedEventsMutex);
+        std::vector<uint64_t> droppedPerSubHal(mSubHalList.size());
+        stream << "  Dropped events per sensor:" << std::endl;
+        for (const auto& [sensorHandle, count] : mDroppedEventCounts) {
+            stream << "    0x" << std::hex << sensorHandle << std::dec << ": " << count
+                   << std::endl;
+            size_t subHalIndex = extractSubHalIndex(sensorHandle);
+            if (subHalIndex < droppedPerSubHal.size()) {
+                droppedPerSubHal[subHalIndex] += count;
+            }
+        }
+        stream << "  Dropped events per subhal:" << std::endl;
+        for (size_t i = 0; i < mSubHalList.size(); i++) {
+            stream << "    " << mSubHalList[i]->getName() << ": " << droppedPerSubHal[i]
+                   << std::endl;
+        }
     }
     stream << "  # of non-dynamic sensors across all subhals: " << mSensors.size() << std::endl;
     stream << "  # of dynamic sensors across all subhals: " << mDynamicSensors.size() << std::endl;
+    stream << "  Startup time: " << msFromNs(mStartupTimeNs) << " ms" << std::endl;
+    stream << "  Sensor list served from cache: "
+           << (mSensorListCacheStale ? "false (stale)" : mSensorListFromCache ? "true" : "false")
+           << std::endl;
+    stream << "  Sensor fix-up rules: " << mFixupRules.size() << " (digest "
+           << mFixupRules.getDigest() << ")" << std::endl;
+    if (mEventTraceWriter.isActive()) {
+        stream << "  Tracing events to " << mEventTraceWriter.getPath() << ": "
+               << mEventTraceWriter.getNumRecords() << " traced, "
+               << mEventTraceWriter.getNumDropped() << " dropped" << std::endl;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mThreadPolicyReportsMutex);
+        stream << "  Thread policies:" << (mThreadPolicyReports.empty() ? " none" : "")
+               << std::endl;
+        for (const auto& [thread, report] : mThreadPolicyReports) {
+            stream << "    " << thread << ": " << report << std::endl;
+        }
+    }
+    mDirectChannels.dump(stream);
+    mFlightRecorder.dumpLatency(stream);
+    mFlightRecorder.dump(stream, {} /* sensorHandles */);
     stream << "SubHals (" << mSubHalList.size() << "):" << std::endl;
-    for (auto& subHal : mSubHalList) {
+    for (size_t i = 0; i < mSubHalList.size(); i++) {
+        const std::shared_ptr<ISubHalWrapperBase>& subHal = mSubHalList[i];
         stream << "  Name: " << subHal->getName() << std::endl;
+        stream << "  Load time: " << msFromNs(mSubHalTimings[i].loadNs) << " ms" << std::endl;
+        stream << "  getSensorsList time: " << msFromNs(mSubHalTimings[i].getSensorsListNs)
+               << " ms" << std::endl;
+        stream << "  Last initialize time: " << msFromNs(mSubHalTimings[i].initializeNs) << " ms"
+               << std::endl;
+        mSubHalExecutors[i]->dump(stream);
         stream << "  Debug dump: " << std::endl;
         android::base::WriteStringToFd(stream.str(), writeFd);
         subHal->debug(fd, args);
@@ -416,20 +687,30 @@ Return<void> HalProxy::debug(const hidl_handle& fd, const hidl_vec<hidl_string>&
 Return<void> HalProxy::onDynamicSensorsConnected(const hidl_vec<SensorInfo>& dynamicSensorsAdded,
                                                  int32_t subHalIndex) {
     std::vector<SensorInfo> sensors;
+    sp<ISensorsCallbackWrapperBase> callback;
     {
         std::lock_guard<std::mutex> lock(mDynamicSensorsMutex);
+        callback = mDynamicSensorsCallback;
         for (SensorInfo sensor : dynamicSensorsAdded) {
             if (!subHalIndexIsClear(sensor.sensorHandle)) {
                 ALOGE("Dynamic sensor added %s had sensorHandle with first byte not 0.",
                       sensor.name.c_str());
             } else {
                 sensor.sensorHandle = setSubHalIndex(sensor.sensorHandle, subHalIndex);
+                fixup::EventFilter filter;
+                if (!mFixupRules.apply(&sensor, &filter)) {
+                    ALOGI("Hiding dynamic sensor %s", sensor.name.c_str());
+                    continue;
+                }
                 mDynamicSensors[sensor.sensorHandle] = sensor;
+                if (!mSensorInfoTable.set(sensor, filter) && !filter.isNoOp()) {
+                    mEventFilters[sensor.sensorHandle] = filter;
+                }
                 sensors.push_back(sensor);
             }
         }
     }
-    mDynamicSensorsCallback->onDynamicSensorsConnected(sensors);
+    callback->onDynamicSensorsConnected(sensors);
     return Return<void>();
 }
 
@@ -437,8 +718,10 @@ Return<void> HalProxy::onDynamicSensorsDisconnected(
         const hidl_vec<int32_t>& dynamicSensorHandlesRemoved, int32_t subHalIndex) {
     // TODO(b/143302327): Block this call until all pending events are flushed from queue
     std::vector<int32_t> sensorHandles;
+    sp<ISensorsCallbackWrapperBase> callback;
     {
         std::lock_guard<std::mutex> lock(mDynamicSensorsMutex);
+        callback = mDynamicSensorsCallback;
         for (int32_t sensorHandle : dynamicSensorHandlesRemoved) {
             if (!subHalIndexIsClear(sensorHandle)) {
                 ALOGE("Dynamic sensorHandle removed had first byte not 0.");
@@ -446,89 +729,279 @@ Return<void> HalProxy::onDynamicSensorsDisconnected(
                 sensorHandle = setSubHalIndex(sensorHandle, subHalIndex);
                 if (mDynamicSensors.find(sensorHandle) != mDynamicSensors.end()) {
                     mDynamicSensors.erase(sensorHandle);
+                    mSensorInfoTable.erase(sensorHandle);
+                    mEventFilters.erase(sensorHandle);
                     sensorHandles.push_back(sensorHandle);
                 }
             }
         }
     }
-    mDynamicSensorsCallback->onDynamicSensorsDisconnected(sensorHandles);
+    callback->onDynamicSensorsDisconnected(sensorHandles);
     return Return<void>();
 }
 
-void HalProxy::initializeSubHalListFromConfigFile(const char* configFileName) {
+void HalProxy::readSubHalConfigFile(const char* configFileName,
+                                    std::vector<std::string>* subHalLibraryFiles) {
     std::ifstream subHalConfigStream(configFileName);
     if (!subHalConfigStream) {
         ALOGE("Failed to load subHal config file: %s", configFileName);
     } else {
         std::string subHalLibraryFile;
         while (subHalConfigStream >> subHalLibraryFile) {
-            void* handle = getHandleForSubHalSharedObject(subHalLibraryFile);
-            if (handle == nullptr) {
-                ALOGE("dlopen failed for library: %s", subHalLibraryFile.c_str());
-            } else {
-                SensorsHalGetSubHalFunc* sensorsHalGetSubHalPtr =
-                        (SensorsHalGetSubHalFunc*)dlsym(handle, "sensorsHalGetSubHal");
-                if (sensorsHalGetSubHalPtr != nullptr) {
-                    std::function<SensorsHalGetSubHalFunc> sensorsHalGetSubHal =
-                            *sensorsHalGetSubHalPtr;
-                    uint32_t version;
-                    ISensorsSubHalV2_0* subHal = sensorsHalGetSubHal(&version);
-                    if (version != SUB_HAL_2_0_VERSION) {
-                        ALOGE("SubHal version was not 2.0 for library: %s",
-                              subHalLibraryFile.c_str());
-                    } else {
-                        ALOGV("Loaded SubHal from library: %s", subHalLibraryFile.c_str());
-                        mSubHalList.push_back(std::make_unique<SubHalWrapperV2_0>(subHal));
-                    }
-                } else {
-                    SensorsHalGetSubHalV2_1Func* getSubHalV2_1Ptr =
-                            (SensorsHalGetSubHalV2_1Func*)dlsym(handle, "sensorsHalGetSubHal_2_1");
-
-                    if (getSubHalV2_1Ptr == nullptr) {
-                        ALOGE("Failed to locate sensorsHalGetSubHal function for library: %s",
-                              subHalLibraryFile.c_str());
-                    } else {
-                        std::function<SensorsHalGetSubHalV2_1Func> sensorsHalGetSubHal_2_1 =
-                                *getSubHalV2_1Ptr;
-                        uint32_t version;
-                        ISensorsSubHalV2_1* subHal = sensorsHalGetSubHal_2_1(&version);
-                        if (version != SUB_HAL_2_1_VERSION) {
-                            ALOGE("SubHal version was not 2.1 for library: %s",
-                                  subHalLibraryFile.c_str());
-                        } else {
-                            ALOGV("Loaded SubHal from library: %s", subHalLibraryFile.c_str());
-                            mSubHalList.push_back(std::make_unique<SubHalWrapperV2_1>(subHal));
-                        }
-                    }
-                }
-            }
+            subHalLibraryFiles->push_back(subHalLibraryFile);
+        }
+    }
+}
+
+void HalProxy::initializeSubHalList(const std::vector<std::string>& subHalLibraryFiles) {
+    std::vector<std::vector<std::shared_ptr<ISubHalWrapperBase>>> subHals(
+            subHalLibraryFiles.size());
+    std::vector<SensorListCache::LibraryKey> keys(subHalLibraryFiles.size());
+    std::vector<int64_t> loadTimes(subHalLibraryFiles.size());
+    std::atomic_bool allKeysFound = true;
+    runInParallel(subHalLibraryFiles.size(), [&](size_t i) {
+        int64_t startTime = getTimeNow();
+        bool keyFound = false;
+        subHals[i] = loadSubHal(subHalLibraryFiles[i], &keys[i], &keyFound);
+        loadTimes[i] = getTimeNow() - startTime;
+        if (!subHals[i].empty() && !keyFound) {
+            allKeysFound.store(false);
+        }
+    });
+    // Sub-HAL indices follow the config files regardless of which library loaded first.
+    for (size_t i = 0; i < subHals.size(); i++) {
+        for (std::shared_ptr<ISubHalWrapperBase>& subHal : subHals[i]) {
+            SubHalTiming timing;
+            timing.loadNs = loadTimes[i];
+            mSubHalList.push_back(std::move(subHal));
+            mSubHalTimings.push_back(timing);
+            mSubHalLibraryKeys.push_back(keys[i]);
+        }
+    }
+    if (!allKeysFound.load()) {
+        ALOGW("Not caching the sensor list, failed to identify every subhal library");
+        mSubHalLibraryKeys.clear();
+    }
+}
+
+std::vector<std::shared_ptr<ISubHalWrapperBase>> HalProxy::loadSubHal(
+        const std::string& subHalLibraryFile, SensorListCache::LibraryKey* key, bool* keyFound) {
+    void* handle = getHandleForSubHalSharedObject(subHalLibraryFile);
+    if (handle == nullptr) {
+        ALOGE("dlopen failed for library: %s", subHalLibraryFile.c_str());
+        return {};
+    }
+    SensorsHalGetSubHalFunc* sensorsHalGetSubHalPtr =
+            (SensorsHalGetSubHalFunc*)dlsym(handle, "sensorsHalGetSubHal");
+    if (sensorsHalGetSubHalPtr != nullptr) {
+        std::function<SensorsHalGetSubHalFunc> sensorsHalGetSubHal = *sensorsHalGetSubHalPtr;
+        uint32_t version;
+        ISensorsSubHalV2_0* subHal = sensorsHalGetSubHal(&version);
+        if (version != SUB_HAL_2_0_VERSION) {
+            ALOGE("SubHal version was not 2.0 for library: %s", subHalLibraryFile.c_str());
+            return {};
+        }
+        ALOGV("Loaded SubHal from library: %s", subHalLibraryFile.c_str());
+        *keyFound = SensorListCache::getLibraryKey(
+                reinterpret_cast<const void*>(sensorsHalGetSubHalPtr), key);
+        return {std::make_shared<SubHalWrapperV2_0>(subHal)};
+    }
+
+    SensorsHalGetSubHalsV2_1Func* getSubHalsV2_1Ptr =
+            (SensorsHalGetSubHalsV2_1Func*)dlsym(handle, "sensorsHalGetSubHals_2_1");
+    if (getSubHalsV2_1Ptr != nullptr) {
+        uint32_t version;
+        size_t count = 0;
+        ISensorsSubHalV2_1* const* subHals = getSubHalsV2_1Ptr(&version, &count);
+        if (version != SUB_HAL_2_1_VERSION) {
+            ALOGE("SubHal version was not 2.1 for library: %s", subHalLibraryFile.c_str());
+            return {};
+        }
+        ALOGV("Loaded %zu SubHals from library: %s", count, subHalLibraryFile.c_str());
+        *keyFound = SensorListCache::getLibraryKey(
+                reinterpret_cast<const void*>(getSubHalsV2_1Ptr), key);
+        std::vector<std::shared_ptr<ISubHalWrapperBase>> wrappers;
+        for (size_t i = 0; i < count; i++) {
+            wrappers.push_back(std::make_shared<SubHalWrapperV2_1>(subHals[i]));
         }
+        return wrappers;
     }
+
+    SensorsHalGetSubHalV2_1Func* getSubHalV2_1Ptr =
+            (SensorsHalGetSubHalV2_1Func*)dlsym(handle, "sensorsHalGetSubHal_2_1");
+    if (getSubHalV2_1Ptr == nullptr) {
+        ALOGE("Failed to locate sensorsHalGetSubHal function for library: %s",
+              subHalLibraryFile.c_str());
+        return {};
+    }
+    std::function<SensorsHalGetSubHalV2_1Func> sensorsHalGetSubHal_2_1 = *getSubHalV2_1Ptr;
+    uint32_t version;
+    ISensorsSubHalV2_1* subHal = sensorsHalGetSubHal_2_1(&version);
+    if (version != SUB_HAL_2_1_VERSION) {
+        ALOGE("SubHal version was not 2.1 for library: %s", subHalLibraryFile.c_str());
+        return {};
+    }
+    ALOGV("Loaded SubHal from library: %s", subHalLibraryFile.c_str());
+    *keyFound =
+            SensorListCache::getLibraryKey(reinterpret_cast<const void*>(getSubHalV2_1Ptr), key);
+    return {std::make_shared<SubHalWrapperV2_1>(subHal)};
 }
 
 void HalProxy::initializeSensorList() {
-    for (size_t subHalIndex = 0; subHalIndex < mSubHalList.size(); subHalIndex++) {
-        auto result = mSubHalList[subHalIndex]->getSensorsList([&](const auto& list) {
-            for (SensorInfo sensor : list) {
-                if (!subHalIndexIsClear(sensor.sensorHandle)) {
-                    ALOGE("SubHal sensorHandle's first byte was not 0");
-                } else {
-                    ALOGV("Loaded sensor: %s", sensor.name.c_str());
-                    sensor.sensorHandle = setSubHalIndex(sensor.sensorHandle, subHalIndex);
-                    setDirectChannelFlags(&sensor, mSubHalList[subHalIndex]);
-                    bool keep = patchXiaomiPickupSensor(sensor);
-                    if (!keep) {
-                        continue;
-                    }
+    SensorListCache::Contents contents;
+    bool cacheDisabled = false;
+    bool cacheHit = !mSubHalLibraryKeys.empty() &&
+                    mSensorListCache.load(mSubHalLibraryKeys, &contents, &cacheDisabled);
+    if (!cacheHit) {
+        collectSensorList(&contents, &mSubHalTimings);
+    }
+    mSensorListFromCache = cacheHit;
+    applySensorList(contents);
+
+    if (mSubHalLibraryKeys.empty() || cacheDisabled) {
+        return;
+    }
+    mSensorListCacheThread = std::thread([this, cacheHit, contents = std::move(contents)] {
+        if (!cacheHit) {
+            mSensorListCache.store(mSubHalLibraryKeys, contents);
+            return;
+        }
+        SensorListCache::Contents actualContents;
+        collectSensorList(&actualContents, nullptr /* timings */);
+        if (actualContents.sensors != contents.sensors ||
+            actualContents.eventFilters != contents.eventFilters ||
+            actualContents.copiedDirectSensors != contents.copiedDirectSensors) {
+            mSensorListCache.disable(mSubHalLibraryKeys);
+            mFreshSensorList = std::move(actualContents);
+            mSensorListCacheStale = true;
+            ALOGE("Sensor list cache %s was stale, disabled it", kSensorListCacheFile);
+        }
+    });
+}
 
-                    mSensors[sensor.sensorHandle] = sensor;
+void HalProxy::waitForSensorList() {
+    std::call_once(mSensorListVerified, [this] {
+        if (!mSensorListFromCache || !mSensorListCacheThread.joinable()) {
+            return;
+        }
+        mSensorListCacheThread.join();
+        if (mSensorListCacheStale) {
+            applySensorList(mFreshSensorList);
+            mFreshSensorList = {};
+        }
+    });
+}
+
+void HalProxy::applySensorList(const SensorListCache::Contents& contents) {
+    mSensors.clear();
+    mEventFilters.clear();
+    mSensorInfoTable.reset(mSubHalList.size());
+    mSoftwareBatcher.reset();
+    mDirectChannels.reset(
+            mSubHalList,
+            [this](size_t subHalIndex, const char* callName, const std::function<void()>& call) {
+                mSubHalExecutors[subHalIndex]->run(callName, call);
+            },
+            mDirectChannelMinPollNs);
+    std::set<int32_t> copiedDirectSensors(contents.copiedDirectSensors.begin(),
+                                          contents.copiedDirectSensors.end());
+    for (size_t i = 0; i < contents.sensors.size(); i++) {
+        SensorInfo sensor = contents.sensors[i];
+        const fixup::EventFilter& filter = contents.eventFilters[i];
+        mDirectChannels.addSensor(sensor, copiedDirectSensors.count(sensor.sensorHandle) != 0);
+        mSoftwareBatcher.addSensor(&sensor);
+        mSensors[sensor.sensorHandle] = sensor;
+        if (!mSensorInfoTable.set(sensor, filter) && !filter.isNoOp()) {
+            mEventFilters[sensor.sensorHandle] = filter;
+        }
+    }
+}
+
+std::string HalProxy::getSensorConfigDigest() const {
+    // Both the properties and the config files the subhals read decide which sensors they report.
+    static const char* kSensorPropertyPrefixes[] = {"ro.vendor.sensors.xiaomi.",
+                                                    "persist.vendor.sensors.xiaomi.",
+                                                    "vendor.sensors.xiaomi."};
+    static const char* kSensorConfigDirs[] = {"/vendor/etc/sensors", "/odm/etc/sensors"};
+
+    std::map<std::string, std::string> inputs;
+    property_list(
+            [](const char* key, const char* value, void* cookie) {
+                for (const char* prefix : kSensorPropertyPrefixes) {
+                    if (strncmp(key, prefix, strlen(prefix)) == 0) {
+                        (*static_cast<std::map<std::string, std::string>*>(cookie))[key] = value;
+                        break;
+                    }
                 }
+            },
+            &inputs);
+    for (const char* dirPath : kSensorConfigDirs) {
+        std::unique_ptr<DIR, decltype(&closedir)> dir(opendir(dirPath), closedir);
+        for (struct dirent* entry; dir != nullptr && (entry = readdir(dir.get())) != nullptr;) {
+            std::string path = std::string(dirPath) + "/" + entry->d_name;
+            std::string contents;
+            if (entry->d_type == DT_REG && base::ReadFileToString(path, &contents)) {
+                inputs[path] = std::move(contents);
             }
-        });
+        }
+    }
+
+    // FNV-1a like the fix-up rules digest, with each input delimited by its name.
+    uint64_t hash = 0xcbf29ce484222325;
+    auto update = [&hash](const std::string& text) {
+        // Including the terminating null.
+        for (size_t i = 0; i <= text.size(); i++) {
+            hash = (hash ^ static_cast<uint8_t>(text.c_str()[i])) * 0x100000001b3;
+        }
+    };
+    for (const auto& [name, value] : inputs) {
+        update(name);
+        update(value);
+    }
+    char digest[17];
+    snprintf(digest, sizeof(digest), "%016" PRIx64, hash);
+    return mFixupRules.getDigest() + " " + digest + (mDirectChannelCopy ? " direct-copy" : "");
+}
+
+void HalProxy::collectSensorList(SensorListCache::Contents* contents,
+                                 std::vector<SubHalTiming>* timings) {
+    std::vector<std::vector<SensorInfo>> subHalSensors(mSubHalList.size());
+    // Through the executors, so this never races control calls when verifying the cache.
+    runOnEverySubHal("getSensorsList", [&](size_t subHalIndex) {
+        int64_t startTime = getTimeNow();
+        auto result = mSubHalList[subHalIndex]->getSensorsList(
+                [&](const auto& list) { subHalSensors[subHalIndex] = list; });
+        if (timings != nullptr) {
+            (*timings)[subHalIndex].getSensorsListNs = getTimeNow() - startTime;
+        }
         if (!result.isOk()) {
             ALOGE("getSensorsList call failed for SubHal: %s",
                   mSubHalList[subHalIndex]->getName().c_str());
         }
+    });
+
+    // Merge in sub-HAL order so the sensor list is the same on every start.
+    contents->sensors.clear();
+    contents->eventFilters.clear();
+    contents->copiedDirectSensors.clear();
+    for (size_t subHalIndex = 0; subHalIndex < mSubHalList.size(); subHalIndex++) {
+        for (SensorInfo& sensor : subHalSensors[subHalIndex]) {
+            if (!subHalIndexIsClear(sensor.sensorHandle)) {
+                ALOGE("SubHal sensorHandle's first byte was not 0");
+            } else {
+                ALOGV("Loaded sensor: %s", sensor.name.c_str());
+                sensor.sensorHandle = setSubHalIndex(sensor.sensorHandle, subHalIndex);
+                fixup::EventFilter filter;
+                if (!mFixupRules.apply(&sensor, &filter)) {
+                    continue;
+                }
+                if (mDirectChannelCopy && DirectChannelMultiplexer::setCopiedFlags(&sensor)) {
+                    contents->copiedDirectSensors.push_back(sensor.sensorHandle);
+                }
+                contents->sensors.push_back(sensor);
+                contents->eventFilters.push_back(filter);
+            }
+        }
     }
 }
 
@@ -552,6 +1025,21 @@ void* HalProxy::getHandleForSubHalSharedObject(const std::string& filename) {
 }
 
 void HalProxy::init() {
+    mSubHalTimings.resize(mSubHalList.size());
+    for (size_t i = 0; i < mSubHalList.size(); i++) {
+        mSubHalWakelockRefCounters.push_back(new SubHalWakelockRefCounter(this, i));
+        mSubHalExecutors.push_back(std::make_unique<SubHalExecutor>(mSubHalList[i]->getName(),
+                                                                    mSubHalCallBudgetNs));
+    }
+    mWakelockAccounting.reset(mSubHalList.size());
+    mFixupRules.load();
+    if (!mSubHalLibraryKeys.empty()) {
+        // A changed config makes for a different sensor list just like subhals that changed.
+        SensorListCache::LibraryKey configKey;
+        configKey.path = "config";
+        configKey.buildId = getSensorConfigDigest();
+        mSubHalLibraryKeys.push_back(configKey);
+    }
     initializeSensorList();
 }
 
@@ -569,25 +1057,72 @@ void HalProxy::stopThreads() {
         mWakelockQueueFlag->wake(static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN));
     }
     mWakelockCV.notify_one();
-    mEventQueueWriteCV.notify_one();
+    notifyPendingWritesThread();
+    { std::lock_guard<std::mutex> lock(mPendingWritesMutex); }
+    mPendingPriorityRoomCV.notify_all();
+    mSoftwareBatcher.wakeUp();
     if (mPendingWritesThread.joinable()) {
         mPendingWritesThread.join();
     }
+    if (mSoftwareBatchThread.joinable()) {
+        mSoftwareBatchThread.join();
+    }
     if (mWakelockThread.joinable()) {
         mWakelockThread.join();
     }
 }
 
 void HalProxy::disableAllSensors() {
+    std::vector<std::vector<int32_t>> sensorHandles(mSubHalList.size());
     for (const auto& sensorEntry : mSensors) {
-        int32_t sensorHandle = sensorEntry.first;
-        activate(sensorHandle, false /* enabled */);
+        sensorHandles[extractSubHalIndex(sensorEntry.first)].push_back(sensorEntry.first);
     }
-    std::lock_guard<std::mutex> dynamicSensorsLock(mDynamicSensorsMutex);
-    for (const auto& sensorEntry : mDynamicSensors) {
-        int32_t sensorHandle = sensorEntry.first;
-        activate(sensorHandle, false /* enabled */);
+    {
+        std::lock_guard<std::mutex> dynamicSensorsLock(mDynamicSensorsMutex);
+        for (const auto& sensorEntry : mDynamicSensors) {
+            if (isSubHalIndexValid(sensorEntry.first)) {
+                sensorHandles[extractSubHalIndex(sensorEntry.first)].push_back(sensorEntry.first);
+            }
+        }
     }
+    // The threads are stopped, so there are no software batches to deliver.
+    runOnEverySubHal("disableAllSensors", [&](size_t i) {
+        for (int32_t sensorHandle : sensorHandles[i]) {
+            mSubHalList[i]->activate(clearSubHalIndex(sensorHandle), false /* enabled */);
+        }
+    });
+}
+
+void HalProxy::runOnEverySubHal(const char* callName, const std::function<void(size_t)>& task) {
+    std::vector<std::future<void>> futures;
+    for (size_t i = 0; i < mSubHalExecutors.size(); i++) {
+        futures.push_back(mSubHalExecutors[i]->post(callName, [&task, i] { task(i); }));
+    }
+    for (size_t i = 0; i < futures.size(); i++) {
+        mSubHalExecutors[i]->wait(futures[i]);
+    }
+}
+
+SubHalExecutor& HalProxy::getExecutorForSensorHandle(int32_t sensorHandle) {
+    return *mSubHalExecutors[extractSubHalIndex(sensorHandle)];
+}
+
+Result HalProxy::runSensorCall(const char* callName, int32_t sensorHandle,
+                               std::function<Result(ISubHalWrapperBase*)> call) {
+    // Shared with the call, which outlives this if it times out.
+    auto result = std::make_shared<Result>(Result::OK);
+    std::shared_ptr<ISubHalWrapperBase> subHal = getSubHalForSensorHandle(sensorHandle);
+    auto task = [result, subHal, call] { *result = call(subHal.get()); };
+    if (!getExecutorForSensorHandle(sensorHandle).runFor(callName, task, mSubHalCallTimeoutNs)) {
+        return Result::INVALID_OPERATION;
+    }
+    return *result;
+}
+
+std::shared_lock<std::shared_mutex> HalProxy::enterCall() {
+    // Before the lock, as the sensor list may be replaced, which initialize also waits for.
+    waitForSensorList();
+    return std::shared_lock<std::shared_mutex>(mCallsMutex);
 }
 
 void HalProxy::startPendingWritesThread(HalProxy* halProxy) {
@@ -595,44 +1130,211 @@ void HalProxy::startPendingWritesThread(HalProxy* halProxy) {
 }
 
 void HalProxy::handlePendingWrites() {
-    // TODO(b/143302327): Find a way to optimize locking strategy maybe using two mutexes instead of
-    // one.
-    std::unique_lock<std::mutex> lock(mEventQueueWriteMutex);
+    // Producers only write to the fmq themselves while both rings are empty, and the rings only
+    // become empty once the writes below have completed, so this thread can own the fmq writes
+    // without holding mEventQueueWriteMutex.
+    int64_t stallStartTime = 0;
     while (mThreadsRun.load()) {
-        mEventQueueWriteCV.wait(
-                lock, [&] { return !mPendingWriteEventsQueue.empty() || !mThreadsRun.load(); });
-        if (mThreadsRun.load()) {
-            std::vector<Event>& pendingWriteEvents = mPendingWriteEventsQueue.front().first;
-            size_t numWakeupEvents = mPendingWriteEventsQueue.front().second;
-            size_t eventQueueSize = mEventQueue->getQuantumCount();
-            size_t numToWrite = std::min(pendingWriteEvents.size(), eventQueueSize);
-            lock.unlock();
-            if (!mEventQueue->writeBlocking(
-                        pendingWriteEvents.data(), numToWrite,
-                        static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ),
-                        static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS),
-                        kPendingWriteTimeoutNs, mEventQueueFlag)) {
-                ALOGE("Dropping %zu events after blockingWrite failed.", numToWrite);
-                if (numWakeupEvents > 0) {
-                    if (pendingWriteEvents.size() > eventQueueSize) {
-                        decrementRefCountAndMaybeReleaseWakelock(
-                                countNumWakeupEvents(pendingWriteEvents, eventQueueSize));
-                    } else {
-                        decrementRefCountAndMaybeReleaseWakelock(numWakeupEvents);
-                    }
-                }
+        {
+            std::unique_lock<std::mutex> lock(mPendingWritesMutex);
+            bool wasEmpty = !hasPendingWriteEvents();
+            mPendingWritesThreadWaiting.store(true);
+            // Pairs with the fence in writeEventsLocked: either this thread sees the pushed
+            // events or the producer sees it waiting.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            mEventQueueWriteCV.wait(lock,
+                                    [&] { return hasPendingWriteEvents() || !mThreadsRun.load(); });
+            mPendingWritesThreadWaiting.store(false);
+            if (wasEmpty && mEventCoalesceWindowNs > 0) {
+                // Give other subhals a chance to post before waking the framework up.
+                mEventQueueWriteCV.wait_for(
+                        lock, std::chrono::nanoseconds(mEventCoalesceWindowNs),
+                        [&] { return mFlushPendingWrites.load() || !mThreadsRun.load(); });
             }
-            lock.lock();
-            mSizePendingWriteEventsQueue -= numToWrite;
-            if (pendingWriteEvents.size() > eventQueueSize) {
-                // TODO(b/143302327): Check if this erase operation is too inefficient. It will copy
-                // all the events ahead of it down to fill gap off array at front after the erase.
-                pendingWriteEvents.erase(pendingWriteEvents.begin(),
-                                         pendingWriteEvents.begin() + eventQueueSize);
-            } else {
-                mPendingWriteEventsQueue.pop();
+        }
+        mFlushPendingWrites.store(false);
+        if (!mThreadsRun.load()) {
+            break;
+        }
+        if (writePendingEventsNonBlocking() > 0) {
+            notifyPendingPriorityRoom();
+            stallStartTime = 0;
+            continue;
+        }
+        if (mEventQueue->availableToWrite() > 0) {
+            // A producer reserved slots but has not published them yet.
+            std::this_thread::yield();
+            continue;
+        }
+
+        // The fmq is full. Wait for the framework to read from it rather than blocking on a
+        // single write, so priority events that come in meanwhile still go out first.
+        int64_t now = getTimeNow();
+        if (stallStartTime == 0) {
+            stallStartTime = now;
+        } else if (now - stallStartTime >= kPendingWriteTimeoutNs) {
+            // Wakeup and one-shot events are never dropped, they wait for the framework to
+            // recover while the shared wakelock times out.
+            size_t numToDrop;
+            size_t numWakeupEvents;
+            int64_t* receivedNs;
+            const Event* eventsToDrop = mPendingWriteEvents.peek(
+                    mEventQueue->getQuantumCount(), &numToDrop, &numWakeupEvents, &receivedNs);
+            if (numToDrop > 0) {
+                ALOGE("Dropping %zu events after the event fmq stayed full.", numToDrop);
+                countDroppedEvents(eventsToDrop, numToDrop);
+                mPendingWriteEvents.pop(numToDrop);
+            }
+            stallStartTime = now;
+            continue;
+        }
+        uint32_t efState = 0;
+        mEventQueueFlag->wait(static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ), &efState,
+                              kPendingWriteTimeoutNs - (now - stallStartTime), true /* retry */);
+    }
+}
+
+void HalProxy::startSoftwareBatchThread(HalProxy* halProxy) {
+    halProxy->handleSoftwareBatches();
+}
+
+void HalProxy::handleSoftwareBatches() {
+    std::vector<Event> events;
+    while (mThreadsRun.load()) {
+        mSoftwareBatcher.waitForExpiredEvents(mThreadsRun);
+        if (!mThreadsRun.load()) {
+            break;
+        }
+        std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
+        events.clear();
+        mSoftwareBatcher.takeExpiredEvents(&events);
+        writeEventsLocked(events, 0 /* numWakeupEvents */, 0 /* receivedNs */);
+    }
+}
+
+size_t HalProxy::writePendingEventsNonBlocking() {
+    size_t numTaken = 0;
+    size_t numWritten = 0;
+    // The rings hand out runs up to their wrap point and the framework may read in between, so
+    // keep writing until either the fmq or both rings run dry. Priority events always go first.
+    size_t availableToWrite;
+    while ((availableToWrite = mEventQueue->availableToWrite()) > 0) {
+        size_t numPeeked;
+        size_t numWakeupEvents;
+        int64_t* receivedNs;
+        PendingEventRing* ring = &mPendingPriorityWriteEvents;
+        Event* pendingWriteEvents =
+                ring->peek(availableToWrite, &numPeeked, &numWakeupEvents, &receivedNs);
+        size_t numToWrite = numPeeked;
+        if (numPeeked == 0) {
+            ring = &mPendingWriteEvents;
+            pendingWriteEvents =
+                    ring->peek(availableToWrite, &numPeeked, &numWakeupEvents, &receivedNs);
+            numToWrite = numPeeked;
+            // Only events of non-wakeup continuous and on-change sensors are in this ring.
+            size_t ringSize = ring->size();
+            if (mDropPolicy == DropPolicy::DECIMATE && ringSize > ring->capacity() / 2) {
+                numToWrite = decimatePendingEvents(pendingWriteEvents, receivedNs, numPeeked,
+                                                   ringSize - ring->capacity() / 2);
+            }
+        }
+        if (numPeeked == 0 ||
+            (numToWrite > 0 && !mEventQueue->write(pendingWriteEvents, numToWrite))) {
+            break;
+        }
+        markEventsWritten(pendingWriteEvents, receivedNs, numToWrite);
+        ring->pop(numPeeked);
+        numTaken += numPeeked;
+        numWritten += numToWrite;
+    }
+    if (numWritten > 0) {
+        mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
+    }
+    return numTaken;
+}
+
+size_t HalProxy::decimatePendingEvents(Event* events, int64_t* receivedNs, size_t count,
+                                       size_t numToDrop) {
+    DecimationCandidate* candidates = mDecimationCandidates;
+    size_t numCandidates = 0;
+    auto findCandidate = [&](int32_t sensorHandle) -> DecimationCandidate* {
+        for (size_t i = 0; i < numCandidates; i++) {
+            if (candidates[i].sensorHandle == sensorHandle) {
+                return &candidates[i];
+            }
+        }
+        return nullptr;
+    };
+
+    // Each continuous sensor's share of the run is its share of the event rate filling the ring.
+    // Flush complete events must always reach the framework, so they are never counted.
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].sensorType == SensorType::META_DATA) {
+            continue;
+        }
+        DecimationCandidate* candidate = findCandidate(events[i].sensorHandle);
+        if (candidate != nullptr) {
+            candidate->numEvents++;
+        } else if (numCandidates < kMaxDecimatedSensors &&
+                   getSensorEntry(events[i].sensorHandle).isContinuous()) {
+            candidates[numCandidates++] = {events[i].sensorHandle, 1, 0, false, false};
+        }
+    }
+
+    // Decimate the fastest sensors until that frees enough of the ring, sparing slower ones.
+    size_t numDecimated = 0;
+    for (size_t numPlanned = 0; numPlanned < numToDrop;) {
+        DecimationCandidate* fastest = nullptr;
+        for (size_t i = 0; i < numCandidates; i++) {
+            if (!candidates[i].decimated &&
+                (fastest == nullptr || candidates[i].numEvents > fastest->numEvents)) {
+                fastest = &candidates[i];
+            }
+        }
+        if (fastest == nullptr || fastest->numEvents < 2) {
+            break;
+        }
+        fastest->decimated = true;
+        numPlanned += fastest->numEvents / 2;
+        numDecimated++;
+    }
+    if (numDecimated == 0) {
+        return count;
+    }
+
+    size_t numKept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (events[i].sensorType != SensorType::META_DATA) {
+            DecimationCandidate* candidate = findCandidate(events[i].sensorHandle);
+            if (candidate != nullptr && candidate->decimated) {
+                bool drop = candidate->dropNext;
+                candidate->dropNext = !drop;
+                if (drop) {
+                    candidate->numDropped++;
+                    continue;
+                }
             }
         }
+        if (numKept != i) {
+            events[numKept] = events[i];
+            receivedNs[numKept] = receivedNs[i];
+        }
+        numKept++;
+    }
+
+    std::lock_guard<std::mutex> lock(mDroppedEventsMutex);
+    for (size_t i = 0; i < numCandidates; i++) {
+        if (candidates[i].numDropped > 0) {
+            mDroppedEventCounts[candidates[i].sensorHandle] += candidates[i].numDropped;
+        }
+    }
+    return numKept;
+}
+
+void HalProxy::countDroppedEvents(const Event* events, size_t count) {
+    std::lock_guard<std::mutex> lock(mDroppedEventsMutex);
+    for (size_t i = 0; i < count; i++) {
+        mDroppedEventCounts[events[i].sensorHandle]++;
     }
 }
 
@@ -643,26 +1345,60 @@ void HalProxy::startWakelockThread(HalProxy* halProxy) {
 void HalProxy::handleWakelocks() {
     std::unique_lock<std::recursive_mutex> lock(mWakelockMutex);
     while (mThreadsRun.load()) {
-        mWakelockCV.wait(lock, [&] { return mWakelockRefCount > 0 || !mThreadsRun.load(); });
+        mWakelockCV.wait(lock, [&] {
+            return mWakelockRefCount > 0 || mWakelockReleasePending || !mThreadsRun.load();
+        });
         if (mThreadsRun.load()) {
             int64_t timeLeft;
-            if (sharedWakelockDidTimeout(&timeLeft)) {
+            if (mWakelockRefCount == 0) {
+                // Only the delayed release is left, unless a new wakeup event cancels it.
+                auto delay = std::chrono::nanoseconds(mWakelockReleaseDeadline - getTimeNow());
+                if (!mWakelockCV.wait_for(lock, delay, [&] {
+                        return mWakelockRefCount > 0 || !mThreadsRun.load();
+                    })) {
+                    mWakelockReleasePending = false;
+                    release_wake_lock(kWakelockName);
+                    mNumWakelockReleases++;
+                }
+            } else if (sharedWakelockDidTimeout(&timeLeft)) {
+                mWakelockAccounting.onTimeout(getTimeNow());
                 resetSharedWakelock();
             } else {
-                uint32_t numWakeLocksProcessed;
+                uint32_t numWakeLocksProcessed[kMaxWakeLockAcksPerRead];
                 lock.unlock();
-                bool success = mWakeLockQueue->readBlocking(
-                        &numWakeLocksProcessed, 1, 0,
-                        static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN), timeLeft);
+                if (mWakeLockQueue->availableToRead() == 0) {
+                    // Also woken by a release another thread delays, see releaseWakelockLocked().
+                    uint32_t efState = 0;
+                    mWakelockQueueFlag->wait(
+                            static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN) |
+                                    kWakelockReleasePendingBit,
+                            &efState, timeLeft, true /* retry */);
+                }
+                // Drain whatever the framework has acknowledged meanwhile.
+                size_t numRead =
+                        std::min(mWakeLockQueue->availableToRead(), kMaxWakeLockAcksPerRead);
+                if (numRead > 0 && !mWakeLockQueue->read(numWakeLocksProcessed, numRead)) {
+                    numRead = 0;
+                }
                 lock.lock();
-                if (success) {
-                    decrementRefCountAndMaybeReleaseWakelock(
-                            static_cast<size_t>(numWakeLocksProcessed));
+                if (numRead > 0) {
+                    size_t numAcked = 0;
+                    for (size_t i = 0; i < numRead; i++) {
+                        numAcked += numWakeLocksProcessed[i];
+                    }
+                    mNumWakeLockQueueReads++;
+                    mNumWakeLockAcksRead += numRead;
+                    decrementRefCountAndMaybeReleaseWakelock(numAcked);
                 }
             }
         }
     }
     resetSharedWakelock();
+    if (mWakelockReleasePending) {
+        mWakelockReleasePending = false;
+        release_wake_lock(kWakelockName);
+        mNumWakelockReleases++;
+    }
 }
 
 bool HalProxy::sharedWakelockDidTimeout(int64_t* timeLeft) {
@@ -683,35 +1419,249 @@ void HalProxy::resetSharedWakelock() {
     mWakelockTimeoutResetTime = getTimeNow();
 }
 
+void HalProxy::appendToEventTrace(const std::vector<Event>& events, int32_t subHalIndex) {
+    int64_t arrivalNs = elapsedRealtimeNano();
+    for (const Event& event : events) {
+        bool isWakeUp = getSensorEntry(setSubHalIndex(event.sensorHandle, subHalIndex)).isWakeUp();
+        mEventTraceWriter.append(event, subHalIndex, isWakeUp, arrivalNs);
+    }
+}
+
+bool HalProxy::startEventTrace(const std::string& path, size_t sizeMb) {
+    std::vector<trace::TraceSensor> sensors;
+    auto addSensor = [&sensors](const SensorInfo& sensor) {
+        trace::TraceSensor traceSensor = {};
+        traceSensor.sensorHandle = sensor.sensorHandle;
+        traceSensor.type = static_cast<int32_t>(sensor.type);
+        traceSensor.flags = sensor.flags;
+        traceSensor.minDelay = sensor.minDelay;
+        traceSensor.maxDelay = sensor.maxDelay;
+        traceSensor.maxRange = sensor.maxRange;
+        traceSensor.resolution = sensor.resolution;
+        traceSensor.power = sensor.power;
+        strlcpy(traceSensor.name, sensor.name.c_str(), sizeof(traceSensor.name));
+        strlcpy(traceSensor.typeAsString, sensor.typeAsString.c_str(),
+                sizeof(traceSensor.typeAsString));
+        sensors.push_back(traceSensor);
+    };
+    for (const auto& [sensorHandle, sensor] : mSensors) {
+        addSensor(sensor);
+    }
+    {
+        std::lock_guard<std::mutex> lock(mDynamicSensorsMutex);
+        for (const auto& [sensorHandle, sensor] : mDynamicSensors) {
+            addSensor(sensor);
+        }
+    }
+    size_t maxRecords = sizeMb * 1024 * 1024 / sizeof(trace::TraceRecord);
+    return mEventTraceWriter.start(path, maxRecords, sensors, elapsedRealtimeNano());
+}
+
 void HalProxy::postEventsToMessageQueue(const std::vector<Event>& events, size_t numWakeupEvents,
                                         V2_0::implementation::ScopedWakelock wakelock) {
-    size_t numToWrite = 0;
+    int64_t receivedNs = elapsedRealtimeNano();
+    for (const Event& event : events) {
+        mFlightRecorder.record(event, receivedNs, 0 /* writtenNs */);
+    }
     std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
-    if (wakelock.isLocked()) {
-        incrementRefCountAndMaybeAcquireWakelock(numWakeupEvents);
+    if (wakelock.isLocked() && incrementRefCountAndMaybeAcquireWakelock(numWakeupEvents) &&
+        numWakeupEvents > 0) {
+        int64_t now = getTimeNow();
+        for (const Event& event : events) {
+            if (isWakeUpSensor(event.sensorHandle)) {
+                mWakelockAccounting.onWakeupEventPosted(event.sensorHandle, now);
+            }
+        }
     }
-    if (mPendingWriteEventsQueue.empty()) {
+    if (mSoftwareBatcher.isActive()) {
+        // Filtering under the lock keeps released batches in order with newer events.
+        std::vector<Event> eventsToWrite;
+        mSoftwareBatcher.filter(events, &eventsToWrite);
+        writeEventsLocked(eventsToWrite, numWakeupEvents, receivedNs);
+    } else {
+        writeEventsLocked(events, numWakeupEvents, receivedNs);
+    }
+}
+
+void HalProxy::writeEventsLocked(const std::vector<Event>& events, size_t numWakeupEvents,
+                                 int64_t receivedNs) {
+    size_t numToWrite = 0;
+    // While coalescing, only wakeup events skip the pending writes thread.
+    if (!hasPendingWriteEvents() && (mEventCoalesceWindowNs == 0 || numWakeupEvents > 0)) {
         numToWrite = std::min(events.size(), mEventQueue->availableToWrite());
         if (numToWrite > 0) {
             if (mEventQueue->write(events.data(), numToWrite)) {
-                // TODO(b/143302327): While loop if mEventQueue->avaiableToWrite > 0 to possibly fit
-                // in more writes immediately
                 mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
+                int64_t writtenNs = elapsedRealtimeNano();
+                for (size_t i = 0; i < numToWrite; i++) {
+                    mFlightRecorder.markWritten(events[i], receivedNs, writtenNs);
+                }
             } else {
                 numToWrite = 0;
             }
         }
     }
-    size_t numLeft = events.size() - numToWrite;
-    if (numToWrite < events.size() &&
-        mSizePendingWriteEventsQueue + numLeft <= kMaxSizePendingWriteEventsQueue) {
-        std::vector<Event> eventsLeft(events.begin() + numToWrite, events.end());
-        mPendingWriteEventsQueue.push({eventsLeft, numWakeupEvents});
-        mSizePendingWriteEventsQueue += numLeft;
-        mMostEventsObservedPendingWriteEventsQueue =
-                std::max(mMostEventsObservedPendingWriteEventsQueue, mSizePendingWriteEventsQueue);
-        mEventQueueWriteCV.notify_one();
+    if (numToWrite == events.size()) {
+        return;
+    }
+
+    // Every event of a sensor goes to the same ring, which keeps each sensor's events in order.
+    bool pushedPriorityEvents = false;
+    size_t runStart = numToWrite;
+    bool runIsPriority = isPriorityEvent(events[runStart]);
+    for (size_t i = runStart + 1; i <= events.size(); i++) {
+        bool isPriority = i < events.size() && isPriorityEvent(events[i]);
+        if (i < events.size() && isPriority == runIsPriority) {
+            continue;
+        }
+        const Event* run = events.data() + runStart;
+        size_t runSize = i - runStart;
+        if (runIsPriority) {
+            pushPriorityEventsLocked(run, runSize, numWakeupEvents, receivedNs);
+            pushedPriorityEvents = true;
+        } else if (!mPendingWriteEvents.push(run, runSize, receivedNs,
+                                             [](const Event&) { return false; })) {
+            // Only non-wakeup continuous and on-change sensors are in this ring.
+            countDroppedEvents(run, runSize);
+        }
+        runStart = i;
+        runIsPriority = isPriority;
+    }
+
+    size_t numPending = mPendingPriorityWriteEvents.size() + mPendingWriteEvents.size();
+    mMostEventsObservedPendingWriteEventsQueue =
+            std::max(mMostEventsObservedPendingWriteEventsQueue, numPending);
+    bool flush = mEventCoalesceWindowNs > 0 &&
+                 (pushedPriorityEvents || numPending >= mEventQueue->getQuantumCount());
+    if (flush) {
+        if (!mFlushPendingWrites.exchange(true)) {
+            notifyPendingWritesThread();
+        }
+    } else {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (mPendingWritesThreadWaiting.load()) {
+            notifyPendingWritesThread();
+        }
+    }
+}
+
+void HalProxy::pushPriorityEventsLocked(const Event* events, size_t count,
+                                        size_t numWakeupEvents, int64_t receivedNs) {
+    auto isWakeUpEvent = [&](const Event& event) {
+        return numWakeupEvents > 0 && isWakeUpSensor(event.sensorHandle);
+    };
+    size_t capacity = mPendingPriorityWriteEvents.capacity();
+    while (count > 0) {
+        size_t chunkSize = std::min(count, capacity);
+        if (mPendingPriorityWriteEvents.push(events, chunkSize, receivedNs, isWakeUpEvent)) {
+            events += chunkSize;
+            count -= chunkSize;
+            continue;
+        }
+        if (!mThreadsRun.load()) {
+            // Nothing drains the ring anymore, the events are lost along with the fmq.
+            countDroppedEvents(events, count);
+            size_t numDroppedWakeupEvents = std::count_if(events, events + count, isWakeUpEvent);
+            if (numDroppedWakeupEvents > 0) {
+                decrementRefCountAndMaybeReleaseWakelock(numDroppedWakeupEvents);
+            }
+            return;
+        }
+
+        // Wait for the pending writes thread to make room rather than dropping the events. Bulk
+        // events never wait in this ring, so it only fills up while the framework stalls.
+        mNumPendingPriorityRoomWaiters++;
+        if (!mFlushPendingWrites.exchange(true)) {
+            notifyPendingWritesThread();
+        }
+        auto hasRoom = [&] {
+            return mPendingPriorityWriteEvents.size() + chunkSize <= capacity ||
+                   !mThreadsRun.load();
+        };
+        {
+            std::unique_lock<std::mutex> lock(mPendingWritesMutex);
+            mPendingPriorityRoomCV.wait_for(lock, std::chrono::nanoseconds(kPendingWriteTimeoutNs),
+                                            hasRoom);
+        }
+        mNumPendingPriorityRoomWaiters--;
+    }
+}
+
+void HalProxy::notifyPendingPriorityRoom() {
+    // Pairs with the increment in pushPriorityEventsLocked: either the producer sees the room
+    // made by the pops before this or this sees the producer waiting.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (mNumPendingPriorityRoomWaiters.load() > 0) {
+        { std::lock_guard<std::mutex> lock(mPendingWritesMutex); }
+        mPendingPriorityRoomCV.notify_all();
+    }
+}
+
+void HalProxy::markEventsWritten(const Event* events, const int64_t* receivedNs, size_t count) {
+    int64_t writtenNs = elapsedRealtimeNano();
+    for (size_t i = 0; i < count; i++) {
+        mFlightRecorder.markWritten(events[i], receivedNs[i], writtenNs);
+    }
+}
+
+bool HalProxy::isPriorityEvent(const Event& event) {
+    return getSensorEntry(event.sensorHandle).isPriority();
+}
+
+void HalProxy::notifyPendingWritesThread() {
+    // Taking the lock orders the notification after the pending writes thread's empty check, so
+    // it is not lost. The thread only holds the lock for that check, never while writing.
+    { std::lock_guard<std::mutex> lock(mPendingWritesMutex); }
+    mEventQueueWriteCV.notify_one();
+}
+
+bool HalProxy::postEventsDirect(const std::vector<Event>& events,
+                                const V2_0::implementation::HalProxyCallbackBase& callback,
+                                V2_0::implementation::ScopedWakelock& wakelock,
+                                size_t* numWakeupEvents) {
+    if (mEventCoalesceWindowNs > 0 || mSoftwareBatcher.isActive()) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mEventQueueWriteMutex);
+    if (hasPendingWriteEvents() || !mEventQueue->beginWrite(events.size())) {
+        return false;
+    }
+
+    size_t numToWrite = 0;
+    *numWakeupEvents = 0;
+    int64_t now = getTimeNow();
+    int64_t receivedNs = elapsedRealtimeNano();
+    for (const Event& event : events) {
+        Event processedEvent;
+        bool isWakeupEvent;
+        if (callback.processEvent(event, &processedEvent, &isWakeupEvent)) {
+            mEventQueue->setSlot(numToWrite++, processedEvent);
+            mFlightRecorder.record(processedEvent, receivedNs, receivedNs);
+            if (isWakeupEvent) {
+                (*numWakeupEvents)++;
+                if (wakelock.isLocked()) {
+                    mWakelockAccounting.onWakeupEventPosted(processedEvent.sensorHandle, now);
+                }
+            }
+        }
+    }
+
+    // The framework may ack wakeup events as soon as they are committed, so the ref count must
+    // already account for them.
+    if (wakelock.isLocked()) {
+        incrementRefCountAndMaybeAcquireWakelock(*numWakeupEvents);
+    }
+    if (numToWrite > 0) {
+        if (mEventQueue->commitWrite(numToWrite)) {
+            mEventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS));
+        } else {
+            ALOGE("Dropping %zu events after commitWrite failed.", numToWrite);
+            if (*numWakeupEvents > 0) {
+                decrementRefCountAndMaybeReleaseWakelock(*numWakeupEvents);
+            }
+        }
     }
+    return true;
 }
 
 bool HalProxy::incrementRefCountAndMaybeAcquireWakelock(size_t delta,
@@ -719,7 +1669,13 @@ bool HalProxy::incrementRefCountAndMaybeAcquireWakelock(size_t delta,
     if (!mThreadsRun.load()) return false;
     std::lock_guard<std::recursive_mutex> lockGuard(mWakelockMutex);
     if (mWakelockRefCount == 0) {
-        acquire_wake_lock(PARTIAL_WAKE_LOCK, kWakelockName);
+        if (mWakelockReleasePending) {
+            mWakelockReleasePending = false;
+            mNumWakelockReleasesAvoided++;
+        } else {
+            acquire_wake_lock(PARTIAL_WAKE_LOCK, kWakelockName);
+            mNumWakelockAcquisitions++;
+        }
         mWakelockCV.notify_one();
     }
     mWakelockTimeoutStartTime = getTimeNow();
@@ -738,27 +1694,50 @@ void HalProxy::decrementRefCountAndMaybeReleaseWakelock(size_t delta,
         ALOGE("Decrementing wakelock ref count by %zu when count is %zu",
               delta, mWakelockRefCount);
     }
+    bool isWakeupEventAck = timeoutStart == -1;
     if (timeoutStart == -1) timeoutStart = mWakelockTimeoutResetTime;
     if (mWakelockRefCount == 0 || timeoutStart < mWakelockTimeoutResetTime) return;
     mWakelockRefCount -= std::min(mWakelockRefCount, delta);
+    if (isWakeupEventAck) {
+        mWakelockAccounting.onWakeupEventsHandled(delta, getTimeNow());
+    }
     if (mWakelockRefCount == 0) {
+        releaseWakelockLocked();
+    }
+}
+
+void HalProxy::releaseWakelockLocked() {
+    if (mWakelockReleaseDelayNs == 0) {
         release_wake_lock(kWakelockName);
+        mNumWakelockReleases++;
+        return;
+    }
+    // The wakelock thread releases it once the deadline passes.
+    mWakelockReleasePending = true;
+    mWakelockReleaseDeadline = getTimeNow() + mWakelockReleaseDelayNs;
+    mWakelockCV.notify_one();
+    if (std::this_thread::get_id() != mWakelockThread.get_id() && mWakelockQueueFlag != nullptr) {
+        // The wakelock thread may be waiting for acks that will not come until the next event.
+        mWakelockQueueFlag->wake(kWakelockReleasePendingBit);
     }
 }
 
-void HalProxy::setDirectChannelFlags(SensorInfo* sensorInfo,
-                                     std::shared_ptr<ISubHalWrapperBase> subHal) {
-    bool sensorSupportsDirectChannel =
-            (sensorInfo->flags & (V1_0::SensorFlagBits::MASK_DIRECT_REPORT |
-                                  V1_0::SensorFlagBits::MASK_DIRECT_CHANNEL)) != 0;
-    if (mDirectChannelSubHal == nullptr && sensorSupportsDirectChannel) {
-        mDirectChannelSubHal = subHal;
-    } else if (mDirectChannelSubHal != nullptr && subHal != mDirectChannelSubHal) {
-        // disable direct channel capability for sensors in subHals that are not
-        // the only one we will enable
-        sensorInfo->flags &= ~(V1_0::SensorFlagBits::MASK_DIRECT_REPORT |
-                               V1_0::SensorFlagBits::MASK_DIRECT_CHANNEL);
+bool HalProxy::SubHalWakelockRefCounter::incrementRefCountAndMaybeAcquireWakelock(
+        size_t delta, int64_t* timeoutStart /* = nullptr */) {
+    if (!mHalProxy->incrementRefCountAndMaybeAcquireWakelock(delta, timeoutStart)) {
+        return false;
+    }
+    mHalProxy->mWakelockAccounting.onScopedWakelockAcquired(mSubHalIndex);
+    return true;
+}
+
+void HalProxy::SubHalWakelockRefCounter::decrementRefCountAndMaybeReleaseWakelock(
+        size_t delta, int64_t timeoutStart /* = -1 */) {
+    if (timeoutStart != -1) {
+        mHalProxy->mWakelockAccounting.onScopedWakelockReleased(mSubHalIndex,
+                                                                getTimeNow() - timeoutStart);
     }
+    mHalProxy->decrementRefCountAndMaybeReleaseWakelock(delta, timeoutStart);
 }
 
 std::shared_ptr<ISubHalWrapperBase> HalProxy::getSubHalForSensorHandle(int32_t sensorHandle) {
@@ -769,15 +1748,32 @@ bool HalProxy::isSubHalIndexValid(int32_t sensorHandle) {
     return extractSubHalIndex(sensorHandle) < mSubHalList.size();
 }
 
-size_t HalProxy::countNumWakeupEvents(const std::vector<Event>& events, size_t n) {
-    size_t numWakeupEvents = 0;
-    for (size_t i = 0; i < n; i++) {
-        int32_t sensorHandle = events[i].sensorHandle;
-        if (mSensors[sensorHandle].flags & static_cast<uint32_t>(V1_0::SensorFlagBits::WAKE_UP)) {
-            numWakeupEvents++;
+bool HalProxy::isWakeUpSensor(int32_t sensorHandle) {
+    return getSensorEntry(sensorHandle).isWakeUp();
+}
+
+SensorInfoTable::Entry HalProxy::getSensorEntry(int32_t sensorHandle) {
+    SensorInfoTable::Entry entry;
+    if (mSensorInfoTable.find(sensorHandle, &entry)) {
+        return entry;
+    }
+
+    // Sensors that do not fit in the table are rare enough to be looked up in the maps.
+    std::lock_guard<std::mutex> lock(mDynamicSensorsMutex);
+    auto sensor = mSensors.find(sensorHandle);
+    if (sensor == mSensors.end()) {
+        sensor = mDynamicSensors.find(sensorHandle);
+        if (sensor == mDynamicSensors.end()) {
+            return entry;
         }
     }
-    return numWakeupEvents;
+    entry.flags = sensor->second.flags;
+    entry.type = sensor->second.type;
+    auto filter = mEventFilters.find(sensorHandle);
+    if (filter != mEventFilters.end()) {
+        entry.filter = filter->second;
+    }
+    return entry;
 }
 
 int32_t HalProxy::clearSubHalIndex(int32_t sensorHandle) {
@@ -0,0 +1,848 @@
+/*
+ * Copyright (C) 2019 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "DirectChannelMultiplexer.h"
+#include "DirectEventMessageQueueWrapper.h"
+#include "DrainableWakeLockMessageQueueWrapper.h"
+#include "EventTrace.h"
+#include "FlightRecorder.h"
+#include "HalProxyCallback.h"
+#include "ISensorsCallbackWrapper.h"
+#include "PendingEventRing.h"
+#include "SensorListCache.h"
+#include "SensorInfoTable.h"
+#include "SoftwareBatcher.h"
+#include "SubHalExecutor.h"
+#include "SubHalWrapper.h"
+#include "ThreadPolicy.h"
+#include "V2_0/ScopedWakelock.h"
+#include "V2_0/SubHal.h"
+#include "V2_1/SubHal.h"
+#include "WakeLockMessageQueueWrapper.h"
+#include "WakelockAccounting.h"
+#include "convertV2_1.h"
+
+#include <android/hardware/sensors/2.1/ISensors.h>
+#include <android/hardware/sensors/2.1/types.h>
+#include <fmq/MessageQueue.h>
+#include <hardware_legacy/power.h>
+#include <hidl/MQDescriptor.h>
+#include <hidl/Status.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+using ::android::sp;
+using ::android::hardware::EventFlag;
+using ::android::hardware::hidl_handle;
+using ::android::hardware::hidl_string;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::MessageQueue;
+using ::android::hardware::MQDescriptor;
+using ::android::hardware::Return;
+using ::android::hardware::Void;
+
+/**
+ * Optional entry point of a 2.1 subhal library providing several independent subhals, each with
+ * its own sub-HAL index. sensorsHalGetSubHal_2_1 is ignored when a library provides it.
+ *
+ * @param version Set to SUB_HAL_2_1_VERSION.
+ * @param count Set to the number of subhals.
+ *
+ * @return The subhals, valid as long as the library stays loaded.
+ */
+using SensorsHalGetSubHalsV2_1Func = V2_1::implementation::ISensorsSubHal* const*(uint32_t* version,
+                                                                                 size_t* count);
+
+class HalProxy : public V2_0::implementation::IScopedWakelockRefCounter,
+                 public V2_0::implementation::ISubHalCallback {
+  public:
+    using Event = ::android::hardware::sensors::V2_1::Event;
+    using OperationMode = ::android::hardware::sensors::V1_0::OperationMode;
+    using RateLevel = ::android::hardware::sensors::V1_0::RateLevel;
+    using Result = ::android::hardware::sensors::V1_0::Result;
+    using SensorInfo = ::android::hardware::sensors::V2_1::SensorInfo;
+    using SensorType = ::android::hardware::sensors::V2_1::SensorType;
+    using SharedMemInfo = ::android::hardware::sensors::V1_0::SharedMemInfo;
+    using ISensorsSubHalV2_0 = V2_0::implementation::ISensorsSubHal;
+    using ISensorsSubHalV2_1 = V2_1::implementation::ISensorsSubHal;
+    using ISensorsV2_0 = V2_0::ISensors;
+    using ISensorsV2_1 = V2_1::ISensors;
+
+    explicit HalProxy();
+    // Test only constructor.
+    explicit HalProxy(std::vector<ISensorsSubHalV2_0*>& subHalList);
+    explicit HalProxy(std::vector<ISensorsSubHalV2_0*>& subHalList,
+                      std::vector<ISensorsSubHalV2_1*>& subHalListV2_1);
+    ~HalProxy();
+
+    // Methods from ::android::hardware::sensors::V2_1::ISensors follow.
+    Return<void> getSensorsList_2_1(ISensorsV2_1::getSensorsList_2_1_cb _hidl_cb);
+
+    Return<Result> initialize_2_1(
+            const ::android::hardware::MQDescriptorSync<V2_1::Event>& eventQueueDescriptor,
+            const ::android::hardware::MQDescriptorSync<uint32_t>& wakeLockDescriptor,
+            const sp<V2_1::ISensorsCallback>& sensorsCallback);
+
+    Return<Result> injectSensorData_2_1(const Event& event);
+
+    // Methods from ::android::hardware::sensors::V2_0::ISensors follow.
+    Return<void> getSensorsList(ISensorsV2_0::getSensorsList_cb _hidl_cb);
+
+    Return<Result> setOperationMode(OperationMode mode);
+
+    Return<Result> activate(int32_t sensorHandle, bool enabled);
+
+    Return<Result> initialize(
+            const ::android::hardware::MQDescriptorSync<V1_0::Event>& eventQueueDescriptor,
+            const ::android::hardware::MQDescriptorSync<uint32_t>& wakeLockDescriptor,
+            const sp<V2_0::ISensorsCallback>& sensorsCallback);
+
+    Return<Result> initializeCommon(
+            std::unique_ptr<DirectEventMessageQueueWrapperBase>& eventQueue,
+            std::unique_ptr<DrainableWakeLockMessageQueueWrapperBase>& wakeLockQueue,
+            const sp<ISensorsCallbackWrapperBase>& sensorsCallback);
+
+    Return<Result> batch(int32_t sensorHandle, int64_t samplingPeriodNs,
+                         int64_t maxReportLatencyNs);
+
+    Return<Result> flush(int32_t sensorHandle);
+
+    Return<Result> injectSensorData(const V1_0::Event& event);
+
+    Return<void> registerDirectChannel(const SharedMemInfo& mem,
+                                       ISensorsV2_0::registerDirectChannel_cb _hidl_cb);
+
+    Return<Result> unregisterDirectChannel(int32_t channelHandle);
+
+    Return<void> configDirectReport(int32_t sensorHandle, int32_t channelHandle, RateLevel rate,
+                                    ISensorsV2_0::configDirectReport_cb _hidl_cb);
+
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& args);
+
+    Return<void> onDynamicSensorsConnected(const hidl_vec<SensorInfo>& dynamicSensorsAdded,
+                                           int32_t subHalIndex) override;
+
+    Return<void> onDynamicSensorsDisconnected(const hidl_vec<int32_t>& dynamicSensorHandlesRemoved,
+                                              int32_t subHalIndex) override;
+
+    void postEventsToMessageQueue(const std::vector<Event>& events, size_t numWakeupEvents,
+                                  V2_0::implementation::ScopedWakelock wakelock) override;
+
+    bool postEventsDirect(const std::vector<Event>& events,
+                          const V2_0::implementation::HalProxyCallbackBase& callback,
+                          V2_0::implementation::ScopedWakelock& wakelock,
+                          size_t* numWakeupEvents) override;
+
+    void traceEvents(const std::vector<Event>& events, int32_t subHalIndex) override {
+        if (mEventTraceWriter.isActive()) {
+            appendToEventTrace(events, subHalIndex);
+        }
+    }
+
+    bool copyEventToDirectChannels(const Event& event) override {
+        return !mDirectChannels.isCopying() || mDirectChannels.copyEvent(event);
+    }
+
+    SensorInfoTable::Entry getSensorEntry(int32_t sensorHandle) override;
+
+    bool areThreadsRunning() override { return mThreadsRun.load(); }
+
+    // Below methods are from IScopedWakelockRefCounter interface
+    bool incrementRefCountAndMaybeAcquireWakelock(size_t delta,
+                                                  int64_t* timeoutStart = nullptr) override;
+
+    void decrementRefCountAndMaybeReleaseWakelock(size_t delta, int64_t timeoutStart = -1) override;
+
+    //! The sensor list the framework gets, once it is known not to be stale.
+    const std::map<int32_t, SensorInfo>& getSensors() {
+        waitForSensorList();
+        return mSensors;
+    }
+
+    //! Counters of the event path since the HalProxy was created.
+    struct EventPathStats {
+        uint64_t numDroppedEvents = 0;
+        uint64_t numWakelockAcquisitions = 0;
+        uint64_t numWakelockReleases = 0;
+    };
+
+    EventPathStats getEventPathStats();
+
+  private:
+    using EventMessageQueueV2_1 = MessageQueue<V2_1::Event, kSynchronizedReadWrite>;
+    using EventMessageQueueV2_0 = MessageQueue<V1_0::Event, kSynchronizedReadWrite>;
+    using WakeLockMessageQueue = MessageQueue<uint32_t, kSynchronizedReadWrite>;
+
+    /**
+     * The Event FMQ where sensor events are written
+     */
+    std::unique_ptr<DirectEventMessageQueueWrapperBase> mEventQueue;
+
+    /**
+     * The Wake Lock FMQ that is read to determine when the framework has handled WAKE_UP events
+     */
+    std::unique_ptr<DrainableWakeLockMessageQueueWrapperBase> mWakeLockQueue;
+
+    /**
+     * Event Flag to signal to the framework when sensor events are available to be read and to
+     * interrupt event queue blocking write.
+     */
+    EventFlag* mEventQueueFlag = nullptr;
+
+    //! Event Flag to signal internally that the wakelock queue should stop its blocking read.
+    EventFlag* mWakelockQueueFlag = nullptr;
+
+    /**
+     * Callback to the sensors framework to inform it that new sensors have been added or removed.
+     */
+    sp<ISensorsCallbackWrapperBase> mDynamicSensorsCallback;
+
+    /**
+     * SubHal objects that have been saved from vendor dynamic libraries.
+     */
+    std::vector<std::shared_ptr<ISubHalWrapperBase>> mSubHalList;
+
+    //! How long each step of bringing up a subhal took, in nanoseconds, for debug purposes.
+    struct SubHalTiming {
+        int64_t loadNs = 0;
+        int64_t getSensorsListNs = 0;
+        int64_t initializeNs = 0;
+    };
+
+    //! The timing of each subhal, indexed like mSubHalList.
+    std::vector<SubHalTiming> mSubHalTimings;
+
+    //! The default of ro.vendor.sensors.xiaomi.multihal.subhal_call_budget_ms.
+    static constexpr int64_t kDefaultSubHalCallBudgetMs = 500;
+
+    //! How long a control call to a subhal may take before it is flagged.
+    int64_t mSubHalCallBudgetNs = kDefaultSubHalCallBudgetMs * 1000000;
+
+    //! The default of ro.vendor.sensors.xiaomi.multihal.subhal_call_timeout_ms.
+    static constexpr int64_t kDefaultSubHalCallTimeoutMs = 10000;
+
+    //! How long a sensor control call waits for its subhal before failing.
+    int64_t mSubHalCallTimeoutNs = kDefaultSubHalCallTimeoutMs * 1000000;
+
+    /**
+     * Binder calls come in on several threads. Calls resetting the HalProxy, initialize and debug,
+     * hold it exclusively, every other one shared.
+     */
+    std::shared_mutex mCallsMutex;
+
+    //! The executor running the control calls of each subhal, indexed like mSubHalList.
+    std::vector<std::unique_ptr<SubHalExecutor>> mSubHalExecutors;
+
+    //! The scheduling policies of the HalProxy threads.
+    ThreadPolicies mThreadPolicies;
+
+    //! The mutex protecting mThreadPolicyReports.
+    std::mutex mThreadPolicyReportsMutex;
+
+    //! What was applied to each thread with a policy, for debug purposes.
+    std::vector<std::pair<std::string, std::string>> mThreadPolicyReports;
+
+    //! How long the HalProxy constructor took to load all subhals and their sensors.
+    int64_t mStartupTimeNs = 0;
+
+    //! The file caching the sensor list across restarts.
+    static constexpr char kSensorListCacheFile[] = "/data/vendor/sensors/multihal_sensors.cache";
+
+    //! The sensor list cache, used only when the subhals were loaded from config files.
+    SensorListCache mSensorListCache{kSensorListCacheFile};
+
+    /**
+     * The key of each subhal library indexed like mSubHalList followed by a key of the sensor
+     * config, see getSensorConfigDigest(), or empty to skip the cache.
+     */
+    std::vector<SensorListCache::LibraryKey> mSubHalLibraryKeys;
+
+    //! The rules fixing up the sensors of the subhals.
+    fixup::SensorFixupRules mFixupRules;
+
+    //! The thread verifying or writing the sensor list cache in the background.
+    std::thread mSensorListCacheThread;
+
+    //! Whether the sensor list was read from the sensor list cache.
+    bool mSensorListFromCache = false;
+
+    //! Whether the sensor list read from the cache turned out to differ from the subhals' lists.
+    std::atomic<bool> mSensorListCacheStale = false;
+
+    //! The sensor list of the subhals, set by mSensorListCacheThread if the cache was stale.
+    SensorListCache::Contents mFreshSensorList;
+
+    //! Guards waiting for the cached sensor list to be verified.
+    std::once_flag mSensorListVerified;
+
+    /**
+     * Map of sensor handles to SensorInfo objects that contains the sensor info from subhals as
+     * well as the modified sensor handle for the framework.
+     *
+     * The subhal index is encoded in the first byte of the sensor handle and the remaining
+     * bytes are generated by the subhal to identify the sensor.
+     */
+    std::map<int32_t, SensorInfo> mSensors;
+
+    //! Map of the dynamic sensors that have been added to halproxy.
+    std::map<int32_t, SensorInfo> mDynamicSensors;
+
+    //! Per event lookup table of both the static and the dynamic sensors.
+    SensorInfoTable mSensorInfoTable;
+
+    /**
+     * The event filters of the sensors mSensorInfoTable could not store, protected by
+     * mDynamicSensorsMutex.
+     */
+    std::map<int32_t, fixup::EventFilter> mEventFilters;
+
+    //! The mutex serializing operation mode changes, which may come from several binder threads.
+    std::mutex mOperationModeMutex;
+
+    //! The current operation mode for all subhals, only changed with mOperationModeMutex held.
+    std::atomic<OperationMode> mCurrentOperationMode = OperationMode::NORMAL;
+
+    //! The direct channels of the framework, multiplexed across the subhals.
+    DirectChannelMultiplexer mDirectChannels;
+
+    //! Whether to copy events of subhals into direct channels, see setCopiedFlags().
+    bool mDirectChannelCopy = false;
+
+    //! The default of ro.vendor.sensors.xiaomi.multihal.direct_channel_min_poll_us.
+    static constexpr int64_t kDefaultDirectChannelMinPollUs = 1000;
+
+    /**
+     * The shortest period private direct channels of subhals are copied into the framework's
+     * channels at, which otherwise follows the fastest report in them.
+     */
+    int64_t mDirectChannelMinPollNs = kDefaultDirectChannelMinPollUs * 1000;
+
+    //! The timeout for each pending write on background thread for events.
+    static const int64_t kPendingWriteTimeoutNs = 5 * INT64_C(1000000000) /* 5 seconds */;
+
+    //! The bit mask used to get the subhal index from a sensor handle.
+    static constexpr int32_t kSensorHandleSubHalIndexMask = 0xFF000000;
+
+    //! The max number of events allowed in the pending write events queue
+    static constexpr size_t kMaxSizePendingWriteEventsQueue = 100000;
+
+    //! The max number of events allowed in the pending priority write events queue
+    static constexpr size_t kMaxSizePendingPriorityWriteEventsQueue = 10000;
+
+    /**
+     * A fixed capacity ring of events, each tagged with whether it is a wakeup event, which are
+     * waiting to be written to the events fmq in the background thread.
+     */
+    PendingEventRing mPendingWriteEvents{kMaxSizePendingWriteEventsQueue};
+
+    /**
+     * Like mPendingWriteEvents, but for events of wakeup, one-shot and special sensors, which are
+     * always written to the events fmq before any event of mPendingWriteEvents.
+     */
+    PendingEventRing mPendingPriorityWriteEvents{kMaxSizePendingPriorityWriteEventsQueue};
+
+    //! The most events observed on the pending write events queue for debug purposes.
+    size_t mMostEventsObservedPendingWriteEventsQueue = 0;
+
+    //! How events are chosen to be dropped when the pending write events queue backs up.
+    enum class DropPolicy {
+        //! Only drop new events that do not fit in the queue anymore.
+        DROP_NEWEST,
+        /**
+         * Additionally drop every other event of the fastest continuous sensors from the oldest
+         * pending events while the queue is more than half full.
+         */
+        DECIMATE,
+    };
+
+    //! The drop policy, set by ro.vendor.sensors.xiaomi.multihal.drop_policy.
+    DropPolicy mDropPolicy = DropPolicy::DECIMATE;
+
+    //! The last events of every sensor, for debug purposes.
+    FlightRecorder mFlightRecorder;
+
+    //! The default size of an event trace started without one, in megabytes.
+    static constexpr size_t kDefaultEventTraceSizeMb = 64;
+
+    //! The event trace being captured, started and stopped through debug().
+    trace::EventTraceWriter mEventTraceWriter;
+
+    //! The mutex protecting mDroppedEventCounts.
+    std::mutex mDroppedEventsMutex;
+
+    //! The number of events dropped for each sensor handle for debug purposes.
+    std::map<int32_t, uint64_t> mDroppedEventCounts;
+
+    //! The most distinct continuous sensors decimatePendingEvents() ranks in a single run.
+    static constexpr size_t kMaxDecimatedSensors = 64;
+
+    //! A continuous sensor of the run of pending events being decimated.
+    struct DecimationCandidate {
+        int32_t sensorHandle;
+        size_t numEvents;
+        size_t numDropped;
+        bool decimated;
+        //! Whether the next event of the sensor is dropped.
+        bool dropNext;
+    };
+
+    //! Scratch space of decimatePendingEvents(), only used by the pending writes thread.
+    DecimationCandidate mDecimationCandidates[kMaxDecimatedSensors];
+
+    /**
+     * The condition variable producers wait on, with mPendingWritesMutex, for room in
+     * mPendingPriorityWriteEvents.
+     */
+    std::condition_variable mPendingPriorityRoomCV;
+
+    //! The number of producers waiting on mPendingPriorityRoomCV.
+    std::atomic<size_t> mNumPendingPriorityRoomWaiters = 0;
+
+    /**
+     * The mutex serializing producers writing to the fmq or pushing to the pending events ring.
+     * The pending writes thread never takes it, so producers never wait behind its writes.
+     */
+    std::mutex mEventQueueWriteMutex;
+
+    //! The mutex the pending writes thread holds only while checking for and sleeping on events.
+    std::mutex mPendingWritesMutex;
+
+    //! The condition variable waiting on pending write events to stack up
+    std::condition_variable mEventQueueWriteCV;
+
+    //! Whether the pending writes thread may be sleeping on mEventQueueWriteCV.
+    std::atomic_bool mPendingWritesThreadWaiting = false;
+
+    /**
+     * How long the pending writes thread waits for more batches after the first one arrives, so
+     * they can be written to the fmq with a single wake of the framework. 0 disables coalescing.
+     */
+    int64_t mEventCoalesceWindowNs = 0;
+
+    //! Whether the pending writes thread must stop coalescing and write out events right away.
+    std::atomic_bool mFlushPendingWrites = false;
+
+    //! The thread object ref of the thread writing pending events to fmq
+    std::thread mPendingWritesThread;
+
+    //! The software FIFOs of sensors whose subhal has no hardware FIFO.
+    SoftwareBatcher mSoftwareBatcher;
+
+    //! The thread object ref of the thread releasing software batches when their latency expires
+    std::thread mSoftwareBatchThread;
+
+    //! The bool indicating whether to end the threads started in initialize
+    std::atomic_bool mThreadsRun = true;
+
+    //! The mutex protecting access to the dynamic sensors added and removed methods.
+    std::mutex mDynamicSensorsMutex;
+
+    // WakelockRefCount membar vars below
+
+    //! The mutex protecting the wakelock refcount and subsequent wakelock releases and
+    //! acquisitions
+    std::recursive_mutex mWakelockMutex;
+
+    std::condition_variable_any mWakelockCV;
+
+    //! The refcount of how many ScopedWakelocks and pending wakeup events are active
+    size_t mWakelockRefCount = 0;
+
+    int64_t mWakelockTimeoutStartTime = V2_0::implementation::getTimeNow();
+
+    int64_t mWakelockTimeoutResetTime = V2_0::implementation::getTimeNow();
+
+    std::thread mWakelockThread;
+
+    const char* kWakelockName = "SensorsHAL_WAKEUP";
+
+    //! The most wakelock acknowledgements handled per read of the wake lock FMQ.
+    static constexpr size_t kMaxWakeLockAcksPerRead = 64;
+
+    //! The default of ro.vendor.sensors.xiaomi.multihal.wakelock_release_delay_ms.
+    static constexpr int64_t kDefaultWakelockReleaseDelayMs = 0;
+
+    /**
+     * The wake lock FMQ event flag bit, next to those of WakeLockQueueFlagBits, waking the
+     * wakelock thread up for a release delayed by another thread.
+     */
+    static constexpr uint32_t kWakelockReleasePendingBit = 1 << 1;
+
+    //! How long the kernel wakelock is kept after the ref count drops to zero, 0 to release it
+    //! immediately. A wakeup event arriving meanwhile then needs no new acquisition.
+    int64_t mWakelockReleaseDelayNs = 0;
+
+    //! Whether the kernel wakelock is held only until mWakelockReleaseDeadline.
+    bool mWakelockReleasePending = false;
+
+    int64_t mWakelockReleaseDeadline = 0;
+
+    //! Counters of the kernel wakelock and wake lock FMQ activity, for debug purposes.
+    uint64_t mNumWakelockAcquisitions = 0;
+    uint64_t mNumWakelockReleases = 0;
+    uint64_t mNumWakelockReleasesAvoided = 0;
+    uint64_t mNumWakeLockQueueReads = 0;
+    uint64_t mNumWakeLockAcksRead = 0;
+
+    /**
+     * The ref counter handed to one subhal, which forwards to the HalProxy and charges the
+     * subhal's scoped wakelocks to it in mWakelockAccounting.
+     */
+    class SubHalWakelockRefCounter : public V2_0::implementation::IScopedWakelockRefCounter {
+      public:
+        SubHalWakelockRefCounter(HalProxy* halProxy, size_t subHalIndex)
+            : mHalProxy(halProxy), mSubHalIndex(subHalIndex) {}
+
+        bool incrementRefCountAndMaybeAcquireWakelock(size_t delta,
+                                                      int64_t* timeoutStart = nullptr) override;
+
+        void decrementRefCountAndMaybeReleaseWakelock(size_t delta,
+                                                      int64_t timeoutStart = -1) override;
+
+      private:
+        HalProxy* mHalProxy;
+        size_t mSubHalIndex;
+    };
+
+    //! The ref counter of each subhal, indexed like mSubHalList.
+    std::vector<sp<SubHalWakelockRefCounter>> mSubHalWakelockRefCounters;
+
+    //! Who held the shared wakelock and for how long, per subhal and per sensor.
+    WakelockAccounting mWakelockAccounting;
+
+    /**
+     * Read the names of the dynamic libraries listed in a config file.
+     *
+     * @param configFileName The config file to read.
+     * @param subHalLibraryFiles Appended with the library names, in order.
+     */
+    void readSubHalConfigFile(const char* configFileName,
+                              std::vector<std::string>* subHalLibraryFiles);
+
+    /**
+     * Initialize the list of SubHal objects in mSubHalList by loading dynamic libraries in
+     * parallel, keeping the order in which they are listed.
+     *
+     * @param subHalLibraryFiles The library names to load.
+     */
+    void initializeSubHalList(const std::vector<std::string>& subHalLibraryFiles);
+
+    /**
+     * Load a dynamic library and get the subhals it provides, usually one.
+     *
+     * @param subHalLibraryFile The library name.
+     * @param key Set to the key identifying the library for the sensor list cache.
+     * @param keyFound Set to whether key could be set.
+     *
+     * @return The subhals, empty if loading failed.
+     */
+    std::vector<std::shared_ptr<ISubHalWrapperBase>> loadSubHal(
+            const std::string& subHalLibraryFile, SensorListCache::LibraryKey* key,
+            bool* keyFound);
+
+    /**
+     * Initialize the list of SensorInfo objects in mSensorList from the sensor list cache, or by
+     * getting sensors from each subhal. A cached list is verified in the background until
+     * waitForSensorList() is called.
+     */
+    void initializeSensorList();
+
+    /**
+     * Wait for the cached sensor list to be verified and replace it with the subhals' lists if
+     * it was stale, so the framework never sees a stale list. Called before any sensor is
+     * reported to the framework or any subhal is initialized, which also keeps getSensorsList
+     * the first call every subhal gets.
+     */
+    void waitForSensorList();
+
+    //! Set up mSensors and every table derived from the sensor list from contents.
+    void applySensorList(const SensorListCache::Contents& contents);
+
+    /**
+     * Get a digest of every input other than the subhal libraries deciding the sensor list: the
+     * fix-up rules, the direct channel config, the sensor properties and the sensor config files.
+     */
+    std::string getSensorConfigDigest() const;
+
+    /**
+     * Get the sensors of every subhal in parallel and merge them as reported to the framework.
+     *
+     * @param contents Set to the merged sensor list.
+     * @param timings If not null, updated with the time each subhal took.
+     */
+    void collectSensorList(SensorListCache::Contents* contents,
+                           std::vector<SubHalTiming>* timings);
+
+    /**
+     * Try using the default include directories as well as the directories defined in
+     * kSubHalShareObjectLocations to get a handle for dlsym for a subhal.
+     *
+     * @param filename The file name to search for.
+     *
+     * @return The handle or nullptr if search failed.
+     */
+    void* getHandleForSubHalSharedObject(const std::string& filename);
+
+    /**
+     * Calls the helper methods that all ctors use.
+     */
+    void init();
+
+    /**
+     * Stops all threads by setting the threads running flag to false and joining to them.
+     */
+    void stopThreads();
+
+    /**
+     * Disable all the sensors observed by the HalProxy, on every subhal in parallel.
+     */
+    void disableAllSensors();
+
+    /**
+     * Run task on the executor of every subhal in parallel and wait for all of them to finish.
+     *
+     * @param callName The name of the call, for logs.
+     * @param task The task to run, given the subhal index.
+     */
+    void runOnEverySubHal(const char* callName, const std::function<void(size_t)>& task);
+
+    //! Get the executor of the subhal a sensor handle belongs to. The handle must be valid.
+    SubHalExecutor& getExecutorForSensorHandle(int32_t sensorHandle);
+
+    /**
+     * Run a control call for a sensor on its subhal's executor, giving up after
+     * mSubHalCallTimeoutNs.
+     *
+     * @param callName The name of the call, for logs.
+     * @param sensorHandle The valid sensor handle.
+     * @param call The call, given the subhal. It may run after this returned.
+     *
+     * @return The result of the call, or INVALID_OPERATION if it timed out.
+     */
+    Result runSensorCall(const char* callName, int32_t sensorHandle,
+                         std::function<Result(ISubHalWrapperBase*)> call);
+
+    /**
+     * Enter a binder call other than initialize and debug, waiting for the sensor list to be
+     * verified first.
+     *
+     * @return The lock to hold for the duration of the call.
+     */
+    std::shared_lock<std::shared_mutex> enterCall();
+
+    /**
+     * Starts the thread that handles pending writes to event fmq.
+     *
+     * @param halProxy The HalProxy object pointer.
+     */
+    static void startPendingWritesThread(HalProxy* halProxy);
+
+    //! Handles the pending writes on events to eventqueue.
+    void handlePendingWrites();
+
+    //! Wake the pending writes thread up if it may be sleeping.
+    void notifyPendingWritesThread();
+
+    /**
+     * Write as many pending events as the event fmq has room for without blocking, waking the
+     * framework up once for all of them.
+     *
+     * @return The number of events taken off the pending write events rings, including those
+     *    dropped by the drop policy.
+     */
+    size_t writePendingEventsNonBlocking();
+
+    /**
+     * Drop every other event of the continuous sensors with the most events in a run of pending
+     * events, the fastest first, until that drops numToDrop events or every continuous sensor of
+     * the run is decimated. Kept events are moved to the front of the run. Only the first
+     * kMaxDecimatedSensors continuous sensors of the run are candidates, so that it never
+     * allocates.
+     *
+     * @param events The run of events to decimate in place.
+     * @param receivedNs The receive times of the run, decimated along with it.
+     * @param count The number of events in the run.
+     * @param numToDrop The number of events to drop to bring the ring back to half full.
+     *
+     * @return The number of events kept.
+     */
+    size_t decimatePendingEvents(Event* events, int64_t* receivedNs, size_t count,
+                                 size_t numToDrop);
+
+    //! Account for count events dropped before reaching the event fmq.
+    void countDroppedEvents(const Event* events, size_t count);
+
+    /**
+     * Push a run of priority events to mPendingPriorityWriteEvents, waiting for the pending writes
+     * thread to make room if it is full, so that wakeup and one-shot events are never dropped.
+     * Events are only dropped if the threads are stopped meanwhile. mEventQueueWriteMutex must
+     * be held, which holds other producers back as well while the ring is full.
+     *
+     * @param events The run of priority events.
+     * @param count The number of events in the run.
+     * @param numWakeupEvents The number of wakeup events in the batch the run is part of.
+     * @param receivedNs When the HalProxy received the events.
+     */
+    void pushPriorityEventsLocked(const Event* events, size_t count, size_t numWakeupEvents,
+                                  int64_t receivedNs);
+
+    //! Wake producers waiting for room in mPendingPriorityWriteEvents up, if there are any.
+    void notifyPendingPriorityRoom();
+
+    //! Mark events received at receivedNs as written to the event fmq in the flight recorder.
+    void markEventsWritten(const Event* events, const int64_t* receivedNs, size_t count);
+
+    /**
+     * Write events to the event fmq, or to the pending events rings if the fmq has no room for
+     * them, waiting for room in the priority ring if needed. mEventQueueWriteMutex must be held.
+     *
+     * @param events The events to write.
+     * @param numWakeupEvents The number of wakeup events in events.
+     * @param receivedNs When the HalProxy received events, or 0 for events released from
+     *    software FIFOs, whose wait was asked for by the framework.
+     */
+    void writeEventsLocked(const std::vector<Event>& events, size_t numWakeupEvents,
+                           int64_t receivedNs);
+
+    //! Whether either pending write events ring holds any event.
+    bool hasPendingWriteEvents() const {
+        return !mPendingPriorityWriteEvents.empty() || !mPendingWriteEvents.empty();
+    }
+
+    /**
+     * Check whether event comes from a sensor whose events go to mPendingPriorityWriteEvents.
+     *
+     * @param event The event to check.
+     *
+     * @return true if the sensor is a wakeup, one-shot or special sensor.
+     */
+    bool isPriorityEvent(const Event& event);
+
+    //! Apply mThreadPolicies to the HalProxy threads and the subhal executors.
+    void applyThreadPolicies();
+
+    //! Append events posted by a subhal to the event trace being captured.
+    void appendToEventTrace(const std::vector<Event>& events, int32_t subHalIndex);
+
+    /**
+     * Start capturing an event trace of every static and dynamic sensor.
+     *
+     * @param path The trace file to write.
+     * @param sizeMb The size of the trace file, in megabytes.
+     *
+     * @return false if a trace is already being captured or the file could not be created.
+     */
+    bool startEventTrace(const std::string& path, size_t sizeMb);
+
+    /**
+     * Starts the thread that releases software batches once their max report latency expires.
+     *
+     * @param halProxy The HalProxy object pointer.
+     */
+    static void startSoftwareBatchThread(HalProxy* halProxy);
+
+    //! Handles releasing expired software batches.
+    void handleSoftwareBatches();
+
+    /**
+     * Starts the thread that handles decrementing the ref count on wakeup events processed by the
+     * framework and timing out wakelocks.
+     *
+     * @param halProxy The HalProxy object pointer.
+     */
+    static void startWakelockThread(HalProxy* halProxy);
+
+    //! Handles the wakelocks.
+    void handleWakelocks();
+
+    /**
+     * @param timeLeft The variable that should be set to the timeleft before timeout will occur or
+     * unmodified if timeout occurred.
+     *
+     * @return true if the shared wakelock has been held passed the timeout and should be released
+     */
+    bool sharedWakelockDidTimeout(int64_t* timeLeft);
+
+    /**
+     * Reset all the member variables associated with the wakelock ref count and maybe release
+     * the shared wakelock.
+     */
+    void resetSharedWakelock();
+
+    //! Release the kernel wakelock, now or after mWakelockReleaseDelayNs. Requires mWakelockMutex.
+    void releaseWakelockLocked();
+
+    /*
+     * Get the subhal pointer which can be found by indexing into the mSubHalList vector
+     * using the index from the first byte of sensorHandle.
+     *
+     * @param sensorHandle The handle used to identify a sensor in one of the subhals.
+     */
+    std::shared_ptr<ISubHalWrapperBase> getSubHalForSensorHandle(int32_t sensorHandle);
+
+    /**
+     * Checks that sensorHandle's subhal index byte is within bounds of mSubHalList.
+     *
+     * @param sensorHandle The sensor handle to check.
+     *
+     * @return true if sensorHandles's subhal index byte is valid.
+     */
+    bool isSubHalIndexValid(int32_t sensorHandle);
+
+    /**
+     * Check whether the sensor behind sensorHandle is a wakeup sensor.
+     *
+     * @param sensorHandle The sensor handle to check.
+     *
+     * @return true if the sensor has the WAKE_UP flag set.
+     */
+    bool isWakeUpSensor(int32_t sensorHandle);
+
+    /*
+     * Clear out the subhal index bytes from a sensorHandle.
+     *
+     * @param sensorHandle The sensor handle to modify.
+     *
+     * @return The modified version of the sensor handle.
+     */
+    static int32_t clearSubHalIndex(int32_t sensorHandle);
+
+    /**
+     * @param sensorHandle The sensor handle to modify.
+     *
+     * @return true if subHalIndex byte of sensorHandle is zeroed.
+     */
+    static bool subHalIndexIsClear(int32_t sensorHandle);
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
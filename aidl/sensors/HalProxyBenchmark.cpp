@@ -0,0 +1,322 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Runs a HalProxy on the subhal libraries given on the command line, standing in for the sensors
+ * framework on the other end of the FMQs, and reports the throughput, latency and CPU cost per
+ * event. Paired with the replay subhal, this benchmarks the HalProxy without real sensors.
+ *
+ * Usage: sensors.xiaomi.multihal-benchmark [--subhal <library>]... [--duration <seconds>]
+ *                                          [--fmq-size <events>[,<events>]...]
+ *                                          [--sampling-period-us <us>] [--latency-ms <ms>]
+ *
+ * Every sensor, including dynamic sensors as they connect, is enabled at the given sampling period,
+ * or its min delay. With several FMQ sizes, the HalProxy is initialized again for each of them,
+ * like it is when the sensors framework restarts. CPU time includes the subhals generating events.
+ * A library providing several subhals, like the load generator with several instances, adds all of
+ * them.
+ */
+
+#include "HalProxy.h"
+#include "LatencyHistogram.h"
+
+#include <android/hardware/sensors/2.1/ISensorsCallback.h>
+#include <fmq/MessageQueue.h>
+#include <utils/SystemClock.h>
+
+#include <dlfcn.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using ::android::sp;
+using ::android::hardware::EventFlag;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
+using ::android::hardware::Return;
+using ::android::hardware::Void;
+using ::android::hardware::sensors::V1_0::SensorFlagBits;
+using ::android::hardware::sensors::V2_0::EventQueueFlagBits;
+using ::android::hardware::sensors::V2_0::WakeLockQueueFlagBits;
+using ::android::hardware::sensors::V2_1::Event;
+using ::android::hardware::sensors::V2_1::ISensorsCallback;
+using ::android::hardware::sensors::V2_1::SensorInfo;
+using ::android::hardware::sensors::V2_1::SensorType;
+using ::android::hardware::sensors::V2_1::implementation::HalProxy;
+using ::android::hardware::sensors::V2_1::implementation::LatencyHistogram;
+using ::android::hardware::sensors::V2_1::implementation::SensorsHalGetSubHalsV2_1Func;
+
+using ISensorsSubHalV2_0 = ::android::hardware::sensors::V2_0::implementation::ISensorsSubHal;
+using ISensorsSubHalV2_1 = ::android::hardware::sensors::V2_1::implementation::ISensorsSubHal;
+using EventMessageQueue = MessageQueue<Event, kSynchronizedReadWrite>;
+using WakeLockMessageQueue = MessageQueue<uint32_t, kSynchronizedReadWrite>;
+
+//! The size of the event FMQ of the sensors framework.
+static constexpr size_t kDefaultEventQueueSize = 256;
+
+//! The size of the wake lock FMQ of the sensors framework.
+static constexpr size_t kWakeLockQueueSize = 256;
+
+static constexpr int64_t kReadTimeoutNs = 100 * 1000000;
+
+struct BenchmarkOptions {
+    int64_t durationS = 10;
+    int64_t samplingPeriodNs = -1;
+    int64_t maxReportLatencyNs = 0;
+};
+
+//! Keeps the dynamic sensors the HalProxy reports, so they can be enabled as they connect.
+class BenchmarkSensorsCallback : public ISensorsCallback {
+  public:
+    Return<void> onDynamicSensorsConnected(
+            const hidl_vec<::android::hardware::sensors::V1_0::SensorInfo>& /* sensors */)
+            override {
+        return Void();
+    }
+
+    Return<void> onDynamicSensorsDisconnected(const hidl_vec<int32_t>& sensorHandles) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (int32_t sensorHandle : sensorHandles) {
+            mSensors.erase(sensorHandle);
+        }
+        return Void();
+    }
+
+    Return<void> onDynamicSensorsConnected_2_1(const hidl_vec<SensorInfo>& sensors) override {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const SensorInfo& sensor : sensors) {
+            mSensors[sensor.sensorHandle] = sensor;
+            mConnected.push_back(sensor);
+        }
+        return Void();
+    }
+
+    //! Take the sensors connected since the last call.
+    std::vector<SensorInfo> takeConnected() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return std::move(mConnected);
+    }
+
+    bool isWakeUpSensor(int32_t sensorHandle) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto sensor = mSensors.find(sensorHandle);
+        return sensor != mSensors.end() && (sensor->second.flags & SensorFlagBits::WAKE_UP);
+    }
+
+  private:
+    std::mutex mMutex;
+    std::map<int32_t, SensorInfo> mSensors;
+    std::vector<SensorInfo> mConnected;
+};
+
+static int64_t cpuTimeNs() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * INT64_C(1000000000) +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * INT64_C(1000);
+}
+
+static bool loadSubHal(const std::string& library, std::vector<ISensorsSubHalV2_0*>* subHals,
+                       std::vector<ISensorsSubHalV2_1*>* subHalsV2_1) {
+    void* handle = dlopen(library.c_str(), RTLD_NOW);
+    if (handle == nullptr) {
+        std::cerr << "Failed to load " << library << ": " << dlerror() << std::endl;
+        return false;
+    }
+    uint32_t version;
+    auto getSubHalsV2_1 = reinterpret_cast<SensorsHalGetSubHalsV2_1Func*>(
+            dlsym(handle, "sensorsHalGetSubHals_2_1"));
+    if (getSubHalsV2_1 != nullptr) {
+        size_t count = 0;
+        ISensorsSubHalV2_1* const* librarySubHals = getSubHalsV2_1(&version, &count);
+        subHalsV2_1->insert(subHalsV2_1->end(), librarySubHals, librarySubHals + count);
+        return true;
+    }
+    auto getSubHalV2_1 = reinterpret_cast<ISensorsSubHalV2_1* (*)(uint32_t*)>(
+            dlsym(handle, "sensorsHalGetSubHal_2_1"));
+    if (getSubHalV2_1 != nullptr) {
+        subHalsV2_1->push_back(getSubHalV2_1(&version));
+        return true;
+    }
+    auto getSubHal = reinterpret_cast<ISensorsSubHalV2_0* (*)(uint32_t*)>(
+            dlsym(handle, "sensorsHalGetSubHal"));
+    if (getSubHal != nullptr) {
+        subHals->push_back(getSubHal(&version));
+        return true;
+    }
+    std::cerr << library << " is not a sensors subhal" << std::endl;
+    return false;
+}
+
+static void enableSensor(const sp<HalProxy>& halProxy, const SensorInfo& sensor,
+                         const BenchmarkOptions& options) {
+    int64_t samplingPeriodNs = options.samplingPeriodNs >= 0
+                                       ? options.samplingPeriodNs
+                                       : std::max(sensor.minDelay, 0) * INT64_C(1000);
+    halProxy->batch(sensor.sensorHandle, samplingPeriodNs, options.maxReportLatencyNs);
+    halProxy->activate(sensor.sensorHandle, true);
+}
+
+//! Run the benchmark once with an event FMQ of eventQueueSize events and print the results.
+static bool runBenchmark(const sp<HalProxy>& halProxy, size_t eventQueueSize,
+                         const BenchmarkOptions& options) {
+    // The queues of the sensors framework.
+    auto eventQueue = std::make_unique<EventMessageQueue>(eventQueueSize,
+                                                          true /* configureEventFlagWord */);
+    auto wakeLockQueue = std::make_unique<WakeLockMessageQueue>(kWakeLockQueueSize,
+                                                                true /* configureEventFlagWord */);
+    EventFlag* eventQueueFlag = nullptr;
+    EventFlag* wakeLockQueueFlag = nullptr;
+    EventFlag::createEventFlag(eventQueue->getEventFlagWord(), &eventQueueFlag);
+    EventFlag::createEventFlag(wakeLockQueue->getEventFlagWord(), &wakeLockQueueFlag);
+    if (eventQueueFlag == nullptr || wakeLockQueueFlag == nullptr) {
+        std::cerr << "Failed to create the FMQ event flags" << std::endl;
+        return false;
+    }
+    sp<BenchmarkSensorsCallback> callback = new BenchmarkSensorsCallback();
+    if (halProxy->initialize_2_1(*eventQueue->getDesc(), *wakeLockQueue->getDesc(), callback) !=
+        ::android::hardware::sensors::V1_0::Result::OK) {
+        std::cerr << "Failed to initialize the HalProxy" << std::endl;
+        return false;
+    }
+
+    const std::map<int32_t, SensorInfo>& sensors = halProxy->getSensors();
+    for (const auto& [sensorHandle, sensor] : sensors) {
+        enableSensor(halProxy, sensor, options);
+    }
+
+    std::vector<Event> events(eventQueueSize);
+    LatencyHistogram latency;
+    uint64_t numEvents = 0;
+    uint64_t numWakeupEvents = 0;
+    uint64_t numReads = 0;
+    HalProxy::EventPathStats startStats = halProxy->getEventPathStats();
+    int64_t startNs = ::android::elapsedRealtimeNano();
+    int64_t startCpuNs = cpuTimeNs();
+    int64_t endNs = startNs + options.durationS * INT64_C(1000000000);
+    while (::android::elapsedRealtimeNano() < endNs) {
+        for (const SensorInfo& sensor : callback->takeConnected()) {
+            enableSensor(halProxy, sensor, options);
+        }
+
+        uint32_t eventFlagState = 0;
+        eventQueueFlag->wait(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS),
+                             &eventFlagState, kReadTimeoutNs, true /* retry */);
+        size_t numToRead = std::min(eventQueue->availableToRead(), events.size());
+        if (numToRead == 0 || !eventQueue->read(events.data(), numToRead)) {
+            continue;
+        }
+        eventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ));
+        numReads++;
+
+        int64_t now = ::android::elapsedRealtimeNano();
+        uint32_t numWakeupEventsRead = 0;
+        for (size_t i = 0; i < numToRead; i++) {
+            const Event& event = events[i];
+            auto sensor = sensors.find(event.sensorHandle);
+            if (sensor != sensors.end() ? (sensor->second.flags & SensorFlagBits::WAKE_UP) != 0
+                                        : callback->isWakeUpSensor(event.sensorHandle)) {
+                numWakeupEventsRead++;
+            }
+            // Flush complete events carry no timestamp.
+            if (event.sensorType != SensorType::META_DATA) {
+                latency.record(now - event.timestamp);
+            }
+        }
+        numEvents += numToRead;
+        if (numWakeupEventsRead > 0) {
+            numWakeupEvents += numWakeupEventsRead;
+            wakeLockQueue->write(&numWakeupEventsRead);
+            wakeLockQueueFlag->wake(static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN));
+        }
+    }
+    int64_t elapsedNs = ::android::elapsedRealtimeNano() - startNs;
+    int64_t cpuNs = cpuTimeNs() - startCpuNs;
+    HalProxy::EventPathStats stats = halProxy->getEventPathStats();
+
+    for (const auto& [sensorHandle, sensor] : sensors) {
+        halProxy->activate(sensorHandle, false);
+    }
+
+    double elapsedS = elapsedNs / 1e9;
+    printf("Event FMQ size: %zu, sensors: %zu\n", eventQueueSize, sensors.size());
+    printf("  Events: %" PRIu64 " (%" PRIu64 " wakeup) in %" PRIu64 " reads\n", numEvents,
+           numWakeupEvents, numReads);
+    printf("  Events/s: %.1f\n", numEvents / elapsedS);
+    printf("  Dropped events: %" PRIu64 "\n",
+           stats.numDroppedEvents - startStats.numDroppedEvents);
+    printf("  Wakelock acquisitions/s: %.1f, releases/s: %.1f\n",
+           (stats.numWakelockAcquisitions - startStats.numWakelockAcquisitions) / elapsedS,
+           (stats.numWakelockReleases - startStats.numWakelockReleases) / elapsedS);
+    printf("  CPU per event: %.2f us\n", numEvents > 0 ? cpuNs / 1e3 / numEvents : 0.0);
+    std::cout << "  Latency from event timestamp to read: ";
+    latency.dump(std::cout);
+    std::cout << std::endl;
+
+    EventFlag::deleteEventFlag(&eventQueueFlag);
+    EventFlag::deleteEventFlag(&wakeLockQueueFlag);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> libraries;
+    std::vector<size_t> eventQueueSizes;
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--subhal") == 0 && i + 1 < argc) {
+            libraries.push_back(argv[++i]);
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            options.durationS = strtoll(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "--fmq-size") == 0 && i + 1 < argc) {
+            std::istringstream sizes(argv[++i]);
+            std::string size;
+            while (std::getline(sizes, size, ',')) {
+                eventQueueSizes.push_back(strtoul(size.c_str(), nullptr, 0));
+            }
+        } else if (strcmp(argv[i], "--sampling-period-us") == 0 && i + 1 < argc) {
+            options.samplingPeriodNs = strtoll(argv[++i], nullptr, 0) * 1000;
+        } else if (strcmp(argv[i], "--latency-ms") == 0 && i + 1 < argc) {
+            options.maxReportLatencyNs = strtoll(argv[++i], nullptr, 0) * 1000000;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--subhal <library>]... [--duration <seconds>]"
+                      << " [--fmq-size <events>[,<events>]...] [--sampling-period-us <us>]"
+                      << " [--latency-ms <ms>]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    if (libraries.empty()) {
+        libraries.push_back("sensors.xiaomi.loadgen.so");
+    }
+    if (eventQueueSizes.empty()) {
+        eventQueueSizes.push_back(kDefaultEventQueueSize);
+    }
+
+    std::vector<ISensorsSubHalV2_0*> subHals;
+    std::vector<ISensorsSubHalV2_1*> subHalsV2_1;
+    for (const std::string& library : libraries) {
+        if (!loadSubHal(library, &subHals, &subHalsV2_1)) {
+            return EXIT_FAILURE;
+        }
+    }
+    sp<HalProxy> halProxy = new HalProxy(subHals, subHalsV2_1);
+    for (size_t eventQueueSize : eventQueueSizes) {
+        if (eventQueueSize == 0 || !runBenchmark(halProxy, eventQueueSize, options)) {
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -41,19 +41,14 @@ int32_t setSubHalIndex(int32_t sensorHandle, size_t subHalIndex) {
 void HalProxyCallbackBase::postEvents(const std::vector<V2_1::Event>& events,
                                       ScopedWakelock wakelock) {
     if (events.empty() || !mCallback->areThreadsRunning()) return;
+    mCallback->traceEvents(events, mSubHalIndex);
     size_t numWakeupEvents;
-    std::vector<V2_1::Event> processedEvents = processEvents(events, &numWakeupEvents);
-    if (numWakeupEvents > 0) {
-        ALOG_ASSERT(wakelock.isLocked(),
-                    "Wakeup events posted while wakelock unlocked for subhal"
-                    " w/ index %" PRId32 ".",
-                    mSubHalIndex);
-    } else {
-        ALOG_ASSERT(!wakelock.isLocked(),
-                    "No Wakeup events posted but wakelock locked for subhal"
-                    " w/ index %" PRId32 ".",
-                    mSubHalIndex);
+    if (mCallback->postEventsDirect(events, *this, wakelock, &numWakeupEvents)) {
+        checkWakelock(numWakeupEvents, wakelock);
+        return;
     }
+    std::vector<V2_1::Event> processedEvents = processEvents(events, &numWakeupEvents);
+    checkWakelock(numWakeupEvents, wakelock);
     mCallback->postEventsToMessageQueue(processedEvents, numWakeupEvents, std::move(wakelock));
 }
 
@@ -62,31 +57,63 @@ ScopedWakelock HalProxyCallbackBase::createScopedWakelock(bool lock) {
     return wakelock;
 }
 
+bool HalProxyCallbackBase::processEvent(const V2_1::Event& event, V2_1::Event* eventOut,
+                                        bool* isWakeupEvent) const {
+    *eventOut = event;
+    eventOut->sensorHandle = setSubHalIndex(event.sensorHandle, mSubHalIndex);
+    if (event.sensorType == V2_1::SensorType::DYNAMIC_SENSOR_META) {
+        eventOut->u.dynamic.sensorHandle =
+                setSubHalIndex(event.u.dynamic.sensorHandle, mSubHalIndex);
+    }
+    V2_1::implementation::SensorInfoTable::Entry sensor =
+            mCallback->getSensorEntry(eventOut->sensorHandle);
+
+    if (!sensor.filter.apply(eventOut)) {
+        return false;
+    }
+    if (!mCallback->copyEventToDirectChannels(*eventOut)) {
+        return false;
+    }
+
+    *isWakeupEvent = sensor.isWakeUp();
+    return true;
+}
+
 std::vector<V2_1::Event> HalProxyCallbackBase::processEvents(const std::vector<V2_1::Event>& events,
                                                              size_t* numWakeupEvents) const {
     *numWakeupEvents = 0;
     std::vector<V2_1::Event> eventsOut;
-    for (V2_1::Event event : events) {
-        event.sensorHandle = setSubHalIndex(event.sensorHandle, mSubHalIndex);
-        if (event.sensorType == V2_1::SensorType::DYNAMIC_SENSOR_META) {
-            event.u.dynamic.sensorHandle =
-                    setSubHalIndex(event.u.dynamic.sensorHandle, mSubHalIndex);
-        }
-        const V2_1::SensorInfo& sensor = mCallback->getSensorInfo(event.sensorHandle);
-
-        if (sensor.type == V2_1::SensorType::PICK_UP_GESTURE
-            && event.u.scalar != 1) {
+    eventsOut.reserve(events.size());
+    for (const V2_1::Event& event : events) {
+        V2_1::Event eventOut;
+        bool isWakeupEvent;
+        if (!processEvent(event, &eventOut, &isWakeupEvent)) {
             continue;
         }
 
-        if ((sensor.flags & V1_0::SensorFlagBits::WAKE_UP) != 0) {
+        if (isWakeupEvent) {
             (*numWakeupEvents)++;
         }
-        eventsOut.push_back(event);
+        eventsOut.push_back(eventOut);
     }
     return eventsOut;
 }
 
+void HalProxyCallbackBase::checkWakelock(size_t numWakeupEvents,
+                                         ScopedWakelock& wakelock) const {
+    if (numWakeupEvents > 0) {
+        ALOG_ASSERT(wakelock.isLocked(),
+                    "Wakeup events posted while wakelock unlocked for subhal"
+                    " w/ index %" PRId32 ".",
+                    mSubHalIndex);
+    } else {
+        ALOG_ASSERT(!wakelock.isLocked(),
+                    "No Wakeup events posted but wakelock locked for subhal"
+                    " w/ index %" PRId32 ".",
+                    mSubHalIndex);
+    }
+}
+
 }  // namespace implementation
 }  // namespace V2_0
 }  // namespace sensors
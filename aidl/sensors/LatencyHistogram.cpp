@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "LatencyHistogram.h"
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+void LatencyHistogram::record(int64_t latencyNs) {
+    latencyNs = std::max<int64_t>(latencyNs, 0);
+    mBuckets[bucketOf(latencyNs / 1000)].fetch_add(1, std::memory_order_relaxed);
+    int64_t maxNs = mMaxNs.load(std::memory_order_relaxed);
+    while (latencyNs > maxNs &&
+           !mMaxNs.compare_exchange_weak(maxNs, latencyNs, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::reset() {
+    for (std::atomic<uint32_t>& bucket : mBuckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    mMaxNs.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::dump(std::ostream& stream) const {
+    uint64_t count = 0;
+    for (const std::atomic<uint32_t>& bucket : mBuckets) {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+    stream << count;
+    if (count > 0) {
+        stream << " events, p50 " << percentile(count, 0.5) << " us, p99 "
+               << percentile(count, 0.99) << " us, max "
+               << mMaxNs.load(std::memory_order_relaxed) / 1000 << " us";
+    } else {
+        stream << " events";
+    }
+}
+
+size_t LatencyHistogram::bucketOf(uint64_t latencyUs) {
+    if (latencyUs < kSubBuckets) {
+        return latencyUs;
+    }
+    uint32_t bits = 64 - __builtin_clzll(latencyUs);
+    if (bits > kMaxBits) {
+        return kNumBuckets - 1;
+    }
+    uint32_t shift = bits - 1 - kSubBucketBits;
+    return kSubBuckets + shift * kSubBuckets + ((latencyUs >> shift) & (kSubBuckets - 1));
+}
+
+uint64_t LatencyHistogram::middleOf(size_t bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    uint32_t shift = (bucket - kSubBuckets) / kSubBuckets;
+    return ((kSubBuckets + (bucket % kSubBuckets)) << shift) + ((1 << shift) >> 1);
+}
+
+uint64_t LatencyHistogram::percentile(uint64_t count, double percentile) const {
+    uint64_t rank = std::max<uint64_t>(static_cast<uint64_t>(count * percentile), 1);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kNumBuckets; i++) {
+        seen += mBuckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return middleOf(i);
+        }
+    }
+    return middleOf(kNumBuckets - 1);
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
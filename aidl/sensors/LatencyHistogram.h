@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Lock-free log-linear histogram of latencies, in the style of an HDR histogram.
+ *
+ * Latencies are kept in microseconds. Every power of two range is split into kSubBuckets linear
+ * buckets and percentiles are reported at the middle of their bucket, so they are within
+ * 1 / (2 * kSubBuckets), under 2%, of the true value, up to about a minute.
+ */
+class LatencyHistogram {
+  public:
+    void record(int64_t latencyNs);
+
+    //! Forget every recorded latency. Latencies recorded concurrently may be lost.
+    void reset();
+
+    //! Write the number of latencies, p50, p99 and max.
+    void dump(std::ostream& stream) const;
+
+  private:
+    static constexpr uint32_t kSubBucketBits = 5;
+    static constexpr uint32_t kSubBuckets = 1 << kSubBucketBits;
+    static constexpr uint32_t kMaxBits = 26;
+    static constexpr size_t kNumBuckets = kSubBuckets + (kMaxBits - kSubBucketBits) * kSubBuckets;
+
+    static size_t bucketOf(uint64_t latencyUs);
+
+    //! The latency in the middle of a bucket, in microseconds.
+    static uint64_t middleOf(size_t bucket);
+
+    //! The latency at percentile, in microseconds.
+    uint64_t percentile(uint64_t count, double percentile) const;
+
+    std::atomic<uint32_t> mBuckets[kNumBuckets] = {};
+
+    std::atomic<int64_t> mMaxNs = 0;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "PendingEventRing.h"
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+PendingEventRing::PendingEventRing(size_t capacity)
+    : mCapacity(capacity),
+      mEvents(new Event[capacity]),
+      mReceivedNs(new int64_t[capacity]),
+      mWakeup(new bool[capacity]),
+      mSequence(new std::atomic<uint64_t>[capacity]) {
+    for (size_t i = 0; i < mCapacity; i++) {
+        mSequence[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool PendingEventRing::reserve(size_t count, uint64_t* pos) {
+    uint64_t tail = mTail.load(std::memory_order_relaxed);
+    do {
+        uint64_t head = mHead.load(std::memory_order_acquire);
+        if (tail - head + count > mCapacity) {
+            return false;
+        }
+    } while (!mTail.compare_exchange_weak(tail, tail + count, std::memory_order_acq_rel,
+                                          std::memory_order_relaxed));
+    *pos = tail;
+    return true;
+}
+
+PendingEventRing::Event* PendingEventRing::peek(size_t maxCount, size_t* count,
+                                                size_t* numWakeupEvents, int64_t** receivedNs) {
+    uint64_t head = mHead.load(std::memory_order_relaxed);
+    size_t first = head % mCapacity;
+    size_t limit = std::min(maxCount, mCapacity - first);
+
+    size_t n = 0;
+    size_t wakeups = 0;
+    while (n < limit &&
+           mSequence[first + n].load(std::memory_order_acquire) == head + n + 1) {
+        if (mWakeup[first + n]) {
+            wakeups++;
+        }
+        n++;
+    }
+
+    *count = n;
+    *numWakeupEvents = wakeups;
+    *receivedNs = &mReceivedNs[first];
+    return &mEvents[first];
+}
+
+void PendingEventRing::pop(size_t count) {
+    mHead.fetch_add(count, std::memory_order_release);
+}
+
+void PendingEventRing::clear() {
+    // Positions keep increasing so stale sequence numbers never look published.
+    mHead.store(mTail.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <android/hardware/sensors/2.1/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Fixed capacity multi-producer/single-consumer ring of events waiting to be written to the
+ * event FMQ.
+ *
+ * All storage is allocated once at construction. Producers reserve a run of slots with a single
+ * CAS on the tail, copy their events in and publish each slot through its sequence number. The
+ * single consumer hands out contiguous runs of published events, writes as much of them as the fmq
+ * has room for with a non-blocking MessageQueue::write, then releases what it wrote and waits for
+ * EVENTS_READ before trying again. Every slot carries its own wakeup bit so the consumer knows
+ * exactly how many wakeup events it is about to write or drop.
+ */
+class PendingEventRing {
+  public:
+    using Event = ::android::hardware::sensors::V2_1::Event;
+
+    explicit PendingEventRing(size_t capacity);
+
+    /**
+     * Append count events, or none of them if they do not all fit.
+     *
+     * @param events The events to append.
+     * @param count The number of events to append.
+     * @param receivedNs When the HalProxy received the events, or 0 if unknown.
+     * @param isWakeUp Called for each event to tag its slot as holding a wakeup event or not.
+     *
+     * @return true if the events were appended.
+     */
+    template <typename IsWakeUpFn>
+    bool push(const Event* events, size_t count, int64_t receivedNs, IsWakeUpFn isWakeUp) {
+        uint64_t pos;
+        if (!reserve(count, &pos)) {
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            size_t slot = (pos + i) % mCapacity;
+            mEvents[slot] = events[i];
+            mReceivedNs[slot] = receivedNs;
+            mWakeup[slot] = isWakeUp(events[i]);
+            mSequence[slot].store(pos + i + 1, std::memory_order_release);
+        }
+        return true;
+    }
+
+    /**
+     * Consumer only. Get the longest contiguous run of published events at the head of the ring.
+     *
+     * @param maxCount The maximum number of events to return.
+     * @param count Set to the number of events in the run.
+     * @param numWakeupEvents Set to the number of wakeup events in the run.
+     * @param receivedNs Set to the times the events of the run were received, indexed like the
+     *    run and with the same lifetime.
+     *
+     * @return Pointer to the first event of the run, valid until pop() is called. The consumer
+     *    may rewrite the run in place until then.
+     */
+    Event* peek(size_t maxCount, size_t* count, size_t* numWakeupEvents, int64_t** receivedNs);
+
+    //! Consumer only. Release the first count events returned by peek().
+    void pop(size_t count);
+
+    //! Discard every event in the ring. Must not race with producers or the consumer.
+    void clear();
+
+    bool empty() const { return size() == 0; }
+
+    //! The number of events reserved in the ring, including those not yet published.
+    size_t size() const {
+        return mTail.load(std::memory_order_acquire) - mHead.load(std::memory_order_acquire);
+    }
+
+    size_t capacity() const { return mCapacity; }
+
+  private:
+    bool reserve(size_t count, uint64_t* pos);
+
+    const size_t mCapacity;
+
+    // Left default initialized so pages are only committed once the ring is actually used.
+    std::unique_ptr<Event[]> mEvents;
+    std::unique_ptr<int64_t[]> mReceivedNs;
+    std::unique_ptr<bool[]> mWakeup;
+
+    //! Absolute position + 1 of the event last published into each slot.
+    std::unique_ptr<std::atomic<uint64_t>[]> mSequence;
+
+    //! Absolute positions of the next event to consume and the next slot to reserve.
+    alignas(64) std::atomic<uint64_t> mHead{0};
+    alignas(64) std::atomic<uint64_t> mTail{0};
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
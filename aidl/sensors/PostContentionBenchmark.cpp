@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Runs a HalProxy on several in-process subhals posting events concurrently, standing in for the
+ * sensors framework on the other end of the FMQs, and reports how long each postEvents call of a
+ * subhal takes. This is the time a subhal thread spends in the HalProxy, so it shows producers
+ * waiting behind each other or behind the pending writes thread.
+ *
+ * Usage: sensors.xiaomi.multihal-contention-benchmark [--producers <n>] [--batch <events>]
+ *                                                     [--period-us <us>] [--duration <seconds>]
+ *                                                     [--fmq-size <events>] [--wakeup]
+ *
+ * Every producer is a subhal of its own with a single sensor, posting a batch of events every
+ * period from its own thread, or back to back with a period of 0. With --wakeup the sensors are
+ * wakeup sensors, so every post also takes the wakelock path.
+ */
+
+#include "HalProxy.h"
+
+#include <android/hardware/sensors/2.1/ISensorsCallback.h>
+#include <fmq/MessageQueue.h>
+#include <utils/SystemClock.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using ::android::sp;
+using ::android::hardware::EventFlag;
+using ::android::hardware::hidl_handle;
+using ::android::hardware::hidl_string;
+using ::android::hardware::hidl_vec;
+using ::android::hardware::kSynchronizedReadWrite;
+using ::android::hardware::MessageQueue;
+using ::android::hardware::Return;
+using ::android::hardware::Void;
+using ::android::hardware::sensors::V1_0::OperationMode;
+using ::android::hardware::sensors::V1_0::RateLevel;
+using ::android::hardware::sensors::V1_0::Result;
+using ::android::hardware::sensors::V1_0::SensorFlagBits;
+using ::android::hardware::sensors::V1_0::SensorStatus;
+using ::android::hardware::sensors::V1_0::SharedMemInfo;
+using ::android::hardware::sensors::V2_0::EventQueueFlagBits;
+using ::android::hardware::sensors::V2_0::WakeLockQueueFlagBits;
+using ::android::hardware::sensors::V2_1::Event;
+using ::android::hardware::sensors::V2_1::ISensors;
+using ::android::hardware::sensors::V2_1::ISensorsCallback;
+using ::android::hardware::sensors::V2_1::SensorInfo;
+using ::android::hardware::sensors::V2_1::SensorType;
+using ::android::hardware::sensors::V2_1::implementation::HalProxy;
+using ::android::hardware::sensors::V2_1::implementation::IHalProxyCallback;
+
+using ISensorsSubHalV2_0 = ::android::hardware::sensors::V2_0::implementation::ISensorsSubHal;
+using ISensorsSubHalV2_1 = ::android::hardware::sensors::V2_1::implementation::ISensorsSubHal;
+using EventMessageQueue = MessageQueue<Event, kSynchronizedReadWrite>;
+using WakeLockMessageQueue = MessageQueue<uint32_t, kSynchronizedReadWrite>;
+
+static constexpr size_t kWakeLockQueueSize = 256;
+
+static constexpr int64_t kReadTimeoutNs = 100 * 1000000;
+
+struct BenchmarkOptions {
+    size_t numProducers = 4;
+    size_t batchSize = 4;
+    int64_t periodNs = 1000000;
+    int64_t durationS = 10;
+    size_t eventQueueSize = 256;
+    bool wakeUp = false;
+};
+
+/**
+ * Subhal with a single sensor, posting a batch of events every period from its own thread while
+ * the sensor is enabled, and recording how long every post takes.
+ */
+class ProducerSubHal : public ISensorsSubHalV2_1 {
+  public:
+    ProducerSubHal(size_t index, const BenchmarkOptions& options)
+        : mIndex(index), mOptions(options) {
+        mSensor.sensorHandle = 1;
+        mSensor.name = "Contention Sensor " + std::to_string(index);
+        mSensor.vendor = "LineageOS";
+        mSensor.version = 1;
+        mSensor.type = SensorType::ACCELEROMETER;
+        mSensor.typeAsString = "";
+        mSensor.maxRange = 78.4f;
+        mSensor.resolution = 0.01f;
+        mSensor.power = 0.001f;
+        mSensor.minDelay = 1;
+        mSensor.requiredPermission = "";
+        mSensor.maxDelay = 1000000;
+        mSensor.flags = static_cast<uint32_t>(SensorFlagBits::CONTINUOUS_MODE);
+        if (options.wakeUp) {
+            mSensor.flags |= static_cast<uint32_t>(SensorFlagBits::WAKE_UP);
+        }
+    }
+
+    ~ProducerSubHal() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mStop = true;
+        }
+        mCV.notify_all();
+        if (mThread.joinable()) {
+            mThread.join();
+        }
+    }
+
+    Return<void> getSensorsList_2_1(ISensors::getSensorsList_2_1_cb _hidl_cb) override {
+        _hidl_cb({mSensor});
+        return Void();
+    }
+
+    Return<Result> injectSensorData_2_1(const Event& /* event */) override {
+        return Result::INVALID_OPERATION;
+    }
+
+    Return<Result> initialize(const sp<IHalProxyCallback>& halProxyCallback) override {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCallback = halProxyCallback;
+        }
+        if (!mThread.joinable()) {
+            mThread = std::thread(&ProducerSubHal::run, this);
+        }
+        return Result::OK;
+    }
+
+    Return<Result> setOperationMode(OperationMode mode) override {
+        return mode == OperationMode::NORMAL ? Result::OK : Result::BAD_VALUE;
+    }
+
+    Return<Result> activate(int32_t sensorHandle, bool enabled) override {
+        if (sensorHandle != mSensor.sensorHandle) {
+            return Result::BAD_VALUE;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mEnabled = enabled;
+        }
+        mCV.notify_all();
+        return Result::OK;
+    }
+
+    Return<Result> batch(int32_t sensorHandle, int64_t /* samplingPeriodNs */,
+                         int64_t /* maxReportLatencyNs */) override {
+        return sensorHandle == mSensor.sensorHandle ? Result::OK : Result::BAD_VALUE;
+    }
+
+    Return<Result> flush(int32_t /* sensorHandle */) override { return Result::INVALID_OPERATION; }
+
+    Return<void> registerDirectChannel(const SharedMemInfo& /* mem */,
+                                       ISensors::registerDirectChannel_cb _hidl_cb) override {
+        _hidl_cb(Result::INVALID_OPERATION, -1 /* channelHandle */);
+        return Void();
+    }
+
+    Return<Result> unregisterDirectChannel(int32_t /* channelHandle */) override {
+        return Result::INVALID_OPERATION;
+    }
+
+    Return<void> configDirectReport(int32_t /* sensorHandle */, int32_t /* channelHandle */,
+                                    RateLevel /* rate */,
+                                    ISensors::configDirectReport_cb _hidl_cb) override {
+        _hidl_cb(Result::INVALID_OPERATION, 0 /* reportToken */);
+        return Void();
+    }
+
+    Return<void> debug(const hidl_handle& /* fd */,
+                       const hidl_vec<hidl_string>& /* args */) override {
+        return Void();
+    }
+
+    const std::string getName() override { return "ProducerSubHal" + std::to_string(mIndex); }
+
+    //! The time every post took so far.
+    std::vector<int64_t> getPostDurationsNs() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mPostDurationsNs;
+    }
+
+  private:
+    void run() {
+        std::vector<Event> events(mOptions.batchSize);
+        for (Event& event : events) {
+            event.sensorHandle = mSensor.sensorHandle;
+            event.sensorType = mSensor.type;
+            event.u.vec3.z = 9.81f;
+            event.u.vec3.status = SensorStatus::ACCURACY_HIGH;
+        }
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        int64_t nextPostNs = 0;
+        while (!mStop) {
+            if (!mEnabled) {
+                mCV.wait(lock);
+                nextPostNs = ::android::elapsedRealtimeNano();
+                continue;
+            }
+            int64_t now = ::android::elapsedRealtimeNano();
+            if (now < nextPostNs) {
+                mCV.wait_for(lock, std::chrono::nanoseconds(nextPostNs - now));
+                continue;
+            }
+            nextPostNs += mOptions.periodNs;
+            sp<IHalProxyCallback> callback = mCallback;
+            lock.unlock();
+
+            for (Event& event : events) {
+                event.timestamp = now;
+            }
+            int64_t startNs = ::android::elapsedRealtimeNano();
+            callback->postEvents(events, callback->createScopedWakelock(mOptions.wakeUp));
+            int64_t durationNs = ::android::elapsedRealtimeNano() - startNs;
+
+            lock.lock();
+            mPostDurationsNs.push_back(durationNs);
+        }
+    }
+
+    const size_t mIndex;
+
+    const BenchmarkOptions mOptions;
+
+    SensorInfo mSensor;
+
+    std::mutex mMutex;
+
+    std::condition_variable mCV;
+
+    sp<IHalProxyCallback> mCallback;
+
+    bool mEnabled = false;
+
+    bool mStop = false;
+
+    std::thread mThread;
+
+    std::vector<int64_t> mPostDurationsNs;
+};
+
+class BenchmarkSensorsCallback : public ISensorsCallback {
+  public:
+    Return<void> onDynamicSensorsConnected(
+            const hidl_vec<::android::hardware::sensors::V1_0::SensorInfo>& /* sensors */)
+            override {
+        return Void();
+    }
+
+    Return<void> onDynamicSensorsDisconnected(const hidl_vec<int32_t>& /* handles */) override {
+        return Void();
+    }
+
+    Return<void> onDynamicSensorsConnected_2_1(const hidl_vec<SensorInfo>& /* sensors */) override {
+        return Void();
+    }
+};
+
+static int64_t percentile(std::vector<int64_t>* values, int percent) {
+    if (values->empty()) {
+        return 0;
+    }
+    size_t index = (values->size() - 1) * percent / 100;
+    std::nth_element(values->begin(), values->begin() + index, values->end());
+    return (*values)[index];
+}
+
+static void printDurations(const std::string& name, std::vector<int64_t> durationsNs) {
+    size_t numPosts = durationsNs.size();
+    int64_t p50 = percentile(&durationsNs, 50);
+    int64_t p99 = percentile(&durationsNs, 99);
+    int64_t max = percentile(&durationsNs, 100);
+    printf("%-12s %10zu %10.1f %10.1f %10.1f\n", name.c_str(), numPosts, p50 / 1e3, p99 / 1e3,
+           max / 1e3);
+}
+
+//! Stand in for the sensors framework until endNs, reading events and acking wakeup events.
+static uint64_t readEvents(EventMessageQueue* eventQueue, EventFlag* eventQueueFlag,
+                           WakeLockMessageQueue* wakeLockQueue, EventFlag* wakeLockQueueFlag,
+                           const BenchmarkOptions& options, int64_t endNs) {
+    std::vector<Event> events(options.eventQueueSize);
+    uint64_t numEvents = 0;
+    while (::android::elapsedRealtimeNano() < endNs) {
+        uint32_t eventFlagState = 0;
+        eventQueueFlag->wait(static_cast<uint32_t>(EventQueueFlagBits::READ_AND_PROCESS),
+                             &eventFlagState, kReadTimeoutNs, true /* retry */);
+        size_t numToRead = std::min(eventQueue->availableToRead(), events.size());
+        if (numToRead == 0 || !eventQueue->read(events.data(), numToRead)) {
+            continue;
+        }
+        eventQueueFlag->wake(static_cast<uint32_t>(EventQueueFlagBits::EVENTS_READ));
+        numEvents += numToRead;
+        if (options.wakeUp) {
+            uint32_t numWakeupEvents = static_cast<uint32_t>(numToRead);
+            wakeLockQueue->write(&numWakeupEvents);
+            wakeLockQueueFlag->wake(static_cast<uint32_t>(WakeLockQueueFlagBits::DATA_WRITTEN));
+        }
+    }
+    return numEvents;
+}
+
+int main(int argc, char** argv) {
+    BenchmarkOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--producers") == 0 && i + 1 < argc) {
+            options.numProducers = std::max(strtoul(argv[++i], nullptr, 0), 1UL);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            options.batchSize = std::max(strtoul(argv[++i], nullptr, 0), 1UL);
+        } else if (strcmp(argv[i], "--period-us") == 0 && i + 1 < argc) {
+            options.periodNs = std::max(strtoll(argv[++i], nullptr, 0), 0LL) * 1000;
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            options.durationS = std::max(strtoll(argv[++i], nullptr, 0), 1LL);
+        } else if (strcmp(argv[i], "--fmq-size") == 0 && i + 1 < argc) {
+            options.eventQueueSize = std::max(strtoul(argv[++i], nullptr, 0), 1UL);
+        } else if (strcmp(argv[i], "--wakeup") == 0) {
+            options.wakeUp = true;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--producers <n>] [--batch <events>]"
+                      << " [--period-us <us>] [--duration <seconds>] [--fmq-size <events>]"
+                      << " [--wakeup]" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::vector<std::unique_ptr<ProducerSubHal>> producers;
+    std::vector<ISensorsSubHalV2_0*> subHals;
+    std::vector<ISensorsSubHalV2_1*> subHalsV2_1;
+    for (size_t i = 0; i < options.numProducers; i++) {
+        producers.push_back(std::make_unique<ProducerSubHal>(i, options));
+        subHalsV2_1.push_back(producers.back().get());
+    }
+    sp<HalProxy> halProxy = new HalProxy(subHals, subHalsV2_1);
+
+    // The queues of the sensors framework.
+    auto eventQueue = std::make_unique<EventMessageQueue>(options.eventQueueSize,
+                                                          true /* configureEventFlagWord */);
+    auto wakeLockQueue = std::make_unique<WakeLockMessageQueue>(kWakeLockQueueSize,
+                                                                true /* configureEventFlagWord */);
+    EventFlag* eventQueueFlag = nullptr;
+    EventFlag* wakeLockQueueFlag = nullptr;
+    EventFlag::createEventFlag(eventQueue->getEventFlagWord(), &eventQueueFlag);
+    EventFlag::createEventFlag(wakeLockQueue->getEventFlagWord(), &wakeLockQueueFlag);
+    if (eventQueueFlag == nullptr || wakeLockQueueFlag == nullptr) {
+        std::cerr << "Failed to create the FMQ event flags" << std::endl;
+        return EXIT_FAILURE;
+    }
+    sp<BenchmarkSensorsCallback> callback = new BenchmarkSensorsCallback();
+    if (halProxy->initialize_2_1(*eventQueue->getDesc(), *wakeLockQueue->getDesc(), callback) !=
+        Result::OK) {
+        std::cerr << "Failed to initialize the HalProxy" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    const std::map<int32_t, SensorInfo>& sensors = halProxy->getSensors();
+    for (const auto& [sensorHandle, sensor] : sensors) {
+        halProxy->batch(sensorHandle, 0 /* samplingPeriodNs */, 0 /* maxReportLatencyNs */);
+        halProxy->activate(sensorHandle, true);
+    }
+    int64_t startNs = ::android::elapsedRealtimeNano();
+    uint64_t numEvents = readEvents(eventQueue.get(), eventQueueFlag, wakeLockQueue.get(),
+                                    wakeLockQueueFlag, options,
+                                    startNs + options.durationS * INT64_C(1000000000));
+    for (const auto& [sensorHandle, sensor] : sensors) {
+        halProxy->activate(sensorHandle, false);
+    }
+    HalProxy::EventPathStats stats = halProxy->getEventPathStats();
+
+    printf("Producers: %zu, batch: %zu events, period: %" PRId64 " us, event FMQ size: %zu%s\n",
+           options.numProducers, options.batchSize, options.periodNs / 1000,
+           options.eventQueueSize, options.wakeUp ? ", wakeup" : "");
+    printf("Events read: %" PRIu64 ", dropped: %" PRIu64 "\n\n", numEvents,
+           stats.numDroppedEvents);
+    printf("%-12s %10s %10s %10s %10s\n", "producer", "posts", "p50_us", "p99_us", "max_us");
+    std::vector<int64_t> allDurationsNs;
+    for (const auto& producer : producers) {
+        std::vector<int64_t> durationsNs = producer->getPostDurationsNs();
+        printDurations(producer->getName(), durationsNs);
+        allDurationsNs.insert(allDurationsNs.end(), durationsNs.begin(), durationsNs.end());
+    }
+    printDurations("all", std::move(allDurationsNs));
+
+    EventFlag::deleteEventFlag(&eventQueueFlag);
+    EventFlag::deleteEventFlag(&wakeLockQueueFlag);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SensorInfoTable.h"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+void SensorInfoTable::reset(size_t numSubHals) {
+    size_t size = numSubHals * kMaxLocalSensorHandles;
+    mNumSubHals = numSubHals;
+    mNumFilters = 1;
+    mEntries.reset(new std::atomic<uint64_t>[size]);
+    for (size_t i = 0; i < size; i++) {
+        mEntries[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool SensorInfoTable::set(const V2_1::SensorInfo& sensor, const fixup::EventFilter& filter) {
+    size_t index;
+    if (!indexOf(sensor.sensorHandle, &index)) {
+        return false;
+    }
+    size_t filterIndex = 0;
+    if (!filter.isNoOp()) {
+        filterIndex = 1;
+        while (filterIndex < mNumFilters && mFilters[filterIndex] != filter) {
+            filterIndex++;
+        }
+        if (filterIndex == mNumFilters && mNumFilters < kMaxEventFilters) {
+            mFilters[mNumFilters++] = filter;
+        }
+    }
+    if (filterIndex == kMaxEventFilters || sensor.flags > 0xFFFF) {
+        mEntries[index].store(kNotStored, std::memory_order_release);
+        return false;
+    }
+    uint64_t word = (static_cast<uint64_t>(filterIndex) << 48) |
+                    (static_cast<uint64_t>(sensor.flags) << 32) |
+                    static_cast<uint32_t>(sensor.type);
+    mEntries[index].store(word, std::memory_order_release);
+    return true;
+}
+
+void SensorInfoTable::erase(int32_t sensorHandle) {
+    size_t index;
+    if (indexOf(sensorHandle, &index)) {
+        mEntries[index].store(0, std::memory_order_release);
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
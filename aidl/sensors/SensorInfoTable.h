@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "SensorFixupRules.h"
+
+#include <android/hardware/sensors/2.1/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Dense table of the sensor info fields needed for every posted event, indexed by sub-HAL index
+ * and the sub-HAL's local sensor handle.
+ *
+ * Each entry is a single atomic word, so lookups from sub-HAL threads never take a lock even
+ * while dynamic sensors are being connected or disconnected. Event filters are deduplicated into
+ * a fixed array the words index, as few sensors have one and most of those share it.
+ */
+class SensorInfoTable {
+  public:
+    struct Entry {
+        uint32_t flags = 0;
+        V2_1::SensorType type = static_cast<V2_1::SensorType>(0);
+        fixup::EventFilter filter;
+
+        bool isWakeUp() const {
+            return (flags & static_cast<uint32_t>(V1_0::SensorFlagBits::WAKE_UP)) != 0;
+        }
+
+        bool isContinuous() const {
+            return (flags & static_cast<uint32_t>(V1_0::SensorFlagBits::MASK_REPORTING_MODE)) ==
+                   static_cast<uint32_t>(V1_0::SensorFlagBits::CONTINUOUS_MODE);
+        }
+
+        //! Whether events of the sensor must not wait behind those of continuous sensors.
+        bool isPriority() const {
+            using V1_0::SensorFlagBits;
+            uint32_t reportingMode =
+                    flags & static_cast<uint32_t>(SensorFlagBits::MASK_REPORTING_MODE);
+            return isWakeUp() ||
+                   reportingMode == static_cast<uint32_t>(SensorFlagBits::ONE_SHOT_MODE) ||
+                   reportingMode == static_cast<uint32_t>(SensorFlagBits::SPECIAL_REPORTING_MODE);
+        }
+    };
+
+    //! Local sensor handles at or above this are not stored in the table.
+    static constexpr int32_t kMaxLocalSensorHandles = 1024;
+
+    //! The number of distinct event filters the table holds, including the no-op one.
+    static constexpr size_t kMaxEventFilters = 64;
+
+    /**
+     * Allocate an empty table. Must not race with any other method.
+     *
+     * @param numSubHals The number of sub-HALs to make room for.
+     */
+    void reset(size_t numSubHals);
+
+    /**
+     * Store the entry for sensor.sensorHandle. Must not race with itself.
+     *
+     * @param sensor The sensor.
+     * @param filter The filter of its events.
+     *
+     * @return false if the handle is outside of the table, or the flags or the filter do not fit.
+     */
+    bool set(const V2_1::SensorInfo& sensor, const fixup::EventFilter& filter);
+
+    //! Clear the entry for sensorHandle, if it is inside of the table.
+    void erase(int32_t sensorHandle);
+
+    /**
+     * Look up the entry for sensorHandle.
+     *
+     * @param sensorHandle The sensor handle with the sub-HAL index in its first byte.
+     * @param entry Set to the entry, or to an empty entry if no sensor is stored there.
+     *
+     * @return false if the sensor is not stored in the table and the caller must look it up
+     *    elsewhere.
+     */
+    bool find(int32_t sensorHandle, Entry* entry) const {
+        size_t index;
+        if (!indexOf(sensorHandle, &index)) {
+            return false;
+        }
+        uint64_t word = mEntries[index].load(std::memory_order_acquire);
+        if (word == kNotStored) {
+            return false;
+        }
+        entry->flags = static_cast<uint32_t>(word >> 32) & 0xFFFF;
+        entry->type = static_cast<V2_1::SensorType>(static_cast<uint32_t>(word));
+        entry->filter = mFilters[word >> 48];
+        return true;
+    }
+
+  private:
+    //! The word of a sensor set() could not store.
+    static constexpr uint64_t kNotStored = ~0ull;
+
+    bool indexOf(int32_t sensorHandle, size_t* index) const {
+        size_t subHalIndex = static_cast<uint32_t>(sensorHandle) >> 24;
+        int32_t localHandle = sensorHandle & 0x00FFFFFF;
+        if (subHalIndex >= mNumSubHals || localHandle >= kMaxLocalSensorHandles) {
+            return false;
+        }
+        *index = subHalIndex * kMaxLocalSensorHandles + localHandle;
+        return true;
+    }
+
+    size_t mNumSubHals = 0;
+
+    /**
+     * The index of the event filter in the upper 16 bits, sensor flags in the next 16 and sensor
+     * type in the lower 32 bits, 0 if no sensor.
+     */
+    std::unique_ptr<std::atomic<uint64_t>[]> mEntries;
+
+    //! Filters are only appended, before the words indexing them are stored. 0 is the no-op one.
+    fixup::EventFilter mFilters[kMaxEventFilters];
+
+    size_t mNumFilters = 1;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
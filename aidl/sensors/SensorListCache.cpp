@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SensorListCache.h"
+
+#include <android-base/file.h>
+#include <android-base/unique_fd.h>
+#include <log/log.h>
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <type_traits>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+using ::android::base::unique_fd;
+
+static constexpr uint32_t kMagic = 0x434c5348;  // "HSLC"
+static constexpr uint32_t kVersion = 3;
+static constexpr uint32_t kFlagDisabled = 1 << 0;
+
+//! Appends little endian fields and length prefixed strings to a buffer.
+class Writer {
+  public:
+    template <typename T>
+    void put(T value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        mBuffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    void putString(const std::string& value) {
+        put<uint32_t>(value.size());
+        mBuffer.append(value);
+    }
+
+    const std::string& buffer() const { return mBuffer; }
+
+  private:
+    std::string mBuffer;
+};
+
+//! Reads what Writer wrote, failing on any out of bounds access.
+class Reader {
+  public:
+    Reader(const uint8_t* data, size_t size) : mData(data), mSize(size) {}
+
+    template <typename T>
+    bool get(T* value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        if (mSize - mOffset < sizeof(T)) {
+            return false;
+        }
+        memcpy(value, mData + mOffset, sizeof(T));
+        mOffset += sizeof(T);
+        return true;
+    }
+
+    bool getString(std::string* value) {
+        uint32_t size;
+        if (!get(&size) || mSize - mOffset < size) {
+            return false;
+        }
+        value->assign(reinterpret_cast<const char*>(mData + mOffset), size);
+        mOffset += size;
+        return true;
+    }
+
+  private:
+    const uint8_t* mData;
+    size_t mSize;
+    size_t mOffset = 0;
+};
+
+static void putSensor(Writer* writer, const V2_1::SensorInfo& sensor) {
+    writer->put<int32_t>(sensor.sensorHandle);
+    writer->putString(sensor.name);
+    writer->putString(sensor.vendor);
+    writer->put<int32_t>(sensor.version);
+    writer->put<int32_t>(static_cast<int32_t>(sensor.type));
+    writer->putString(sensor.typeAsString);
+    writer->put<float>(sensor.maxRange);
+    writer->put<float>(sensor.resolution);
+    writer->put<float>(sensor.power);
+    writer->put<int32_t>(sensor.minDelay);
+    writer->put<uint32_t>(sensor.fifoReservedEventCount);
+    writer->put<uint32_t>(sensor.fifoMaxEventCount);
+    writer->putString(sensor.requiredPermission);
+    writer->put<int32_t>(sensor.maxDelay);
+    writer->put<uint32_t>(sensor.flags);
+}
+
+static bool getSensor(Reader* reader, V2_1::SensorInfo* sensor) {
+    std::string name, vendor, typeAsString, requiredPermission;
+    int32_t type;
+    bool ok = reader->get(&sensor->sensorHandle) && reader->getString(&name) &&
+              reader->getString(&vendor) && reader->get(&sensor->version) && reader->get(&type) &&
+              reader->getString(&typeAsString) && reader->get(&sensor->maxRange) &&
+              reader->get(&sensor->resolution) && reader->get(&sensor->power) &&
+              reader->get(&sensor->minDelay) && reader->get(&sensor->fifoReservedEventCount) &&
+              reader->get(&sensor->fifoMaxEventCount) && reader->getString(&requiredPermission) &&
+              reader->get(&sensor->maxDelay) && reader->get(&sensor->flags);
+    sensor->name = name;
+    sensor->vendor = vendor;
+    sensor->type = static_cast<V2_1::SensorType>(type);
+    sensor->typeAsString = typeAsString;
+    sensor->requiredPermission = requiredPermission;
+    return ok;
+}
+
+struct BuildIdSearch {
+    uintptr_t address;
+    std::string* buildId;
+};
+
+static int findBuildId(struct dl_phdr_info* info, size_t /* size */, void* data) {
+    BuildIdSearch* search = static_cast<BuildIdSearch*>(data);
+    bool containsAddress = false;
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        uintptr_t start = info->dlpi_addr + phdr.p_vaddr;
+        if (phdr.p_type == PT_LOAD && search->address >= start &&
+            search->address < start + phdr.p_memsz) {
+            containsAddress = true;
+            break;
+        }
+    }
+    if (!containsAddress) {
+        return 0;
+    }
+
+    for (ElfW(Half) i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr)& phdr = info->dlpi_phdr[i];
+        if (phdr.p_type != PT_NOTE) {
+            continue;
+        }
+        const uint8_t* note = reinterpret_cast<const uint8_t*>(info->dlpi_addr + phdr.p_vaddr);
+        const uint8_t* end = note + phdr.p_memsz;
+        while (note + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr)* nhdr = reinterpret_cast<const ElfW(Nhdr)*>(note);
+            const uint8_t* name = note + sizeof(ElfW(Nhdr));
+            const uint8_t* desc = name + ((nhdr->n_namesz + 3) & ~3);
+            const uint8_t* next = desc + ((nhdr->n_descsz + 3) & ~3);
+            if (next > end) {
+                break;
+            }
+            if (nhdr->n_type == NT_GNU_BUILD_ID && nhdr->n_namesz == 4 &&
+                memcmp(name, "GNU", 4) == 0) {
+                search->buildId->assign(reinterpret_cast<const char*>(desc), nhdr->n_descsz);
+                return 1;
+            }
+            note = next;
+        }
+    }
+    // The library has no build-id, its path and modification time have to do.
+    return 1;
+}
+
+bool SensorListCache::getLibraryKey(const void* symbol, LibraryKey* key) {
+    Dl_info info;
+    if (dladdr(symbol, &info) == 0 || info.dli_fname == nullptr) {
+        return false;
+    }
+    struct stat st;
+    if (stat(info.dli_fname, &st) != 0) {
+        return false;
+    }
+    key->path = info.dli_fname;
+    key->mtimeNs = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    key->buildId.clear();
+    BuildIdSearch search = {reinterpret_cast<uintptr_t>(symbol), &key->buildId};
+    dl_iterate_phdr(findBuildId, &search);
+    return true;
+}
+
+bool SensorListCache::load(const std::vector<LibraryKey>& keys, Contents* contents,
+                           bool* disabled) const {
+    *disabled = false;
+    unique_fd fd(TEMP_FAILURE_RETRY(open(mPath.c_str(), O_RDONLY | O_CLOEXEC)));
+    struct stat st;
+    if (fd.get() < 0 || fstat(fd.get(), &st) != 0 || st.st_size == 0) {
+        return false;
+    }
+    size_t size = st.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd.get(), 0);
+    if (data == MAP_FAILED) {
+        ALOGE("Failed to map %s: %s", mPath.c_str(), strerror(errno));
+        return false;
+    }
+
+    Reader reader(static_cast<const uint8_t*>(data), size);
+    uint32_t magic, version, flags, numLibraries;
+    bool valid = reader.get(&magic) && magic == kMagic && reader.get(&version) &&
+                 version == kVersion && reader.get(&flags) && reader.get(&numLibraries) &&
+                 numLibraries == keys.size();
+    for (size_t i = 0; valid && i < keys.size(); i++) {
+        LibraryKey key;
+        valid = reader.getString(&key.path) && reader.get(&key.mtimeNs) &&
+                reader.getString(&key.buildId) && key == keys[i];
+    }
+    if (valid && (flags & kFlagDisabled) != 0) {
+        *disabled = true;
+        valid = false;
+    }
+
+    uint32_t numCopiedDirectSensors;
+    valid = valid && reader.get(&numCopiedDirectSensors);
+    if (valid) {
+        contents->copiedDirectSensors.clear();
+        for (uint32_t i = 0; valid && i < numCopiedDirectSensors; i++) {
+            int32_t sensorHandle;
+            valid = reader.get(&sensorHandle);
+            contents->copiedDirectSensors.push_back(sensorHandle);
+        }
+    }
+    uint32_t numSensors;
+    valid = valid && reader.get(&numSensors);
+    if (valid) {
+        contents->sensors.clear();
+        contents->eventFilters.clear();
+        for (uint32_t i = 0; valid && i < numSensors; i++) {
+            V2_1::SensorInfo sensor;
+            fixup::EventFilter filter;
+            valid = getSensor(&reader, &sensor) && reader.get(&filter);
+            contents->sensors.push_back(std::move(sensor));
+            contents->eventFilters.push_back(filter);
+        }
+    }
+    munmap(data, size);
+    return valid;
+}
+
+bool SensorListCache::store(const std::vector<LibraryKey>& keys, const Contents& contents) const {
+    return write(keys, contents, 0 /* flags */);
+}
+
+bool SensorListCache::disable(const std::vector<LibraryKey>& keys) const {
+    return write(keys, Contents(), kFlagDisabled);
+}
+
+bool SensorListCache::write(const std::vector<LibraryKey>& keys, const Contents& contents,
+                            uint32_t flags) const {
+    Writer writer;
+    writer.put<uint32_t>(kMagic);
+    writer.put<uint32_t>(kVersion);
+    writer.put<uint32_t>(flags);
+    writer.put<uint32_t>(keys.size());
+    for (const LibraryKey& key : keys) {
+        writer.putString(key.path);
+        writer.put<int64_t>(key.mtimeNs);
+        writer.putString(key.buildId);
+    }
+    writer.put<uint32_t>(contents.copiedDirectSensors.size());
+    for (int32_t sensorHandle : contents.copiedDirectSensors) {
+        writer.put<int32_t>(sensorHandle);
+    }
+    writer.put<uint32_t>(contents.sensors.size());
+    for (size_t i = 0; i < contents.sensors.size(); i++) {
+        putSensor(&writer, contents.sensors[i]);
+        writer.put<fixup::EventFilter>(contents.eventFilters[i]);
+    }
+
+    // Write a temporary file first so readers never see a partially written cache.
+    std::string tmpPath = mPath + ".tmp";
+    if (!android::base::WriteStringToFile(writer.buffer(), tmpPath) ||
+        rename(tmpPath.c_str(), mPath.c_str()) != 0) {
+        ALOGE("Failed to write %s: %s", mPath.c_str(), strerror(errno));
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
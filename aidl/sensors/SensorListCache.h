@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "SensorFixupRules.h"
+
+#include <android/hardware/sensors/2.1/types.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * On-disk cache of the merged sensor list of all subhals, so that the HalProxy can start without
+ * waiting for every subhal to report its sensors and verify them while the service starts up.
+ *
+ * The cache is only valid for the exact set of subhal libraries it was written for, identified
+ * by their path, modification time and build-id, and for the sensor config the HalProxy keys it
+ * with. A cache that turned out to be stale is kept as a disabled marker so the same libraries
+ * are never served from the cache again.
+ */
+class SensorListCache {
+  public:
+    //! Identifies one subhal library.
+    struct LibraryKey {
+        std::string path;
+        int64_t mtimeNs = 0;
+        std::string buildId;
+
+        bool operator==(const LibraryKey& other) const {
+            return path == other.path && mtimeNs == other.mtimeNs && buildId == other.buildId;
+        }
+    };
+
+    //! The cached sensor list, as merged by the HalProxy.
+    struct Contents {
+        std::vector<V2_1::SensorInfo> sensors;
+
+        //! The event filter of each sensor, in the same order.
+        std::vector<fixup::EventFilter> eventFilters;
+
+        //! The sensors whose events the HalProxy copies into direct channels.
+        std::vector<int32_t> copiedDirectSensors;
+    };
+
+    explicit SensorListCache(std::string path) : mPath(std::move(path)) {}
+
+    /**
+     * Get the key of the library that contains symbol.
+     *
+     * @param symbol The address of any symbol of a loaded library.
+     * @param key Set to the key of the library.
+     *
+     * @return false if the library could not be identified.
+     */
+    static bool getLibraryKey(const void* symbol, LibraryKey* key);
+
+    /**
+     * Read the cache.
+     *
+     * @param keys The keys of the currently loaded subhal libraries, in subhal index order.
+     * @param contents Set to the cached contents.
+     * @param disabled Set to whether the cache was disabled for keys.
+     *
+     * @return true if the cache is usable for keys.
+     */
+    bool load(const std::vector<LibraryKey>& keys, Contents* contents, bool* disabled) const;
+
+    /**
+     * Replace the cache.
+     *
+     * @param keys The keys of the subhal libraries contents came from.
+     * @param contents The contents to cache.
+     *
+     * @return false if the cache could not be written.
+     */
+    bool store(const std::vector<LibraryKey>& keys, const Contents& contents) const;
+
+    //! Replace the cache with a marker that stops keys from ever being served from the cache.
+    bool disable(const std::vector<LibraryKey>& keys) const;
+
+  private:
+    bool write(const std::vector<LibraryKey>& keys, const Contents& contents,
+               uint32_t flags) const;
+
+    const std::string mPath;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
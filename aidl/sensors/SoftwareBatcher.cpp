@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SoftwareBatcher.h"
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::SensorFlagBits;
+
+void SoftwareBatcher::addSensor(SensorInfo* sensor) {
+    uint32_t reportingMode =
+            sensor->flags & static_cast<uint32_t>(SensorFlagBits::MASK_REPORTING_MODE);
+    if (sensor->fifoMaxEventCount != 0 ||
+        (sensor->flags & static_cast<uint32_t>(SensorFlagBits::WAKE_UP)) != 0 ||
+        (reportingMode != static_cast<uint32_t>(SensorFlagBits::CONTINUOUS_MODE) &&
+         reportingMode != static_cast<uint32_t>(SensorFlagBits::ON_CHANGE_MODE))) {
+        return;
+    }
+    sensor->fifoReservedEventCount = kFifoEventCount;
+    sensor->fifoMaxEventCount = kFifoEventCount;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFifos.emplace(sensor->sensorHandle, Fifo());
+}
+
+void SoftwareBatcher::reset() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFifos.clear();
+    mNumBatchedSensors.store(0);
+}
+
+void SoftwareBatcher::clear() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& [sensorHandle, fifo] : mFifos) {
+        fifo.maxReportLatencyNs = 0;
+        fifo.events.clear();
+    }
+    mNumBatchedSensors.store(0);
+}
+
+void SoftwareBatcher::batch(int32_t sensorHandle, int64_t maxReportLatencyNs,
+                            std::vector<Event>* eventsOut) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mFifos.find(sensorHandle);
+    if (it == mFifos.end()) {
+        return;
+    }
+    Fifo& fifo = it->second;
+    bool wasBatched = fifo.maxReportLatencyNs > 0;
+    fifo.maxReportLatencyNs = std::max<int64_t>(maxReportLatencyNs, 0);
+    if (fifo.maxReportLatencyNs > 0) {
+        fifo.events.reserve(kFifoEventCount);
+        if (!wasBatched) {
+            mNumBatchedSensors++;
+        }
+    } else {
+        releaseLocked(&fifo, eventsOut);
+        if (wasBatched) {
+            mNumBatchedSensors--;
+        }
+    }
+}
+
+void SoftwareBatcher::release(int32_t sensorHandle, std::vector<Event>* eventsOut) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mFifos.find(sensorHandle);
+    if (it != mFifos.end()) {
+        releaseLocked(&it->second, eventsOut);
+    }
+}
+
+void SoftwareBatcher::filter(const std::vector<Event>& events, std::vector<Event>* eventsOut) {
+    eventsOut->reserve(eventsOut->size() + events.size());
+    bool newDeadline = false;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (const Event& event : events) {
+            auto it = mFifos.find(event.sensorHandle);
+            if (it == mFifos.end()) {
+                eventsOut->push_back(event);
+                continue;
+            }
+            Fifo& fifo = it->second;
+            if (event.sensorType == SensorType::META_DATA) {
+                // Events held before a flush must reach the framework before its completion.
+                releaseLocked(&fifo, eventsOut);
+                eventsOut->push_back(event);
+                continue;
+            }
+            if (fifo.maxReportLatencyNs == 0) {
+                eventsOut->push_back(event);
+                continue;
+            }
+            if (fifo.events.empty()) {
+                fifo.deadline = Clock::now() + std::chrono::nanoseconds(fifo.maxReportLatencyNs);
+                newDeadline = true;
+            }
+            fifo.events.push_back(event);
+            if (fifo.events.size() >= kFifoEventCount) {
+                releaseLocked(&fifo, eventsOut);
+            }
+        }
+    }
+    if (newDeadline) {
+        mCV.notify_one();
+    }
+}
+
+void SoftwareBatcher::waitForExpiredEvents(const std::atomic_bool& running) {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (running.load()) {
+        Clock::time_point deadline = Clock::time_point::max();
+        for (const auto& [sensorHandle, fifo] : mFifos) {
+            if (!fifo.events.empty()) {
+                deadline = std::min(deadline, fifo.deadline);
+            }
+        }
+        if (deadline == Clock::time_point::max()) {
+            mCV.wait(lock);
+        } else if (mCV.wait_until(lock, deadline) == std::cv_status::timeout) {
+            return;
+        }
+    }
+}
+
+void SoftwareBatcher::takeExpiredEvents(std::vector<Event>* eventsOut) {
+    Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto& [sensorHandle, fifo] : mFifos) {
+        if (!fifo.events.empty() && fifo.deadline <= now) {
+            releaseLocked(&fifo, eventsOut);
+        }
+    }
+}
+
+void SoftwareBatcher::wakeUp() {
+    { std::lock_guard<std::mutex> lock(mMutex); }
+    mCV.notify_all();
+}
+
+void SoftwareBatcher::releaseLocked(Fifo* fifo, std::vector<Event>* eventsOut) {
+    eventsOut->insert(eventsOut->end(), fifo->events.begin(), fifo->events.end());
+    fifo->events.clear();
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <android/hardware/sensors/2.1/types.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Software FIFOs for sensors whose subhal has no hardware FIFO, so that their events honour the
+ * requested max report latency instead of reaching the framework one batch at a time.
+ *
+ * Events of a batched sensor are held until the oldest of them has waited for the max report
+ * latency, until kFifoEventCount of them are held, or until a flush complete event for the sensor
+ * comes in. Only non-wakeup continuous and on-change sensors are batched, so held events never
+ * account for a wakelock.
+ */
+class SoftwareBatcher {
+  public:
+    using Event = ::android::hardware::sensors::V2_1::Event;
+    using SensorInfo = ::android::hardware::sensors::V2_1::SensorInfo;
+
+    //! The number of events held per batched sensor, advertised as its FIFO size.
+    static constexpr uint32_t kFifoEventCount = 300;
+
+    /**
+     * Check whether the sensor needs a software FIFO, and if so advertise it and make it eligible
+     * for batching.
+     *
+     * @param sensor The sensor info, as reported to the framework, to check and update.
+     */
+    void addSensor(SensorInfo* sensor);
+
+    //! Forget every sensor and drop every held event.
+    void reset();
+
+    //! Drop every held event and stop batching every sensor until batch() is called again.
+    void clear();
+
+    /**
+     * Set the max report latency for a sensor. Held events are released when batching is turned
+     * off for the sensor.
+     *
+     * @param sensorHandle The sensor handle.
+     * @param maxReportLatencyNs The max report latency requested by the framework.
+     * @param eventsOut Appended with the released events.
+     */
+    void batch(int32_t sensorHandle, int64_t maxReportLatencyNs, std::vector<Event>* eventsOut);
+
+    /**
+     * Release every event held for a sensor.
+     *
+     * @param sensorHandle The sensor handle.
+     * @param eventsOut Appended with the released events.
+     */
+    void release(int32_t sensorHandle, std::vector<Event>* eventsOut);
+
+    //! Whether any sensor is currently batched, so filter() must see its events.
+    bool isActive() const { return mNumBatchedSensors.load(std::memory_order_relaxed) > 0; }
+
+    /**
+     * Hold the events of batched sensors and pass all other events through, along with any held
+     * events that must be released now. Per sensor ordering is preserved.
+     *
+     * @param events The events posted by a subhal.
+     * @param eventsOut Appended with the events to write to the event fmq now.
+     */
+    void filter(const std::vector<Event>& events, std::vector<Event>* eventsOut);
+
+    //! Block until held events have reached their max report latency or until wakeUp().
+    void waitForExpiredEvents(const std::atomic_bool& running);
+
+    //! Release held events that have reached their max report latency into eventsOut.
+    void takeExpiredEvents(std::vector<Event>* eventsOut);
+
+    //! Wake up waitForExpiredEvents().
+    void wakeUp();
+
+    //! The number of sensors currently batched.
+    size_t getNumBatchedSensors() const { return mNumBatchedSensors.load(); }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Fifo {
+        //! 0 when the sensor is not batched.
+        int64_t maxReportLatencyNs = 0;
+
+        //! When the events currently held must be released.
+        Clock::time_point deadline;
+
+        std::vector<Event> events;
+    };
+
+    //! Move the events held in fifo to the end of eventsOut.
+    static void releaseLocked(Fifo* fifo, std::vector<Event>* eventsOut);
+
+    //! The mutex protecting mFifos.
+    std::mutex mMutex;
+
+    //! The condition variable notified whenever a new deadline may have been set.
+    std::condition_variable mCV;
+
+    //! The FIFO of each sensor eligible for batching.
+    std::unordered_map<int32_t, Fifo> mFifos;
+
+    //! The number of entries of mFifos with a non-zero max report latency.
+    std::atomic<size_t> mNumBatchedSensors = 0;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SubHalExecutor.h"
+
+#include <log/log.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+static int64_t getTimeNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+SubHalExecutor::SubHalExecutor(std::string name, int64_t latencyBudgetNs)
+    : mName(std::move(name)), mLatencyBudgetNs(latencyBudgetNs) {
+    mThread = std::thread(&SubHalExecutor::handleCalls, this);
+}
+
+SubHalExecutor::~SubHalExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopped = true;
+    }
+    mCallsCV.notify_one();
+    mThread.join();
+}
+
+std::future<void> SubHalExecutor::post(const char* callName, std::function<void()> task) {
+    std::packaged_task<void()> packagedTask(std::move(task));
+    std::future<void> future = packagedTask.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCalls.push_back({callName, std::move(packagedTask)});
+    }
+    mCallsCV.notify_one();
+    return future;
+}
+
+bool SubHalExecutor::wait(std::future<void>& future, int64_t timeoutNs) {
+    int64_t deadlineNs = timeoutNs < 0 ? INT64_MAX : getTimeNow() + timeoutNs;
+    while (true) {
+        int64_t waitNs = std::min(mLatencyBudgetNs, deadlineNs - getTimeNow());
+        if (waitNs <= 0) {
+            return false;
+        }
+        if (future.wait_for(std::chrono::nanoseconds(waitNs)) == std::future_status::ready) {
+            break;
+        }
+        std::lock_guard<std::mutex> lock(mMutex);
+        int64_t runningNs = getTimeNow() - mCurrentCallStartNs;
+        if (mCurrentCallName != nullptr && !mCurrentCallFlagged && runningNs > mLatencyBudgetNs) {
+            mCurrentCallFlagged = true;
+            ALOGW("Subhal %s: %s has been running for %" PRId64 " ms", mName.c_str(),
+                  mCurrentCallName, runningNs / 1000000);
+        }
+    }
+    future.get();
+    return true;
+}
+
+void SubHalExecutor::run(const char* callName, std::function<void()> task) {
+    if (std::this_thread::get_id() == mThread.get_id()) {
+        task();
+        return;
+    }
+    std::future<void> future = post(callName, std::move(task));
+    wait(future);
+}
+
+bool SubHalExecutor::runFor(const char* callName, std::function<void()> task,
+                            int64_t timeoutNs) {
+    if (std::this_thread::get_id() == mThread.get_id()) {
+        task();
+        return true;
+    }
+    std::future<void> future = post(callName, std::move(task));
+    if (wait(future, timeoutNs)) {
+        return true;
+    }
+    ALOGE("Subhal %s: gave up on %s after %" PRId64 " ms", mName.c_str(), callName,
+          timeoutNs / 1000000);
+    return false;
+}
+
+void SubHalExecutor::dump(std::ostream& stream) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    stream << "  Control calls: " << mNumCalls << ", over the " << mLatencyBudgetNs / 1000000
+           << " ms budget: " << mNumSlowCalls << ", slowest: " << mMaxLatencyNs / 1000000
+           << " ms";
+    if (mMaxLatencyCallName != nullptr) {
+        stream << " (" << mMaxLatencyCallName << ")";
+    }
+    stream << std::endl;
+    if (mCurrentCallName != nullptr) {
+        stream << "  Running " << mCurrentCallName << " for "
+               << (getTimeNow() - mCurrentCallStartNs) / 1000000 << " ms, " << mCalls.size()
+               << " calls queued" << std::endl;
+    }
+}
+
+void SubHalExecutor::handleCalls() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true) {
+        mCallsCV.wait(lock, [&] { return mStopped || !mCalls.empty(); });
+        if (mCalls.empty()) {
+            break;
+        }
+        Call call = std::move(mCalls.front());
+        mCalls.pop_front();
+        mCurrentCallName = call.name;
+        mCurrentCallStartNs = getTimeNow();
+        mCurrentCallFlagged = false;
+        lock.unlock();
+
+        call.task();
+
+        lock.lock();
+        int64_t latencyNs = getTimeNow() - mCurrentCallStartNs;
+        mNumCalls++;
+        if (latencyNs > mLatencyBudgetNs) {
+            mNumSlowCalls++;
+            if (mCurrentCallFlagged) {
+                ALOGW("Subhal %s: %s finished after %" PRId64 " ms", mName.c_str(), call.name,
+                      latencyNs / 1000000);
+            }
+        }
+        if (latencyNs > mMaxLatencyNs) {
+            mMaxLatencyNs = latencyNs;
+            mMaxLatencyCallName = call.name;
+        }
+        mCurrentCallName = nullptr;
+    }
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
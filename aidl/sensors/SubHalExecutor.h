@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Runs the control calls of one subhal on a thread of its own, one at a time and in order, so a
+ * slow subhal only holds up calls to itself and calls to different subhals can be fanned out.
+ *
+ * Whoever waits for a call doubles as its watchdog and logs calls exceeding the latency budget.
+ * Callers may bound their wait with runFor(), giving up on a hung call rather than keeping a binder
+ * thread blocked. Calls queued behind a hung call still wait for it, while calls to other subhals
+ * carry on.
+ */
+class SubHalExecutor {
+  public:
+    /**
+     * @param name The subhal name, for logs.
+     * @param latencyBudgetNs How long a call may take before it is flagged.
+     */
+    SubHalExecutor(std::string name, int64_t latencyBudgetNs);
+
+    ~SubHalExecutor();
+
+    /**
+     * Queue a call.
+     *
+     * @param callName The name of the call, for logs.
+     * @param task The call.
+     *
+     * @return The future to pass to wait().
+     */
+    std::future<void> post(const char* callName, std::function<void()> task);
+
+    /**
+     * Wait for a posted call, flagging it while it exceeds the latency budget.
+     *
+     * @param future The future of the call.
+     * @param timeoutNs How long to wait at most, or -1 to wait until the call finishes.
+     *
+     * @return false if the call did not finish in time.
+     */
+    bool wait(std::future<void>& future, int64_t timeoutNs = -1);
+
+    //! Run a call and wait for it. Calls made from the executor thread run inline.
+    void run(const char* callName, std::function<void()> task);
+
+    /**
+     * Run a call and wait for it up to timeoutNs. A call that times out still runs to completion
+     * later, so the task must own everything it uses rather than refer to the caller's stack.
+     *
+     * @return false if the call timed out.
+     */
+    bool runFor(const char* callName, std::function<void()> task, int64_t timeoutNs);
+
+    //! The thread running the calls.
+    pthread_t getNativeHandle() { return mThread.native_handle(); }
+
+    //! Write the call statistics.
+    void dump(std::ostream& stream);
+
+  private:
+    struct Call {
+        const char* name;
+        std::packaged_task<void()> task;
+    };
+
+    void handleCalls();
+
+    const std::string mName;
+
+    const int64_t mLatencyBudgetNs;
+
+    std::mutex mMutex;
+
+    std::condition_variable mCallsCV;
+
+    std::deque<Call> mCalls;
+
+    bool mStopped = false;
+
+    //! The call running now, or nullptr.
+    const char* mCurrentCallName = nullptr;
+
+    int64_t mCurrentCallStartNs = 0;
+
+    //! Whether the call running now was already flagged.
+    bool mCurrentCallFlagged = false;
+
+    uint64_t mNumCalls = 0;
+
+    uint64_t mNumSlowCalls = 0;
+
+    int64_t mMaxLatencyNs = 0;
+
+    const char* mMaxLatencyCallName = nullptr;
+
+    std::thread mThread;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
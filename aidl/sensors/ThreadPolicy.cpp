@@ -0,0 +1,156 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "ThreadPolicy.h"
+
+#include <android-base/file.h>
+#include <log/log.h>
+
+#include <sched.h>
+#include <sys/resource.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+void ThreadPolicies::readConfigFile(const char* path) {
+    std::ifstream stream(path);
+    if (!stream) {
+        return;
+    }
+    std::string line;
+    while (std::getline(stream, line)) {
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string thread;
+        if (!(words >> thread)) {
+            continue;
+        }
+        Policy policy;
+        bool valid = true;
+        std::string word;
+        while (words >> word) {
+            size_t equals = word.find('=');
+            std::string key = word.substr(0, equals);
+            std::string value = equals == std::string::npos ? "" : word.substr(equals + 1);
+            char* end = nullptr;
+            if (key == "nice") {
+                policy.hasNice = true;
+                policy.nice = strtol(value.c_str(), &end, 10);
+                valid &= !value.empty() && *end == '\0' && policy.nice >= -20 && policy.nice <= 19;
+            } else if (key == "fifo") {
+                policy.fifoPriority = strtol(value.c_str(), &end, 10);
+                valid &= !value.empty() && *end == '\0' && policy.fifoPriority >= 1 &&
+                         policy.fifoPriority <= 99;
+            } else if (key == "cpus") {
+                valid &= parseCpus(value, &policy.cpus);
+            } else if (key == "cpuset") {
+                policy.cpuset = value;
+                valid &= !value.empty() && value.find('/') == std::string::npos &&
+                         value.find("..") == std::string::npos;
+            } else if (key == "name") {
+                policy.name = value.substr(0, 15);
+                valid &= !value.empty();
+            } else {
+                valid = false;
+            }
+            policy.description += (policy.description.empty() ? "" : " ") + word;
+        }
+        if (!valid) {
+            ALOGE("%s: ignoring invalid thread policy '%s'", path, line.c_str());
+            continue;
+        }
+        mPolicies[thread] = std::move(policy);
+    }
+}
+
+bool ThreadPolicies::parseCpus(const std::string& value, std::vector<int>* cpus) {
+    std::istringstream ranges(value);
+    std::string range;
+    while (std::getline(ranges, range, ',')) {
+        char* end = nullptr;
+        long first = strtol(range.c_str(), &end, 10);
+        long last = first;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        if (end == range.c_str() || *end != '\0' || first < 0 || last < first ||
+            last >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = first; cpu <= last; cpu++) {
+            cpus->push_back(static_cast<int>(cpu));
+        }
+    }
+    return !cpus->empty();
+}
+
+void ThreadPolicies::apply(const std::string& thread, const char* fallback, pthread_t handle,
+                           std::string* report) const {
+    report->clear();
+    auto policy = mPolicies.find(thread);
+    if (policy == mPolicies.end() && fallback != nullptr) {
+        policy = mPolicies.find(fallback);
+    }
+    if (policy == mPolicies.end()) {
+        return;
+    }
+    const Policy& p = policy->second;
+    pid_t tid = pthread_gettid_np(handle);
+    std::ostringstream stream;
+    stream << p.description << " (tid " << tid << ")";
+    auto fail = [&](const char* what) {
+        ALOGE("Failed to apply %s to thread %s: %s", what, thread.c_str(), strerror(errno));
+        stream << ", " << what << " failed: " << strerror(errno);
+    };
+
+    if (!p.name.empty()) {
+        int error = pthread_setname_np(handle, p.name.c_str());
+        if (error != 0) {
+            errno = error;
+            fail("name");
+        }
+    }
+    if (p.fifoPriority > 0) {
+        struct sched_param param = {.sched_priority = p.fifoPriority};
+        if (sched_setscheduler(tid, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) != 0) {
+            fail("fifo");
+        }
+    }
+    if (p.hasNice && setpriority(PRIO_PROCESS, tid, p.nice) != 0) {
+        fail("nice");
+    }
+    if (!p.cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : p.cpus) {
+            CPU_SET(cpu, &set);
+        }
+        if (sched_setaffinity(tid, sizeof(set), &set) != 0) {
+            fail("cpus");
+        }
+    }
+    if (!p.cpuset.empty() &&
+        !android::base::WriteStringToFile(std::to_string(tid),
+                                          "/dev/cpuset/" + p.cpuset + "/tasks")) {
+        fail("cpuset");
+    }
+    *report = stream.str();
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <pthread.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Scheduling policies of the HalProxy threads, read from config files next to hals.conf.
+ *
+ * Each line names a thread followed by any of:
+ *   nice=<-20..19>      Run at that nice value, raising it only with CAP_SYS_NICE.
+ *   fifo=<1..99>        Run with SCHED_FIFO at that priority, bounded by the rtprio rlimit.
+ *   cpus=<list>         Restrict to CPUs like 4-7 or 0,2,4-5.
+ *   cpuset=<name>       Move into /dev/cpuset/<name>.
+ *   name=<name>         Rename the thread, up to 15 characters.
+ *
+ * The threads are pending_writes, software_batch, wakelock and subhal_executor, which covers the
+ * executor of every subhal unless there is a subhal_executor:<subhal name> line for it. Lines of
+ * later files replace lines of earlier files for the same thread. '#' starts a comment.
+ */
+class ThreadPolicies {
+  public:
+    struct Policy {
+        bool hasNice = false;
+        int nice = 0;
+        //! The SCHED_FIFO priority, or 0 to keep the default scheduler.
+        int fifoPriority = 0;
+        std::vector<int> cpus;
+        std::string cpuset;
+        std::string name;
+        //! The line as written in the config file, for the debug dump.
+        std::string description;
+    };
+
+    //! Read the policies of a config file. A missing file is not an error.
+    void readConfigFile(const char* path);
+
+    bool empty() const { return mPolicies.empty(); }
+
+    /**
+     * Apply the policy of a thread, if there is one.
+     *
+     * @param thread The thread name as used in the config file.
+     * @param fallback The thread name to look up when thread has no policy, or nullptr.
+     * @param handle The thread.
+     * @param report Set to what was applied and what failed, left empty without a policy.
+     */
+    void apply(const std::string& thread, const char* fallback, pthread_t handle,
+               std::string* report) const;
+
+  private:
+    static bool parseCpus(const std::string& value, std::vector<int>* cpus);
+
+    std::map<std::string, Policy> mPolicies;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "WakelockAccounting.h"
+
+#include <algorithm>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+static constexpr int64_t kNanosPerMilli = 1000000;
+
+void WakelockAccounting::Stats::recordHold(int64_t holdNs) {
+    holdNs = std::max<int64_t>(holdNs, 0);
+    totalHoldNs += holdNs;
+    size_t bucket = 0;
+    for (int64_t limitNs = kNanosPerMilli;
+         bucket < kNumHistogramBuckets - 1 && holdNs >= limitNs; limitNs *= 2) {
+        bucket++;
+    }
+    histogram[bucket]++;
+}
+
+void WakelockAccounting::reset(size_t numSubHals) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSubHalStats.assign(numSubHals, Stats());
+    mScopedWakelocksHeld.assign(numSubHals, 0);
+    mSensorStats.clear();
+    mPendingWakeupEventsHead = mPendingWakeupEventsTail.load();
+    mNumUntrackedWakeupEvents = 0;
+    mTotalUntrackedWakeupEvents = 0;
+}
+
+void WakelockAccounting::onScopedWakelockAcquired(size_t subHalIndex) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (subHalIndex < mSubHalStats.size()) {
+        mSubHalStats[subHalIndex].scopedAcquisitions++;
+        mScopedWakelocksHeld[subHalIndex]++;
+    }
+}
+
+void WakelockAccounting::onScopedWakelockReleased(size_t subHalIndex, int64_t holdNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (subHalIndex < mSubHalStats.size()) {
+        mSubHalStats[subHalIndex].recordHold(holdNs);
+        if (mScopedWakelocksHeld[subHalIndex] > 0) {
+            mScopedWakelocksHeld[subHalIndex]--;
+        }
+    }
+}
+
+void WakelockAccounting::onWakeupEventPosted(int32_t sensorHandle, int64_t nowNs) {
+    size_t tail = mPendingWakeupEventsTail.load(std::memory_order_relaxed);
+    if (tail - mPendingWakeupEventsHead.load(std::memory_order_acquire) ==
+        kMaxPendingWakeupEvents) {
+        mNumUntrackedWakeupEvents++;
+        mTotalUntrackedWakeupEvents++;
+        return;
+    }
+    mPendingWakeupEvents[tail % kMaxPendingWakeupEvents] = {sensorHandle, nowNs};
+    mPendingWakeupEventsTail.store(tail + 1, std::memory_order_release);
+}
+
+size_t WakelockAccounting::popPendingWakeupEventsLocked(size_t count, int64_t nowNs,
+                                                        std::set<int32_t>* sensorHandles) {
+    size_t head = mPendingWakeupEventsHead.load(std::memory_order_relaxed);
+    size_t numPopped =
+            std::min(count, mPendingWakeupEventsTail.load(std::memory_order_acquire) - head);
+    for (size_t i = 0; i < numPopped; i++) {
+        const PendingWakeupEvent& event =
+                mPendingWakeupEvents[(head + i) % kMaxPendingWakeupEvents];
+        int64_t holdNs = nowNs - event.postedAtNs;
+        Stats& sensorStats = mSensorStats[event.sensorHandle];
+        sensorStats.wakeupEvents++;
+        sensorStats.recordHold(holdNs);
+        if (Stats* subHalStats = getSubHalStats(event.sensorHandle)) {
+            subHalStats->wakeupEvents++;
+            subHalStats->recordHold(holdNs);
+        }
+        if (sensorHandles != nullptr) {
+            sensorHandles->insert(event.sensorHandle);
+        }
+    }
+    mPendingWakeupEventsHead.store(head + numPopped, std::memory_order_release);
+    return numPopped;
+}
+
+void WakelockAccounting::onWakeupEventsHandled(size_t count, int64_t nowNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    count -= popPendingWakeupEventsLocked(count, nowNs, nullptr /* sensorHandles */);
+    // Acknowledgements beyond the tracked events are for those the ring had no room for.
+    size_t numUntracked = mNumUntrackedWakeupEvents.load();
+    while (count > 0 && numUntracked > 0 &&
+           !mNumUntrackedWakeupEvents.compare_exchange_weak(
+                   numUntracked, numUntracked - std::min(count, numUntracked))) {
+    }
+}
+
+void WakelockAccounting::onTimeout(int64_t nowNs) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::set<int32_t> sensorHandles;
+    popPendingWakeupEventsLocked(kMaxPendingWakeupEvents, nowNs, &sensorHandles);
+    mNumUntrackedWakeupEvents = 0;
+    std::set<size_t> subHalIndices;
+    for (int32_t sensorHandle : sensorHandles) {
+        if (getSubHalStats(sensorHandle) != nullptr) {
+            subHalIndices.insert(static_cast<uint32_t>(sensorHandle) >> 24);
+        }
+    }
+    for (size_t i = 0; i < mScopedWakelocksHeld.size(); i++) {
+        if (mScopedWakelocksHeld[i] > 0) {
+            subHalIndices.insert(i);
+        }
+    }
+    for (int32_t sensorHandle : sensorHandles) {
+        mSensorStats[sensorHandle].timeouts++;
+    }
+    for (size_t subHalIndex : subHalIndices) {
+        mSubHalStats[subHalIndex].timeouts++;
+    }
+}
+
+void WakelockAccounting::clearPendingWakeupEvents() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mPendingWakeupEventsHead = mPendingWakeupEventsTail.load();
+    mNumUntrackedWakeupEvents = 0;
+}
+
+void WakelockAccounting::dump(std::ostream& stream,
+                              const std::function<std::string(size_t)>& getSubHalName) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    stream << "  Wakelock holds per subhal (histogram buckets are < 1, 2, 4, ... ms):"
+           << std::endl;
+    for (size_t i = 0; i < mSubHalStats.size(); i++) {
+        stream << "    " << getSubHalName(i) << ": ";
+        dumpStats(stream, mSubHalStats[i]);
+    }
+    stream << "  Wakelock holds per sensor:" << std::endl;
+    for (const auto& [sensorHandle, stats] : mSensorStats) {
+        stream << "    0x" << std::hex << sensorHandle << std::dec << ": ";
+        dumpStats(stream, stats);
+    }
+    stream << "  # of wakeup events waiting for the framework: "
+           << mPendingWakeupEventsTail.load() - mPendingWakeupEventsHead.load() +
+                      mNumUntrackedWakeupEvents.load()
+           << " (" << mTotalUntrackedWakeupEvents.load() << " not tracked in total)" << std::endl;
+}
+
+void WakelockAccounting::dumpCsv(std::ostream& stream,
+                                 const std::function<std::string(size_t)>& getSubHalName) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    stream << "kind,id,wakeup_events,scoped_acquisitions,timeouts,total_hold_ms";
+    for (size_t i = 0; i < kNumHistogramBuckets; i++) {
+        stream << ",bucket_" << i;
+    }
+    stream << std::endl;
+    for (size_t i = 0; i < mSubHalStats.size(); i++) {
+        stream << "subhal," << getSubHalName(i) << ",";
+        dumpStatsCsv(stream, mSubHalStats[i]);
+    }
+    for (const auto& [sensorHandle, stats] : mSensorStats) {
+        stream << "sensor," << sensorHandle << ",";
+        dumpStatsCsv(stream, stats);
+    }
+}
+
+void WakelockAccounting::dumpStats(std::ostream& stream, const Stats& stats) {
+    stream << stats.wakeupEvents << " wakeup events, " << stats.scopedAcquisitions
+           << " scoped acquisitions, " << stats.timeouts << " timeouts, "
+           << stats.totalHoldNs / kNanosPerMilli << " ms held, histogram [";
+    for (size_t i = 0; i < kNumHistogramBuckets; i++) {
+        stream << (i == 0 ? "" : " ") << stats.histogram[i];
+    }
+    stream << "]" << std::endl;
+}
+
+void WakelockAccounting::dumpStatsCsv(std::ostream& stream, const Stats& stats) {
+    stream << stats.wakeupEvents << "," << stats.scopedAcquisitions << "," << stats.timeouts << ","
+           << stats.totalHoldNs / kNanosPerMilli;
+    for (uint64_t count : stats.histogram) {
+        stream << "," << count;
+    }
+    stream << std::endl;
+}
+
+WakelockAccounting::Stats* WakelockAccounting::getSubHalStats(int32_t sensorHandle) {
+    size_t subHalIndex = static_cast<uint32_t>(sensorHandle) >> 24;
+    return subHalIndex < mSubHalStats.size() ? &mSubHalStats[subHalIndex] : nullptr;
+}
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
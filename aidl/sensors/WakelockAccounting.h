@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace implementation {
+
+/**
+ * Accounts for who keeps the shared sensors wakelock held, per subhal and per sensor.
+ *
+ * Subhals hold the wakelock through scoped wakelocks, whose hold time is known exactly. Wakeup
+ * events hold it until the framework acknowledges them, which it does by count only, so
+ * acknowledgements are matched to posted wakeup events in order.
+ *
+ * Posting wakeup events neither locks nor allocates: they wait for their acknowledgement in a
+ * fixed ring with a single producer, the thread holding the HalProxy event queue write lock, and
+ * are only accounted for once acknowledged or timed out.
+ */
+class WakelockAccounting {
+  public:
+    //! Bucket i counts holds shorter than 2^i ms, the last bucket counts all longer holds.
+    static constexpr size_t kNumHistogramBuckets = 16;
+
+    //! The most wakeup events waiting for the framework that are matched to acknowledgements.
+    static constexpr size_t kMaxPendingWakeupEvents = 1024;
+
+    struct Stats {
+        //! Wakeup events acknowledged, timed out or forgotten.
+        uint64_t wakeupEvents = 0;
+        //! Scoped wakelocks acquired, only for subhals.
+        uint64_t scopedAcquisitions = 0;
+        uint64_t timeouts = 0;
+        int64_t totalHoldNs = 0;
+        std::array<uint64_t, kNumHistogramBuckets> histogram = {};
+
+        void recordHold(int64_t holdNs);
+    };
+
+    //! Forget all statistics and size them for numSubHals subhals.
+    void reset(size_t numSubHals);
+
+    //! A subhal acquired a scoped wakelock.
+    void onScopedWakelockAcquired(size_t subHalIndex);
+
+    //! A subhal released a scoped wakelock after holding it for holdNs.
+    void onScopedWakelockReleased(size_t subHalIndex, int64_t holdNs);
+
+    /**
+     * A wakeup event of sensorHandle was posted to the framework at nowNs. Must not race with
+     * itself.
+     */
+    void onWakeupEventPosted(int32_t sensorHandle, int64_t nowNs);
+
+    //! count wakeup events were acknowledged by the framework, or dropped, at nowNs.
+    void onWakeupEventsHandled(size_t count, int64_t nowNs);
+
+    //! The shared wakelock timed out at nowNs and every current holder is charged for it.
+    void onTimeout(int64_t nowNs);
+
+    //! Forget wakeup events the framework will never acknowledge, e.g. after it reconnected.
+    void clearPendingWakeupEvents();
+
+    /**
+     * Write human readable statistics.
+     *
+     * @param stream The stream to write to.
+     * @param getSubHalName Returns the name of the subhal at an index.
+     */
+    void dump(std::ostream& stream,
+              const std::function<std::string(size_t)>& getSubHalName) const;
+
+    /**
+     * Write statistics as comma separated values, one line per subhal and per sensor, with a
+     * header line naming the columns.
+     */
+    void dumpCsv(std::ostream& stream,
+                 const std::function<std::string(size_t)>& getSubHalName) const;
+
+  private:
+    struct PendingWakeupEvent {
+        int32_t sensorHandle;
+        int64_t postedAtNs;
+    };
+
+    static void dumpStats(std::ostream& stream, const Stats& stats);
+
+    static void dumpStatsCsv(std::ostream& stream, const Stats& stats);
+
+    Stats* getSubHalStats(int32_t sensorHandle);
+
+    /**
+     * Take up to count of the oldest pending wakeup events off the ring, accounting for them as
+     * held until nowNs.
+     *
+     * @param sensorHandles If not null, the handles of the sensors taken off are added to it.
+     *
+     * @return The number of events taken off the ring.
+     */
+    size_t popPendingWakeupEventsLocked(size_t count, int64_t nowNs,
+                                        std::set<int32_t>* sensorHandles);
+
+    //! Protects everything but the producer side of the pending wakeup events ring.
+    mutable std::mutex mMutex;
+
+    std::vector<Stats> mSubHalStats;
+
+    //! The number of scoped wakelocks each subhal currently holds.
+    std::vector<size_t> mScopedWakelocksHeld;
+
+    std::map<int32_t, Stats> mSensorStats;
+
+    //! Wakeup events not yet acknowledged by the framework, oldest first.
+    std::array<PendingWakeupEvent, kMaxPendingWakeupEvents> mPendingWakeupEvents;
+
+    //! The number of wakeup events ever taken off and put on mPendingWakeupEvents.
+    std::atomic<size_t> mPendingWakeupEventsHead = 0;
+    std::atomic<size_t> mPendingWakeupEventsTail = 0;
+
+    //! Wakeup events posted while mPendingWakeupEvents was full, and not acknowledged yet.
+    std::atomic<size_t> mNumUntrackedWakeupEvents = 0;
+
+    //! Wakeup events posted while mPendingWakeupEvents was full, for debug purposes.
+    std::atomic<uint64_t> mTotalUntrackedWakeupEvents = 0;
+};
+
+}  // namespace implementation
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
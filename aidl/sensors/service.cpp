@@ -21,8 +21,14 @@
 
 using ::aidl::android::hardware::sensors::implementation::HalProxyAidl;
 
+// Binder threads on top of the main thread. Control calls wait for their subhal's executor, so a
+// single thread would let one hung subhal stall the calls to every other subhal. The HalProxy
+// serializes initialize and debug against every other call.
+static constexpr uint32_t kBinderThreadPoolSize = 3;
+
 int main() {
-    ABinderProcess_setThreadPoolMaxThreadCount(0);
+    ABinderProcess_setThreadPoolMaxThreadCount(kBinderThreadPoolSize);
+    ABinderProcess_startThreadPool();
 
     // Make a default multihal sensors service
     auto halProxy = ndk::SharedRefBase::make<HalProxyAidl>();
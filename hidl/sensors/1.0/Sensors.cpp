@@ -95,6 +95,8 @@ Sensors::Sensors() : mInitCheck(NO_INIT), mSensorModule(nullptr), mSensorDevice(
         }
     }
 
+    initFixedUpSensorList();
+
     mInitCheck = OK;
 }
 
@@ -103,7 +105,7 @@ status_t Sensors::initCheck() const {
 }
 
 Return<void> Sensors::getSensorsList(getSensorsList_cb _hidl_cb) {
-    hidl_vec<SensorInfo> out = getFixedUpSensorList();
+    hidl_vec<SensorInfo> out = mSensorList;
 
     _hidl_cb(out);
 
@@ -190,13 +192,21 @@ Return<void> Sensors::poll(int32_t maxCount, poll_cb _hidl_cb) {
         SensorInfo info;
         convertFromSensor(*dyn->sensor, &info);
 
+        fixup::EventFilter filter;
+        if (!mFixupRules.apply(&info, &filter)) {
+            continue;
+        }
+        if (!filter.isNoOp()) {
+            mEventFilters[info.sensorHandle] = filter;
+        }
+
         size_t numDynamicSensors = dynamicSensorsAdded.size();
         dynamicSensorsAdded.resize(numDynamicSensors + 1);
         dynamicSensorsAdded[numDynamicSensors] = info;
     }
 
     std::vector<Event> events;
-    convertFromSensorEvents(err, data.get(), events, getFixedUpSensorList());
+    convertFromSensorEvents(err, data.get(), events);
     out = events;
 
     _hidl_cb(Result::OK, out, dynamicSensorsAdded);
@@ -289,8 +299,8 @@ Return<void> Sensors::configDirectReport(int32_t sensorHandle, int32_t channelHa
     return Void();
 }
 
-std::vector<SensorInfo> Sensors::getFixedUpSensorList() {
-    std::vector<SensorInfo> sensors;
+void Sensors::initFixedUpSensorList() {
+    mFixupRules.load();
 
     sensor_t const* list;
     size_t count = mSensorModule->get_sensors_list(mSensorModule, &list);
@@ -301,38 +311,31 @@ std::vector<SensorInfo> Sensors::getFixedUpSensorList() {
 
         convertFromSensor(*src, &sensor);
 
-        bool keep = patchXiaomiPickupSensor(sensor);
-        if (keep) {
-            sensors.push_back(sensor);
+        fixup::EventFilter filter;
+        if (!mFixupRules.apply(&sensor, &filter)) {
+            continue;
+        }
+        if (!filter.isNoOp()) {
+            mEventFilters[sensor.sensorHandle] = filter;
         }
+        mSensorList.push_back(sensor);
     }
+}
 
-    return sensors;
-};
-
-// static
 void Sensors::convertFromSensorEvents(size_t count, const sensors_event_t* srcArray,
-                                      std::vector<Event>& dstVec,
-                                      std::vector<SensorInfo> sensorsList) {
+                                      std::vector<Event>& dstVec) const {
+    dstVec.reserve(count);
     for (size_t i = 0; i < count; ++i) {
         const sensors_event_t& src = srcArray[i];
         Event event;
 
         convertFromSensorEvent(src, &event);
 
-        SensorInfo* sensor = nullptr;
-        for (auto& s : sensorsList) {
-            if (s.sensorHandle == event.sensorHandle) {
-                sensor = &s;
-                break;
-            }
-        }
-
-        if (sensor && sensor->type == SensorType::PICK_UP_GESTURE) {
-            if (event.u.scalar != 1) {
+        if (!mEventFilters.empty()) {
+            auto filter = mEventFilters.find(event.sensorHandle);
+            if (filter != mEventFilters.end() && !filter->second.apply(&event)) {
                 continue;
             }
-            event.sensorType = SensorType::PICK_UP_GESTURE;
         }
 
         dstVec.push_back(event);
@@ -16,10 +16,12 @@
 
 #pragma once
 
+#include <SensorFixupRules.h>
 #include <android-base/macros.h>
 #include <android/hardware/sensors/1.0/ISensors.h>
 #include <hardware/sensors.h>
 #include <mutex>
+#include <unordered_map>
 #include <vector>
 
 namespace android {
@@ -63,12 +65,19 @@ struct Sensors : public ::android::hardware::sensors::V1_0::ISensors {
     sensors_poll_device_1_t* mSensorDevice;
     std::mutex mPollLock;
 
+    fixup::SensorFixupRules mFixupRules;
+
+    // The sensor list with the fix-up rules applied, which the HAL never changes.
+    std::vector<SensorInfo> mSensorList;
+
+    // The event filters of the sensors that have one, only used by poll().
+    std::unordered_map<int32_t, fixup::EventFilter> mEventFilters;
+
     int getHalDeviceVersion() const;
-    std::vector<SensorInfo> getFixedUpSensorList();
+    void initFixedUpSensorList();
 
-    static void convertFromSensorEvents(size_t count, const sensors_event_t* src,
-                                        std::vector<Event>& dst,
-                                        std::vector<SensorInfo> sensorsList);
+    void convertFromSensorEvents(size_t count, const sensors_event_t* src,
+                                 std::vector<Event>& dst) const;
 
     DISALLOW_COPY_AND_ASSIGN(Sensors);
 };
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SensorFixupRules.h"
+
+#include <android-base/file.h>
+#include <log/log.h>
+
+#include <cctype>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace fixup {
+
+namespace {
+
+// SensorFlagBits::WAKE_UP, the same in every HAL version.
+constexpr uint32_t kWakeUpFlag = 1;
+
+// Quirks of the Xiaomi HALs that hold on every device.
+constexpr char kBuiltInRules[] = R"(
+# The pickup sensor is a pick up gesture posting 1 on pickup and 2 on put down.
+typeAsString="xiaomi.sensor.pickup" : require=wakeup type=25 \
+        typeAsString=android.sensor.pick_up_gesture maxRange=1
+typeAsString="xiaomi pick up sensor" : require=wakeup type=25 \
+        typeAsString=android.sensor.pick_up_gesture maxRange=1
+type=25 : keep_if=scalar==1
+)";
+
+const char* const kConfigFiles[] = {
+        "/vendor/etc/sensors/fixup.conf",
+        "/odm/etc/sensors/fixup.conf",
+};
+
+// Split a line into words, keeping double quoted values whole and ':' as a word of its own.
+bool tokenize(const std::string& line, std::vector<std::string>* words) {
+    std::string word;
+    bool inWord = false;
+    bool quoted = false;
+    for (char c : line) {
+        if (quoted) {
+            if (c == '"') {
+                quoted = false;
+            } else {
+                word += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+            inWord = true;
+        } else if (isspace(static_cast<unsigned char>(c)) || c == ':') {
+            if (inWord) {
+                words->push_back(word);
+                word.clear();
+                inWord = false;
+            }
+            if (c == ':') {
+                words->push_back(":");
+            }
+        } else {
+            word += c;
+            inWord = true;
+        }
+    }
+    if (inWord) {
+        words->push_back(word);
+    }
+    return !quoted;
+}
+
+bool parseInt(const std::string& value, int32_t* out) {
+    char* end = nullptr;
+    long result = strtol(value.c_str(), &end, 0);
+    *out = static_cast<int32_t>(result);
+    return !value.empty() && *end == '\0' && result == *out;
+}
+
+bool parseFloat(const std::string& value, float* out) {
+    char* end = nullptr;
+    *out = strtof(value.c_str(), &end);
+    return !value.empty() && *end == '\0';
+}
+
+// Compile keep_if=<field><op><value>.
+bool parseKeepIf(const std::string& value, EventFilter* filter) {
+    size_t field = value.find_first_of("=!<>");
+    if (field == std::string::npos) {
+        return false;
+    }
+    std::string name = value.substr(0, field);
+    if (name == "scalar") {
+        filter->index = 0;
+    } else {
+        int32_t index;
+        if (name.size() < 7 || name.compare(0, 5, "data[") != 0 || name.back() != ']' ||
+            !parseInt(name.substr(5, name.size() - 6), &index) || index < 0 || index > 15) {
+            return false;
+        }
+        filter->index = static_cast<uint8_t>(index);
+    }
+
+    static const std::pair<const char*, EventFilter::Compare> kOperators[] = {
+            {"==", EventFilter::kEq}, {"!=", EventFilter::kNe}, {"<=", EventFilter::kLe},
+            {">=", EventFilter::kGe}, {"<", EventFilter::kLt},  {">", EventFilter::kGt},
+    };
+    for (const auto& op : kOperators) {
+        std::string symbol = op.first;
+        if (value.compare(field, symbol.size(), symbol) == 0) {
+            filter->compare = op.second;
+            return parseFloat(value.substr(field + symbol.size()), &filter->value);
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+void SensorFixupRules::load() {
+    parse(kBuiltInRules, "built-in rules");
+    for (const char* path : kConfigFiles) {
+        std::string text;
+        if (android::base::ReadFileToString(path, &text)) {
+            parse(text, path);
+        }
+    }
+    ALOGI("Loaded %zu sensor fix-up rules", mRules.size());
+}
+
+void SensorFixupRules::parse(const std::string& text, const std::string& source) {
+    std::istringstream stream(text);
+    std::string line;
+    std::string continued;
+    while (std::getline(stream, line)) {
+        line = line.substr(0, line.find('#'));
+        if (!line.empty() && line.back() == '\\') {
+            continued += line.substr(0, line.size() - 1) + " ";
+            continue;
+        }
+        line = continued + line;
+        continued.clear();
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+
+        std::vector<std::string> words;
+        if (tokenize(line, &words) && words.size() == 1 && words[0] == "clear") {
+            mRules.clear();
+            mText += "clear\n";
+            continue;
+        }
+        Rule rule;
+        if (!parseRule(line, &rule)) {
+            ALOGE("%s: ignoring invalid sensor fix-up rule '%s'", source.c_str(), line.c_str());
+            continue;
+        }
+        mRules.push_back(std::move(rule));
+        mText += line + "\n";
+    }
+}
+
+bool SensorFixupRules::parseRule(const std::string& line, Rule* rule) {
+    std::vector<std::string> words;
+    if (!tokenize(line, &words)) {
+        return false;
+    }
+    bool inActions = false;
+    for (const std::string& word : words) {
+        if (word == ":") {
+            if (inActions) {
+                return false;
+            }
+            inActions = true;
+            continue;
+        }
+        size_t equals = word.find('=');
+        std::string key = word.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : word.substr(equals + 1);
+        int32_t intValue;
+        float floatValue;
+        bool valid;
+
+        if (!inActions) {
+            valid = equals != std::string::npos &&
+                    (key == "name" || key == "vendor" || key == "typeAsString" ||
+                     (key == "type" && parseInt(value, &intValue)));
+            rule->matches.emplace_back(key, value);
+        } else if (key == "hide") {
+            valid = equals == std::string::npos;
+            rule->actions.emplace_back(key, value);
+        } else if (key == "keep_if") {
+            valid = parseKeepIf(value, &rule->keepIf);
+            rule->hasKeepIf = true;
+        } else {
+            if (key == "require") {
+                valid = value == "wakeup" || value == "non-wakeup";
+            } else if (key == "type" || key == "minDelay" || key == "maxDelay") {
+                valid = parseInt(value, &intValue);
+            } else if (key == "maxRange" || key == "resolution" || key == "power") {
+                valid = parseFloat(value, &floatValue);
+            } else {
+                valid = (key == "name" || key == "typeAsString") && equals != std::string::npos;
+            }
+            rule->actions.emplace_back(key, value);
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    return inActions && !rule->matches.empty() && (!rule->actions.empty() || rule->hasKeepIf);
+}
+
+bool SensorFixupRules::apply(SensorFields* sensor, EventFilter* filter) const {
+    *filter = EventFilter();
+    filter->sourceType = sensor->type;
+    for (const Rule& rule : mRules) {
+        bool matches = true;
+        for (const auto& [key, value] : rule.matches) {
+            int32_t type;
+            if (key == "name") {
+                matches &= sensor->name == value;
+            } else if (key == "vendor") {
+                matches &= sensor->vendor == value;
+            } else if (key == "typeAsString") {
+                matches &= sensor->typeAsString == value;
+            } else if (key == "type") {
+                matches &= parseInt(value, &type) && sensor->type == type;
+            }
+        }
+        if (!matches) {
+            continue;
+        }
+
+        for (const auto& [key, value] : rule.actions) {
+            if (key == "hide") {
+                return false;
+            } else if (key == "require") {
+                if (((sensor->flags & kWakeUpFlag) != 0) != (value == "wakeup")) {
+                    return false;
+                }
+            } else if (key == "type") {
+                parseInt(value, &sensor->type);
+                filter->retype = 1;
+                filter->type = sensor->type;
+            } else if (key == "name") {
+                sensor->name = value;
+            } else if (key == "typeAsString") {
+                sensor->typeAsString = value;
+            } else if (key == "maxRange") {
+                parseFloat(value, &sensor->maxRange);
+            } else if (key == "resolution") {
+                parseFloat(value, &sensor->resolution);
+            } else if (key == "power") {
+                parseFloat(value, &sensor->power);
+            } else if (key == "minDelay") {
+                parseInt(value, &sensor->minDelay);
+            } else if (key == "maxDelay") {
+                parseInt(value, &sensor->maxDelay);
+            }
+        }
+        if (rule.hasKeepIf) {
+            filter->compare = rule.keepIf.compare;
+            filter->index = rule.keepIf.index;
+            filter->value = rule.keepIf.value;
+        }
+    }
+    return true;
+}
+
+std::string SensorFixupRules::getDigest() const {
+    // FNV-1a, good enough to tell rule sets apart.
+    uint64_t hash = 0xcbf29ce484222325;
+    for (char c : mText) {
+        hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    }
+    char digest[17];
+    snprintf(digest, sizeof(digest), "%016" PRIx64, hash);
+    return digest;
+}
+
+}  // namespace fixup
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
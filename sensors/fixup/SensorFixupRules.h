@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace fixup {
+
+/**
+ * What to do with each event of a sensor, compiled from every rule that matched the sensor. Small
+ * and trivially copyable, so it can live in the per-event lookup tables.
+ */
+struct EventFilter {
+    enum Compare : uint8_t { kAlways, kEq, kNe, kLt, kLe, kGt, kGe };
+
+    //! Whether to set the event type to type.
+    uint8_t retype = 0;
+    //! Keep only events whose data[index] compares to value like this.
+    uint8_t compare = kAlways;
+    uint8_t index = 0;
+    uint8_t reserved = 0;
+    //! The type of the events the filter applies to, leaving flush complete events and such alone.
+    int32_t sourceType = 0;
+    int32_t type = 0;
+    float value = 0;
+
+    bool isNoOp() const { return !retype && compare == kAlways; }
+
+    bool operator==(const EventFilter& other) const {
+        return retype == other.retype && compare == other.compare && index == other.index &&
+               sourceType == other.sourceType && type == other.type && value == other.value;
+    }
+
+    bool operator!=(const EventFilter& other) const { return !(*this == other); }
+
+    //! @return false if the event must be dropped.
+    template <typename EventT>
+    bool apply(EventT* event) const {
+        if (static_cast<int32_t>(event->sensorType) != sourceType) {
+            return true;
+        }
+        if (compare != kAlways && !keeps(event->u.data[index])) {
+            return false;
+        }
+        if (retype) {
+            event->sensorType = static_cast<decltype(event->sensorType)>(type);
+        }
+        return true;
+    }
+
+  private:
+    bool keeps(float data) const {
+        switch (compare) {
+            case kEq:
+                return data == value;
+            case kNe:
+                return data != value;
+            case kLt:
+                return data < value;
+            case kLe:
+                return data <= value;
+            case kGt:
+                return data > value;
+            case kGe:
+                return data >= value;
+            default:
+                return true;
+        }
+    }
+};
+
+/**
+ * Rules fixing up the sensors of vendor HALs, read from config files so new quirks need no
+ * rebuild. Each line is
+ *
+ *   <match>... : <action>...
+ *
+ * where every match of name=, vendor=, type= and typeAsString= must equal the sensor, and the
+ * actions are any of:
+ *   hide                       Drop the sensor.
+ *   require=wakeup             Drop the sensor unless it is a wakeup sensor, and the reverse
+ *   require=non-wakeup         for non-wakeup sensors.
+ *   type=<n>                   Retype the sensor and its events.
+ *   typeAsString=, name=       Rename the sensor.
+ *   maxRange=, resolution=, power=, minDelay=, maxDelay=
+ *                              Override the sensor info field.
+ *   keep_if=<field><op><value> Drop events unless the field, scalar or data[<0..15>], compares to
+ *                              value with ==, !=, <, <=, > or >=.
+ *
+ * Values containing spaces are double quoted. Rules apply in order, each matching the sensor as
+ * left by the previous ones. A line holding only "clear" forgets every earlier rule, built-in
+ * ones included. '#' starts a comment.
+ */
+class SensorFixupRules {
+  public:
+    //! Load the built-in rules followed by the rules of the config files.
+    void load();
+
+    /**
+     * Add the rules of text. Invalid lines are logged and skipped.
+     *
+     * @param text The rules.
+     * @param source Where the rules came from, for logs.
+     */
+    void parse(const std::string& text, const std::string& source);
+
+    //! A digest of every rule, to tell whether the rules changed.
+    std::string getDigest() const;
+
+    size_t size() const { return mRules.size(); }
+
+    /**
+     * Apply the rules to a sensor.
+     *
+     * @param sensor The sensor info, V1_0 or V2_1, rewritten in place.
+     * @param filter Set to the filter of its events.
+     *
+     * @return false if the sensor must be hidden.
+     */
+    template <typename SensorInfoT>
+    bool apply(SensorInfoT* sensor, EventFilter* filter) const {
+        SensorFields fields;
+        fields.name = sensor->name;
+        fields.vendor = sensor->vendor;
+        fields.typeAsString = sensor->typeAsString;
+        fields.type = static_cast<int32_t>(sensor->type);
+        fields.flags = sensor->flags;
+        fields.maxRange = sensor->maxRange;
+        fields.resolution = sensor->resolution;
+        fields.power = sensor->power;
+        fields.minDelay = sensor->minDelay;
+        fields.maxDelay = sensor->maxDelay;
+        if (!apply(&fields, filter)) {
+            return false;
+        }
+        sensor->name = fields.name;
+        sensor->typeAsString = fields.typeAsString;
+        sensor->type = static_cast<decltype(sensor->type)>(fields.type);
+        sensor->maxRange = fields.maxRange;
+        sensor->resolution = fields.resolution;
+        sensor->power = fields.power;
+        sensor->minDelay = fields.minDelay;
+        sensor->maxDelay = fields.maxDelay;
+        return true;
+    }
+
+  private:
+    //! The fields of a sensor rules can match or rewrite.
+    struct SensorFields {
+        std::string name;
+        std::string vendor;
+        std::string typeAsString;
+        int32_t type = 0;
+        uint32_t flags = 0;
+        float maxRange = 0;
+        float resolution = 0;
+        float power = 0;
+        int32_t minDelay = 0;
+        int32_t maxDelay = 0;
+    };
+
+    struct Rule {
+        //! The match and action keys with their values, in the order written.
+        std::vector<std::pair<std::string, std::string>> matches;
+        std::vector<std::pair<std::string, std::string>> actions;
+        //! The keep_if action, compiled.
+        bool hasKeepIf = false;
+        EventFilter keepIf;
+    };
+
+    bool apply(SensorFields* sensor, EventFilter* filter) const;
+
+    static bool parseRule(const std::string& line, Rule* rule);
+
+    std::vector<Rule> mRules;
+
+    //! Every rule as read, for getDigest().
+    std::string mText;
+};
+
+}  // namespace fixup
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SensorFixupRules.h"
+
+#include <gtest/gtest.h>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace fixup {
+namespace {
+
+constexpr int32_t kPickUpGesture = 25;
+constexpr int32_t kXiaomiPickUp = 33171036;
+constexpr uint32_t kWakeUp = 1;
+
+// The fields of SensorInfo and Event the rules use, like in every HAL version.
+struct TestSensorInfo {
+    std::string name;
+    std::string vendor;
+    std::string typeAsString;
+    int32_t type = 0;
+    uint32_t flags = 0;
+    float maxRange = 10;
+    float resolution = 1;
+    float power = 1;
+    int32_t minDelay = 0;
+    int32_t maxDelay = 0;
+};
+
+struct TestEvent {
+    int32_t sensorType = 0;
+    union {
+        float data[16];
+        float scalar;
+    } u = {};
+};
+
+TestSensorInfo makeSensor(const std::string& typeAsString, int32_t type, uint32_t flags) {
+    TestSensorInfo sensor;
+    sensor.name = "Sensor";
+    sensor.vendor = "Xiaomi";
+    sensor.typeAsString = typeAsString;
+    sensor.type = type;
+    sensor.flags = flags;
+    return sensor;
+}
+
+TestEvent makeEvent(int32_t type, float scalar) {
+    TestEvent event;
+    event.sensorType = type;
+    event.u.scalar = scalar;
+    return event;
+}
+
+TEST(SensorFixupRulesTest, ParsesValidRules) {
+    SensorFixupRules rules;
+    rules.parse("name=A : hide\n"
+                "vendor=B type=0x10 : type=5 maxRange=2.5 minDelay=100\n"
+                "typeAsString=C : require=non-wakeup keep_if=data[3]>=1.5\n",
+                "test");
+    EXPECT_EQ(3u, rules.size());
+}
+
+TEST(SensorFixupRulesTest, SkipsInvalidRules) {
+    SensorFixupRules rules;
+    rules.parse("name=A\n"                      // No actions.
+                ": hide\n"                      // No matches.
+                "name=A : hide : hide\n"        // Two separators.
+                "name : hide\n"                 // Match without a value.
+                "type=x : hide\n"               // Match type not an integer.
+                "name=A : type=1.5\n"           // Action type not an integer.
+                "name=A : maxRange=big\n"       // Not a float.
+                "name=A : require=sometimes\n"  // Unknown requirement.
+                "name=A : hide=1\n"             // hide with a value.
+                "name=A : color=red\n"          // Unknown action.
+                "name=A : keep_if=scalar\n"     // No operator.
+                "name=A : keep_if=data[16]==1\n"
+                "name=A : keep_if=data[x]==1\n"
+                "name=A : keep_if=scalar==one\n"
+                "name=\"A : hide\n",  // Unterminated quote.
+                "test");
+    EXPECT_EQ(0u, rules.size());
+}
+
+TEST(SensorFixupRulesTest, KeepsQuotedValuesWhole) {
+    SensorFixupRules rules;
+    rules.parse("name=\"Pick Up : Sensor\" : name=\"Pick up\" typeAsString=\"a b\"", "test");
+    ASSERT_EQ(1u, rules.size());
+
+    TestSensorInfo sensor = makeSensor("", 1, 0);
+    sensor.name = "Pick Up : Sensor";
+    EventFilter filter;
+    ASSERT_TRUE(rules.apply(&sensor, &filter));
+    EXPECT_EQ("Pick up", sensor.name);
+    EXPECT_EQ("a b", sensor.typeAsString);
+}
+
+TEST(SensorFixupRulesTest, JoinsContinuedLines) {
+    SensorFixupRules rules;
+    rules.parse("name=A : \\\n"
+                "        maxRange=4 \\\n"
+                "        power=0.5 # the rest is a comment \\\n"
+                "name=B : hide\n",
+                "test");
+    ASSERT_EQ(2u, rules.size());
+
+    TestSensorInfo sensor = makeSensor("", 1, 0);
+    sensor.name = "A";
+    EventFilter filter;
+    ASSERT_TRUE(rules.apply(&sensor, &filter));
+    EXPECT_EQ(4.0f, sensor.maxRange);
+    EXPECT_EQ(0.5f, sensor.power);
+}
+
+TEST(SensorFixupRulesTest, ClearForgetsEarlierRules) {
+    SensorFixupRules rules;
+    rules.load();
+    ASSERT_GT(rules.size(), 0u);
+    std::string builtInDigest = rules.getDigest();
+
+    rules.parse("clear\nname=A : hide\n", "test");
+    EXPECT_EQ(1u, rules.size());
+    EXPECT_NE(builtInDigest, rules.getDigest());
+
+    TestSensorInfo sensor = makeSensor("xiaomi.sensor.pickup", kXiaomiPickUp, kWakeUp);
+    EventFilter filter;
+    ASSERT_TRUE(rules.apply(&sensor, &filter));
+    EXPECT_EQ(kXiaomiPickUp, sensor.type);
+    EXPECT_TRUE(filter.isNoOp());
+}
+
+TEST(SensorFixupRulesTest, DigestFollowsRules) {
+    SensorFixupRules a;
+    SensorFixupRules b;
+    a.parse("name=A : hide\n", "test");
+    b.parse("name=A : hide\n", "test");
+    EXPECT_EQ(a.getDigest(), b.getDigest());
+    b.parse("name=B : hide\n", "test");
+    EXPECT_NE(a.getDigest(), b.getDigest());
+}
+
+TEST(SensorFixupRulesTest, BuiltInRulesFixUpPickUpSensors) {
+    SensorFixupRules rules;
+    rules.load();
+
+    for (const char* typeAsString : {"xiaomi.sensor.pickup", "xiaomi pick up sensor"}) {
+        TestSensorInfo sensor = makeSensor(typeAsString, kXiaomiPickUp, kWakeUp);
+        EventFilter filter;
+        ASSERT_TRUE(rules.apply(&sensor, &filter)) << typeAsString;
+        EXPECT_EQ(kPickUpGesture, sensor.type);
+        EXPECT_EQ("android.sensor.pick_up_gesture", sensor.typeAsString);
+        EXPECT_EQ(1.0f, sensor.maxRange);
+
+        EXPECT_EQ(1, filter.retype);
+        EXPECT_EQ(kXiaomiPickUp, filter.sourceType);
+        EXPECT_EQ(kPickUpGesture, filter.type);
+        EXPECT_EQ(EventFilter::kEq, filter.compare);
+        EXPECT_EQ(0, filter.index);
+        EXPECT_EQ(1.0f, filter.value);
+    }
+}
+
+TEST(SensorFixupRulesTest, BuiltInRulesHideNonWakeUpPickUpSensors) {
+    SensorFixupRules rules;
+    rules.load();
+
+    TestSensorInfo sensor = makeSensor("xiaomi.sensor.pickup", kXiaomiPickUp, 0);
+    EventFilter filter;
+    EXPECT_FALSE(rules.apply(&sensor, &filter));
+}
+
+TEST(SensorFixupRulesTest, BuiltInRulesLeaveOtherSensorsAlone) {
+    SensorFixupRules rules;
+    rules.load();
+
+    TestSensorInfo sensor = makeSensor("android.sensor.accelerometer", 1, 0);
+    TestSensorInfo original = sensor;
+    EventFilter filter;
+    ASSERT_TRUE(rules.apply(&sensor, &filter));
+    EXPECT_EQ(original.type, sensor.type);
+    EXPECT_EQ(original.typeAsString, sensor.typeAsString);
+    EXPECT_TRUE(filter.isNoOp());
+}
+
+TEST(SensorFixupRulesTest, RulesApplyInOrder) {
+    SensorFixupRules rules;
+    rules.parse("name=A : name=B\n"
+                "name=B : maxRange=3\n"
+                "name=A : hide\n",
+                "test");
+
+    TestSensorInfo sensor = makeSensor("", 1, 0);
+    sensor.name = "A";
+    EventFilter filter;
+    ASSERT_TRUE(rules.apply(&sensor, &filter));
+    EXPECT_EQ("B", sensor.name);
+    EXPECT_EQ(3.0f, sensor.maxRange);
+}
+
+TEST(EventFilterTest, RetypesAndFiltersEventsOfTheSourceType) {
+    SensorFixupRules rules;
+    rules.load();
+    TestSensorInfo sensor = makeSensor("xiaomi.sensor.pickup", kXiaomiPickUp, kWakeUp);
+    EventFilter filter;
+    ASSERT_TRUE(rules.apply(&sensor, &filter));
+
+    TestEvent pickUp = makeEvent(kXiaomiPickUp, 1);
+    EXPECT_TRUE(filter.apply(&pickUp));
+    EXPECT_EQ(kPickUpGesture, pickUp.sensorType);
+
+    TestEvent putDown = makeEvent(kXiaomiPickUp, 2);
+    EXPECT_FALSE(filter.apply(&putDown));
+}
+
+TEST(EventFilterTest, LeavesOtherEventTypesAlone) {
+    EventFilter filter;
+    filter.sourceType = kXiaomiPickUp;
+    filter.retype = 1;
+    filter.type = kPickUpGesture;
+    filter.compare = EventFilter::kEq;
+    filter.value = 1;
+
+    // Like a flush complete event, which must reach the framework untouched.
+    constexpr int32_t kMetaData = 0;
+    TestEvent meta = makeEvent(kMetaData, 2);
+    EXPECT_TRUE(filter.apply(&meta));
+    EXPECT_EQ(kMetaData, meta.sensorType);
+}
+
+TEST(EventFilterTest, ComparesTheChosenField) {
+    SensorFixupRules rules;
+    rules.parse("type=1 : keep_if=data[2]<0\n", "test");
+    TestSensorInfo sensor = makeSensor("", 1, 0);
+    EventFilter filter;
+    ASSERT_TRUE(rules.apply(&sensor, &filter));
+    EXPECT_FALSE(filter.retype);
+
+    TestEvent event = makeEvent(1, 5);
+    event.u.data[2] = -1;
+    EXPECT_TRUE(filter.apply(&event));
+    EXPECT_EQ(1, event.sensorType);
+    event.u.data[2] = 0;
+    EXPECT_FALSE(filter.apply(&event));
+}
+
+TEST(EventFilterTest, NoOpKeepsEverything) {
+    EventFilter filter;
+    filter.sourceType = 1;
+    ASSERT_TRUE(filter.isNoOp());
+
+    TestEvent event = makeEvent(1, -100);
+    EXPECT_TRUE(filter.apply(&event));
+    EXPECT_EQ(1, event.sensorType);
+}
+
+}  // namespace
+}  // namespace fixup
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
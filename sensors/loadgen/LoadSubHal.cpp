@@ -0,0 +1,473 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "LoadSubHal.h"
+
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <utils/SystemClock.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+
+using ::android::hardware::sensors::V2_1::implementation::ISensorsSubHal;
+using ::android::hardware::sensors::V2_1::subhal::implementation::LoadSubHal;
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+using ::android::hardware::Void;
+using ::android::hardware::sensors::V1_0::MetaDataEventType;
+using ::android::hardware::sensors::V1_0::SensorFlagBits;
+using ::android::hardware::sensors::V1_0::SensorStatus;
+using ::android::hardware::sensors::V2_0::implementation::ScopedWakelock;
+
+LoadSubHal::LoadSubHal(const std::string& instance)
+    : mName(instance.empty() ? "LoadSubHal" : "LoadSubHal:" + instance) {
+    std::string prefix =
+            "vendor.sensors.xiaomi.loadgen." + (instance.empty() ? "" : instance + ".");
+    auto getInt64 = [&prefix](const char* name, int64_t defaultValue) {
+        return property_get_int64((prefix + name).c_str(), defaultValue);
+    };
+    int64_t minDelayNs = std::clamp<int64_t>(getInt64("min_delay_us", 1000), 1, INT32_MAX) * 1000;
+    int32_t fifoSize = static_cast<int32_t>(std::clamp<int64_t>(getInt64("fifo_size", 0), 0,
+                                                                INT32_MAX));
+    mDynamicPeriodNs = std::max<int64_t>(getInt64("dynamic_period_ms", 0), 0) * 1000000;
+
+    char sensors[PROPERTY_VALUE_MAX];
+    if (property_get((prefix + "sensors").c_str(), sensors, "") > 0) {
+        if (!addSensors(sensors, minDelayNs, fifoSize)) {
+            ALOGE("%s: invalid sensor list '%s'", mName.c_str(), sensors);
+        }
+        return;
+    }
+
+    int64_t numContinuous = getInt64("num_continuous", 4);
+    int64_t numWakeup = getInt64("num_wakeup", 1);
+    int64_t numDynamic = getInt64("num_dynamic", 1);
+    uint32_t continuous = static_cast<uint32_t>(SensorFlagBits::CONTINUOUS_MODE);
+    for (int64_t i = 0; i < numContinuous; i++) {
+        addSensor("Load Continuous " + std::to_string(i), continuous, false /* isDynamic */,
+                  minDelayNs, fifoSize);
+    }
+    for (int64_t i = 0; i < numWakeup; i++) {
+        addSensor("Load Wakeup " + std::to_string(i), continuous | SensorFlagBits::WAKE_UP,
+                  false /* isDynamic */, minDelayNs, fifoSize);
+    }
+    for (int64_t i = 0; i < numDynamic; i++) {
+        addSensor("Load Dynamic " + std::to_string(i), continuous | SensorFlagBits::DYNAMIC_SENSOR,
+                  true /* isDynamic */, minDelayNs, fifoSize);
+    }
+}
+
+LoadSubHal::~LoadSubHal() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCV.notify_all();
+    if (mThread.joinable()) {
+        mThread.join();
+    }
+}
+
+void LoadSubHal::addSensor(const std::string& name, uint32_t flags, bool isDynamic,
+                           int64_t minDelayNs, int32_t fifoSize) {
+    Sensor sensor;
+    sensor.info.sensorHandle = static_cast<int32_t>(mSensors.size()) + 1;
+    sensor.info.name = name;
+    sensor.info.vendor = "LineageOS";
+    sensor.info.version = 1;
+    sensor.info.type = SensorType::ACCELEROMETER;
+    sensor.info.typeAsString = "";
+    sensor.info.maxRange = 78.4f;
+    sensor.info.resolution = 0.01f;
+    sensor.info.power = 0.001f;
+    sensor.info.minDelay = static_cast<int32_t>(minDelayNs / 1000);
+    sensor.info.fifoReservedEventCount = fifoSize;
+    sensor.info.fifoMaxEventCount = fifoSize;
+    sensor.info.requiredPermission = "";
+    sensor.info.maxDelay = std::max(1000000, sensor.info.minDelay);
+    sensor.info.flags = flags;
+    sensor.isDynamic = isDynamic;
+    sensor.connected = !isDynamic;
+    sensor.minDelayNs = minDelayNs;
+    sensor.samplingPeriodNs = minDelayNs;
+    mSensors.push_back(std::move(sensor));
+}
+
+bool LoadSubHal::addSensors(const std::string& list, int64_t defaultMinDelayNs,
+                            int32_t defaultFifoSize) {
+    uint32_t continuous = static_cast<uint32_t>(SensorFlagBits::CONTINUOUS_MODE);
+    std::istringstream entries(list);
+    std::string entry;
+    while (std::getline(entries, entry, ',')) {
+        std::istringstream fields(entry);
+        std::string kind;
+        std::string minDelayUs;
+        std::string fifoSize;
+        std::getline(fields, kind, ':');
+        std::getline(fields, minDelayUs, ':');
+        std::getline(fields, fifoSize, ':');
+        if (!fields.eof()) {
+            return false;
+        }
+
+        int64_t minDelayNs = defaultMinDelayNs;
+        if (!minDelayUs.empty()) {
+            char* end = nullptr;
+            long long value = strtoll(minDelayUs.c_str(), &end, 10);
+            if (*end != '\0' || value < 1 || value > INT32_MAX) {
+                return false;
+            }
+            minDelayNs = value * 1000;
+        }
+        int32_t fifo = defaultFifoSize;
+        if (!fifoSize.empty()) {
+            char* end = nullptr;
+            long long value = strtoll(fifoSize.c_str(), &end, 10);
+            if (*end != '\0' || value < 0 || value > INT32_MAX) {
+                return false;
+            }
+            fifo = static_cast<int32_t>(value);
+        }
+
+        std::string name = std::to_string(mSensors.size());
+        if (kind == "continuous") {
+            addSensor("Load Continuous " + name, continuous, false /* isDynamic */, minDelayNs,
+                      fifo);
+        } else if (kind == "wakeup") {
+            addSensor("Load Wakeup " + name, continuous | SensorFlagBits::WAKE_UP,
+                      false /* isDynamic */, minDelayNs, fifo);
+        } else if (kind == "dynamic") {
+            addSensor("Load Dynamic " + name, continuous | SensorFlagBits::DYNAMIC_SENSOR,
+                      true /* isDynamic */, minDelayNs, fifo);
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+LoadSubHal::Sensor* LoadSubHal::findSensor(int32_t sensorHandle) {
+    if (sensorHandle < 1 || static_cast<size_t>(sensorHandle) > mSensors.size()) {
+        return nullptr;
+    }
+    Sensor& sensor = mSensors[sensorHandle - 1];
+    return sensor.connected ? &sensor : nullptr;
+}
+
+Return<void> LoadSubHal::getSensorsList_2_1(ISensors::getSensorsList_2_1_cb _hidl_cb) {
+    std::vector<SensorInfo> sensors;
+    for (const Sensor& sensor : mSensors) {
+        if (!sensor.isDynamic) {
+            sensors.push_back(sensor.info);
+        }
+    }
+    _hidl_cb(sensors);
+    return Void();
+}
+
+Return<Result> LoadSubHal::setOperationMode(OperationMode mode) {
+    return mode == OperationMode::NORMAL ? Result::OK : Result::BAD_VALUE;
+}
+
+Return<Result> LoadSubHal::activate(int32_t sensorHandle, bool enabled) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Sensor* sensor = findSensor(sensorHandle);
+        if (sensor == nullptr) {
+            return Result::BAD_VALUE;
+        }
+        if (sensor->enabled == enabled) {
+            return Result::OK;
+        }
+        sensor->enabled = enabled;
+        sensor->fifo.clear();
+        sensor->nextSampleNs = elapsedRealtimeNano() + sensor->samplingPeriodNs;
+    }
+    mCV.notify_all();
+    return Result::OK;
+}
+
+Return<Result> LoadSubHal::batch(int32_t sensorHandle, int64_t samplingPeriodNs,
+                                 int64_t maxReportLatencyNs) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Sensor* sensor = findSensor(sensorHandle);
+        if (sensor == nullptr) {
+            return Result::BAD_VALUE;
+        }
+        sensor->samplingPeriodNs = std::clamp(samplingPeriodNs, sensor->minDelayNs,
+                                              sensor->info.maxDelay * INT64_C(1000));
+        sensor->maxReportLatencyNs = sensor->info.fifoMaxEventCount > 0 ? maxReportLatencyNs : 0;
+    }
+    mCV.notify_all();
+    return Result::OK;
+}
+
+Return<Result> LoadSubHal::flush(int32_t sensorHandle) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Sensor* sensor = findSensor(sensorHandle);
+        if (sensor == nullptr || !sensor->enabled) {
+            return Result::BAD_VALUE;
+        }
+        // The sampling thread posts the flush complete event after the FIFO, keeping them ordered.
+        sensor->numPendingFlushes++;
+    }
+    mCV.notify_all();
+    return Result::OK;
+}
+
+Return<Result> LoadSubHal::injectSensorData_2_1(const Event& /* event */) {
+    return Result::INVALID_OPERATION;
+}
+
+Return<void> LoadSubHal::registerDirectChannel(const SharedMemInfo& /* mem */,
+                                               ISensors::registerDirectChannel_cb _hidl_cb) {
+    _hidl_cb(Result::INVALID_OPERATION, -1 /* channelHandle */);
+    return Return<void>();
+}
+
+Return<Result> LoadSubHal::unregisterDirectChannel(int32_t /* channelHandle */) {
+    return Result::INVALID_OPERATION;
+}
+
+Return<void> LoadSubHal::configDirectReport(int32_t /* sensorHandle */,
+                                            int32_t /* channelHandle */, RateLevel /* rate */,
+                                            ISensors::configDirectReport_cb _hidl_cb) {
+    _hidl_cb(Result::INVALID_OPERATION, 0 /* reportToken */);
+    return Return<void>();
+}
+
+Return<void> LoadSubHal::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& /* args */) {
+    if (fd.getNativeHandle() == nullptr || fd->numFds < 1) {
+        ALOGE("%s: missing fd for writing", __FUNCTION__);
+        return Void();
+    }
+
+    FILE* out = fdopen(dup(fd->data[0]), "w");
+
+    std::ostringstream stream;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        stream << "Events posted: " << mNumEventsPosted << std::endl;
+        stream << "Dynamic sensor connection changes: " << mNumDynamicToggles << std::endl;
+        for (const Sensor& sensor : mSensors) {
+            stream << "  " << sensor.info.name << ": "
+                   << (sensor.enabled ? "enabled" : "disabled") << ", period "
+                   << sensor.samplingPeriodNs / 1000 << " us, latency "
+                   << sensor.maxReportLatencyNs / 1000000 << " ms, " << sensor.numSamples
+                   << " samples" << std::endl;
+        }
+    }
+    stream << std::endl;
+
+    fprintf(out, "%s", stream.str().c_str());
+
+    fclose(out);
+    return Return<void>();
+}
+
+Return<Result> LoadSubHal::initialize(const sp<IHalProxyCallback>& halProxyCallback) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCallback = halProxyCallback;
+        // A new HalProxy session knows no dynamic sensors, so connect them again right away.
+        for (Sensor& sensor : mSensors) {
+            if (sensor.isDynamic) {
+                sensor.connected = false;
+                sensor.enabled = false;
+            }
+        }
+        mDynamicSensorsConnected = false;
+        mNextDynamicToggleNs = elapsedRealtimeNano();
+    }
+    if (!mThread.joinable()) {
+        mThread = std::thread(&LoadSubHal::run, this);
+    }
+    mCV.notify_all();
+    return Result::OK;
+}
+
+int64_t LoadSubHal::sample(Sensor& sensor, int64_t now, std::vector<Event>* events) {
+    while (sensor.nextSampleNs <= now) {
+        Event event;
+        event.timestamp = sensor.nextSampleNs;
+        event.sensorHandle = sensor.info.sensorHandle;
+        event.sensorType = sensor.info.type;
+        event.u.vec3.x = static_cast<float>(sensor.numSamples % 1000) / 100;
+        event.u.vec3.y = 0.0f;
+        event.u.vec3.z = 9.81f;
+        event.u.vec3.status = SensorStatus::ACCURACY_HIGH;
+        sensor.fifo.push_back(event);
+        sensor.numSamples++;
+        sensor.nextSampleNs += sensor.samplingPeriodNs;
+    }
+
+    size_t fifoSize = static_cast<size_t>(sensor.info.fifoMaxEventCount);
+    bool report = sensor.maxReportLatencyNs == 0 || sensor.fifo.size() >= fifoSize ||
+                  sensor.numPendingFlushes > 0 ||
+                  (!sensor.fifo.empty() &&
+                   now - sensor.fifo.front().timestamp >= sensor.maxReportLatencyNs);
+    if (report) {
+        events->insert(events->end(), sensor.fifo.begin(), sensor.fifo.end());
+        sensor.fifo.clear();
+        for (; sensor.numPendingFlushes > 0; sensor.numPendingFlushes--) {
+            Event event;
+            event.timestamp = 0;
+            event.sensorHandle = sensor.info.sensorHandle;
+            event.sensorType = SensorType::META_DATA;
+            event.u.meta.what = MetaDataEventType::META_DATA_FLUSH_COMPLETE;
+            events->push_back(event);
+        }
+    }
+
+    if (sensor.maxReportLatencyNs == 0) {
+        return sensor.nextSampleNs;
+    }
+    // Wake up when the FIFO fills up or its oldest sample reaches the max report latency.
+    int64_t fullNs = sensor.nextSampleNs +
+                     static_cast<int64_t>(fifoSize - sensor.fifo.size() - 1) *
+                             sensor.samplingPeriodNs;
+    int64_t oldestNs = sensor.fifo.empty() ? sensor.nextSampleNs : sensor.fifo.front().timestamp;
+    return std::min(fullNs, oldestNs + sensor.maxReportLatencyNs);
+}
+
+void LoadSubHal::run() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (!mStop) {
+        int64_t now = elapsedRealtimeNano();
+        int64_t nextWakeNs = INT64_MAX;
+        std::vector<Event> events;
+        std::vector<Event> wakeupEvents;
+        for (Sensor& sensor : mSensors) {
+            if (!sensor.connected || !sensor.enabled) {
+                // Flushes of sensors disabled since are dropped.
+                sensor.numPendingFlushes = 0;
+                continue;
+            }
+            bool isWakeUp = (sensor.info.flags & SensorFlagBits::WAKE_UP) != 0;
+            nextWakeNs = std::min(nextWakeNs,
+                                  sample(sensor, now, isWakeUp ? &wakeupEvents : &events));
+        }
+
+        bool toggleDynamicSensors = false;
+        if (mNextDynamicToggleNs != 0) {
+            if (mNextDynamicToggleNs <= now) {
+                toggleDynamicSensors = true;
+                mNextDynamicToggleNs = mDynamicPeriodNs > 0 ? now + mDynamicPeriodNs : 0;
+            }
+            if (mNextDynamicToggleNs != 0) {
+                nextWakeNs = std::min(nextWakeNs, mNextDynamicToggleNs);
+            }
+        }
+
+        if (!events.empty() || !wakeupEvents.empty() || toggleDynamicSensors) {
+            mNumEventsPosted += events.size() + wakeupEvents.size();
+            sp<IHalProxyCallback> callback = mCallback;
+            bool connect = !mDynamicSensorsConnected;
+            lock.unlock();
+            if (!events.empty()) {
+                callback->postEvents(events, callback->createScopedWakelock(false));
+            }
+            if (!wakeupEvents.empty()) {
+                callback->postEvents(wakeupEvents, callback->createScopedWakelock(true));
+            }
+            if (toggleDynamicSensors) {
+                setDynamicSensorsConnected(connect);
+            }
+            lock.lock();
+            continue;
+        }
+
+        if (nextWakeNs == INT64_MAX) {
+            mCV.wait(lock);
+        } else {
+            mCV.wait_for(lock, std::chrono::nanoseconds(nextWakeNs - now));
+        }
+    }
+}
+
+void LoadSubHal::setDynamicSensorsConnected(bool connected) {
+    std::vector<SensorInfo> sensors;
+    std::vector<int32_t> sensorHandles;
+    sp<IHalProxyCallback> callback;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (Sensor& sensor : mSensors) {
+            if (sensor.isDynamic) {
+                sensor.connected = connected;
+                sensor.enabled = false;
+                sensors.push_back(sensor.info);
+                sensorHandles.push_back(sensor.info.sensorHandle);
+            }
+        }
+        mDynamicSensorsConnected = connected;
+        mNumDynamicToggles++;
+        callback = mCallback;
+    }
+    if (sensors.empty()) {
+        return;
+    }
+    if (connected) {
+        callback->onDynamicSensorsConnected_2_1(sensors);
+    } else {
+        callback->onDynamicSensorsDisconnected(sensorHandles);
+    }
+}
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+//! The subhals of the library, created on first use.
+static const std::vector<ISensorsSubHal*>& getSubHals() {
+    static std::vector<std::unique_ptr<LoadSubHal>> sInstances;
+    static const std::vector<ISensorsSubHal*> sSubHals = [] {
+        char instances[PROPERTY_VALUE_MAX];
+        property_get("vendor.sensors.xiaomi.loadgen.instances", instances, "");
+        std::istringstream names(instances);
+        std::string name;
+        while (std::getline(names, name, ',')) {
+            if (!name.empty()) {
+                sInstances.push_back(std::make_unique<LoadSubHal>(name));
+            }
+        }
+        if (sInstances.empty()) {
+            sInstances.push_back(std::make_unique<LoadSubHal>(""));
+        }
+        std::vector<ISensorsSubHal*> subHals;
+        for (const auto& instance : sInstances) {
+            subHals.push_back(instance.get());
+        }
+        return subHals;
+    }();
+    return sSubHals;
+}
+
+ISensorsSubHal* sensorsHalGetSubHal_2_1(uint32_t* version) {
+    *version = SUB_HAL_2_1_VERSION;
+    return getSubHals().front();
+}
+
+extern "C" ISensorsSubHal* const* sensorsHalGetSubHals_2_1(uint32_t* version, size_t* count) {
+    *version = SUB_HAL_2_1_VERSION;
+    *count = getSubHals().size();
+    return getSubHals().data();
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "V2_1/SubHal.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::OperationMode;
+using ::android::hardware::sensors::V1_0::RateLevel;
+using ::android::hardware::sensors::V1_0::Result;
+using ::android::hardware::sensors::V1_0::SharedMemInfo;
+using ::android::hardware::sensors::V2_1::Event;
+using ::android::hardware::sensors::V2_1::implementation::IHalProxyCallback;
+using ::android::hardware::sensors::V2_1::implementation::ISensorsSubHal;
+
+/**
+ * Subhal generating synthetic events to put the HalProxy under controlled load.
+ *
+ * The library provides one subhal per name in vendor.sensors.xiaomi.loadgen.instances, a comma
+ * separated list, each configured by the vendor.sensors.xiaomi.loadgen.<name>.* properties below.
+ * Without that list it provides a single subhal configured by vendor.sensors.xiaomi.loadgen.*.
+ *
+ * The sensors are listed by sensors, a comma separated list of <kind>[:<min_delay_us>[:<fifo>]]
+ * where kind is continuous, wakeup or dynamic (continuous too), for instance
+ * "continuous:1000:64,continuous:20000,wakeup:5000". The min delay and FIFO size default to
+ * min_delay_us and fifo_size. Without sensors, there are num_continuous continuous sensors,
+ * num_wakeup continuous wakeup sensors and num_dynamic dynamic sensors, all with those defaults.
+ * With a FIFO size, sensors hold their events for up to the max report latency like a hardware
+ * FIFO of that size. Dynamic sensors connect on initialize and, with dynamic_period_ms set,
+ * disconnect and connect again every period.
+ *
+ * Every sensor of a subhal is sampled by a single thread, so the subhal itself stays cheap at high
+ * rates while separate subhals post events concurrently.
+ */
+class LoadSubHal : public ISensorsSubHal {
+  public:
+    /**
+     * @param instance The name of the instance whose properties configure the subhal, or empty
+     *    for the vendor.sensors.xiaomi.loadgen.* properties.
+     */
+    explicit LoadSubHal(const std::string& instance);
+    ~LoadSubHal();
+
+    Return<void> getSensorsList_2_1(ISensors::getSensorsList_2_1_cb _hidl_cb);
+    Return<Result> injectSensorData_2_1(const Event& event);
+    Return<Result> initialize(const sp<IHalProxyCallback>& halProxyCallback);
+
+    Return<Result> setOperationMode(OperationMode mode);
+
+    Return<Result> activate(int32_t sensorHandle, bool enabled);
+
+    Return<Result> batch(int32_t sensorHandle, int64_t samplingPeriodNs,
+                         int64_t maxReportLatencyNs);
+
+    Return<Result> flush(int32_t sensorHandle);
+
+    Return<void> registerDirectChannel(const SharedMemInfo& mem,
+                                       ISensors::registerDirectChannel_cb _hidl_cb);
+
+    Return<Result> unregisterDirectChannel(int32_t channelHandle);
+
+    Return<void> configDirectReport(int32_t sensorHandle, int32_t channelHandle, RateLevel rate,
+                                    ISensors::configDirectReport_cb _hidl_cb);
+
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& args);
+
+    const std::string getName() { return mName; }
+
+  private:
+    struct Sensor {
+        SensorInfo info;
+        bool isDynamic = false;
+        bool connected = true;
+        bool enabled = false;
+        int64_t minDelayNs = 0;
+        int64_t samplingPeriodNs = 0;
+        int64_t maxReportLatencyNs = 0;
+        //! The timestamp of the next sample.
+        int64_t nextSampleNs = 0;
+        //! The samples held in the FIFO.
+        std::vector<Event> fifo;
+        //! The number of flush complete events to post after the FIFO.
+        uint32_t numPendingFlushes = 0;
+        uint64_t numSamples = 0;
+    };
+
+    void addSensor(const std::string& name, uint32_t flags, bool isDynamic, int64_t minDelayNs,
+                   int32_t fifoSize);
+
+    /**
+     * Add the sensors of a sensors property.
+     *
+     * @return false if the list is invalid, with the sensors before the invalid one added.
+     */
+    bool addSensors(const std::string& list, int64_t defaultMinDelayNs, int32_t defaultFifoSize);
+
+    //! Find a connected sensor. Requires mMutex.
+    Sensor* findSensor(int32_t sensorHandle);
+
+    //! Sample the sensors and post their events until the subhal is destroyed.
+    void run();
+
+    /**
+     * Take the samples of a sensor due by now, and move its FIFO to events when it must be
+     * reported. Requires mMutex.
+     *
+     * @return The time the sensor must next be looked at.
+     */
+    int64_t sample(Sensor& sensor, int64_t now, std::vector<Event>* events);
+
+    //! Connect or disconnect every dynamic sensor.
+    void setDynamicSensorsConnected(bool connected);
+
+    std::mutex mMutex;
+
+    std::condition_variable mCV;
+
+    //! Never resized after construction, so entries can be referenced without holding mMutex.
+    std::vector<Sensor> mSensors;
+
+    const std::string mName;
+
+    int64_t mDynamicPeriodNs;
+
+    int64_t mNextDynamicToggleNs = 0;
+
+    bool mDynamicSensorsConnected = false;
+
+    sp<IHalProxyCallback> mCallback;
+
+    std::thread mThread;
+
+    bool mStop = false;
+
+    uint64_t mNumEventsPosted = 0;
+
+    uint64_t mNumDynamicToggles = 0;
+};
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "ReplaySubHal.h"
+
+#include <cutils/properties.h>
+#include <log/log.h>
+#include <utils/SystemClock.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+using ::android::hardware::sensors::V2_1::implementation::ISensorsSubHal;
+using ::android::hardware::sensors::V2_1::subhal::implementation::ReplaySubHal;
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+using ::android::hardware::Void;
+using ::android::hardware::sensors::V1_0::MetaDataEventType;
+using ::android::hardware::sensors::V1_0::SensorFlagBits;
+using ::android::hardware::sensors::V2_0::implementation::ScopedWakelock;
+
+ReplaySubHal::ReplaySubHal() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("vendor.sensors.xiaomi.replay.trace", value, "");
+    mTracePath = value;
+    property_get("vendor.sensors.xiaomi.replay.speed", value, "1");
+    mSpeed = strtod(value, nullptr);
+    if (!(mSpeed > 0)) {
+        ALOGW("Invalid replay speed '%s', replaying at the original speed", value);
+        mSpeed = 1.0;
+    }
+    mLoop = property_get_bool("vendor.sensors.xiaomi.replay.loop", false);
+
+    if (mTracePath.empty() || !mTrace.open(mTracePath)) {
+        ALOGW("No event trace to replay");
+        return;
+    }
+    for (const trace::TraceSensor& traceSensor : mTrace.getSensors()) {
+        int32_t sensorHandle = toReplayHandle(traceSensor.sensorHandle >> 24,
+                                              traceSensor.sensorHandle & 0xFFFFFF);
+        SensorInfo& info = mSensors[sensorHandle].info;
+        info.sensorHandle = sensorHandle;
+        info.name = std::string(traceSensor.name, strnlen(traceSensor.name,
+                                                          sizeof(traceSensor.name)));
+        info.vendor = "Replay";
+        info.version = 1;
+        info.type = static_cast<SensorType>(traceSensor.type);
+        info.typeAsString = std::string(
+                traceSensor.typeAsString,
+                strnlen(traceSensor.typeAsString, sizeof(traceSensor.typeAsString)));
+        info.maxRange = traceSensor.maxRange;
+        info.resolution = traceSensor.resolution;
+        info.power = traceSensor.power;
+        info.minDelay = traceSensor.minDelay;
+        info.fifoReservedEventCount = 0;
+        info.fifoMaxEventCount = 0;
+        info.requiredPermission = "";
+        info.maxDelay = traceSensor.maxDelay;
+        // Direct reports are not replayed.
+        info.flags = traceSensor.flags & ~(SensorFlagBits::MASK_DIRECT_REPORT |
+                                           SensorFlagBits::MASK_DIRECT_CHANNEL);
+    }
+    ALOGI("Replaying %zu events of %zu sensors from %s at %.2fx", mTrace.getNumRecords(),
+          mSensors.size(), mTracePath.c_str(), mSpeed);
+}
+
+ReplaySubHal::~ReplaySubHal() {
+    {
+        std::lock_guard<std::mutex> lock(mStopMutex);
+        mStop = true;
+    }
+    mStopCV.notify_all();
+    if (mReplayThread.joinable()) {
+        mReplayThread.join();
+    }
+}
+
+Return<void> ReplaySubHal::getSensorsList_2_1(ISensors::getSensorsList_2_1_cb _hidl_cb) {
+    std::vector<SensorInfo> sensors;
+    for (const auto& [sensorHandle, sensor] : mSensors) {
+        sensors.push_back(sensor.info);
+    }
+    _hidl_cb(sensors);
+    return Void();
+}
+
+Return<Result> ReplaySubHal::setOperationMode(OperationMode mode) {
+    return mode == OperationMode::NORMAL ? Result::OK : Result::BAD_VALUE;
+}
+
+Return<Result> ReplaySubHal::activate(int32_t sensorHandle, bool enabled) {
+    auto sensor = mSensors.find(sensorHandle);
+    if (sensor != mSensors.end()) {
+        sensor->second.active.store(enabled);
+        return Result::OK;
+    }
+    return Result::BAD_VALUE;
+}
+
+Return<Result> ReplaySubHal::batch(int32_t sensorHandle, int64_t /* samplingPeriodNs */,
+                                   int64_t /* maxReportLatencyNs */) {
+    return mSensors.count(sensorHandle) > 0 ? Result::OK : Result::BAD_VALUE;
+}
+
+Return<Result> ReplaySubHal::flush(int32_t sensorHandle) {
+    auto sensor = mSensors.find(sensorHandle);
+    if (sensor == mSensors.end() || !sensor->second.active.load()) {
+        return Result::BAD_VALUE;
+    }
+    Event event;
+    event.sensorHandle = sensorHandle;
+    event.sensorType = SensorType::META_DATA;
+    event.u.meta.what = MetaDataEventType::META_DATA_FLUSH_COMPLETE;
+    postEvents({event}, (sensor->second.info.flags & SensorFlagBits::WAKE_UP) != 0);
+    return Result::OK;
+}
+
+Return<Result> ReplaySubHal::injectSensorData_2_1(const Event& /* event */) {
+    return Result::INVALID_OPERATION;
+}
+
+Return<void> ReplaySubHal::registerDirectChannel(const SharedMemInfo& /* mem */,
+                                                 ISensors::registerDirectChannel_cb _hidl_cb) {
+    _hidl_cb(Result::INVALID_OPERATION, -1 /* channelHandle */);
+    return Return<void>();
+}
+
+Return<Result> ReplaySubHal::unregisterDirectChannel(int32_t /* channelHandle */) {
+    return Result::INVALID_OPERATION;
+}
+
+Return<void> ReplaySubHal::configDirectReport(int32_t /* sensorHandle */,
+                                              int32_t /* channelHandle */, RateLevel /* rate */,
+                                              ISensors::configDirectReport_cb _hidl_cb) {
+    _hidl_cb(Result::INVALID_OPERATION, 0 /* reportToken */);
+    return Return<void>();
+}
+
+Return<void> ReplaySubHal::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& /* args */) {
+    if (fd.getNativeHandle() == nullptr || fd->numFds < 1) {
+        ALOGE("%s: missing fd for writing", __FUNCTION__);
+        return Void();
+    }
+
+    FILE* out = fdopen(dup(fd->data[0]), "w");
+
+    std::ostringstream stream;
+    stream << "Trace: " << (mTracePath.empty() ? "none" : mTracePath) << std::endl;
+    stream << "Events in trace: " << mTrace.getNumRecords() << std::endl;
+    stream << "Speed: " << mSpeed << "x" << (mLoop ? ", looping" : "") << std::endl;
+    stream << "Events posted: " << mNumEventsPosted.load() << std::endl;
+    stream << "Complete passes: " << mNumPasses.load() << std::endl;
+    stream << "Active sensors:" << std::endl;
+    for (const auto& [sensorHandle, sensor] : mSensors) {
+        if (sensor.active.load()) {
+            stream << "  0x" << std::hex << sensorHandle << std::dec << " " << sensor.info.name
+                   << std::endl;
+        }
+    }
+    stream << std::endl;
+
+    fprintf(out, "%s", stream.str().c_str());
+
+    fclose(out);
+    return Return<void>();
+}
+
+Return<Result> ReplaySubHal::initialize(const sp<IHalProxyCallback>& halProxyCallback) {
+    // The framework restarting initializes the subhal again, which restarts the replay.
+    {
+        std::lock_guard<std::mutex> lock(mStopMutex);
+        mStop = true;
+    }
+    mStopCV.notify_all();
+    if (mReplayThread.joinable()) {
+        mReplayThread.join();
+    }
+    mStop = false;
+    mCallback = halProxyCallback;
+    if (mTrace.getNumRecords() > 0) {
+        mReplayThread = std::thread(&ReplaySubHal::replay, this);
+    }
+    return Result::OK;
+}
+
+void ReplaySubHal::replay() {
+    size_t numRecords = mTrace.getNumRecords();
+    int64_t firstArrivalNs = mTrace.getRecord(0).arrivalNs;
+    do {
+        // Arrival times and event timestamps are both moved to now, then scaled by the speed.
+        int64_t replayStartNs = elapsedRealtimeNano();
+        auto toReplayTime = [&](int64_t traceNs) {
+            return replayStartNs + static_cast<int64_t>((traceNs - firstArrivalNs) / mSpeed);
+        };
+        size_t i = 0;
+        while (i < numRecords) {
+            // Events posted together by a subhal were traced with the same arrival time.
+            const trace::TraceRecord& first = mTrace.getRecord(i);
+            if (!sleepUntil(toReplayTime(first.arrivalNs))) {
+                return;
+            }
+            std::vector<Event> events;
+            bool wakeup = false;
+            for (; i < numRecords; i++) {
+                const trace::TraceRecord& record = mTrace.getRecord(i);
+                if (record.arrivalNs != first.arrivalNs ||
+                    record.subHalIndex != first.subHalIndex) {
+                    break;
+                }
+                // Flushes are answered by flush() and dynamic sensors are replayed as static ones.
+                SensorType sensorType = static_cast<SensorType>(record.sensorType);
+                if (sensorType == SensorType::META_DATA ||
+                    sensorType == SensorType::DYNAMIC_SENSOR_META) {
+                    continue;
+                }
+                auto sensor =
+                        mSensors.find(toReplayHandle(record.subHalIndex, record.sensorHandle));
+                if (sensor == mSensors.end() || !sensor->second.active.load()) {
+                    continue;
+                }
+                Event event = trace::toEvent(record);
+                event.sensorHandle = sensor->first;
+                event.timestamp = toReplayTime(record.timestamp);
+                wakeup |= (sensor->second.info.flags & SensorFlagBits::WAKE_UP) != 0;
+                events.push_back(event);
+            }
+            if (!events.empty()) {
+                postEvents(events, wakeup);
+            }
+        }
+        mNumPasses++;
+    } while (mLoop);
+}
+
+bool ReplaySubHal::sleepUntil(int64_t deadlineNs) {
+    std::unique_lock<std::mutex> lock(mStopMutex);
+    while (!mStop) {
+        int64_t now = elapsedRealtimeNano();
+        if (now >= deadlineNs) {
+            return true;
+        }
+        mStopCV.wait_for(lock, std::chrono::nanoseconds(deadlineNs - now));
+    }
+    return false;
+}
+
+void ReplaySubHal::postEvents(const std::vector<Event>& events, bool wakeup) {
+    ScopedWakelock wakelock = mCallback->createScopedWakelock(wakeup);
+    mCallback->postEvents(events, std::move(wakelock));
+    mNumEventsPosted += events.size();
+}
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
+
+ISensorsSubHal* sensorsHalGetSubHal_2_1(uint32_t* version) {
+    static ReplaySubHal subHal;
+    *version = SUB_HAL_2_1_VERSION;
+    return &subHal;
+}
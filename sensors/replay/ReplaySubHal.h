@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "EventTrace.h"
+#include "V2_1/SubHal.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+using ::android::hardware::sensors::V1_0::OperationMode;
+using ::android::hardware::sensors::V1_0::RateLevel;
+using ::android::hardware::sensors::V1_0::Result;
+using ::android::hardware::sensors::V1_0::SharedMemInfo;
+using ::android::hardware::sensors::V2_1::Event;
+using ::android::hardware::sensors::V2_1::implementation::IHalProxyCallback;
+using ::android::hardware::sensors::V2_1::implementation::ISensorsSubHal;
+
+/**
+ * Subhal exposing every sensor of an event trace and posting the traced events of its active
+ * sensors with their original timing, or sped up.
+ *
+ * The trace is set by vendor.sensors.xiaomi.replay.trace, the speed factor by
+ * vendor.sensors.xiaomi.replay.speed and whether to start over at the end of the trace by
+ * vendor.sensors.xiaomi.replay.loop. Sampling rates are those of the trace, whatever the batch
+ * calls ask for.
+ */
+class ReplaySubHal : public ISensorsSubHal {
+  public:
+    ReplaySubHal();
+    ~ReplaySubHal();
+
+    Return<void> getSensorsList_2_1(ISensors::getSensorsList_2_1_cb _hidl_cb);
+    Return<Result> injectSensorData_2_1(const Event& event);
+    Return<Result> initialize(const sp<IHalProxyCallback>& halProxyCallback);
+
+    Return<Result> setOperationMode(OperationMode mode);
+
+    Return<Result> activate(int32_t sensorHandle, bool enabled);
+
+    Return<Result> batch(int32_t sensorHandle, int64_t samplingPeriodNs,
+                         int64_t maxReportLatencyNs);
+
+    Return<Result> flush(int32_t sensorHandle);
+
+    Return<void> registerDirectChannel(const SharedMemInfo& mem,
+                                       ISensors::registerDirectChannel_cb _hidl_cb);
+
+    Return<Result> unregisterDirectChannel(int32_t channelHandle);
+
+    Return<void> configDirectReport(int32_t sensorHandle, int32_t channelHandle, RateLevel rate,
+                                    ISensors::configDirectReport_cb _hidl_cb);
+
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& args);
+
+    const std::string getName() { return "ReplaySubHal"; }
+
+  private:
+    struct Sensor {
+        SensorInfo info;
+        std::atomic_bool active = false;
+    };
+
+    /**
+     * Map a sensor of the trace to the handle this subhal reports it with.
+     *
+     * @param subHalIndex The index of the subhal the sensor belonged to when traced.
+     * @param sensorHandle The handle of the sensor within that subhal.
+     */
+    static int32_t toReplayHandle(uint32_t subHalIndex, int32_t sensorHandle) {
+        return static_cast<int32_t>(subHalIndex << 16) | (sensorHandle & 0xFFFF);
+    }
+
+    //! Post the traced events until the end of the trace, or forever when looping.
+    void replay();
+
+    /**
+     * Sleep until deadlineNs on the elapsed realtime clock.
+     *
+     * @return false if the subhal is being destroyed.
+     */
+    bool sleepUntil(int64_t deadlineNs);
+
+    void postEvents(const std::vector<Event>& events, bool wakeup);
+
+    trace::EventTraceReader mTrace;
+
+    std::string mTracePath;
+
+    double mSpeed = 1.0;
+
+    bool mLoop = false;
+
+    //! The sensors of the trace, keyed by replay handle. Never resized after construction.
+    std::map<int32_t, Sensor> mSensors;
+
+    sp<IHalProxyCallback> mCallback;
+
+    std::thread mReplayThread;
+
+    std::mutex mStopMutex;
+
+    std::condition_variable mStopCV;
+
+    bool mStop = false;
+
+    std::atomic<uint64_t> mNumEventsPosted = 0;
+
+    std::atomic<uint64_t> mNumPasses = 0;
+};
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "EventTrace.h"
+
+#include <log/log.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstring>
+#include <thread>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace trace {
+
+V2_1::Event toEvent(const TraceRecord& record) {
+    V2_1::Event event;
+    event.timestamp = record.timestamp;
+    event.sensorHandle = record.sensorHandle;
+    event.sensorType = static_cast<V2_1::SensorType>(record.sensorType);
+    memcpy(&event.u, record.payload, sizeof(event.u));
+    return event;
+}
+
+bool EventTraceWriter::start(const std::string& path, size_t maxRecords,
+                             const std::vector<TraceSensor>& sensors, int64_t startNs) {
+    if (mActive.load() || mMapping != nullptr) {
+        return false;
+    }
+    int fd = TEMP_FAILURE_RETRY(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0660));
+    if (fd < 0) {
+        ALOGE("Failed to create %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    size_t recordsOffset = sizeof(TraceHeader) + sensors.size() * sizeof(TraceSensor);
+    // Records are aligned so they can be read in place.
+    recordsOffset = (recordsOffset + alignof(TraceRecord) - 1) & ~(alignof(TraceRecord) - 1);
+    size_t size = recordsOffset + maxRecords * sizeof(TraceRecord);
+    void* mapping = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+        mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (mapping == MAP_FAILED) {
+        ALOGE("Failed to map %s: %s", path.c_str(), strerror(errno));
+        close(fd);
+        unlink(path.c_str());
+        return false;
+    }
+
+    mPath = path;
+    mFd = fd;
+    mMapping = static_cast<uint8_t*>(mapping);
+    mMappingSize = size;
+    TraceHeader header = {kTraceMagic, kTraceVersion, static_cast<uint32_t>(sensors.size()),
+                          sizeof(TraceRecord), startNs};
+    memcpy(mMapping, &header, sizeof(header));
+    memcpy(mMapping + sizeof(header), sensors.data(), sensors.size() * sizeof(TraceSensor));
+    mRecords = reinterpret_cast<TraceRecord*>(mMapping + recordsOffset);
+    mMaxRecords = maxRecords;
+    mNextRecord.store(0);
+    mNumDropped.store(0);
+    mActive.store(true);
+    return true;
+}
+
+void EventTraceWriter::stop() {
+    if (!mActive.exchange(false)) {
+        return;
+    }
+    // Appends that saw the trace active finish before the mapping goes away.
+    while (mNumAppending.load() > 0) {
+        std::this_thread::yield();
+    }
+    size_t numRecords = getNumRecords();
+    size_t used = reinterpret_cast<uint8_t*>(mRecords + numRecords) - mMapping;
+    msync(mMapping, used, MS_SYNC);
+    munmap(mMapping, mMappingSize);
+    if (ftruncate(mFd, used) != 0) {
+        ALOGW("Failed to truncate %s: %s", mPath.c_str(), strerror(errno));
+    }
+    close(mFd);
+    mFd = -1;
+    mMapping = nullptr;
+    mRecords = nullptr;
+    ALOGI("Traced %zu events to %s, dropped %" PRIu64, numRecords, mPath.c_str(),
+          mNumDropped.load());
+}
+
+void EventTraceWriter::append(const V2_1::Event& event, uint32_t subHalIndex, bool isWakeUp,
+                              int64_t arrivalNs) {
+    mNumAppending.fetch_add(1, std::memory_order_seq_cst);
+    if (mActive.load(std::memory_order_seq_cst)) {
+        uint64_t index = mNextRecord.fetch_add(1, std::memory_order_relaxed);
+        if (index < mMaxRecords) {
+            TraceRecord& record = mRecords[index];
+            record.arrivalNs = arrivalNs;
+            record.timestamp = event.timestamp;
+            record.sensorHandle = event.sensorHandle;
+            record.sensorType = static_cast<int32_t>(event.sensorType);
+            record.subHalIndex = subHalIndex;
+            memcpy(record.payload, &event.u, sizeof(event.u));
+            // Readers of a trace cut short by a crash stop at the first record without this flag.
+            __atomic_store_n(&record.flags, kRecordValid | (isWakeUp ? kRecordWakeUp : 0),
+                             __ATOMIC_RELEASE);
+        } else {
+            mNumDropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    mNumAppending.fetch_sub(1, std::memory_order_release);
+}
+
+uint64_t EventTraceWriter::getNumRecords() const {
+    return std::min<uint64_t>(mNextRecord.load(std::memory_order_relaxed), mMaxRecords);
+}
+
+EventTraceReader::~EventTraceReader() {
+    if (mMapping != nullptr) {
+        munmap(mMapping, mMappingSize);
+    }
+}
+
+bool EventTraceReader::open(const std::string& path) {
+    int fd = TEMP_FAILURE_RETRY(::open(path.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(TraceHeader)) {
+        ALOGE("Failed to open trace %s", path.c_str());
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    mMappingSize = st.st_size;
+    mMapping = mmap(nullptr, mMappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mMapping == MAP_FAILED) {
+        mMapping = nullptr;
+        ALOGE("Failed to map trace %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    const uint8_t* data = static_cast<const uint8_t*>(mMapping);
+    TraceHeader header;
+    memcpy(&header, data, sizeof(header));
+    size_t recordsOffset = sizeof(TraceHeader) + header.numSensors * sizeof(TraceSensor);
+    recordsOffset = (recordsOffset + alignof(TraceRecord) - 1) & ~(alignof(TraceRecord) - 1);
+    if (header.magic != kTraceMagic || header.version != kTraceVersion ||
+        header.recordSize != sizeof(TraceRecord) || recordsOffset > mMappingSize) {
+        ALOGE("%s is not a supported trace", path.c_str());
+        return false;
+    }
+    mSensors.resize(header.numSensors);
+    memcpy(mSensors.data(), data + sizeof(header), header.numSensors * sizeof(TraceSensor));
+    mStartNs = header.startNs;
+    mRecords = reinterpret_cast<const TraceRecord*>(data + recordsOffset);
+    size_t maxRecords = (mMappingSize - recordsOffset) / sizeof(TraceRecord);
+    mNumRecords = 0;
+    while (mNumRecords < maxRecords && (mRecords[mNumRecords].flags & kRecordValid) != 0) {
+        mNumRecords++;
+    }
+    return true;
+}
+
+}  // namespace trace
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <android/hardware/sensors/2.1/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace trace {
+
+/*
+ * A trace file is a TraceHeader, followed by header.numSensors TraceSensors describing every
+ * sensor the HalProxy knew when the trace started, followed by TraceRecords until the end of the
+ * file or the first record without kRecordValid.
+ */
+
+static constexpr uint32_t kTraceMagic = 0x52544e53;  // "SNTR"
+static constexpr uint32_t kTraceVersion = 1;
+
+struct TraceHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numSensors;
+    uint32_t recordSize;
+    //! When the trace started, on the event timestamp clock.
+    int64_t startNs;
+};
+
+struct TraceSensor {
+    //! The sensor handle as reported to the framework, with the subhal index in its top byte.
+    int32_t sensorHandle;
+    int32_t type;
+    uint32_t flags;
+    int32_t minDelay;
+    int32_t maxDelay;
+    float maxRange;
+    float resolution;
+    float power;
+    char name[64];
+    char typeAsString[64];
+};
+
+static constexpr uint32_t kRecordValid = 1 << 0;
+static constexpr uint32_t kRecordWakeUp = 1 << 1;
+
+struct TraceRecord {
+    //! When the HalProxy received the event, on the event timestamp clock.
+    int64_t arrivalNs;
+    int64_t timestamp;
+    //! The sensor handle as posted by the subhal.
+    int32_t sensorHandle;
+    int32_t sensorType;
+    uint32_t subHalIndex;
+    uint32_t flags;
+    uint8_t payload[64];
+};
+
+static_assert(sizeof(TraceRecord) == 96);
+static_assert(sizeof(V2_1::Event::u) <= sizeof(TraceRecord::payload));
+
+//! Convert a recorded event back into an event, keeping its recorded timestamp.
+V2_1::Event toEvent(const TraceRecord& record);
+
+/**
+ * Appends events to a memory mapped trace file of fixed capacity, from any number of threads and
+ * without taking a lock. Events appended once the file is full are counted as dropped.
+ */
+class EventTraceWriter {
+  public:
+    ~EventTraceWriter() { stop(); }
+
+    /**
+     * Create the trace file and start tracing.
+     *
+     * @param path The file to write.
+     * @param maxRecords The number of records to make room for.
+     * @param sensors The sensors to describe in the trace.
+     * @param startNs The current time, on the event timestamp clock.
+     *
+     * @return false if tracing is already active or the file could not be created.
+     */
+    bool start(const std::string& path, size_t maxRecords, const std::vector<TraceSensor>& sensors,
+               int64_t startNs);
+
+    //! Stop tracing and truncate the file to the records written.
+    void stop();
+
+    bool isActive() const { return mActive.load(std::memory_order_relaxed); }
+
+    /**
+     * Append an event, if tracing is active.
+     *
+     * @param event The event as posted by the subhal.
+     * @param subHalIndex The index of the subhal that posted the event.
+     * @param isWakeUp Whether the event is a wakeup event.
+     * @param arrivalNs When the HalProxy received the event, on the event timestamp clock.
+     */
+    void append(const V2_1::Event& event, uint32_t subHalIndex, bool isWakeUp, int64_t arrivalNs);
+
+    uint64_t getNumRecords() const;
+
+    uint64_t getNumDropped() const { return mNumDropped.load(std::memory_order_relaxed); }
+
+    const std::string& getPath() const { return mPath; }
+
+  private:
+    std::atomic_bool mActive = false;
+
+    //! The number of append() calls that may still be using the mapping.
+    std::atomic<uint32_t> mNumAppending = 0;
+
+    std::atomic<uint64_t> mNextRecord = 0;
+
+    std::atomic<uint64_t> mNumDropped = 0;
+
+    std::string mPath;
+
+    int mFd = -1;
+
+    uint8_t* mMapping = nullptr;
+
+    size_t mMappingSize = 0;
+
+    TraceRecord* mRecords = nullptr;
+
+    size_t mMaxRecords = 0;
+};
+
+//! Maps a trace file for reading.
+class EventTraceReader {
+  public:
+    ~EventTraceReader();
+
+    //! @return false if the file could not be mapped or is not a trace.
+    bool open(const std::string& path);
+
+    const std::vector<TraceSensor>& getSensors() const { return mSensors; }
+
+    int64_t getStartNs() const { return mStartNs; }
+
+    size_t getNumRecords() const { return mNumRecords; }
+
+    const TraceRecord& getRecord(size_t index) const { return mRecords[index]; }
+
+  private:
+    void* mMapping = nullptr;
+
+    size_t mMappingSize = 0;
+
+    std::vector<TraceSensor> mSensors;
+
+    int64_t mStartNs = 0;
+
+    const TraceRecord* mRecords = nullptr;
+
+    size_t mNumRecords = 0;
+};
+
+}  // namespace trace
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
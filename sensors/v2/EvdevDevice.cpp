@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "EvdevDevice.h"
+
+#include "EventLoop.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <linux/input.h>
+#include <log/log.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <utils/SystemClock.h>
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+namespace {
+
+constexpr char kInputDir[] = "/dev/input";
+
+// The most events read at once.
+constexpr size_t kReadBatch = 64;
+
+int openNode(const std::string& path) {
+    return ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+}
+
+// Open the event node of the input device with the given name.
+int openByName(const std::string& name) {
+    DIR* dir = opendir(kInputDir);
+    if (dir == nullptr) {
+        return -1;
+    }
+    int fd = -1;
+    while (struct dirent* entry = readdir(dir)) {
+        if (strncmp(entry->d_name, "event", 5) != 0) {
+            continue;
+        }
+        fd = openNode(std::string(kInputDir) + "/" + entry->d_name);
+        if (fd < 0) {
+            continue;
+        }
+        char deviceName[256] = {};
+        if (ioctl(fd, EVIOCGNAME(sizeof(deviceName) - 1), deviceName) >= 0 && name == deviceName) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    closedir(dir);
+    return fd;
+}
+
+}  // anonymous namespace
+
+std::shared_ptr<EvdevDevice> EvdevDevice::open(const std::string& device, EventLoop* loop) {
+    static std::mutex sMutex;
+    static std::map<std::string, std::weak_ptr<EvdevDevice>> sDevices;
+
+    std::lock_guard<std::mutex> lock(sMutex);
+    std::shared_ptr<EvdevDevice> shared = sDevices[device].lock();
+    if (shared) {
+        return shared;
+    }
+
+    int fd = device[0] == '/' ? openNode(device) : openByName(device);
+    if (fd < 0) {
+        ALOGE("failed to open input device %s", device.c_str());
+        return nullptr;
+    }
+
+    int clock = CLOCK_BOOTTIME;
+    bool kernelTimestamps = ioctl(fd, EVIOCSCLOCKID, &clock) == 0;
+    if (!kernelTimestamps) {
+        ALOGE("failed to set the clock of input device %s: %s", device.c_str(), strerror(errno));
+    }
+
+    shared.reset(new EvdevDevice(fd, loop, kernelTimestamps));
+    sDevices[device] = shared;
+    return shared;
+}
+
+EvdevDevice::EvdevDevice(int fd, EventLoop* loop, bool kernelTimestamps)
+    : mLoop(loop), mFd(fd), mKernelTimestamps(kernelTimestamps), mX(0), mY(0), mDropping(false) {}
+
+EvdevDevice::~EvdevDevice() {
+    mLoop->remove(mFd);
+    close(mFd);
+}
+
+void EvdevDevice::subscribe(uint16_t type, uint16_t code, Listener listener) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    bool first = mSubscriptions.empty();
+    Subscription& subscription = mSubscriptions[{type, code}];
+    subscription.listener = std::make_shared<Listener>(std::move(listener));
+    if (first) {
+        // Gestures made while nothing was subscribed are stale.
+        readEvents(false /* dispatch */);
+        mLoop->add(mFd, EPOLLIN,
+                   [this](uint32_t /* events */) { readEvents(true /* dispatch */); });
+    }
+}
+
+void EvdevDevice::unsubscribe(uint16_t type, uint16_t code) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mSubscriptions.erase({type, code}) != 0 && mSubscriptions.empty()) {
+        mLoop->remove(mFd);
+    }
+}
+
+void EvdevDevice::readEvents(bool dispatch) {
+    struct input_event events[kReadBatch];
+
+    while (true) {
+        ssize_t size = read(mFd, events, sizeof(events));
+        if (size <= 0) {
+            if (size < 0 && errno != EAGAIN && errno != EINTR) {
+                ALOGE("failed to read input events: %s", strerror(errno));
+            }
+            return;
+        }
+        if (!dispatch) {
+            continue;
+        }
+
+        size_t count = size / sizeof(struct input_event);
+        for (size_t i = 0; i < count; i++) {
+            const struct input_event& event = events[i];
+            if (event.type == EV_SYN) {
+                if (event.code == SYN_DROPPED) {
+                    mDropping = true;
+                } else if (event.code == SYN_REPORT) {
+                    if (!mDropping) {
+                        for (const auto& [listener, timestampNs] : mPending) {
+                            (*listener)(timestampNs, mX, mY);
+                        }
+                    }
+                    mPending.clear();
+                    mDropping = false;
+                }
+                continue;
+            }
+
+            if (event.type == EV_ABS) {
+                if (event.code == ABS_MT_POSITION_X || event.code == ABS_X) {
+                    mX = event.value;
+                } else if (event.code == ABS_MT_POSITION_Y || event.code == ABS_Y) {
+                    mY = event.value;
+                }
+            }
+
+            std::shared_ptr<Listener> listener;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                auto it = mSubscriptions.find({event.type, event.code});
+                if (it == mSubscriptions.end()) {
+                    continue;
+                }
+                bool triggered = event.type == EV_KEY ? event.value == 1
+                                                      : event.value > 0 && it->second.value <= 0;
+                it->second.value = event.value;
+                if (triggered) {
+                    listener = it->second.listener;
+                }
+            }
+            if (listener) {
+                int64_t timestampNs = mKernelTimestamps
+                                              ? event.input_event_sec * 1000000000LL +
+                                                        event.input_event_usec * 1000LL
+                                              : ::android::elapsedRealtimeNano();
+                mPending.emplace_back(listener, timestampNs);
+            }
+        }
+    }
+}
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
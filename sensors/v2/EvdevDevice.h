@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+class EventLoop;
+
+/**
+ * An input device reporting gestures as key or axis events, read in batches on the event loop and
+ * shared by every sensor of the device.
+ *
+ * Event times come from the kernel, on CLOCK_BOOTTIME like sensor events. The device is only on
+ * the event loop while a gesture is subscribed to, and events queued before are discarded. Like
+ * event loop handlers, listeners run on the loop thread without any lock of the device held and
+ * may run once after unsubscribe() returns.
+ */
+class EvdevDevice {
+  public:
+    //! Called for a gesture with the kernel time of its event and the last touch position.
+    using Listener = std::function<void(int64_t timestampNs, int32_t x, int32_t y)>;
+
+    /**
+     * Get an input device.
+     *
+     * @param device The path of the event node, or the name of the device.
+     * @param loop The event loop to read the device on.
+     *
+     * @return The device, shared with every other caller for the same device, or nullptr if it
+     *    cannot be opened.
+     */
+    static std::shared_ptr<EvdevDevice> open(const std::string& device, EventLoop* loop);
+
+    ~EvdevDevice();
+
+    /**
+     * Call a listener for the presses of a key, or an axis turning positive.
+     *
+     * @param type EV_KEY or EV_ABS.
+     * @param code The key or axis code.
+     * @param listener Called on the loop thread at the end of the report holding the event.
+     */
+    void subscribe(uint16_t type, uint16_t code, Listener listener);
+
+    void unsubscribe(uint16_t type, uint16_t code);
+
+  private:
+    struct Subscription {
+        std::shared_ptr<Listener> listener;
+        //! The last value of the key or axis.
+        int32_t value = 0;
+    };
+
+    EvdevDevice(int fd, EventLoop* loop, bool kernelTimestamps);
+
+    //! Read every queued event, dispatching them if asked to.
+    void readEvents(bool dispatch);
+
+    EventLoop* mLoop;
+
+    int mFd;
+
+    //! Whether event times are on CLOCK_BOOTTIME, else the time of the read is used.
+    bool mKernelTimestamps;
+
+    std::mutex mMutex;
+
+    std::map<std::pair<uint16_t, uint16_t>, Subscription> mSubscriptions;
+
+    //! The last touch position, only used by the loop thread.
+    int32_t mX;
+    int32_t mY;
+
+    //! Whether events are being dropped until the next report after the kernel dropped some.
+    bool mDropping;
+
+    //! The gestures of the current report, only used by the loop thread.
+    std::vector<std::pair<std::shared_ptr<Listener>, int64_t>> mPending;
+};
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
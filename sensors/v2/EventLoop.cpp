@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "EventLoop.h"
+
+#include <log/log.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+namespace {
+
+constexpr int kMaxEvents = 8;
+
+}  // anonymous namespace
+
+EventLoop::EventLoop() : mEpollFd(-1), mWakeFd(-1), mStop(false), mScheduler(this) {}
+
+EventLoop::~EventLoop() {
+    stop();
+    if (mWakeFd >= 0) {
+        close(mWakeFd);
+    }
+    if (mEpollFd >= 0) {
+        close(mEpollFd);
+        mEpollFd = -1;
+    }
+}
+
+bool EventLoop::start(const std::string& name) {
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0) {
+        ALOGE("failed to create epoll set: %s", strerror(errno));
+        return false;
+    }
+
+    mWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (mWakeFd < 0) {
+        ALOGE("failed to create eventfd: %s", strerror(errno));
+        return false;
+    }
+
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = mWakeFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mWakeFd, &event) < 0) {
+        ALOGE("failed to add eventfd: %s", strerror(errno));
+        return false;
+    }
+
+    mThread = std::thread(&EventLoop::run, this);
+    pthread_setname_np(mThread.native_handle(), name.substr(0, 15).c_str());
+    return true;
+}
+
+void EventLoop::stop() {
+    if (!mThread.joinable()) {
+        return;
+    }
+    mStop = true;
+    uint64_t value = 1;
+    if (write(mWakeFd, &value, sizeof(value)) != sizeof(value)) {
+        ALOGE("failed to interrupt event loop: %s", strerror(errno));
+    }
+    mThread.join();
+}
+
+bool EventLoop::add(int fd, uint32_t events, Handler handler) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mEpollFd < 0) {
+        return false;
+    }
+
+    struct epoll_event event = {};
+    event.events = events;
+    event.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        ALOGE("failed to add fd %d to event loop: %s", fd, strerror(errno));
+        return false;
+    }
+    mHandlers[fd] = std::make_shared<Handler>(std::move(handler));
+    return true;
+}
+
+void EventLoop::remove(int fd) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mHandlers.erase(fd) == 0 || mEpollFd < 0) {
+        return;
+    }
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, nullptr) < 0) {
+        ALOGE("failed to remove fd %d from event loop: %s", fd, strerror(errno));
+    }
+}
+
+void EventLoop::run() {
+    struct epoll_event events[kMaxEvents];
+
+    while (!mStop) {
+        int count = epoll_wait(mEpollFd, events, kMaxEvents, -1 /* timeout */);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ALOGE("failed to wait for events: %s", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < count && !mStop; i++) {
+            int fd = events[i].data.fd;
+            if (fd == mWakeFd) {
+                uint64_t value;
+                read(mWakeFd, &value, sizeof(value));
+                continue;
+            }
+
+            std::shared_ptr<Handler> handler;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                auto it = mHandlers.find(fd);
+                if (it != mHandlers.end()) {
+                    handler = it->second;
+                }
+            }
+            if (handler) {
+                (*handler)(events[i].events);
+            }
+        }
+    }
+}
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "SamplingScheduler.h"
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+/**
+ * A single thread waiting on an epoll set for every sensor of the subhal, so sensors are handlers
+ * of their file descriptors rather than threads of their own.
+ *
+ * Handlers run on the loop thread without any lock of the loop held, so they may add and remove
+ * file descriptors themselves. As remove() does not wait for a running handler, a handler may still
+ * run once after its file descriptor was removed by another thread and must check the state of its
+ * sensor.
+ */
+class EventLoop {
+  public:
+    //! Handles the epoll events of a file descriptor.
+    using Handler = std::function<void(uint32_t events)>;
+
+    EventLoop();
+    ~EventLoop();
+
+    /**
+     * Start the loop thread.
+     *
+     * @param name The name of the thread.
+     *
+     * @return false if the epoll set could not be created.
+     */
+    bool start(const std::string& name);
+
+    //! Stop and join the loop thread. No handler runs once this returns.
+    void stop();
+
+    /**
+     * Wait for epoll events of a file descriptor, level triggered.
+     *
+     * @param fd The file descriptor, owned by the caller until removed.
+     * @param events The epoll events to wait for.
+     * @param handler Called on the loop thread with the events that happened.
+     *
+     * @return false if the file descriptor could not be added.
+     */
+    bool add(int fd, uint32_t events, Handler handler);
+
+    //! Stop waiting for events of a file descriptor.
+    void remove(int fd);
+
+    //! The scheduler of periodic sensors, sampling on the loop thread.
+    SamplingScheduler* getScheduler() { return &mScheduler; }
+
+  private:
+    void run();
+
+    int mEpollFd;
+
+    //! An eventfd interrupting epoll_wait() to stop the loop.
+    int mWakeFd;
+
+    std::mutex mMutex;
+
+    //! The handlers by file descriptor, shared so the loop can call them without mMutex.
+    std::unordered_map<int, std::shared_ptr<Handler>> mHandlers;
+
+    std::thread mThread;
+
+    std::atomic_bool mStop;
+
+    //! Declared last, as it removes its timerfd from the loop when destroyed.
+    SamplingScheduler mScheduler;
+};
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
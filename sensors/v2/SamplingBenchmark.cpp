@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Samples periodic sensors through the SamplingScheduler of an event loop, with a callback
+ * recording the event timestamps in place of the HalProxy, and reports how far samples land from
+ * their deadlines and how many wakeups they took.
+ *
+ * Usage: sensors.xiaomi.v2-sampling-benchmark [--period-us <us>[,<us>]...] [--duration <seconds>]
+ *
+ * Every period is sampled by a sensor of its own. Deadlines are the multiples of the period since
+ * boot, so the lateness of a sample is its timestamp minus the nearest multiple, negative for
+ * samples taken early by a coalesced wakeup. The interval error is how far two consecutive samples
+ * are from one period apart.
+ */
+
+#include "EventLoop.h"
+#include "Sensor.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using ::android::hardware::sensors::V2_1::Event;
+using ::android::hardware::sensors::V2_1::SensorType;
+using ::android::hardware::sensors::V2_1::subhal::implementation::EventLoop;
+using ::android::hardware::sensors::V2_1::subhal::implementation::ISensorsEventCallback;
+using ::android::hardware::sensors::V2_1::subhal::implementation::SamplingScheduler;
+using ::android::hardware::sensors::V2_1::subhal::implementation::Sensor;
+
+namespace {
+
+class BenchmarkSensor : public Sensor {
+  public:
+    BenchmarkSensor(int32_t sensorHandle, ISensorsEventCallback* callback, EventLoop* loop)
+        : Sensor(sensorHandle, callback, loop) {
+        mSensorInfo.name = "Benchmark Sensor " + std::to_string(sensorHandle);
+        mSensorInfo.type = SensorType::ACCELEROMETER;
+        mSensorInfo.typeAsString = "";
+        mSensorInfo.minDelay = 1000;
+    }
+};
+
+// Stands in for the HalProxy, only ever called on the loop thread.
+class RecordingCallback : public ISensorsEventCallback {
+  public:
+    void postEvents(const std::vector<Event>& events, bool /* wakeup */) override {
+        for (const Event& event : events) {
+            mTimestamps[event.sensorHandle].push_back(event.timestamp);
+        }
+    }
+
+    std::map<int32_t, std::vector<int64_t>> mTimestamps;
+};
+
+int64_t percentile(std::vector<int64_t> values, int percent) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    return values[(values.size() - 1) * percent / 100];
+}
+
+void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--period-us <us>[,<us>]...] [--duration <seconds>]\n", name);
+}
+
+}  // anonymous namespace
+
+int main(int argc, char** argv) {
+    std::vector<int64_t> periodsUs = {5000, 10000, 20000, 66667, 200000};
+    int durationS = 10;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--period-us") && i + 1 < argc) {
+            periodsUs.clear();
+            std::stringstream list(argv[++i]);
+            std::string period;
+            while (std::getline(list, period, ',')) {
+                periodsUs.push_back(std::max(atoll(period.c_str()), 1000LL));
+            }
+        } else if (!strcmp(argv[i], "--duration") && i + 1 < argc) {
+            durationS = std::max(atoi(argv[++i]), 1);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (periodsUs.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    RecordingCallback callback;
+    EventLoop loop;
+    if (!loop.start("sampling_bench")) {
+        return 1;
+    }
+
+    std::vector<std::unique_ptr<BenchmarkSensor>> sensors;
+    for (size_t i = 0; i < periodsUs.size(); i++) {
+        int32_t handle = static_cast<int32_t>(i) + 1;
+        callback.mTimestamps[handle].reserve(durationS * 1000000 / periodsUs[i] + 16);
+        sensors.push_back(std::make_unique<BenchmarkSensor>(handle, &callback, &loop));
+        sensors.back()->batch(static_cast<int32_t>(periodsUs[i] * 1000));
+        sensors.back()->activate(true);
+    }
+
+    sleep(durationS);
+
+    for (auto& sensor : sensors) {
+        sensor->activate(false);
+    }
+    SamplingScheduler::Stats stats = loop.getScheduler()->getStats();
+    loop.stop();
+
+    printf("%-10s %8s %8s %10s %10s %10s %10s %12s\n", "period_us", "samples", "expected",
+           "late_min", "late_p50", "late_p99", "late_max", "interval_max");
+    for (size_t i = 0; i < periodsUs.size(); i++) {
+        const std::vector<int64_t>& timestamps = callback.mTimestamps[static_cast<int32_t>(i) + 1];
+        int64_t periodNs = periodsUs[i] * 1000;
+        std::vector<int64_t> latenessUs;
+        int64_t maxIntervalErrorUs = 0;
+        for (size_t j = 0; j < timestamps.size(); j++) {
+            int64_t deadlineNs = (timestamps[j] + periodNs / 2) / periodNs * periodNs;
+            latenessUs.push_back((timestamps[j] - deadlineNs) / 1000);
+            if (j > 0) {
+                int64_t errorUs = std::abs(timestamps[j] - timestamps[j - 1] - periodNs) / 1000;
+                maxIntervalErrorUs = std::max(maxIntervalErrorUs, errorUs);
+            }
+        }
+        printf("%-10" PRId64 " %8zu %8" PRId64 " %10" PRId64 " %10" PRId64 " %10" PRId64
+               " %10" PRId64 " %12" PRId64 "\n",
+               periodsUs[i], timestamps.size(), durationS * 1000000 / periodsUs[i],
+               percentile(latenessUs, 0), percentile(latenessUs, 50), percentile(latenessUs, 99),
+               percentile(latenessUs, 100), maxIntervalErrorUs);
+    }
+    printf("\n%" PRIu64 " samples in %" PRIu64 " wakeups, %" PRIu64 " missed deadlines\n",
+           stats.samples, stats.wakeups, stats.missedDeadlines);
+    return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SamplingScheduler.h"
+
+#include "EventLoop.h"
+
+#include <log/log.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <utils/SystemClock.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+namespace {
+
+constexpr int64_t kNanosecondsInSeconds = 1000 * 1000 * 1000;
+
+// A wakeup serves every sensor due within this fraction of its period.
+constexpr int64_t kCoalesceDivisor = 32;
+
+// The first multiple of periodNs after timeNs.
+int64_t nextMultiple(int64_t timeNs, int64_t periodNs) {
+    return (timeNs / periodNs + 1) * periodNs;
+}
+
+}  // anonymous namespace
+
+SamplingScheduler::SamplingScheduler(EventLoop* loop)
+    : mLoop(loop), mTimerFd(-1), mTimerDeadlineNs(0) {}
+
+SamplingScheduler::~SamplingScheduler() {
+    if (mTimerFd >= 0) {
+        mLoop->remove(mTimerFd);
+        close(mTimerFd);
+    }
+}
+
+void SamplingScheduler::add(int32_t id, int64_t periodNs, Callback callback) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mTimerFd < 0) {
+        mTimerFd = timerfd_create(CLOCK_BOOTTIME, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (mTimerFd < 0) {
+            ALOGE("failed to create timerfd: %s", strerror(errno));
+            return;
+        }
+        if (!mLoop->add(mTimerFd, EPOLLIN, [this](uint32_t /* events */) { onTimer(); })) {
+            close(mTimerFd);
+            mTimerFd = -1;
+            return;
+        }
+    }
+
+    Entry& entry = mEntries[id];
+    entry.periodNs = std::max<int64_t>(periodNs, 1);
+    entry.nextDeadlineNs = nextMultiple(::android::elapsedRealtimeNano(), entry.periodNs);
+    entry.callback = std::make_shared<Callback>(std::move(callback));
+    setTimerLocked();
+}
+
+void SamplingScheduler::remove(int32_t id) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mEntries.erase(id) != 0) {
+        setTimerLocked();
+    }
+}
+
+SamplingScheduler::Stats SamplingScheduler::getStats() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+void SamplingScheduler::setTimerLocked() {
+    int64_t deadlineNs = 0;
+    for (const auto& [id, entry] : mEntries) {
+        if (deadlineNs == 0 || entry.nextDeadlineNs < deadlineNs) {
+            deadlineNs = entry.nextDeadlineNs;
+        }
+    }
+    if (deadlineNs == mTimerDeadlineNs) {
+        return;
+    }
+
+    // A zero it_value disarms the timer.
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = deadlineNs / kNanosecondsInSeconds;
+    spec.it_value.tv_nsec = deadlineNs % kNanosecondsInSeconds;
+    if (timerfd_settime(mTimerFd, TFD_TIMER_ABSTIME, &spec, nullptr) < 0) {
+        ALOGE("failed to set timerfd: %s", strerror(errno));
+        return;
+    }
+    mTimerDeadlineNs = deadlineNs;
+}
+
+void SamplingScheduler::onTimer() {
+    uint64_t expirations;
+    if (read(mTimerFd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        int64_t now = ::android::elapsedRealtimeNano();
+        mStats.wakeups++;
+        mTimerDeadlineNs = 0;
+        for (auto& [id, entry] : mEntries) {
+            if (entry.nextDeadlineNs > now + entry.periodNs / kCoalesceDivisor) {
+                continue;
+            }
+            mDue.emplace_back(entry.callback, entry.nextDeadlineNs);
+            mStats.samples++;
+            entry.nextDeadlineNs += entry.periodNs;
+            if (entry.nextDeadlineNs <= now) {
+                int64_t nextDeadlineNs = nextMultiple(now, entry.periodNs);
+                mStats.missedDeadlines += (nextDeadlineNs - entry.nextDeadlineNs) / entry.periodNs;
+                entry.nextDeadlineNs = nextDeadlineNs;
+            }
+        }
+        setTimerLocked();
+    }
+
+    for (const auto& [callback, deadlineNs] : mDue) {
+        (*callback)(deadlineNs);
+    }
+    mDue.clear();
+}
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+class EventLoop;
+
+/**
+ * Samples every periodic sensor of the subhal from a single CLOCK_BOOTTIME timerfd on the event
+ * loop, armed with absolute deadlines.
+ *
+ * The deadlines of a sensor are the multiples of its sampling period since boot, so they never
+ * drift with wakeup latency, and sensors whose periods divide each other share wakeups. A wakeup
+ * also serves every sensor due within 1/32 of its period, coalescing periods that are close but do
+ * not divide. Deadlines missed entirely are skipped rather than bunched up.
+ *
+ * Callbacks run on the loop thread without the lock of the scheduler, like event loop handlers, and
+ * may also run once after remove() returns.
+ */
+class SamplingScheduler {
+  public:
+    //! Takes a sample due at the given CLOCK_BOOTTIME deadline.
+    using Callback = std::function<void(int64_t deadlineNs)>;
+
+    struct Stats {
+        uint64_t wakeups = 0;
+        uint64_t samples = 0;
+        uint64_t missedDeadlines = 0;
+    };
+
+    explicit SamplingScheduler(EventLoop* loop);
+    ~SamplingScheduler();
+
+    /**
+     * Start sampling, or change the period of a sampled id.
+     *
+     * @param id Identifies the sampled sensor.
+     * @param periodNs The sampling period.
+     * @param callback Takes each sample.
+     */
+    void add(int32_t id, int64_t periodNs, Callback callback);
+
+    //! Stop sampling.
+    void remove(int32_t id);
+
+    Stats getStats();
+
+  private:
+    struct Entry {
+        int64_t periodNs;
+        int64_t nextDeadlineNs;
+        std::shared_ptr<Callback> callback;
+    };
+
+    //! Arm the timerfd for the earliest deadline. Requires mMutex.
+    void setTimerLocked();
+
+    void onTimer();
+
+    EventLoop* mLoop;
+
+    std::mutex mMutex;
+
+    //! The timerfd, created on the first add().
+    int mTimerFd;
+
+    //! The deadline the timerfd is armed for, or 0 if disarmed.
+    int64_t mTimerDeadlineNs;
+
+    std::map<int32_t, Entry> mEntries;
+
+    Stats mStats;
+
+    //! The samples due on a wakeup, only used by the loop thread and kept to avoid allocations.
+    std::vector<std::pair<std::shared_ptr<Callback>, int64_t>> mDue;
+};
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -16,33 +16,41 @@
 
 #include "Sensor.h"
 
+#include <cutils/properties.h>
 #include <hardware/sensors.h>
 #include <log/log.h>
+#include <sys/epoll.h>
 #include <utils/SystemClock.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 
 namespace {
 
-static bool readBool(int fd, bool seek) {
-    char c;
-    int rc;
-
-    if (seek) {
-        rc = lseek(fd, 0, SEEK_SET);
-        if (rc) {
-            ALOGE("failed to seek: %d", rc);
-            return false;
+// Parse up to max integers separated by commas or spaces, stopping at anything else.
+static size_t parseInts(const char* text, int32_t* values, size_t max) {
+    size_t count = 0;
+    while (count < max) {
+        while (*text == ',' || *text == ' ' || *text == '\t') {
+            text++;
         }
+        bool negative = *text == '-';
+        if (negative) {
+            text++;
+        }
+        if (*text < '0' || *text > '9') {
+            break;
+        }
+        int64_t value = 0;
+        while (*text >= '0' && *text <= '9') {
+            value = std::min<int64_t>(value * 10 + (*text++ - '0'), INT32_MAX);
+        }
+        values[count++] = static_cast<int32_t>(negative ? -value : value);
     }
-
-    rc = read(fd, &c, sizeof(c));
-    if (rc != 1) {
-        ALOGE("failed to read bool: %d", rc);
-        return false;
-    }
-
-    return c != '0';
+    return count;
 }
 
 }  // anonymous namespace
@@ -63,11 +71,12 @@ using ::android::hardware::sensors::V2_1::Event;
 using ::android::hardware::sensors::V2_1::SensorInfo;
 using ::android::hardware::sensors::V2_1::SensorType;
 
-Sensor::Sensor(int32_t sensorHandle, ISensorsEventCallback* callback)
+Sensor::Sensor(int32_t sensorHandle, ISensorsEventCallback* callback, EventLoop* loop)
     : mIsEnabled(false),
+      mArmed(false),
       mSamplingPeriodNs(0),
-      mLastSampleTimeNs(0),
       mCallback(callback),
+      mLoop(loop),
       mMode(OperationMode::NORMAL) {
     mSensorInfo.sensorHandle = sensorHandle;
     mSensorInfo.vendor = "The LineageOS Project";
@@ -78,19 +87,13 @@ Sensor::Sensor(int32_t sensorHandle, ISensorsEventCallback* callback)
     mSensorInfo.fifoMaxEventCount = 0;
     mSensorInfo.requiredPermission = "";
     mSensorInfo.flags = 0;
-    mRunThread = std::thread(startThread, this);
 }
 
 Sensor::~Sensor() {
-    // Ensure that lock is unlocked before calling mRunThread.join() or a
-    // deadlock will occur.
-    {
-        std::unique_lock<std::mutex> lock(mRunMutex);
-        mStopThread = true;
-        mIsEnabled = false;
-        mWaitCV.notify_all();
+    std::lock_guard<std::mutex> lock(mRunMutex);
+    if (mArmed) {
+        mLoop->getScheduler()->remove(mSensorInfo.sensorHandle);
     }
-    mRunThread.join();
 }
 
 const SensorInfo& Sensor::getSensorInfo() const {
@@ -101,10 +104,12 @@ void Sensor::batch(int32_t samplingPeriodNs) {
     samplingPeriodNs =
             std::clamp(samplingPeriodNs, mSensorInfo.minDelay * 1000, mSensorInfo.maxDelay * 1000);
 
+    std::lock_guard<std::mutex> lock(mRunMutex);
     if (mSamplingPeriodNs != samplingPeriodNs) {
         mSamplingPeriodNs = samplingPeriodNs;
-        // Wake up the 'run' thread to check if a new event should be generated now
-        mWaitCV.notify_all();
+        if (mArmed) {
+            scheduleLocked();
+        }
     }
 }
 
@@ -112,7 +117,7 @@ void Sensor::activate(bool enable) {
     std::lock_guard<std::mutex> lock(mRunMutex);
     if (mIsEnabled != enable) {
         mIsEnabled = enable;
-        mWaitCV.notify_all();
+        updateArmedLocked();
     }
 }
 
@@ -135,33 +140,34 @@ Result Sensor::flush() {
     return Result::OK;
 }
 
-void Sensor::startThread(Sensor* sensor) {
-    sensor->run();
+void Sensor::updateArmedLocked() {
+    bool armed = mIsEnabled && mMode == OperationMode::NORMAL;
+    if (mArmed != armed) {
+        mArmed = armed;
+        arm(armed);
+    }
 }
 
-void Sensor::run() {
-    std::unique_lock<std::mutex> runLock(mRunMutex);
-    constexpr int64_t kNanosecondsInSeconds = 1000 * 1000 * 1000;
+void Sensor::arm(bool armed) {
+    if (armed) {
+        scheduleLocked();
+    } else {
+        mLoop->getScheduler()->remove(mSensorInfo.sensorHandle);
+    }
+}
 
-    while (!mStopThread) {
-        if (!mIsEnabled || mMode == OperationMode::DATA_INJECTION) {
-            mWaitCV.wait(runLock, [&] {
-                return ((mIsEnabled && mMode == OperationMode::NORMAL) || mStopThread);
-            });
-        } else {
-            timespec curTime;
-            clock_gettime(CLOCK_REALTIME, &curTime);
-            int64_t now = (curTime.tv_sec * kNanosecondsInSeconds) + curTime.tv_nsec;
-            int64_t nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-
-            if (now >= nextSampleTime) {
-                mLastSampleTimeNs = now;
-                nextSampleTime = mLastSampleTimeNs + mSamplingPeriodNs;
-                mCallback->postEvents(readEvents(), isWakeUpSensor());
-            }
+void Sensor::scheduleLocked() {
+    // Not batched yet, sample at the slowest rate.
+    int64_t periodNs = mSamplingPeriodNs > 0 ? mSamplingPeriodNs
+                                             : static_cast<int64_t>(mSensorInfo.maxDelay) * 1000;
+    mLoop->getScheduler()->add(mSensorInfo.sensorHandle, periodNs,
+                               [this](int64_t /* deadlineNs */) { onSample(); });
+}
 
-            mWaitCV.wait_for(runLock, std::chrono::nanoseconds(nextSampleTime - now));
-        }
+void Sensor::onSample() {
+    std::lock_guard<std::mutex> lock(mRunMutex);
+    if (mArmed) {
+        mCallback->postEvents(readEvents(), isWakeUpSensor());
     }
 }
 
@@ -187,7 +193,7 @@ void Sensor::setOperationMode(OperationMode mode) {
     std::lock_guard<std::mutex> lock(mRunMutex);
     if (mMode != mode) {
         mMode = mode;
-        mWaitCV.notify_all();
+        updateArmedLocked();
     }
 }
 
@@ -210,135 +216,169 @@ Result Sensor::injectEvent(const Event& event) {
     return result;
 }
 
-OneShotSensor::OneShotSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
-    : Sensor(sensorHandle, callback) {
+OneShotSensor::OneShotSensor(int32_t sensorHandle, ISensorsEventCallback* callback,
+                             EventLoop* loop)
+    : Sensor(sensorHandle, callback, loop) {
     mSensorInfo.minDelay = -1;
     mSensorInfo.maxDelay = 0;
     mSensorInfo.flags |= SensorFlagBits::ONE_SHOT_MODE;
 }
 
-SysfsPollingOneShotSensor::SysfsPollingOneShotSensor(
-        int32_t sensorHandle, ISensorsEventCallback* callback, const std::string& pollPath,
-        const std::string& enablePath, const std::string& name, const std::string& typeAsString,
-        SensorType type)
-    : OneShotSensor(sensorHandle, callback) {
-    mSensorInfo.name = name;
-    mSensorInfo.type = type;
-    mSensorInfo.typeAsString = typeAsString;
-    mSensorInfo.maxRange = 2048.0f;
+SysfsPollingOneShotSensor::SysfsPollingOneShotSensor(int32_t sensorHandle,
+                                                     ISensorsEventCallback* callback,
+                                                     EventLoop* loop,
+                                                     const SysfsSensorConfig& config)
+    : OneShotSensor(sensorHandle, callback, loop),
+      mPollFd(-1),
+      mInputType(config.inputType),
+      mInputCode(config.inputCode),
+      mTimestampNs(0),
+      mPayload(config.payload),
+      mNumInts(config.numInts),
+      mNumValues(0) {
+    mSensorInfo.name = config.name;
+    mSensorInfo.type = static_cast<SensorType>(config.type);
+    mSensorInfo.typeAsString = config.typeAsString;
+    mSensorInfo.maxRange = config.maxRange;
     mSensorInfo.resolution = 1.0f;
     mSensorInfo.power = 0;
-    mSensorInfo.flags |= SensorFlagBits::WAKE_UP;
-
-    mEnableStream.open(enablePath);
-
-    int rc;
-
-    rc = pipe(mWaitPipeFd);
-    if (rc < 0) {
-        mWaitPipeFd[0] = -1;
-        mWaitPipeFd[1] = -1;
-        ALOGE("failed to open wait pipe: %d", rc);
+    if (config.wakeUp) {
+        mSensorInfo.flags |= SensorFlagBits::WAKE_UP;
     }
 
-    mPollFd = open(pollPath.c_str(), O_RDONLY);
-    if (mPollFd < 0) {
-        ALOGE("failed to open poll fd: %d", mPollFd);
+    mEnableFd = config.enablePath.empty() ? -1
+                                          : open(config.enablePath.c_str(), O_WRONLY | O_CLOEXEC);
+    if (mEnableFd < 0 && !config.enablePath.empty()) {
+        ALOGE("failed to open enable fd: %d", mEnableFd);
     }
+    mEnableWritten = -1;
+    mKeepArmed = property_get_bool("ro.vendor.sensors.xiaomi.keep_gestures_armed", false);
+    mDroppedGestures = 0;
 
-    if (mWaitPipeFd[0] < 0 || mWaitPipeFd[1] < 0 || mPollFd < 0) {
-        mStopThread = true;
+    if (!config.inputDevice.empty()) {
+        mInput = EvdevDevice::open(config.inputDevice, loop);
         return;
     }
 
-    mPolls[0] = {
-            .fd = mWaitPipeFd[0],
-            .events = POLLIN,
-    };
-
-    mPolls[1] = {
-            .fd = mPollFd,
-            .events = POLLERR | POLLPRI,
-    };
+    mPollFd = open(config.pollPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (mPollFd < 0) {
+        ALOGE("failed to open poll fd: %d", mPollFd);
+    }
 }
 
 SysfsPollingOneShotSensor::~SysfsPollingOneShotSensor() {
-    interruptPoll();
+    if (mInput) {
+        mInput->unsubscribe(mInputType, mInputCode);
+    }
+    if (mPollFd >= 0) {
+        mLoop->remove(mPollFd);
+        close(mPollFd);
+    }
+    if (mEnableFd >= 0) {
+        close(mEnableFd);
+    }
 }
 
 void SysfsPollingOneShotSensor::writeEnable(bool enable) {
-    if (mEnableStream) {
-        mEnableStream << (enable ? '1' : '0') << std::flush;
+    if (mEnableFd < 0 || mEnableWritten == enable) {
+        return;
     }
-}
-
-void SysfsPollingOneShotSensor::activate(bool enable, bool notify, bool lock) {
-    std::unique_lock<std::mutex> runLock(mRunMutex, std::defer_lock);
 
-    if (lock) {
-        runLock.lock();
+    char c = enable ? '1' : '0';
+    if (pwrite(mEnableFd, &c, sizeof(c), 0) != sizeof(c)) {
+        ALOGE("failed to write enable: %s", strerror(errno));
+        mEnableWritten = -1;
+        return;
     }
+    mEnableWritten = enable;
+}
 
-    if (mIsEnabled != enable) {
-        writeEnable(enable);
+void SysfsPollingOneShotSensor::activate(bool enable) {
+    std::lock_guard<std::mutex> lock(mRunMutex);
+    // Deactivating after a trigger still has to disarm a gesture kept armed.
+    mIsEnabled = enable;
+    // The kernel may have reset the gesture meanwhile, as across screen state changes, so write
+    // the enable node again for every activation, kept armed or not.
+    mEnableWritten = -1;
+    updateArmedLocked();
+    writeEnable(mArmed);
+}
 
-        mIsEnabled = enable;
+void SysfsPollingOneShotSensor::arm(bool armed) {
+    writeEnable(armed);
 
-        if (notify) {
-            interruptPoll();
-            mWaitCV.notify_all();
+    if (mInput) {
+        if (armed) {
+            mInput->subscribe(mInputType, mInputCode,
+                              [this](int64_t timestampNs, int32_t x, int32_t y) {
+                                  onInputEvent(timestampNs, x, y);
+                              });
+        } else {
+            mInput->unsubscribe(mInputType, mInputCode);
         }
+        return;
     }
 
-    if (lock) {
-        runLock.unlock();
+    if (mPollFd < 0) {
+        return;
     }
-}
 
-void SysfsPollingOneShotSensor::activate(bool enable) {
-    activate(enable, true, true);
+    if (armed) {
+        mLoop->add(mPollFd, EPOLLERR | EPOLLPRI,
+                   [this](uint32_t events) { onPollEvent(events); });
+    } else {
+        // Sysfs nodes report EPOLLERR when notified even if not asked for, so a disarmed node must
+        // leave the epoll set.
+        mLoop->remove(mPollFd);
+    }
 }
 
-void SysfsPollingOneShotSensor::setOperationMode(OperationMode mode) {
-    Sensor::setOperationMode(mode);
-    interruptPoll();
-}
+void SysfsPollingOneShotSensor::onPollEvent(uint32_t events) {
+    std::lock_guard<std::mutex> lock(mRunMutex);
+    if (!mArmed) {
+        return;
+    }
 
-void SysfsPollingOneShotSensor::run() {
-    std::unique_lock<std::mutex> runLock(mRunMutex);
+    if (events == (EPOLLERR | EPOLLPRI) && readFd(mPollFd)) {
+        triggerLocked(::android::elapsedRealtimeNano());
+    }
+}
 
-    while (!mStopThread) {
-        if (!mIsEnabled || mMode == OperationMode::DATA_INJECTION) {
-            mWaitCV.wait(runLock, [&] {
-                return ((mIsEnabled && mMode == OperationMode::NORMAL) || mStopThread);
-            });
-        } else {
-            // Cannot hold lock while polling.
-            runLock.unlock();
-            int rc = poll(mPolls, 2, -1);
-            runLock.lock();
-
-            if (rc < 0) {
-                ALOGE("failed to poll: %d", rc);
-                mStopThread = true;
-                continue;
-            }
+void SysfsPollingOneShotSensor::onInputEvent(int64_t timestampNs, int32_t x, int32_t y) {
+    std::lock_guard<std::mutex> lock(mRunMutex);
+    if (!mArmed) {
+        return;
+    }
 
-            if (mPolls[1].revents == mPolls[1].events && readFd(mPollFd)) {
-                activate(false, false, false);
-                mCallback->postEvents(readEvents(), isWakeUpSensor());
-            } else if (mPolls[0].revents == mPolls[0].events) {
-                readBool(mWaitPipeFd[0], false /* seek */);
-            }
-        }
+    if (mPayload == SysfsSensorConfig::kXyState) {
+        mValues[0] = x;
+        mValues[1] = y;
+        mNumValues = 2;
+    } else {
+        mNumValues = 0;
     }
+    triggerLocked(timestampNs);
 }
 
-void SysfsPollingOneShotSensor::interruptPoll() {
-    if (mWaitPipeFd[1] < 0) return;
+void SysfsPollingOneShotSensor::triggerLocked(int64_t timestampNs) {
+    if (!mIsEnabled) {
+        // Triggered already and kept armed.
+        mDroppedGestures++;
+        return;
+    }
+
+    mIsEnabled = false;
+    if (!mKeepArmed) {
+        updateArmedLocked();
+    }
+    mTimestampNs = timestampNs;
+    mCallback->postEvents(readEvents(), isWakeUpSensor());
+}
 
-    char c = '1';
-    write(mWaitPipeFd[1], &c, sizeof(c));
+void SysfsPollingOneShotSensor::dump(std::ostream& stream) {
+    std::lock_guard<std::mutex> lock(mRunMutex);
+    stream << "Kept armed: " << (mKeepArmed ? "yes" : "no") << std::endl;
+    stream << "Dropped gestures: " << mDroppedGestures << std::endl;
 }
 
 std::vector<Event> SysfsPollingOneShotSensor::readEvents() {
@@ -346,53 +386,55 @@ std::vector<Event> SysfsPollingOneShotSensor::readEvents() {
     Event event;
     event.sensorHandle = mSensorInfo.sensorHandle;
     event.sensorType = mSensorInfo.type;
-    event.timestamp = ::android::elapsedRealtimeNano();
+    event.timestamp = mTimestampNs;
     fillEventData(event);
     events.push_back(event);
     return events;
 }
 
 void SysfsPollingOneShotSensor::fillEventData(Event& event) {
-    event.u.data[0] = 0;
-    event.u.data[1] = 0;
+    for (size_t i = 0; i < SysfsSensorConfig::kMaxInts; i++) {
+        event.u.data[i] = i < mNumValues ? mValues[i] : 0;
+    }
 }
 
 bool SysfsPollingOneShotSensor::readFd(const int fd) {
-    return readBool(fd, true /* seek */);
-}
-
-void UdfpsSensor::fillEventData(Event& event) {
-    event.u.data[0] = mScreenX;
-    event.u.data[1] = mScreenY;
-}
-
-bool UdfpsSensor::readFd(const int fd) {
-    char buffer[512];
-    int state = 0;
-    int rc;
-
-    rc = lseek(fd, 0, SEEK_SET);
-    if (rc < 0) {
-        ALOGE("failed to seek: %d", rc);
+    char buffer[256];
+    ssize_t size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (size <= 0) {
+        ALOGE("failed to read state: %zd", size);
         return false;
     }
-    rc = read(fd, &buffer, sizeof(buffer));
-    if (rc < 0) {
-        ALOGE("failed to read state: %d", rc);
-        return false;
-    }
-    rc = sscanf(buffer, "%d,%d,%d", &mScreenX, &mScreenY, &state);
-    if (rc == 1) {
-        // If fod_press_status contains only one value,
-        // assume that just reports the state
-        state = mScreenX;
-        mScreenX = 0;
-        mScreenY = 0;
-    } else if (rc < 3) {
-        ALOGE("failed to parse fp state: %d", rc);
-        return false;
+    buffer[size] = '\0';
+
+    size_t count;
+    switch (mPayload) {
+        case SysfsSensorConfig::kBool:
+            mNumValues = 0;
+            return buffer[0] != '0';
+        case SysfsSensorConfig::kXyState:
+            count = parseInts(buffer, mValues, 3);
+            if (count == 1) {
+                // If the node contains only one value, assume that just reports the state
+                mValues[2] = mValues[0];
+                mValues[0] = 0;
+                mValues[1] = 0;
+            } else if (count < 3) {
+                ALOGE("failed to parse x,y,state: %zu", count);
+                return false;
+            }
+            mNumValues = 2;
+            return mValues[2] > 0;
+        case SysfsSensorConfig::kInts:
+            count = parseInts(buffer, mValues, mNumInts);
+            if (count < mNumInts) {
+                ALOGE("failed to parse %zu ints: %zu", mNumInts, count);
+                return false;
+            }
+            mNumValues = count;
+            return std::any_of(mValues, mValues + count, [](int32_t value) { return value != 0; });
     }
-    return state > 0;
+    return false;
 }
 
 }  // namespace implementation
@@ -18,16 +18,17 @@
 
 #include <android/hardware/sensors/2.1/types.h>
 #include <fcntl.h>
-#include <poll.h>
 #include <unistd.h>
 
-#include <condition_variable>
-#include <fstream>
 #include <memory>
 #include <mutex>
-#include <thread>
+#include <ostream>
 #include <vector>
 
+#include "EvdevDevice.h"
+#include "EventLoop.h"
+#include "SysfsSensorConfig.h"
+
 using ::android::hardware::sensors::V1_0::OperationMode;
 using ::android::hardware::sensors::V1_0::Result;
 using ::android::hardware::sensors::V2_1::Event;
@@ -49,7 +50,7 @@ class ISensorsEventCallback {
 
 class Sensor {
   public:
-    Sensor(int32_t sensorHandle, ISensorsEventCallback* callback);
+    Sensor(int32_t sensorHandle, ISensorsEventCallback* callback, EventLoop* loop);
     virtual ~Sensor();
 
     const SensorInfo& getSensorInfo() const;
@@ -61,31 +62,46 @@ class Sensor {
     bool supportsDataInjection() const;
     Result injectEvent(const Event& event);
 
+    //! Add the state of the sensor to the debug dump.
+    virtual void dump(std::ostream& /* stream */) {}
+
   protected:
-    virtual void run();
     virtual std::vector<Event> readEvents();
-    static void startThread(Sensor* sensor);
 
     bool isWakeUpSensor();
 
+    //! Arm or disarm the sensor as it got enabled and in normal mode. Requires mRunMutex.
+    void updateArmedLocked();
+
+    /**
+     * Start or stop waiting for events on the event loop. The default samples every sampling
+     * period with the scheduler of the loop. Requires mRunMutex.
+     */
+    virtual void arm(bool armed);
+
     bool mIsEnabled;
+    bool mArmed;
     int64_t mSamplingPeriodNs;
-    int64_t mLastSampleTimeNs;
     SensorInfo mSensorInfo;
 
-    std::atomic_bool mStopThread;
-    std::condition_variable mWaitCV;
     std::mutex mRunMutex;
-    std::thread mRunThread;
 
     ISensorsEventCallback* mCallback;
 
+    EventLoop* mLoop;
+
     OperationMode mMode;
+
+  private:
+    //! Sample at the sampling period. Requires mRunMutex.
+    void scheduleLocked();
+
+    void onSample();
 };
 
 class OneShotSensor : public Sensor {
   public:
-    OneShotSensor(int32_t sensorHandle, ISensorsEventCallback* callback);
+    OneShotSensor(int32_t sensorHandle, ISensorsEventCallback* callback, EventLoop* loop);
 
     virtual void batch(int32_t /* samplingPeriodNs */) override {}
 
@@ -95,69 +111,65 @@ class OneShotSensor : public Sensor {
 class SysfsPollingOneShotSensor : public OneShotSensor {
   public:
     SysfsPollingOneShotSensor(int32_t sensorHandle, ISensorsEventCallback* callback,
-                              const std::string& pollPath, const std::string& enablePath,
-                              const std::string& name, const std::string& typeAsString,
-                              SensorType type);
+                              EventLoop* loop, const SysfsSensorConfig& config);
     virtual ~SysfsPollingOneShotSensor() override;
 
     virtual void activate(bool enable) override;
-    virtual void activate(bool enable, bool notify, bool lock);
     virtual void writeEnable(bool enable);
-    virtual void setOperationMode(OperationMode mode) override;
     virtual std::vector<Event> readEvents() override;
     virtual void fillEventData(Event& event);
     virtual bool readFd(const int fd);
+    virtual void dump(std::ostream& stream) override;
 
   protected:
-    virtual void run() override;
+    /**
+     * Enable the gesture in the kernel and wait for the sysfs node to be notified or the input
+     * device to report it on the event loop, or the reverse. Requires mRunMutex.
+     */
+    virtual void arm(bool armed) override;
 
-    std::ofstream mEnableStream;
+    int mEnableFd;
 
   private:
-    void interruptPoll();
+    void onPollEvent(uint32_t events);
+
+    void onInputEvent(int64_t timestampNs, int32_t x, int32_t y);
+
+    //! Report a gesture, or drop it if already triggered. Requires mRunMutex.
+    void triggerLocked(int64_t timestampNs);
 
-    struct pollfd mPolls[2];
-    int mWaitPipeFd[2];
     int mPollFd;
-};
 
-class DoubleTapSensor : public SysfsPollingOneShotSensor {
-  public:
-    DoubleTapSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
-        : SysfsPollingOneShotSensor(
-                  sensorHandle, callback, "/sys/class/touch/touch_dev/gesture_double_tap_state",
-                  "/sys/class/touch/touch_dev/gesture_double_tap_enabled", "Double Tap Sensor",
-                  "org.lineageos.sensor.double_tap",
-                  static_cast<SensorType>(static_cast<int32_t>(SensorType::DEVICE_PRIVATE_BASE) +
-                                          1)) {}
-};
+    //! The input device reporting the gesture instead of the poll node, if any.
+    std::shared_ptr<EvdevDevice> mInput;
+    uint16_t mInputType;
+    uint16_t mInputCode;
 
-class SingleTapSensor : public SysfsPollingOneShotSensor {
-  public:
-    SingleTapSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
-        : SysfsPollingOneShotSensor(
-                  sensorHandle, callback, "/sys/class/touch/touch_dev/gesture_single_tap_state",
-                  "/sys/class/touch/touch_dev/gesture_single_tap_enabled", "Single Tap Sensor",
-                  "org.lineageos.sensor.single_tap",
-                  static_cast<SensorType>(static_cast<int32_t>(SensorType::DEVICE_PRIVATE_BASE) +
-                                          2)) {}
-};
+    //! The time of the gesture being reported.
+    int64_t mTimestampNs;
 
-class UdfpsSensor : public SysfsPollingOneShotSensor {
-  public:
-    UdfpsSensor(int32_t sensorHandle, ISensorsEventCallback* callback)
-        : SysfsPollingOneShotSensor(
-                  sensorHandle, callback, "/sys/class/touch/touch_dev/fod_press_status",
-                  "/sys/class/touch/touch_dev/fod_longpress_gesture_enabled", "UDFPS Sensor",
-                  "org.lineageos.sensor.udfps",
-                  static_cast<SensorType>(static_cast<int32_t>(SensorType::DEVICE_PRIVATE_BASE) +
-                                          3)) {}
-    virtual void fillEventData(Event& event);
-    virtual bool readFd(const int fd);
+    //! How to read the poll node.
+    SysfsSensorConfig::Payload mPayload;
+    size_t mNumInts;
 
-  private:
-    int mScreenX;
-    int mScreenY;
+    //! The integers last read from the poll node, as the event data.
+    int32_t mValues[SysfsSensorConfig::kMaxInts];
+    size_t mNumValues;
+
+    /**
+     * The value last written to the enable node, or -1 if unknown. Forgotten on every activation,
+     * so it only saves writes between those.
+     */
+    int mEnableWritten;
+
+    /**
+     * Whether to leave the gesture enabled in the kernel once it triggered, dropping gestures
+     * until the framework activates the sensor again rather than writing the enable node twice.
+     */
+    bool mKeepArmed;
+
+    //! The gestures dropped while waiting to be activated again.
+    uint64_t mDroppedGestures;
 };
 
 }  // namespace implementation
@@ -0,0 +1,134 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "Sensor.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <climits>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+namespace {
+
+// A gesture sensor reading the poll node contents it is given.
+class PollNodeParser {
+  public:
+    PollNodeParser(SysfsSensorConfig::Payload payload, size_t numInts = 0) {
+        SysfsSensorConfig config;
+        config.typeAsString = "test";
+        config.name = "Test";
+        config.payload = payload;
+        config.numInts = numInts;
+        // No poll node, so the sensor never needs an event loop.
+        mSensor = std::make_unique<SysfsPollingOneShotSensor>(1, nullptr, nullptr, config);
+    }
+
+    //! Read contents as the poll node, returning whether they are a trigger.
+    bool read(const std::string& contents) {
+        TemporaryFile file;
+        EXPECT_TRUE(base::WriteStringToFile(contents, file.path));
+        bool triggered = mSensor->readFd(file.fd);
+        mSensor->fillEventData(mEvent);
+        return triggered;
+    }
+
+    float data(size_t index) const { return mEvent.u.data[index]; }
+
+  private:
+    std::unique_ptr<SysfsPollingOneShotSensor> mSensor;
+    Event mEvent;
+};
+
+TEST(SysfsPollingOneShotSensorTest, ReadsBools) {
+    PollNodeParser parser(SysfsSensorConfig::kBool);
+    EXPECT_TRUE(parser.read("1\n"));
+    EXPECT_EQ(0.0f, parser.data(0));
+    EXPECT_TRUE(parser.read("2"));
+    EXPECT_FALSE(parser.read("0\n"));
+    EXPECT_FALSE(parser.read(""));
+}
+
+TEST(SysfsPollingOneShotSensorTest, ReadsPositionsAndState) {
+    PollNodeParser parser(SysfsSensorConfig::kXyState);
+    EXPECT_TRUE(parser.read("540,1800,1\n"));
+    EXPECT_EQ(540.0f, parser.data(0));
+    EXPECT_EQ(1800.0f, parser.data(1));
+    EXPECT_EQ(0.0f, parser.data(2));
+
+    EXPECT_FALSE(parser.read("540 1800 0\n"));
+    EXPECT_FALSE(parser.read("540,1800,-1\n"));
+    // Too few values for a position.
+    EXPECT_FALSE(parser.read("540,1800\n"));
+    EXPECT_FALSE(parser.read("none\n"));
+}
+
+TEST(SysfsPollingOneShotSensorTest, ReadsASingleState) {
+    PollNodeParser parser(SysfsSensorConfig::kXyState);
+    EXPECT_TRUE(parser.read("1\n"));
+    EXPECT_EQ(0.0f, parser.data(0));
+    EXPECT_EQ(0.0f, parser.data(1));
+    EXPECT_FALSE(parser.read("0\n"));
+}
+
+TEST(SysfsPollingOneShotSensorTest, ReadsInts) {
+    PollNodeParser parser(SysfsSensorConfig::kInts, 3);
+    EXPECT_TRUE(parser.read("0, -2\t3 4\n"));
+    EXPECT_EQ(0.0f, parser.data(0));
+    EXPECT_EQ(-2.0f, parser.data(1));
+    EXPECT_EQ(3.0f, parser.data(2));
+    // Values beyond the number asked for are ignored.
+    EXPECT_EQ(0.0f, parser.data(3));
+
+    EXPECT_FALSE(parser.read("0,0,0\n"));
+    // Too few values, or parsing stopped by anything else than a separator.
+    EXPECT_FALSE(parser.read("1,2\n"));
+    EXPECT_FALSE(parser.read("1;2;3\n"));
+}
+
+TEST(SysfsPollingOneShotSensorTest, ClampsOverflowingInts) {
+    PollNodeParser parser(SysfsSensorConfig::kInts, 2);
+    EXPECT_TRUE(parser.read("99999999999,-99999999999\n"));
+    EXPECT_EQ(static_cast<float>(INT32_MAX), parser.data(0));
+    EXPECT_EQ(static_cast<float>(-INT32_MAX), parser.data(1));
+}
+
+TEST(SysfsPollingOneShotSensorTest, RewritesTheEnableNodeOnActivation) {
+    TemporaryFile enableNode;
+    SysfsSensorConfig config;
+    config.typeAsString = "test";
+    config.name = "Test";
+    config.enablePath = enableNode.path;
+    SysfsPollingOneShotSensor sensor(1, nullptr, nullptr, config);
+    std::string contents;
+
+    sensor.activate(true);
+    ASSERT_TRUE(base::ReadFileToString(enableNode.path, &contents));
+    EXPECT_EQ("1", contents);
+
+    // The kernel reset the gesture, as across a screen state change.
+    ASSERT_TRUE(base::WriteStringToFile("0", enableNode.path));
+    sensor.activate(true);
+    ASSERT_TRUE(base::ReadFileToString(enableNode.path, &contents));
+    EXPECT_EQ("1", contents);
+
+    sensor.activate(false);
+    ASSERT_TRUE(base::ReadFileToString(enableNode.path, &contents));
+    EXPECT_EQ("0", contents);
+}
+
+}  // namespace
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
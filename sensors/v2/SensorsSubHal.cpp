@@ -17,9 +17,10 @@
 #include "SensorsSubHal.h"
 
 #include <android/hardware/sensors/2.1/types.h>
-#include <cutils/properties.h>
 #include <log/log.h>
 
+#include <sstream>
+
 using ::android::hardware::sensors::V2_1::implementation::ISensorsSubHal;
 using ::android::hardware::sensors::V2_1::subhal::implementation::SensorsSubHal;
 
@@ -34,17 +35,19 @@ using ::android::hardware::Void;
 using ::android::hardware::sensors::V2_0::implementation::ScopedWakelock;
 
 SensorsSubHal::SensorsSubHal() : mCallback(nullptr), mNextHandle(1) {
-    if (property_get_bool("ro.vendor.sensors.xiaomi.double_tap", false)) {
-        AddSensor<DoubleTapSensor>();
-    }
-    if (property_get_bool("ro.vendor.sensors.xiaomi.single_tap", false)) {
-        AddSensor<SingleTapSensor>();
+    for (const SysfsSensorConfig& config : SysfsSensorConfig::load()) {
+        AddSensor<SysfsPollingOneShotSensor>(config);
     }
-    if (property_get_bool("ro.vendor.sensors.xiaomi.udfps", false)) {
-        AddSensor<UdfpsSensor>();
+    if (!mSensors.empty()) {
+        mLoop.start("sensors_xiaomi");
     }
 }
 
+SensorsSubHal::~SensorsSubHal() {
+    // Stop handlers before the sensors they call go away.
+    mLoop.stop();
+}
+
 Return<void> SensorsSubHal::getSensorsList_2_1(ISensors::getSensorsList_2_1_cb _hidl_cb) {
     std::vector<SensorInfo> sensors;
     for (const auto& sensor : mSensors) {
@@ -137,9 +140,16 @@ Return<void> SensorsSubHal::debug(const hidl_handle& fd, const hidl_vec<hidl_str
         stream << "Name: " << info.name << std::endl;
         stream << "Min delay: " << info.minDelay << std::endl;
         stream << "Flags: " << info.flags << std::endl;
+        sensor.second->dump(stream);
     }
     stream << std::endl;
 
+    SamplingScheduler::Stats stats = mLoop.getScheduler()->getStats();
+    stream << "Sampling wakeups: " << stats.wakeups << std::endl;
+    stream << "Samples: " << stats.samples << std::endl;
+    stream << "Missed sampling deadlines: " << stats.missedDeadlines << std::endl;
+    stream << std::endl;
+
     fprintf(out, "%s", stream.str().c_str());
 
     fclose(out);
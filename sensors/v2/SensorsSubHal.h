@@ -39,6 +39,7 @@ using ::android::hardware::sensors::V2_1::implementation::ISensorsSubHal;
 class SensorsSubHal : public ISensorsSubHal, public ISensorsEventCallback {
   public:
     SensorsSubHal();
+    ~SensorsSubHal();
 
     Return<void> getSensorsList_2_1(ISensors::getSensorsList_2_1_cb _hidl_cb);
     Return<Result> injectSensorData_2_1(const Event& event);
@@ -70,13 +71,17 @@ class SensorsSubHal : public ISensorsSubHal, public ISensorsEventCallback {
     void postEvents(const std::vector<Event>& events, bool wakeup) override;
 
   protected:
-    template <class SensorType>
-    void AddSensor() {
+    template <class SensorType, typename... Args>
+    void AddSensor(Args&&... args) {
         std::shared_ptr<SensorType> sensor =
-                std::make_shared<SensorType>(mNextHandle++ /* sensorHandle */, this /* callback */);
+                std::make_shared<SensorType>(mNextHandle++ /* sensorHandle */, this /* callback */,
+                                             &mLoop /* loop */, std::forward<Args>(args)...);
         mSensors[sensor->getSensorInfo().sensorHandle] = sensor;
     }
 
+    //! The thread every sensor waits for events on, declared first to outlive the sensors.
+    EventLoop mLoop;
+
     std::map<int32_t, std::shared_ptr<Sensor>> mSensors;
 
     sp<IHalProxyCallback> mCallback;
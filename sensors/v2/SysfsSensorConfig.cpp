@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SysfsSensorConfig.h"
+
+#include <android/hardware/sensors/2.1/types.h>
+#include <cutils/properties.h>
+#include <linux/input.h>
+#include <log/log.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+using ::android::hardware::sensors::V2_1::SensorType;
+
+namespace {
+
+const char* const kConfigFiles[] = {
+        "/vendor/etc/sensors/sysfs_sensors.conf",
+        "/odm/etc/sensors/sysfs_sensors.conf",
+};
+
+struct BuiltInSensor {
+    const char* property;
+    SysfsSensorConfig config;
+};
+
+SysfsSensorConfig makeBuiltIn(const char* typeAsString, const char* name, int32_t typeOffset,
+                              const char* pollPath, const char* enablePath,
+                              SysfsSensorConfig::Payload payload) {
+    SysfsSensorConfig config;
+    config.typeAsString = typeAsString;
+    config.name = name;
+    config.type = static_cast<int32_t>(SensorType::DEVICE_PRIVATE_BASE) + typeOffset;
+    config.pollPath = pollPath;
+    config.enablePath = enablePath;
+    config.payload = payload;
+    return config;
+}
+
+// Split a line into words, keeping double quoted values whole.
+bool tokenize(const std::string& line, std::vector<std::string>* words) {
+    std::string word;
+    bool inWord = false;
+    bool quoted = false;
+    for (char c : line) {
+        if (quoted) {
+            if (c == '"') {
+                quoted = false;
+            } else {
+                word += c;
+            }
+        } else if (c == '"') {
+            quoted = true;
+            inWord = true;
+        } else if (isspace(static_cast<unsigned char>(c))) {
+            if (inWord) {
+                words->push_back(word);
+                word.clear();
+                inWord = false;
+            }
+        } else {
+            word += c;
+            inWord = true;
+        }
+    }
+    if (inWord) {
+        words->push_back(word);
+    }
+    return !quoted;
+}
+
+bool parseLine(const std::vector<std::string>& words, SysfsSensorConfig* config) {
+    config->typeAsString = words[0];
+    bool hasType = false;
+    for (size_t i = 1; i < words.size(); i++) {
+        const std::string& word = words[i];
+        size_t equals = word.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+        std::string key = word.substr(0, equals);
+        std::string value = word.substr(equals + 1);
+        char* end = nullptr;
+        bool valid;
+        if (key == "name") {
+            config->name = value;
+            valid = !value.empty();
+        } else if (key == "type") {
+            long type = strtol(value.c_str(), &end, 0);
+            config->type = static_cast<int32_t>(type);
+            hasType = !value.empty() && *end == '\0' && type == config->type;
+            valid = hasType;
+        } else if (key == "poll") {
+            config->pollPath = value;
+            valid = !value.empty();
+        } else if (key == "input") {
+            config->inputDevice = value;
+            valid = !value.empty();
+        } else if (key == "input_key" || key == "input_abs") {
+            unsigned long code = strtoul(value.c_str(), &end, 0);
+            config->inputType = key == "input_key" ? EV_KEY : EV_ABS;
+            config->inputCode = static_cast<uint16_t>(code);
+            valid = !value.empty() && *end == '\0' &&
+                    code <= (key == "input_key" ? KEY_MAX : ABS_MAX);
+        } else if (key == "enable") {
+            config->enablePath = value;
+            valid = !value.empty();
+        } else if (key == "wakeup") {
+            config->wakeUp = value == "true";
+            valid = value == "true" || value == "false";
+        } else if (key == "max_range") {
+            config->maxRange = strtof(value.c_str(), &end);
+            valid = !value.empty() && *end == '\0';
+        } else if (key == "payload") {
+            if (value == "bool") {
+                config->payload = SysfsSensorConfig::kBool;
+                valid = true;
+            } else if (value == "xy_state") {
+                config->payload = SysfsSensorConfig::kXyState;
+                valid = true;
+            } else if (value.compare(0, 5, "ints:") == 0) {
+                config->payload = SysfsSensorConfig::kInts;
+                config->numInts = strtoul(value.c_str() + 5, &end, 10);
+                valid = value.size() > 5 && *end == '\0' && config->numInts >= 1 &&
+                        config->numInts <= SysfsSensorConfig::kMaxInts;
+            } else {
+                valid = false;
+            }
+        } else {
+            valid = false;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    if (!hasType || config->name.empty()) {
+        return false;
+    }
+    if (!config->inputDevice.empty() || config->inputType != 0) {
+        return config->pollPath.empty() && !config->inputDevice.empty() && config->inputType != 0 &&
+               config->payload != SysfsSensorConfig::kInts;
+    }
+    return !config->pollPath.empty();
+}
+
+}  // anonymous namespace
+
+std::vector<SysfsSensorConfig> SysfsSensorConfig::load() {
+    static const BuiltInSensor kBuiltInSensors[] = {
+            {"ro.vendor.sensors.xiaomi.double_tap",
+             makeBuiltIn("org.lineageos.sensor.double_tap", "Double Tap Sensor", 1,
+                         "/sys/class/touch/touch_dev/gesture_double_tap_state",
+                         "/sys/class/touch/touch_dev/gesture_double_tap_enabled", kBool)},
+            {"ro.vendor.sensors.xiaomi.single_tap",
+             makeBuiltIn("org.lineageos.sensor.single_tap", "Single Tap Sensor", 2,
+                         "/sys/class/touch/touch_dev/gesture_single_tap_state",
+                         "/sys/class/touch/touch_dev/gesture_single_tap_enabled", kBool)},
+            {"ro.vendor.sensors.xiaomi.udfps",
+             makeBuiltIn("org.lineageos.sensor.udfps", "UDFPS Sensor", 3,
+                         "/sys/class/touch/touch_dev/fod_press_status",
+                         "/sys/class/touch/touch_dev/fod_longpress_gesture_enabled", kXyState)},
+    };
+
+    std::vector<SysfsSensorConfig> configs;
+    for (const BuiltInSensor& sensor : kBuiltInSensors) {
+        if (property_get_bool(sensor.property, false)) {
+            configs.push_back(sensor.config);
+        }
+    }
+    for (const char* path : kConfigFiles) {
+        readConfigFile(path, &configs);
+    }
+    return configs;
+}
+
+void SysfsSensorConfig::readConfigFile(const char* path, std::vector<SysfsSensorConfig>* configs) {
+    std::ifstream stream(path);
+    if (!stream) {
+        return;
+    }
+    std::string line;
+    while (std::getline(stream, line)) {
+        line = line.substr(0, line.find('#'));
+        std::vector<std::string> words;
+        bool valid = tokenize(line, &words);
+        if (valid && words.empty()) {
+            continue;
+        }
+        SysfsSensorConfig config;
+        if (!valid || !parseLine(words, &config)) {
+            ALOGE("%s: ignoring invalid sensor '%s'", path, line.c_str());
+            continue;
+        }
+
+        bool replaced = false;
+        for (SysfsSensorConfig& existing : *configs) {
+            if (existing.typeAsString == config.typeAsString) {
+                existing = config;
+                replaced = true;
+            }
+        }
+        if (!replaced) {
+            configs->push_back(std::move(config));
+        }
+    }
+}
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+
+/**
+ * A one-shot sensor triggered by a sysfs node or an input device, so supporting the gestures of a
+ * new panel needs a config file rather than a rebuild. The config files are
+ * /vendor/etc/sensors/sysfs_sensors.conf and /odm/etc/sensors/sysfs_sensors.conf, where each line
+ * names the typeAsString of a sensor followed by:
+ *   name=<name>            The sensor name, double quoted if it has spaces.
+ *   type=<n>               The sensor type, usually above DEVICE_PRIVATE_BASE (0x10000).
+ *   poll=<path>            The node notified on a gesture, read to tell whether it triggered.
+ *   input=<device>         Instead of poll, the input device reporting the gesture, as the path
+ *                          of its event node or its name. The event time is the kernel time of
+ *                          the gesture.
+ *   input_key=<code>       With input, the key whose presses are the gesture.
+ *   input_abs=<code>       With input, the axis whose turning positive is the gesture.
+ *   enable=<path>          The node enabling the gesture with '1' and disabling it with '0'.
+ *                          Optional.
+ *   wakeup=<true|false>    Whether it is a wakeup sensor, true by default.
+ *   max_range=<value>      The max range, 2048 by default.
+ *   payload=<parser>       How to read the poll node, one of:
+ *                            bool      Triggered unless it starts with '0', the default.
+ *                            xy_state  "<x>,<y>,<state>" or "<state>", triggered if state is
+ *                                      positive, with x and y as the event data. With input,
+ *                                      the last touch position is the event data.
+ *                            ints:<n>  n integers, 1 to 16, triggered if any is not 0, with the
+ *                                      integers as the event data. Not with input.
+ *
+ * A line for the typeAsString of an earlier sensor, built-in ones included, replaces it. '#'
+ * starts a comment.
+ */
+struct SysfsSensorConfig {
+    enum Payload { kBool, kXyState, kInts };
+
+    //! The most integers an ints payload can have, as many as the data of an event.
+    static constexpr size_t kMaxInts = 16;
+
+    std::string typeAsString;
+    std::string name;
+    int32_t type = 0;
+    std::string pollPath;
+    //! The input device, if the sensor is triggered by input events rather than pollPath.
+    std::string inputDevice;
+    //! The type, EV_KEY or EV_ABS, and code of the input events of the gesture.
+    uint16_t inputType = 0;
+    uint16_t inputCode = 0;
+    std::string enablePath;
+    bool wakeUp = true;
+    float maxRange = 2048.0f;
+    Payload payload = kBool;
+    //! The number of integers of an ints payload.
+    size_t numInts = 0;
+
+    /**
+     * Get the sensors to expose: the built-in gesture sensors enabled by their
+     * ro.vendor.sensors.xiaomi.* property, then the sensors of the config files.
+     */
+    static std::vector<SysfsSensorConfig> load();
+
+    /**
+     * Add the sensors of a config file. A missing file is not an error.
+     *
+     * @param path The config file.
+     * @param configs The sensors read so far, updated with those of the file.
+     */
+    static void readConfigFile(const char* path, std::vector<SysfsSensorConfig>* configs);
+};
+
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2024 The LineageOS Project
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "SysfsSensorConfig.h"
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+#include <linux/input.h>
+
+namespace android {
+namespace hardware {
+namespace sensors {
+namespace V2_1 {
+namespace subhal {
+namespace implementation {
+namespace {
+
+std::vector<SysfsSensorConfig> readConfig(const std::string& contents) {
+    TemporaryFile file;
+    EXPECT_TRUE(base::WriteStringToFile(contents, file.path));
+    std::vector<SysfsSensorConfig> configs;
+    SysfsSensorConfig::readConfigFile(file.path, &configs);
+    return configs;
+}
+
+TEST(SysfsSensorConfigTest, ReadsEachPayload) {
+    std::vector<SysfsSensorConfig> configs = readConfig(
+            "# Gestures of the panel\n"
+            "\n"
+            "a.tap name=\"Tap Sensor\" type=0x10001 poll=/tap enable=/tap_enabled\n"
+            "a.fod name=Fod type=65538 poll=/fod payload=xy_state wakeup=false max_range=1\n"
+            "a.ints name=Ints type=65539 poll=/ints payload=ints:16  # as many as allowed\n");
+    ASSERT_EQ(3u, configs.size());
+
+    EXPECT_EQ("a.tap", configs[0].typeAsString);
+    EXPECT_EQ("Tap Sensor", configs[0].name);
+    EXPECT_EQ(0x10001, configs[0].type);
+    EXPECT_EQ("/tap", configs[0].pollPath);
+    EXPECT_EQ("/tap_enabled", configs[0].enablePath);
+    EXPECT_EQ(SysfsSensorConfig::kBool, configs[0].payload);
+    EXPECT_TRUE(configs[0].wakeUp);
+    EXPECT_EQ(2048.0f, configs[0].maxRange);
+
+    EXPECT_EQ(SysfsSensorConfig::kXyState, configs[1].payload);
+    EXPECT_FALSE(configs[1].wakeUp);
+    EXPECT_EQ(1.0f, configs[1].maxRange);
+    EXPECT_TRUE(configs[1].enablePath.empty());
+
+    EXPECT_EQ(SysfsSensorConfig::kInts, configs[2].payload);
+    EXPECT_EQ(SysfsSensorConfig::kMaxInts, configs[2].numInts);
+}
+
+TEST(SysfsSensorConfigTest, ReadsInputSensors) {
+    std::vector<SysfsSensorConfig> configs = readConfig(
+            "a.key name=Key type=65537 input=/dev/input/event1 input_key=0x160\n"
+            "a.abs name=Abs type=65538 input=\"touch panel\" input_abs=57 payload=xy_state\n");
+    ASSERT_EQ(2u, configs.size());
+
+    EXPECT_EQ("/dev/input/event1", configs[0].inputDevice);
+    EXPECT_EQ(EV_KEY, configs[0].inputType);
+    EXPECT_EQ(0x160, configs[0].inputCode);
+    EXPECT_TRUE(configs[0].pollPath.empty());
+
+    EXPECT_EQ("touch panel", configs[1].inputDevice);
+    EXPECT_EQ(EV_ABS, configs[1].inputType);
+    EXPECT_EQ(57, configs[1].inputCode);
+}
+
+TEST(SysfsSensorConfigTest, RejectsInvalidLines) {
+    std::vector<SysfsSensorConfig> configs = readConfig(
+            "a name=A poll=/a\n"                         // No type.
+            "a type=65537 poll=/a\n"                     // No name.
+            "a name=A type=65537\n"                      // Neither poll nor input.
+            "a name=A type=65537 poll=/a color=red\n"    // Unknown key.
+            "a name=A type=65537 poll=/a enable\n"       // No value.
+            "a name= type=65537 poll=/a\n"               // Empty name.
+            "a name=A type=0x100000000 poll=/a\n"        // Type overflowing.
+            "a name=A type=1x poll=/a\n"                 // Type not an integer.
+            "a name=A type=65537 poll=/a wakeup=yes\n"   // Not a bool.
+            "a name=A type=65537 poll=/a max_range=\n"   // Not a float.
+            "a name=A type=65537 poll=/a payload=int\n"  // Unknown payload.
+            "a name=A type=65537 poll=/a payload=ints:\n"
+            "a name=A type=65537 poll=/a payload=ints:0\n"
+            "a name=A type=65537 poll=/a payload=ints:17\n"
+            "a name=A type=65537 poll=/a payload=ints:2x\n"
+            "a name=A type=65537 input=/b\n"                      // No input code.
+            "a name=A type=65537 input_key=1 poll=/a\n"           // No input device.
+            "a name=A type=65537 input=/b input_key=1 poll=/a\n"  // Both poll and input.
+            "a name=A type=65537 input=/b input_key=1 payload=ints:2\n"
+            "a name=A type=65537 input=/b input_key=0x1000\n"  // Above KEY_MAX.
+            "a name=A type=65537 input=/b input_abs=0x40\n"    // Above ABS_MAX.
+            "a name=\"A type=65537 poll=/a\n");                // Unterminated quote.
+    EXPECT_TRUE(configs.empty());
+}
+
+TEST(SysfsSensorConfigTest, ReplacesEarlierSensors) {
+    std::vector<SysfsSensorConfig> configs = readConfig(
+            "a name=A type=65537 poll=/a\n"
+            "b name=B type=65538 poll=/b\n"
+            "a name=C type=65539 poll=/c payload=bool\n");
+    ASSERT_EQ(2u, configs.size());
+    EXPECT_EQ("a", configs[0].typeAsString);
+    EXPECT_EQ("C", configs[0].name);
+    EXPECT_EQ("/c", configs[0].pollPath);
+    EXPECT_EQ("b", configs[1].typeAsString);
+}
+
+TEST(SysfsSensorConfigTest, IgnoresMissingFiles) {
+    std::vector<SysfsSensorConfig> configs(1);
+    SysfsSensorConfig::readConfigFile("/nonexistent/sysfs_sensors.conf", &configs);
+    EXPECT_EQ(1u, configs.size());
+}
+
+}  // namespace
+}  // namespace implementation
+}  // namespace subhal
+}  // namespace V2_1
+}  // namespace sensors
+}  // namespace hardware
+}  // namespace android